@@ -22,8 +22,8 @@ static int unique_ssid(const uint8_t *ssid) {
     cdll_for_each(ll, &knownnodes) {
         test = cast_cdll_to_my_params(ll);
         result = &test->res;
-        if (strlen(result->ssid) == strlen(ssid)) {
-            int r = memcmp(ssid, result->ssid, strlen(result->ssid));
+        if (strlen((const char *) result->ssid) == strlen((const char *) ssid)) {
+            int r = memcmp(ssid, result->ssid, strlen((const char *) result->ssid));
             if (!r) {
                 return r; //found a match, not unique
             }
@@ -40,7 +40,7 @@ static struct my_scan_result *better_rssi(const uint8_t *ssid, int rssi)
     cdll_for_each(ll, &knownnodes) {
         test = cast_cdll_to_my_params(ll);
         result = &test->res;
-        if (strlen(result->ssid) == strlen(ssid)) {
+        if (strlen((const char *) result->ssid) == strlen((const char *) ssid)) {
             int r = rssi > result->rssi;
             if (r) {
                 return result; //found a better rssi
@@ -53,11 +53,11 @@ static int scan_all_result(void *env, const cyw43_ev_scan_result_t *result) {
     if (result) {
         int uniq = 0;
         printf("ssid: %-32s rssi: %4d chan: %3d mac: %02x:%02x:%02x:%02x:%02x:%02x sec: %u\n",
-            result->ssid, result->rssi, result->channel,
+            (char *) result->ssid, result->rssi, result->channel,
             result->bssid[0], result->bssid[1], result->bssid[2], result->bssid[3], result->bssid[4], result->bssid[5],
             result->auth_mode);
-        if (result->rssi < LOCAL_SCAN_MIN_RSSI || strlen(result->ssid) == 0) {
-            printf("scan AP too weak %d or anon=%s\n", result->rssi, result->ssid);
+        if (result->rssi < LOCAL_SCAN_MIN_RSSI || strlen((const char *) result->ssid) == 0) {
+            printf("scan AP too weak %d or anon=%s\n", result->rssi, (char *) result->ssid);
             return 0;
         }
 
@@ -79,7 +79,8 @@ static int scan_all_result(void *env, const cyw43_ev_scan_result_t *result) {
             if (better) {
                 better->channel = result->channel;
                 better->rssi = result->rssi;
-                printf("new better scan %p chan: %3D rssi %4d\n",  better->channel, better->rssi);
+                printf("new better scan %s chan: %3d rssi %4d\n", (char *) better->ssid,
+                       better->channel, better->rssi);
             }
         }
     }
@@ -94,7 +95,7 @@ static void printlist(struct cdll *p)
         test = cast_cdll_to_my_params(ll);
         result = &test->res;
         printf("printlist ssid: %-32s rssi: %4d chan: %3d\n",
-            result->ssid, result->rssi, result->channel);
+            (char *) result->ssid, result->rssi, result->channel);
         // printf("printlist %p ll=%p\n", test, ll);
     }
 
@@ -164,7 +165,7 @@ struct my_scan_result *scan_find_best_ap(char *password){
             if (test->res.rssi > best->res.rssi) {
                 best = test; //found a new best
             }
-            rb_errors_t  err = flash_io_find_matching_ssid(best->res.ssid, password);
+            rb_errors_t  err = flash_io_find_matching_ssid((char *) best->res.ssid, password);
             if (err < 0) {
                 best= NULL;
                 continue; //no match in flash, keep looking at ssid lists
@@ -1,4 +1,7 @@
+#include <inttypes.h>
 #include "ring_buffer.h"
+#include "crc.h"
+#include "rb_kv.h"
 #include "pico/stdlib.h"
 #include "flash_io.h"
 
@@ -39,7 +42,7 @@ int read_flash_ids(int id, uint32_t flash_buf, uint32_t flash_len){
             }
             return loopcount; //return number found, normal exit
         } else {
-            printf("Reading flash id=%d %ld starting at 0x%lx stat=%d\n\"%s\"\n", id, loopcount, rb.next, err, pagebuff);
+            printf("Reading flash id=%d %" PRIu32 " starting at 0x%" PRIx32 " stat=%d\n\"%s\"\n", id, loopcount, rb.next, err, (char *) pagebuff);
         }
         loopcount++; //count successes
     }
@@ -62,7 +65,7 @@ rb_errors_t read_flash_id_n(int id, uint32_t flash_buf, uint32_t flash_len, int
     for (i = 1; i < n; i++) {
         err = rb_read(&rb, id, pagebuff, sizeof(pagebuff));
 
-        printf("skipping flash entry %d starting at 0x%lx stat=%d\n\"%s\"\n", i, rb.next, err, pagebuff);
+        printf("skipping flash entry %d starting at 0x%" PRIx32 " stat=%d\n\"%s\"\n", i, rb.next, err, (char *) pagebuff);
         if (err <= 0) {
             printf("some read failure %d\n", err);
             return err;
@@ -71,181 +74,270 @@ rb_errors_t read_flash_id_n(int id, uint32_t flash_buf, uint32_t flash_len, int
     //now read the desired flash entry
     err = rb_read(&rb, id, pagebuff, sizeof(pagebuff));
 
-    printf("reading flash entry %d starting at 0x%lx stat=%d\n\"%s\"\n", i, rb.next, err, pagebuff);
+    printf("reading flash entry %d starting at 0x%" PRIx32 " stat=%d\n\"%s\"\n", i, rb.next, err, (char *) pagebuff);
     if (err <= 0) {
         printf("final %d read failure %d\n", i, err);
         return err;
     }
     return err; //return actual length
 }
-//read a specific flash entry entry n
+//read the newest flash entry, walking back from the newest sector
 rb_errors_t read_flash_id_latest(int id, uint32_t flash_buf, uint32_t flash_len){
     int err;
     rb_t rb;
+    rb_rcursor_t c;
 
-    err = read_flash_ids(id, flash_buf, flash_len);
+    err = rb_recreate(&rb, flash_buf, flash_len / FLASH_SECTOR_SIZE, CREATE_INIT_IF_FAIL);
+    if (!(err == RB_OK)) {
+        printf("reopening read_flash_id_latest flash error %d, quitting\n", err);
+        return err;
+    }
+    rb_rcursor_open(&c, &rb);
+    do {
+        err = rb_read_prev(&c, id, pagebuff, sizeof(pagebuff));
+    } while (err == RB_BAD_PAYLOAD_CRC); //damaged, take the one before
     if (err <= 0) {
         printf("final read failure %d\n", err);
-        return err;
+        return 0; //nothing found
     }
-    return read_flash_id_n(id, flash_buf, flash_len, err);
+    printf("reading latest flash entry in sector 0x%" PRIx32 " stat=%d\n\"%s\"\n", c.sector, err, (char *) pagebuff);
+    return err;
 }
 
-rb_errors_t flash_io_write_flash_id(int id, uint32_t flash_buf, uint32_t flash_len, uint8_t *buff, uint32_t blen) {
-    int i;
-    int err;
-    rb_t trb;
-    //first read last entry already in flash
-    err = read_flash_id_latest(id, flash_buf, flash_len);
-    if (err == blen) {
-        //we got something, same length, check if same as the new
-        err = memcmp(pagebuff, buff, blen);
-        if (err == 0) {
-            //exact same data, so do not write the new data
-            printf("no need to write, data is duplicated\n");
-            return 0;
+/*
+ Fingerprints of the live records of the ring last written through
+ flash_io_write_flash_id, so a write already in flash is found without
+ reading the ring. They are built with one scan the first time a ring is
+ written, and again after an append erased a sector. A write is skipped only
+ when the newest print of its id matches, an older match would leave another
+ value the latest. The match is checked against the record in flash before
+ the write is skipped, so a stale print or a crc collision costs one record
+ read, never a lost write. With more live records than FLASH_IO_PRINTS the
+ newest are kept.
+*/
+#define FLASH_IO_PRINTS 64
+typedef struct {
+    uint32_t print; //crc32 of the id, length and payload
+    uint32_t offset; //where the record is
+    uint8_t id;
+} flash_io_print_t;
+
+static struct {
+    rb_t rb;
+    bool open;
+    uint32_t erases; //rb.erases when the prints were built
+    uint32_t count;
+    flash_io_print_t print[FLASH_IO_PRINTS];
+} prints;
+
+static uint32_t flash_io_print_start(uint8_t id, uint32_t len) {
+    uint32_t crc = crc32_update(crc32_init(), &id, sizeof(id));
+    return crc32_update(crc, &len, sizeof(len));
+}
+static void flash_io_print_add(uint8_t id, uint32_t print, uint32_t offset) {
+    if (prints.count == FLASH_IO_PRINTS) {
+        memmove(prints.print, prints.print + 1, sizeof(prints.print) - sizeof(prints.print[0]));
+        prints.count--;
+    }
+    prints.print[prints.count].print = print;
+    prints.print[prints.count].id = id;
+    prints.print[prints.count++].offset = offset;
+}
+//scan the ring oldest first, printing every live record
+static void flash_io_print_build(void) {
+    rb_cursor_t c;
+    rb_reader_t r;
+    prints.count = 0;
+    prints.erases = prints.rb.erases;
+    rb_cursor_open(&c, &prints.rb);
+    while (true) {
+        int len = rb_cursor_reader_open(&r, &c, RB_ANY_ID);
+        if (len == RB_BAD_PAYLOAD_CRC) {
+            continue;
+        }
+        if (len < 0) {
+            break;
+        }
+        uint32_t crc = flash_io_print_start(r.id, len);
+        int n;
+        while ((n = rb_reader_read(&r, pagebuff, sizeof(pagebuff))) > 0) {
+            crc = crc32_update(crc, pagebuff, n);
+        }
+        if (n == 0) {
+            flash_io_print_add(r.id, crc32_finalize(crc), r.at);
         }
     }
-    err = rb_recreate(&trb, flash_buf, flash_len / FLASH_SECTOR_SIZE, CREATE_INIT_IF_FAIL);
-    if (!(err == RB_OK || err == RB_BLANK_HDR)) {
-        printf("write reopening flash error flash_io_write_flash_id %d, quitting\n", err);
-        return err;
+}
+//true if the record of id at offset holds buff
+static bool flash_io_print_same(uint32_t offset, uint8_t id, const uint8_t *buff, uint32_t blen) {
+    rb_cursor_t c = {&prints.rb, offset};
+    rb_reader_t r;
+    int len = rb_cursor_reader_open(&r, &c, id);
+    if (len != (int)blen || r.at != offset) {
+        return false;
     }
-    rb_errors_t terr = rb_append(&trb, id, buff, blen, pagebuff, true);
-    printf("finally wrote flash id=0x%x at 0x%lx stat=%d len=%d",
-            id, trb.last_wrote, terr, blen);
-    for (i = 0; i < blen; i++) {
-        if (i % 8 == 0) {
-            printf("\n");
+    return rb_reader_read(&r, pagebuff, blen) == (int)blen && !memcmp(pagebuff, buff, blen);
+}
+
+rb_errors_t flash_io_write_flash_id(int id, uint32_t flash_buf, uint32_t flash_len, uint8_t *buff, uint32_t blen) {
+    uint32_t i;
+    rb_rcursor_t rc;
+    rb_reader_t r;
+    if (blen > FLASH_PAGE_SIZE) {
+        return RB_BAD_CALLER_DATA;
+    }
+    if (!prints.open || prints.rb.base_address != flash_buf % XIP_BASE ||
+        prints.rb.number_of_bytes != flash_len / FLASH_SECTOR_SIZE * FLASH_SECTOR_SIZE) {
+        rb_errors_t err = rb_recreate(&prints.rb, flash_buf, flash_len / FLASH_SECTOR_SIZE,
+                                      CREATE_INIT_IF_FAIL);
+        if (!(err == RB_OK || err == RB_BLANK_HDR)) {
+            printf("write reopening flash error flash_io_write_flash_id %d, quitting\n", err);
+            prints.open = false;
+            return err;
         }
-        printf(" %02x", buff[i]);
+        prints.open = true;
+        flash_io_print_build();
+    } else if (prints.erases != prints.rb.erases) {
+        flash_io_print_build();
+    }
+    uint32_t print = crc32_finalize(crc32_update(flash_io_print_start(id, blen), buff, blen));
+    //the prints are oldest first, the last one of id is its newest record
+    for (i = prints.count; i > 0 && prints.print[i - 1].id != id; i--) {
     }
-    if (i / 8 % blen) {
-        printf("\n");
+    if (i > 0 && prints.print[i - 1].print == print &&
+        flash_io_print_same(prints.print[i - 1].offset, id, buff, blen)) {
+        //exact same data is the latest in flash, so do not write the new data
+        return 0;
+    }
+    rb_errors_t terr = rb_append(&prints.rb, id, buff, blen, pagebuff, true);
+    if (terr != RB_OK) {
+        printf("flash_io_write_flash_id id=0x%x len=%" PRIu32 " write failed %d\n",
+               id, blen, terr);
+        return terr;
+    }
+    if (prints.erases != prints.rb.erases) {
+        flash_io_print_build(); //finds the new record too
+    } else if (rb_rcursor_open(&rc, &prints.rb) == RB_OK &&
+               rb_rcursor_reader_open(&r, &rc, id) >= 0) {
+        flash_io_print_add(id, print, r.at); //the newest record of id is the new one
     }
     return blen;
 }
 
+/*
+ The ssids and the hostname share one ring, kept as a key/value store: the
+ key of a ssid record is the ssid and its \0, the password follows, and the
+ hostname is the only record of its id. The index is built the first time
+ it is needed, after that a lookup or a change reads just its record.
+*/
+static rb_t kv_rb;
+static rb_cache_t kv_cache; //the index build walks every header
+static rb_kv_t kv;
+static bool kv_open;
+
+static uint32_t flash_io_keylen(uint8_t id, const uint8_t *payload, uint32_t len) {
+    if (id != SSID_ID) {
+        return 0;
+    }
+    const uint8_t *end = memchr(payload, 0, len);
+    //no \0 in reach, too long to be a key so the record is skipped
+    return end ? end - payload + 1 : len + 1;
+}
+static rb_kv_t *flash_io_kv(void) {
+    if (!kv_open) {
+        rb_errors_t err = rb_recreate(&kv_rb, SSID_BUFF, SSID_LEN / FLASH_SECTOR_SIZE,
+                                      CREATE_INIT_IF_FAIL);
+        if (err == RB_OK || err == RB_BLANK_HDR) {
+            rb_set_cache(&kv_rb, &kv_cache);
+            err = rb_kv_open(&kv, &kv_rb, flash_io_keylen);
+        }
+        if (!(err == RB_OK || err == RB_FULL)) {
+            printf("opening ssid/hostname flash error %d\n", err);
+            return NULL;
+        }
+        kv_open = true;
+    }
+    return &kv;
+}
+
 rb_errors_t flash_io_erase_ssids_hostnames() {
     rb_t trb;
     //dangerous routine to erase all the ssid and hostname flash to reinit for user
+    kv_open = false;
+    prints.open = false;
     rb_errors_t err = rb_recreate(&trb, SSID_BUFF, SSID_LEN / FLASH_SECTOR_SIZE, CREATE_INIT_ALWAYS);
     return err;
 }
-//man, maintaining a clean flash is tough. Remove ssids with replaced passwords from flash
-// also remove any null length ssid
-rb_errors_t flash_io_erase_redundant_ssids(char *ss) {
-    rb_t rb;
-    int sslen = strlen(ss) + 1; //include \0 in string check
-    rb_errors_t terr = rb_recreate(&rb, SSID_BUFF, SSID_LEN / FLASH_SECTOR_SIZE, CREATE_FAIL);
-    if (!(terr == RB_OK || terr == RB_BLANK_HDR)) {
-        printf("reopening flash_io_erase_redundant_ssids flash error %d, quitting\n", terr);
-        return terr; //should never happen
-    }
-    while (terr >= 0 && sslen) {
-        terr = rb_find(&rb, SSID_ID, ss, sslen, pagebuff); //find first copy of ssid
-        if (terr < 0) {
-            //some error
-            if (terr == RB_BLANK_HDR || terr == RB_HDR_ID_NOT_FOUND) {
-                //this means we could not find even one entry, so it is a new ssid
-                return RB_OK;
-            }
-            printf("some flash_io_erase_redundant_ssids find failure %d looking for \"%s\"\n", terr, ss);
-            break; //exit loop on failure
-        } else {
-            // at least one ssid matches, see if it is a duplicate because it is older
-            //rb.next is set to after the found entry, so start find from there
-            rb_errors_t next_ssid = rb_find(&rb, SSID_ID, ss, sslen, pagebuff);
-            if (next_ssid >=0) {
-                //found another copy of ssid, so erase earlier one
-                rb.next = terr; //use returned find offset from first match
-                printf("removing redundant @ %d, newer @ %d\n", terr, next_ssid);
-                rb_delete(&rb, SSID_ID, ss, sslen, pagebuff); //so delete redundant
-            } else {
-                //could not find second entry, either a true error or no more
-                //redundant entries exist.
-                printf("second find failed redundant @ %d, newer @ %d\n", terr, next_ssid);
-                if (!(next_ssid == RB_BLANK_HDR || next_ssid == RB_HDR_ID_NOT_FOUND)) {
-                    return next_ssid; //so exit with n error
-                } else {
-                    return RB_OK;
-                }
-            }
-        }
-    }
-    return terr;
-}
 //find matching ssid in flash.
 //return negative error or 0 ok, and return password for my entry data
 rb_errors_t flash_io_find_matching_ssid(char *ss, char *pw) {
-    rb_t rb;
-    rb_errors_t terr;
-    int sslen = strlen(ss);
-    //make sure only one ssid for this ss exists in flash
-     terr = flash_io_erase_redundant_ssids(ss);
+    rb_kv_t *k = flash_io_kv();
+    int sslen = strlen(ss) + 1; //the key includes the \0
+    if (k == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    int terr = rb_kv_get(k, SSID_ID, ss, sslen, pagebuff, sizeof(pagebuff) - 1);
     if (terr < 0) {
-        printf("finding flash error %d, quitting\n", terr);
+        printf("some find failure %d looking for \"%s\"\n", terr, ss);
         return terr;
     }
-
-    terr = rb_recreate(&rb, SSID_BUFF, SSID_LEN / FLASH_SECTOR_SIZE, CREATE_FAIL);
-    if (terr != RB_OK && terr != RB_BLANK_HDR) {
-        printf("reopening finding flash error %d, quitting\n", terr);
-        exit(1); //should never happen
-    }
-
-    while (terr >= 0 && sslen) {
-        terr = rb_find(&rb, SSID_ID, ss, sslen, pagebuff);
-        if (terr < 0) {
-            //some error
-            printf("some find failure %d looking for \"%s\"\n", terr, ss);
-            break; //exit loop on failure
-        } else {
-            //we found a matching ssid, return its password, first read flash
-            rb.next = terr; //use returned find offset
-            rb_read(&rb, SSID_ID, pagebuff, sizeof(pagebuff));
-            int ssidlen = strlen(pagebuff);
-            printf("find AP found %s pw %s\n", pagebuff, pagebuff + ssidlen + 1);
-            if (sslen == ssidlen) {
-                int pwlen = strlen(pagebuff + ssidlen + 1);
-                //copy buffered password and its \0 terminator
-                memcpy(pw, pagebuff + ssidlen + 1, pwlen + 1);
-                break;
-            }
-        }
-    }
-    return terr;
+    pagebuff[terr] = '\0';
+    printf("find AP found %s pw %s\n", ss, (char *) pagebuff);
+    //copy the password and its \0 terminator
+    memcpy(pw, pagebuff, strlen((char *)pagebuff) + 1);
+    return RB_OK;
 }
 
 //for safety write both the ssid and the password as 2 strings to flash
-//write a new ssid/pw pair
+//write a new ssid/pw pair, replacing the password of the same ssid
 rb_errors_t flash_io_write_ssid(char * ss, char *pw) {
-    char tempssid[64]; //note this comes on a very small cpu stack of 4k
-
-    //build 2 strings for one flash write
-    //fixme buffer overflow is possible, limit strings
+    rb_kv_t *k = flash_io_kv();
     int s1len = strlen(ss) + 1;
-    memcpy(tempssid, ss, s1len);
     int s2len = strlen(pw) + 1;
-    memcpy(tempssid + s1len, pw, s2len);
-
-    rb_errors_t terr =  flash_io_write_flash_id(SSID_ID, SSID_BUFF, SSID_LEN, tempssid, s1len+s2len);
-    if (terr > 0) {
-        flash_io_erase_redundant_ssids(ss); // erase matching ssids, not ssid/pw combos
+    if (k == NULL) {
+        return RB_BAD_CALLER_DATA;
     }
-    return terr;
+    if (s1len + s2len > (int)FLASH_PAGE_SIZE || s1len > (int)RB_KV_MAX_KEY) {
+        return RB_BAD_CALLER_DATA;
+    }
+    int err = rb_kv_get(k, SSID_ID, ss, s1len, pagebuff, sizeof(pagebuff));
+    if (err == s2len && memcmp(pagebuff, pw, s2len) == 0) {
+        printf("no need to write, data is duplicated\n");
+        return 0;
+    }
+    rb_errors_t terr = rb_kv_put(k, SSID_ID, ss, s1len, pw, s2len, pagebuff);
+    printf("finally wrote ssid id=0x%x stat=%d ssid=%s\n", SSID_ID, terr, ss);
+    if (terr != RB_OK) {
+        return terr;
+    }
+    return s1len + s2len;
 }
 
+//read the newest hostname into pagebuff, returns its length, 0 if none
 rb_errors_t flash_io_read_latest_hostname(void) {
-        return read_flash_id_latest(HOSTNAME_ID, NAME_BUFF, NAME_LEN);
+    rb_kv_t *k = flash_io_kv();
+    if (k == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    int err = rb_kv_get(k, HOSTNAME_ID, NULL, 0, pagebuff, sizeof(pagebuff));
+    return err == RB_HDR_ID_NOT_FOUND ? 0 : err;
 }
 
 rb_errors_t flash_io_write_hostname(char *hostname, uint32_t nlen) {
-    rb_errors_t terr =  flash_io_write_flash_id(HOSTNAME_ID, NAME_BUFF, NAME_LEN, hostname, nlen);
+    rb_kv_t *k = flash_io_kv();
+    if (k == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    int err = rb_kv_get(k, HOSTNAME_ID, NULL, 0, pagebuff, sizeof(pagebuff));
+    if (err == (int)nlen && memcmp(pagebuff, hostname, nlen) == 0) {
+        printf("no need to write, data is duplicated\n");
+        return 0;
+    }
+    rb_errors_t terr = rb_kv_put(k, HOSTNAME_ID, NULL, 0, hostname, nlen, pagebuff);
     printf("finally wrote hostname id=0x%x stat=%d name=%s\n",
             HOSTNAME_ID, terr, hostname);
-    if (terr > 0) {
-        flash_io_erase_redundant_ssids(hostname);
+    if (terr != RB_OK) {
+        return terr;
     }
-    return terr;
+    return nlen;
 }
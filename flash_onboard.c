@@ -7,6 +7,10 @@
 #include <hardware/sync.h>
 #include <hardware/regs/addressmap.h>
 #include "flash.h"
+#include "flash_sched.h"
+#if LIB_PICO_MULTICORE
+#include <pico/multicore.h>
+#endif
 
 
 const uint32_t FLASH_BASE = 0x1F0000;
@@ -17,16 +21,79 @@ int flash_read(uint32_t address, void *buffer, size_t size) {
     return 0;
 }
 
+const uint8_t *flash_mapped(uint32_t address) {
+    return (const uint8_t *)(XIP_NOCACHE_NOALLOC_BASE + address);
+}
+
+/*
+ while flash is programmed nothing may run from it, if the other core was set
+ up for it (see rb_service.c) it waits in ram until we are done
+*/
+static bool flash_lockout_start(void) {
+#if LIB_PICO_MULTICORE
+    if (multicore_lockout_victim_is_initialized(get_core_num() ^ 1)) {
+        multicore_lockout_start_blocking();
+        return true;
+    }
+#endif
+    return false;
+}
+
+static void flash_lockout_end(bool locked) {
+#if LIB_PICO_MULTICORE
+    if (locked) {
+        multicore_lockout_end_blocking();
+    }
+#else
+    (void)locked;
+#endif
+}
+
 int flash_prog(uint32_t address, const void *buffer, size_t size) {
+    bool locked = flash_lockout_start();
     uint32_t ints = save_and_disable_interrupts();
     flash_range_program(address, buffer, size);
     restore_interrupts(ints);
+    flash_lockout_end(locked);
     return 0; // Success
 }
 
 int flash_erase(uint32_t address, size_t size) {
+    bool locked = flash_lockout_start();
     uint32_t ints = save_and_disable_interrupts();
     flash_range_erase(address, size);
     restore_interrupts(ints);
+    flash_lockout_end(locked);
     return 0; // Success
 }
+
+static int onboard_read(const flash_dev_t *dev, uint32_t address, void *buffer, size_t size) {
+    (void)dev;
+    return flash_read(address, buffer, size);
+}
+static int onboard_prog(const flash_dev_t *dev, uint32_t address, const void *buffer, size_t size) {
+    (void)dev;
+    return flash_prog(address, buffer, size);
+}
+static int onboard_erase(const flash_dev_t *dev, uint32_t address, size_t size) {
+    (void)dev;
+    return flash_erase(address, size);
+}
+static const uint8_t *onboard_mapped(const flash_dev_t *dev, uint32_t address) {
+    (void)dev;
+    return flash_mapped(address);
+}
+
+//flash_range_program only takes whole pages, though the part itself would take single bytes
+flash_dev_t flash_default_dev = {
+    .read = onboard_read,
+    .prog = onboard_prog,
+    .erase = onboard_erase,
+    .mapped = onboard_mapped,
+    .size = PICO_FLASH_SIZE_BYTES,
+    .sector_size = FLASH_SECTOR_SIZE,
+    .block_size = FLASH_BLOCK_SIZE,
+    .page_size = FLASH_PAGE_SIZE,
+    .prog_unit = FLASH_PAGE_SIZE,
+    .sched = &flash_default_sched,
+};
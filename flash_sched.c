@@ -0,0 +1,157 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "flash_sched.h"
+
+//flash operation scheduler, see flash_sched.h
+
+flash_sched_t flash_default_sched = {.dev = &flash_default_dev};
+
+void flash_sched_init(flash_sched_t *sched, const flash_dev_t *dev) {
+    sched->dev = dev;
+    sched->max_erase = 0;
+    sched->count = 0;
+    sched->sectors = 0;
+    sched->erase_commands = 0;
+}
+static int flash_sched_queue(flash_sched_t *sched, uint8_t kind, uint32_t address,
+                             const void *data, uint32_t size) {
+    if (sched->count == FLASH_SCHED_OPS) {
+        int err = flash_sched_run(sched);
+        if (err) {
+            return err;
+        }
+    }
+    flash_op_t *op = &sched->ops[sched->count++];
+    op->kind = kind;
+    op->address = address;
+    op->size = size;
+    op->data = data;
+    return 0;
+}
+int flash_sched_erase(flash_sched_t *sched, uint32_t address, uint32_t size) {
+    uint32_t sector = sched->dev->sector_size;
+    if (size == 0 || address % sector || size % sector) {
+        return -1;
+    }
+    //grow a queued erase it touches, programs queued since keep theirs apart
+    for (uint32_t i = sched->count; i > 0 && sched->ops[i - 1].kind == FLASH_OP_ERASE; i--) {
+        flash_op_t *op = &sched->ops[i - 1];
+        if (address <= op->address + op->size && op->address <= address + size) {
+            uint32_t end = MAX(op->address + op->size, address + size);
+            op->address = MIN(op->address, address);
+            op->size = end - op->address;
+            return 0;
+        }
+    }
+    return flash_sched_queue(sched, FLASH_OP_ERASE, address, NULL, size);
+}
+int flash_sched_prog(flash_sched_t *sched, uint32_t address, const void *data, uint32_t size) {
+    if (size == 0 || data == NULL) {
+        return -1;
+    }
+    return flash_sched_queue(sched, FLASH_OP_PROG, address, data, size);
+}
+/*
+ erase [address, end) in as few commands as the alignment allows, each at
+ most max_erase. Sector erases lead up to the first aligned block.
+*/
+static int flash_sched_erase_range(flash_sched_t *sched, uint32_t address, uint32_t end) {
+    const flash_dev_t *dev = sched->dev;
+    uint32_t max = sched->max_erase ? sched->max_erase : MAX(dev->block_size, dev->sector_size);
+    while (address < end) {
+        uint32_t n = dev->sector_size;
+        if (address % max == 0 && end - address >= max) {
+            n = max;
+        }
+        int err = dev->erase(dev, address, n);
+        if (err) {
+            return err;
+        }
+        sched->sectors += n / dev->sector_size;
+        sched->erase_commands++;
+        address += n;
+    }
+    return 0;
+}
+/*
+ ops[first, last) are all erases. Sort them by address, then erase each run
+ of adjacent or overlapping ranges in one go.
+*/
+static int flash_sched_erases(flash_sched_t *sched, uint32_t first, uint32_t last) {
+    flash_op_t *ops = sched->ops;
+    for (uint32_t i = first + 1; i < last; i++) {
+        flash_op_t op = ops[i];
+        uint32_t j;
+        for (j = i; j > first && ops[j - 1].address > op.address; j--) {
+            ops[j] = ops[j - 1];
+        }
+        ops[j] = op;
+    }
+    uint32_t address = ops[first].address;
+    uint32_t end = address + ops[first].size;
+    for (uint32_t i = first + 1; i < last; i++) {
+        if (ops[i].address > end) {
+            int err = flash_sched_erase_range(sched, address, end);
+            if (err) {
+                return err;
+            }
+            address = ops[i].address;
+        }
+        end = MAX(end, ops[i].address + ops[i].size);
+    }
+    return flash_sched_erase_range(sched, address, end);
+}
+int flash_sched_run(flash_sched_t *sched) {
+    int err = 0;
+    uint32_t i = 0;
+    while (i < sched->count && err == 0) {
+        if (sched->ops[i].kind == FLASH_OP_PROG) {
+            flash_op_t *op = &sched->ops[i++];
+            err = sched->dev->prog(sched->dev, op->address, op->data, op->size);
+            continue;
+        }
+        uint32_t last = i + 1;
+        while (last < sched->count && sched->ops[last].kind == FLASH_OP_ERASE) {
+            last++;
+        }
+        err = flash_sched_erases(sched, i, last);
+        i = last;
+    }
+    sched->count = 0;
+    return err;
+}
+int flash_dev_erase(const flash_dev_t *dev, uint32_t address, uint32_t size) {
+    if (dev->sched == NULL) {
+        return dev->erase(dev, address, size);
+    }
+    int err = flash_sched_erase(dev->sched, address, size);
+    return err ? err : flash_sched_run(dev->sched);
+}
+int flash_dev_prog(const flash_dev_t *dev, uint32_t address, const void *data, uint32_t size) {
+    if (dev->sched == NULL) {
+        return dev->prog(dev, address, data, size);
+    }
+    int err = flash_sched_prog(dev->sched, address, data, size);
+    return err ? err : flash_sched_run(dev->sched);
+}
+int flash_prog_range(const flash_dev_t *dev, uint32_t block, const uint8_t *page,
+                     uint32_t lo, uint32_t hi) {
+    int err = 0;
+    lo -= lo % dev->prog_unit;
+    hi += (dev->prog_unit - hi % dev->prog_unit) % dev->prog_unit;
+    while (lo < hi && err == 0) {
+        uint32_t n = MIN(hi - lo, dev->page_size - lo % dev->page_size);
+        if (dev->sched == NULL) {
+            err = dev->prog(dev, block + lo, page + lo, n);
+        } else {
+            err = flash_sched_prog(dev->sched, block + lo, page + lo, n);
+        }
+        lo += n;
+    }
+    if (err == 0 && dev->sched != NULL) {
+        err = flash_sched_run(dev->sched);
+    }
+    return err;
+}
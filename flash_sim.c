@@ -0,0 +1,296 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <hardware/flash.h>
+#include <pico/stdlib.h>
+#include "flash.h"
+#include "flash_sched.h"
+#include "flash_sim.h"
+
+static flash_sim_t *bound_sim;
+flash_dev_t flash_default_dev;
+
+void flash_sim_default_config(flash_sim_config_t *cfg) {
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->size = PICO_FLASH_SIZE_BYTES;
+    cfg->sector_size = FLASH_SECTOR_SIZE;
+    cfg->page_size = FLASH_PAGE_SIZE;
+    cfg->full_page_prog = true;
+    cfg->prog_unit = 1;
+    //W25Q16JV typical numbers, a 256 byte page program is about 0.4ms
+    cfg->read_ns_per_byte = 40;
+    cfg->prog_setup_ns = 30000;
+    cfg->prog_ns_per_byte = 1450;
+    cfg->erase_ns = 45000000;
+    //a 64K block erase is about 150ms, the pico sdk uses them where it can
+    cfg->block_size = FLASH_BLOCK_SIZE;
+    cfg->block_erase_ns = 150000000;
+}
+
+static void charge(flash_sim_t *sim, uint64_t ns) {
+    sim->stats.modeled_ns += ns;
+    if (sim->cfg.realtime && ns >= 1000) {
+        struct timespec ts = { ns / 1000000000u, ns % 1000000000u };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static bool is_pow2(uint32_t n) {
+    return n && !(n & (n - 1));
+}
+
+int flash_sim_open(flash_sim_t *sim, const flash_sim_config_t *cfg) {
+    memset(sim, 0, sizeof(*sim));
+    sim->fd = -1;
+    if (cfg) {
+        sim->cfg = *cfg;
+    } else {
+        flash_sim_default_config(&sim->cfg);
+    }
+    cfg = &sim->cfg;
+    if (!is_pow2(cfg->page_size) || !is_pow2(cfg->sector_size) ||
+        cfg->sector_size < cfg->page_size || cfg->size == 0 ||
+        !is_pow2(cfg->block_size) || cfg->block_size < cfg->sector_size ||
+        !is_pow2(cfg->prog_unit) || cfg->prog_unit > cfg->page_size ||
+        cfg->size % cfg->sector_size) {
+        return -1;
+    }
+    sim->erase_counts = calloc(cfg->size / cfg->sector_size, sizeof(uint32_t));
+    if (sim->erase_counts == NULL) {
+        return -1;
+    }
+    if (cfg->path == NULL) {
+        sim->mem = malloc(cfg->size);
+        if (sim->mem == NULL) {
+            flash_sim_close(sim);
+            return -1;
+        }
+        memset(sim->mem, 0xff, cfg->size); //factory fresh flash is erased
+        return 0;
+    }
+    sim->fd = open(cfg->path, O_RDWR | O_CREAT, 0644);
+    if (sim->fd < 0) {
+        flash_sim_close(sim);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(sim->fd, &st) || ftruncate(sim->fd, cfg->size)) {
+        flash_sim_close(sim);
+        return -1;
+    }
+    sim->mem = mmap(NULL, cfg->size, PROT_READ | PROT_WRITE, MAP_SHARED, sim->fd, 0);
+    if (sim->mem == MAP_FAILED) {
+        sim->mem = NULL;
+        flash_sim_close(sim);
+        return -1;
+    }
+    if ((uint64_t)st.st_size < cfg->size) {
+        //new or grown backing file, the new part is erased flash
+        memset(sim->mem + st.st_size, 0xff, cfg->size - st.st_size);
+    }
+    return 0;
+}
+
+void flash_sim_close(flash_sim_t *sim) {
+    if (bound_sim == sim) {
+        bound_sim = NULL;
+    }
+    if (sim->fd >= 0) {
+        if (sim->mem) {
+            msync(sim->mem, sim->cfg.size, MS_SYNC);
+            munmap(sim->mem, sim->cfg.size);
+        }
+        close(sim->fd);
+    } else {
+        free(sim->mem);
+    }
+    free(sim->erase_counts);
+    sim->mem = NULL;
+    sim->erase_counts = NULL;
+    sim->fd = -1;
+}
+
+void flash_sim_bind(flash_sim_t *sim) {
+    bound_sim = sim;
+    flash_sim_dev(sim, &flash_default_dev);
+    flash_sched_init(&flash_default_sched, &flash_default_dev);
+    flash_default_dev.sched = &flash_default_sched;
+}
+
+flash_sim_t *flash_sim_bound(void) {
+    return bound_sim;
+}
+
+static bool in_range(flash_sim_t *sim, uint32_t address, size_t size) {
+    return sim->mem && address < sim->cfg.size && size <= sim->cfg.size - address;
+}
+
+int flash_sim_read(flash_sim_t *sim, uint32_t address, void *buffer, size_t size) {
+    if (!in_range(sim, address, size)) {
+        sim->stats.errors++;
+        return -1;
+    }
+    memcpy(buffer, sim->mem + address, size);
+    sim->stats.reads++;
+    sim->stats.read_bytes += size;
+    charge(sim, (uint64_t)size * sim->cfg.read_ns_per_byte);
+    return 0;
+}
+
+//what flash_sim_prog takes, a whole page or prog_unit
+static uint32_t prog_unit(flash_sim_t *sim) {
+    return sim->cfg.full_page_prog ? sim->cfg.page_size : sim->cfg.prog_unit;
+}
+/*
+ NOR programming can only clear bits, and a single program command must stay
+ inside one page. With full_page_prog the pico sdk restriction of whole,
+ aligned pages is enforced too, so host runs catch code that would fail on
+ the board. Otherwise programs are aligned multiples of prog_unit, and cost
+ only the bytes sent; ff_bytes counts the 0xff bytes among them, padding
+ and any 0xff data alike, as the part cannot tell them apart.
+*/
+int flash_sim_prog(flash_sim_t *sim, uint32_t address, const void *buffer, size_t size) {
+    uint32_t page = sim->cfg.page_size;
+    uint32_t unit = prog_unit(sim);
+    if (!in_range(sim, address, size) || size == 0 || address % unit || size % unit) {
+        sim->stats.errors++;
+        return -1;
+    }
+    if (sim->progs_to_fail) {
+        if (sim->progs_before_fail) {
+            sim->progs_before_fail--;
+        } else {
+            sim->progs_to_fail--;
+            sim->stats.failed_programs++;
+            return -1;
+        }
+    }
+    const uint8_t *src = buffer;
+    while (size) {
+        uint32_t chunk = MIN(size, page - address % page);
+        for (uint32_t i = 0; i < chunk; i++) {
+            sim->mem[address + i] &= src[i];
+            sim->stats.ff_bytes += src[i] == 0xff;
+        }
+        sim->stats.programs++;
+        sim->stats.program_bytes += chunk;
+        charge(sim, sim->cfg.prog_setup_ns + (uint64_t)chunk * sim->cfg.prog_ns_per_byte);
+        address += chunk;
+        src += chunk;
+        size -= chunk;
+    }
+    return 0;
+}
+
+int flash_sim_erase(flash_sim_t *sim, uint32_t address, size_t size) {
+    uint32_t sector = sim->cfg.sector_size;
+    if (!in_range(sim, address, size) || address % sector || size % sector) {
+        sim->stats.errors++;
+        return -1;
+    }
+    while (size) {
+        //whole aligned blocks go as one block erase, like the pico sdk does
+        uint32_t block = sim->cfg.block_size;
+        uint32_t n = block > sector && address % block == 0 && size >= block ? block : sector;
+        memset(sim->mem + address, 0xff, n);
+        for (uint32_t a = address; a < address + n; a += sector) {
+            sim->erase_counts[a / sector]++;
+            sim->stats.erases++;
+        }
+        if (n == sector) {
+            charge(sim, sim->cfg.erase_ns);
+        } else {
+            sim->stats.block_erases++;
+            charge(sim, sim->cfg.block_erase_ns);
+        }
+        address += n;
+        size -= n;
+    }
+    return 0;
+}
+
+void flash_sim_fail_progs(flash_sim_t *sim, uint32_t after, uint32_t count) {
+    sim->progs_before_fail = after;
+    sim->progs_to_fail = count;
+}
+
+void flash_sim_get_stats(const flash_sim_t *sim, flash_sim_stats_t *stats) {
+    *stats = sim->stats;
+}
+
+void flash_sim_reset_stats(flash_sim_t *sim) {
+    memset(&sim->stats, 0, sizeof(sim->stats));
+}
+
+uint32_t flash_sim_erase_count(const flash_sim_t *sim, uint32_t address) {
+    if (address >= sim->cfg.size) {
+        return 0;
+    }
+    return sim->erase_counts[address / sim->cfg.sector_size];
+}
+
+void flash_sim_wear(const flash_sim_t *sim, uint32_t address, size_t size,
+                    uint32_t *min_erases, uint32_t *max_erases) {
+    uint32_t lo = UINT32_MAX;
+    uint32_t hi = 0;
+    for (uint32_t a = address; a < address + size && a < sim->cfg.size; a += sim->cfg.sector_size) {
+        uint32_t n = sim->erase_counts[a / sim->cfg.sector_size];
+        lo = MIN(lo, n);
+        hi = MAX(hi, n);
+    }
+    *min_erases = lo == UINT32_MAX ? 0 : lo;
+    *max_erases = hi;
+}
+
+//flash.h backend, same api as flash_onboard.c
+int flash_read(uint32_t address, void *buffer, size_t size) {
+    return flash_sim_read(bound_sim, address, buffer, size);
+}
+
+const uint8_t *flash_mapped(uint32_t address) {
+    return bound_sim->mem + address;
+}
+
+int flash_prog(uint32_t address, const void *buffer, size_t size) {
+    return flash_sim_prog(bound_sim, address, buffer, size);
+}
+
+int flash_erase(uint32_t address, size_t size) {
+    return flash_sim_erase(bound_sim, address, size);
+}
+
+//flash_dev_t calls, on the simulator in ctx
+static int sim_dev_read(const flash_dev_t *dev, uint32_t address, void *buffer, size_t size) {
+    return flash_sim_read(dev->ctx, address, buffer, size);
+}
+static int sim_dev_prog(const flash_dev_t *dev, uint32_t address, const void *buffer, size_t size) {
+    return flash_sim_prog(dev->ctx, address, buffer, size);
+}
+static int sim_dev_erase(const flash_dev_t *dev, uint32_t address, size_t size) {
+    return flash_sim_erase(dev->ctx, address, size);
+}
+static const uint8_t *sim_dev_mapped(const flash_dev_t *dev, uint32_t address) {
+    return ((flash_sim_t *)dev->ctx)->mem + address;
+}
+
+void flash_sim_dev(flash_sim_t *sim, flash_dev_t *dev) {
+    dev->read = sim_dev_read;
+    dev->prog = sim_dev_prog;
+    dev->erase = sim_dev_erase;
+    dev->mapped = sim->cfg.unmapped ? NULL : sim_dev_mapped;
+    dev->size = sim->cfg.size;
+    dev->sector_size = sim->cfg.sector_size;
+    dev->block_size = sim->cfg.block_size;
+    dev->page_size = sim->cfg.page_size;
+    dev->prog_unit = prog_unit(sim);
+    dev->sched = NULL; //flash_sim_bind gives the default device flash_default_sched
+    dev->ctx = sim;
+}
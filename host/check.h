@@ -0,0 +1,41 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Shared by the host test programs run by ctest. A failed CHECK prints where
+ * and what, and exits non zero, so the first failure stops the test.
+ */
+#ifndef _CHECK_H_
+#define _CHECK_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "flash_sim.h"
+
+#define CHECK(cond)                                                             \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);     \
+            exit(1);                                                            \
+        }                                                                       \
+    } while (0)
+
+//a call that should return want, what it returned instead is printed
+#define CHECK_EQ(got, want)                                                     \
+    do {                                                                        \
+        long long got_ = (got);                                                 \
+        long long want_ = (want);                                               \
+        if (got_ != want_) {                                                    \
+            printf("%s:%d: check failed: %s is %lld, not %lld\n", __FILE__,     \
+                   __LINE__, #got, got_, want_);                                \
+            exit(1);                                                            \
+        }                                                                       \
+    } while (0)
+
+//a blank simulated onboard flash in ram, bound as flash_default_dev
+static inline void check_flash(flash_sim_t *sim) {
+    CHECK(flash_sim_open(sim, NULL) == 0);
+    flash_sim_bind(sim);
+}
+
+#endif //_CHECK_H_
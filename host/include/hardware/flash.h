@@ -0,0 +1,37 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host stand-in for the pico sdk hardware/flash.h. Only the geometry the ring
+ * buffer needs is defined here, the flash itself is simulated by flash_sim.c
+ */
+#ifndef _HOST_HARDWARE_FLASH_H
+#define _HOST_HARDWARE_FLASH_H
+
+#include <stdint.h>
+
+//geometry can be overridden on the compile line to try other parts
+#ifndef FLASH_PAGE_SIZE
+#define FLASH_PAGE_SIZE (1u << 8)
+#endif
+#ifndef FLASH_SECTOR_SIZE
+#define FLASH_SECTOR_SIZE (1u << 12)
+#endif
+#ifndef FLASH_BLOCK_SIZE
+#define FLASH_BLOCK_SIZE (1u << 16)
+#endif
+#ifndef PICO_FLASH_SIZE_BYTES
+#define PICO_FLASH_SIZE_BYTES (2 * 1024 * 1024)
+#endif
+
+//callers hand the ring buffer xip addresses, which are reduced to offsets
+#define XIP_BASE 0x10000000
+
+/*
+ host builds have no custom linker script, so the persistent area is placed
+ at the end of the simulated flash, just like memmap_custom.ld does
+*/
+#define __PERSISTENT_LEN    (16 * 1024)
+#define __PERSISTENT_TABLE  (XIP_BASE + PICO_FLASH_SIZE_BYTES - __PERSISTENT_LEN)
+
+#endif
@@ -0,0 +1,47 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host stand-in for the small part of pico/stdlib.h used by the ring buffer
+ */
+#ifndef _HOST_PICO_STDLIB_H
+#define _HOST_PICO_STDLIB_H
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+
+typedef unsigned int uint;
+
+#ifndef MIN
+#define MIN(a, b) ((b) > (a) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+static inline uint64_t time_us_64(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + ts.tv_nsec / 1000;
+}
+
+static inline void sleep_us(uint64_t us) {
+    struct timespec ts = { us / 1000000u, (us % 1000000u) * 1000 };
+    nanosleep(&ts, NULL);
+}
+
+static inline void sleep_ms(uint32_t ms) {
+    sleep_us((uint64_t)ms * 1000);
+}
+
+//spin loops let the other threads have the host cpu
+static inline void tight_loop_contents(void) {
+    sched_yield();
+}
+
+#endif
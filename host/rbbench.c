@@ -0,0 +1,208 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Benchmark of the ring buffer calls on the simulated flash. For every record
+ * size, ring size and fill level it times rb_create, rb_append, rb_read,
+ * rb_find and rb_delete, and writes one csv row per call with what it cost per
+ * op: host time, flash reads, programs, erases, modeled flash time, and the
+ * ring bytes each record takes beyond its payload. The rows only depend on
+ * the library and the timing model (apart from ops_per_sec, which is host
+ * time), so two releases can be diffed.
+ */
+#include <getopt.h>
+#include <inttypes.h>
+#include "ring_buffer.h"
+#include "flash_sim.h"
+
+#define FILL_ID 0x5
+#define BENCH_ID 0x6
+//longest key rb_find and rb_delete look for, the record number
+#define KEY_LEN 4
+#define COUNT_OF(a) (sizeof(a) / sizeof((a)[0]))
+
+static uint8_t pagebuff[FLASH_PAGE_SIZE];
+static uint8_t workdata[RB_MAX_APPEND_SIZE];
+static uint8_t scratch[RB_MAX_APPEND_SIZE];
+
+static const uint32_t record_sizes[] = {1, 16, 64, 256, 1024, RB_MAX_APPEND_SIZE};
+static const uint32_t ring_sizes[] = {2, 8, 32};
+static const uint32_t fill_levels[] = {0, 50, 100};
+
+typedef struct {
+    flash_sim_t *sim;
+    FILE *out;
+    uint32_t ops; //ops per measurement
+    uint32_t base;
+    uint32_t record;
+    uint32_t sectors;
+    uint32_t fill;
+    uint32_t overhead; //ring bytes per record beyond the payload
+    uint64_t start_us;
+} bench_t;
+
+static void usage(const char *name) {
+    printf("usage: %s [-o file] [-n ops] [-p unit] [-r]\n"
+           "  -o  csv output file (default rbbench.csv), - for stdout\n"
+           "  -n  ops per measurement (default 100)\n"
+           "  -p  program in aligned multiples of unit bytes, not whole pages\n"
+           "  -r  run in real time, sleeping for modeled flash busy time\n",
+           name);
+}
+
+static void bench_start(bench_t *b) {
+    flash_sim_reset_stats(b->sim);
+    b->start_us = time_us_64();
+}
+static void bench_row(bench_t *b, const char *op, uint32_t ops) {
+    flash_sim_stats_t st;
+    uint64_t host_us = time_us_64() - b->start_us;
+    flash_sim_get_stats(b->sim, &st);
+    double n = ops ? ops : 1;
+    fprintf(b->out, "%s,%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%.0f,%.2f,%.1f,%.3f,%.1f,"
+            "%.4f,%" PRIu32 ",%.2f\n",
+            op, b->record, b->sectors, b->fill, ops, host_us ? ops * 1e6 / host_us : 0.0,
+            st.reads / n, st.read_bytes / n, st.programs / n, st.program_bytes / n,
+            st.erases / n, b->overhead, st.modeled_ns / 1e3 / n);
+}
+static void set_key(uint32_t n) {
+    memcpy(workdata, &n, MIN(KEY_LEN, sizeof(workdata)));
+}
+//records of this size an empty ring holds, and from that the overhead
+static uint32_t ring_capacity(bench_t *b, rb_t *rb) {
+    uint32_t count = 0;
+    rb_create(rb, b->base, b->sectors, CREATE_INIT_ALWAYS);
+    while (rb_append(rb, FILL_ID, workdata, b->record, pagebuff, false) == RB_OK) {
+        count++;
+    }
+    b->overhead = count ? rb->number_of_bytes / count - b->record : 0;
+    return count;
+}
+//false if the deletes did not remove every record the read found
+static bool bench_one(bench_t *b) {
+    rb_t rb;
+    uint32_t i;
+    uint32_t keylen = MIN(KEY_LEN, b->record);
+    uint32_t fill = ring_capacity(b, &rb) * b->fill / 100;
+
+    rb_create(&rb, b->base, b->sectors, CREATE_INIT_ALWAYS);
+    for (i = 0; i < fill; i++) {
+        set_key(i);
+        rb_append(&rb, FILL_ID, workdata, b->record, pagebuff, true);
+    }
+
+    //mount the filled ring, the first append pays for finding the tail
+    bench_start(b);
+    for (i = 0; i < b->ops; i++) {
+        rb_create(&rb, b->base, b->sectors, CREATE_FAIL);
+    }
+    bench_row(b, "create", b->ops);
+
+    bench_start(b);
+    for (i = 0; i < b->ops; i++) {
+        set_key(i);
+        rb_append(&rb, BENCH_ID, workdata, b->record, pagebuff, true);
+    }
+    bench_row(b, "append", b->ops);
+
+    //read the bench records from the oldest, as many as survived the wrap
+    rb_create(&rb, b->base, b->sectors, CREATE_FAIL);
+    bench_start(b);
+    uint32_t done;
+    uint32_t first = 0; //key of the oldest one left
+    for (done = 0; done < b->ops; done++) {
+        if (rb_read(&rb, BENCH_ID, scratch, b->record) <= 0) {
+            break;
+        }
+        if (done == 0) {
+            memcpy(&first, scratch, keylen);
+        }
+    }
+    bench_row(b, "read", done);
+
+    //look for the newest bench record, rb_find goes on from rb->next
+    rb_create(&rb, b->base, b->sectors, CREATE_FAIL);
+    uint32_t oldest = rb.next;
+    set_key(b->ops - 1);
+    bench_start(b);
+    for (i = 0; i < b->ops; i++) {
+        rb.next = oldest;
+        rb_find(&rb, BENCH_ID, workdata, keylen, scratch);
+    }
+    bench_row(b, "find", b->ops);
+
+    //delete the bench records the read found, oldest first, each search
+    //starting at the oldest. Every one of them must go
+    uint32_t deleted = 0;
+    bench_start(b);
+    for (i = 0; i < done; i++) {
+        set_key(first + i);
+        deleted += rb_delete(&rb, BENCH_ID, workdata, keylen, pagebuff) == RB_OK;
+    }
+    bench_row(b, "delete", deleted);
+    if (deleted != done) {
+        printf("%" PRIu32 " byte records, %" PRIu32 " sectors, %" PRIu32 "%% full: deleted %"
+               PRIu32 " of %" PRIu32 "\n", b->record, b->sectors, b->fill, deleted, done);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    flash_sim_config_t cfg;
+    flash_sim_t sim;
+    bench_t b;
+    const char *path = "rbbench.csv";
+    int failed = 0;
+    int opt;
+
+    b.ops = 100;
+    flash_sim_default_config(&cfg);
+    while ((opt = getopt(argc, argv, "o:n:p:rh")) != -1) {
+        switch (opt) {
+        case 'o': path = optarg; break;
+        case 'n': b.ops = strtoul(optarg, NULL, 0); break;
+        case 'p': cfg.full_page_prog = false; cfg.prog_unit = strtoul(optarg, NULL, 0); break;
+        case 'r': cfg.realtime = true; break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (b.ops == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    //the library logs to stdout, keep the csv apart from it
+    b.out = strcmp(path, "-") ? fopen(path, "w") : stdout;
+    if (b.out == NULL) {
+        printf("could not open %s\n", path);
+        return 1;
+    }
+    if (flash_sim_open(&sim, &cfg)) {
+        printf("could not open flash simulator\n");
+        return 1;
+    }
+    flash_sim_bind(&sim);
+    b.sim = &sim;
+    for (uint32_t i = 0; i < sizeof(workdata); i++) {
+        workdata[i] = (uint8_t) i;
+    }
+    fprintf(b.out, "op,record_bytes,ring_sectors,fill_pct,ops,ops_per_sec,reads_per_op,"
+            "read_bytes_per_op,programs_per_op,program_bytes_per_op,erases_per_op,"
+            "overhead_bytes_per_record,modeled_us_per_op\n");
+    for (uint32_t s = 0; s < COUNT_OF(ring_sizes); s++) {
+        b.sectors = ring_sizes[s];
+        b.base = XIP_BASE + cfg.size - b.sectors * FLASH_SECTOR_SIZE;
+        for (uint32_t r = 0; r < COUNT_OF(record_sizes); r++) {
+            b.record = record_sizes[r];
+            for (uint32_t f = 0; f < COUNT_OF(fill_levels); f++) {
+                b.fill = fill_levels[f];
+                failed += !bench_one(&b);
+            }
+        }
+    }
+    if (b.out != stdout) {
+        fclose(b.out);
+    }
+    flash_sim_close(&sim);
+    return failed ? 1 : 0;
+}
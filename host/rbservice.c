@@ -0,0 +1,148 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host run of the flash writer service. The service thread plays core1 and
+ * appends to the simulated flash, main plays core0 and produces records. It
+ * reports what the producer sees: how long a submit takes, records/sec, how
+ * often the queue was full, and the round trip of a submit and wait.
+ */
+#include <getopt.h>
+#include <inttypes.h>
+#include "ring_buffer.h"
+#include "rb_service.h"
+#include "flash_sim.h"
+
+#define TEST_ID 0x7
+
+static uint8_t pagebuff[FLASH_PAGE_SIZE];
+static uint8_t workdata[RB_SERVICE_MAX_RECORD];
+static rb_service_t svc;
+
+static void usage(const char *name) {
+    printf("usage: %s [-s sectors] [-n records] [-l length] [-b deadline_us] [-e sectors] [-r]\n"
+           "  -s  ring size in sectors (default 4)\n"
+           "  -n  number of records to submit (default 1000)\n"
+           "  -l  record length (default 8, max %u)\n"
+           "  -b  buffered writes, flushing staged records after deadline_us\n"
+           "  -e  keep sectors erased ahead of the tail, erased while idle\n"
+           "  -r  run in real time, sleeping for modeled flash busy time\n",
+           name, (unsigned)RB_SERVICE_MAX_RECORD);
+}
+
+static void print_latency(const char *what, uint32_t ops, uint64_t host_us,
+                          uint64_t sum_ns, uint64_t max_ns) {
+    printf("%-7s ops=%" PRIu32 " host_us=%" PRIu64 " ops/sec=%.0f avg_us=%.2f max_us=%.2f\n",
+           what, ops, host_us, host_us ? ops * 1e6 / host_us : 0.0,
+           ops ? sum_ns / 1e3 / ops : 0.0, max_ns / 1e3);
+}
+
+static uint64_t time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+    flash_sim_config_t cfg;
+    flash_sim_t sim;
+    rb_t rb;
+    uint32_t sectors = 4;
+    uint32_t records = 1000;
+    uint32_t len = 8;
+    bool buffered = false;
+    uint32_t deadline_us = 0;
+    uint32_t erase_ahead = 0;
+    int opt;
+
+    flash_sim_default_config(&cfg);
+    while ((opt = getopt(argc, argv, "s:n:l:b:e:rh")) != -1) {
+        switch (opt) {
+        case 's': sectors = strtoul(optarg, NULL, 0); break;
+        case 'n': records = strtoul(optarg, NULL, 0); break;
+        case 'l': len = strtoul(optarg, NULL, 0); break;
+        case 'b': buffered = true; deadline_us = strtoul(optarg, NULL, 0); break;
+        case 'e': erase_ahead = strtoul(optarg, NULL, 0); break;
+        case 'r': cfg.realtime = true; break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (len == 0 || len > RB_SERVICE_MAX_RECORD || sectors == 0 || records == 0 ||
+        erase_ahead >= sectors || sectors * FLASH_SECTOR_SIZE > __PERSISTENT_LEN * 64) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (flash_sim_open(&sim, &cfg)) {
+        printf("could not open flash simulator\n");
+        return 1;
+    }
+    flash_sim_bind(&sim);
+    uint32_t base = XIP_BASE + cfg.size - sectors * FLASH_SECTOR_SIZE;
+    rb_errors_t err = rb_create(&rb, base, sectors, CREATE_INIT_ALWAYS);
+    if (err != RB_OK) {
+        printf("starting flash error %d, quitting\n", err);
+        return 2;
+    }
+    if (buffered) {
+        rb_set_buffered(&rb, pagebuff, deadline_us);
+    }
+    rb_set_erase_ahead(&rb, erase_ahead);
+    rb_service_init(&svc, &rb, pagebuff, true);
+    if (rb_service_start(&svc) != RB_OK) {
+        printf("could not start the service\n");
+        return 2;
+    }
+
+    //stream records as fast as the queue takes them
+    uint64_t sum_ns = 0, max_ns = 0;
+    uint32_t failures = 0;
+    int ticket = 0;
+    uint64_t t0 = time_us_64();
+    for (uint32_t i = 0; i < records; i++) {
+        memcpy(workdata, &i, MIN(len, sizeof(i)));
+        uint64_t s = time_ns();
+        ticket = rb_service_submit(&svc, TEST_ID, workdata, len, true);
+        uint64_t ns = time_ns() - s;
+        sum_ns += ns;
+        max_ns = MAX(max_ns, ns);
+        if (ticket < 0) {
+            failures++;
+        }
+    }
+    uint64_t submit_us = time_us_64() - t0;
+    if (ticket >= 0 && rb_service_wait(&svc, ticket) != RB_OK) {
+        failures++;
+    }
+    print_latency("submit", records, submit_us, sum_ns, max_ns);
+    uint64_t drain_us = time_us_64() - t0;
+    printf("drain   ops=%" PRIu32 " host_us=%" PRIu64 " ops/sec=%.0f\n", records, drain_us,
+           drain_us ? records * 1e6 / drain_us : 0.0);
+    printf("queue   len=%u full_waits=%" PRIu32 "\n", (unsigned)RB_SERVICE_QUEUE_LEN,
+           svc.full_waits);
+
+    //one record at a time, waiting for each to be appended
+    uint32_t syncs = MAX(records / 10, 1);
+    sum_ns = max_ns = 0;
+    t0 = time_us_64();
+    for (uint32_t i = 0; i < syncs; i++) {
+        uint64_t s = time_ns();
+        ticket = rb_service_submit(&svc, TEST_ID, workdata, len, true);
+        if (ticket < 0 || rb_service_wait(&svc, ticket) != RB_OK) {
+            failures++;
+        }
+        uint64_t ns = time_ns() - s;
+        sum_ns += ns;
+        max_ns = MAX(max_ns, ns);
+    }
+    print_latency("sync", syncs, time_us_64() - t0, sum_ns, max_ns);
+    if (rb_service_stop(&svc) != RB_OK) {
+        failures++;
+    }
+
+    flash_sim_stats_t st;
+    flash_sim_get_stats(&sim, &st);
+    printf("flash   programs=%" PRIu64 " erases=%" PRIu64 " flash_ms=%.3f failures=%" PRIu32 "\n",
+           st.programs, st.erases, st.modeled_ns / 1e6, failures);
+    flash_sim_close(&sim);
+    return failures ? 3 : 0;
+}
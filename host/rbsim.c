@@ -0,0 +1,315 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host version of the rbmain.c demo. Runs a logging workload against the
+ * simulated flash and reports what it cost: appends/sec, mount time and wear.
+ */
+#include <getopt.h>
+#include <inttypes.h>
+#include "ring_buffer.h"
+#include "flash_sim.h"
+#include "flash_sched.h"
+
+#define TEST_ID 0x7
+//long lived records kept through churn, like saved ssids
+#define KEEP_ID 0x8
+#define KEEP_RECORDS 8
+//records the newest first read shows
+#define NEWEST_RECORDS 10
+
+static uint8_t pagebuff[FLASH_PAGE_SIZE];
+static uint8_t workdata[RB_MAX_APPEND_SIZE];
+
+static void usage(const char *name) {
+    printf("usage: %s [-f flashfile] [-s sectors] [-n appends] [-l length] [-b deadline_us] [-e sectors] [-c pct] [-k] [-t] [-x] [-p unit] [-g bytes] [-m] [-r] [-i]\n"
+           "  -f  keep the simulated flash in a file, so it persists between runs\n"
+           "  -s  ring size in sectors (default 4)\n"
+           "  -n  number of records to append (default 1000)\n"
+           "  -l  record length (default 1, max %u)\n"
+           "  -b  buffered writes, flushing staged records after deadline_us\n"
+           "  -e  keep sectors erased ahead of the tail, erasing between appends\n"
+           "  -c  churn: keep a few records, delete each append's previous one and\n"
+           "      compact sectors at most pct live (needs -e)\n"
+           "  -k  mount with checkpoints, in one more sector after the ring\n"
+           "  -t  time ring, then read the newest tenth with rb_seek_time (length >= 8)\n"
+           "  -x  fixed size records, then read the newest tenth by record number\n"
+           "  -p  program in aligned multiples of unit bytes, not whole pages\n"
+           "  -g  ring on an unmapped device erasing bytes at a time, like an spi nor\n"
+           "      with 32K or 64K blocks; -s counts those\n"
+           "  -m  keep a read cache of sector headers and pages for the ring\n"
+           "  -r  run in real time, sleeping for modeled flash busy time\n"
+           "  -i  erase the ring before starting\n",
+           name, (unsigned)RB_MAX_APPEND_SIZE);
+}
+
+//records start with their append number as the timestamp
+static uint64_t record_time(void *entry) {
+    uint64_t ts;
+    memcpy(&ts, entry, sizeof(ts));
+    return ts;
+}
+
+static void print_sim(const char *what, flash_sim_t *sim, uint64_t host_us, uint32_t ops) {
+    flash_sim_stats_t st;
+    flash_sim_get_stats(sim, &st);
+    printf("%-7s ops=%" PRIu32 " host_us=%" PRIu64 " ops/sec=%.0f reads=%" PRIu64
+           " read_bytes=%" PRIu64 " programs=%" PRIu64 " program_bytes=%" PRIu64
+           " ff_bytes=%" PRIu64 " erases=%" PRIu64 " block_erases=%" PRIu64 " flash_ms=%.3f\n",
+           what, ops, host_us, host_us ? ops * 1e6 / host_us : 0.0, st.reads,
+           st.read_bytes, st.programs, st.program_bytes, st.ff_bytes, st.erases,
+           st.block_erases, st.modeled_ns / 1e6);
+    flash_sim_reset_stats(sim);
+}
+
+//what the library counted itself, with the latency histogram of each kind of call
+static void print_rb_stats(rb_t *rb) {
+    static const char *ops[RB_OP_COUNT] = {"create", "append", "read", "find", "delete"};
+    rb_stats_t st;
+    rb_get_stats(rb, &st);
+    printf("rb      reads=%" PRIu32 " read_bytes=%" PRIu32 " programs=%" PRIu32
+           " erases=%" PRIu32 " headers=%" PRIu32 " splits=%" PRIu32 " rescans=%" PRIu32
+           " loops=%" PRIu32 " full_erases=%" PRIu32 " retries=%" PRIu32 "\n",
+           st.reads, st.read_bytes, st.programs, st.erases, st.headers, st.splits,
+           st.rescans, st.loops, st.full_erases, st.retries);
+    for (int op = 0; op < RB_OP_COUNT; op++) {
+        if (st.calls[op] == 0) {
+            continue;
+        }
+        printf("%-7s calls=%" PRIu32 " us", ops[op], st.calls[op]);
+        for (int b = 0; b < RB_STATS_BUCKETS; b++) {
+            if (st.latency[op][b]) {
+                printf(" <%u:%" PRIu32, 1u << b, st.latency[op][b]);
+            }
+        }
+        printf("\n");
+    }
+    for (int e = 1; e < RB_STATS_ERRORS; e++) {
+        if (st.errors[e]) {
+            printf("errors  %d:%" PRIu32 "\n", -e, st.errors[e]);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    flash_sim_config_t cfg;
+    flash_sim_t sim;
+    rb_t rb;
+    uint32_t sectors = 4;
+    uint32_t appends = 1000;
+    uint32_t len = 1;
+    enum init_choices init = CREATE_INIT_IF_FAIL;
+    bool buffered = false;
+    bool timed = false;
+    bool fixed = false;
+    bool cached = false;
+    static rb_cache_t cache;
+    uint32_t erase_ahead = 0;
+    bool churn = false;
+    uint32_t compact_pct = 0;
+    bool checkpoints = false;
+    uint32_t deadline_us = 0;
+    uint32_t unit = FLASH_SECTOR_SIZE;
+    flash_dev_t dev;
+    int opt;
+
+    flash_sim_default_config(&cfg);
+    while ((opt = getopt(argc, argv, "f:s:n:l:b:e:c:ktxp:g:mrih")) != -1) {
+        switch (opt) {
+        case 'f': cfg.path = optarg; break;
+        case 's': sectors = strtoul(optarg, NULL, 0); break;
+        case 'n': appends = strtoul(optarg, NULL, 0); break;
+        case 'l': len = strtoul(optarg, NULL, 0); break;
+        case 'b': buffered = true; deadline_us = strtoul(optarg, NULL, 0); break;
+        case 'e': erase_ahead = strtoul(optarg, NULL, 0); break;
+        case 'c': churn = true; compact_pct = strtoul(optarg, NULL, 0); break;
+        case 'k': checkpoints = true; break;
+        case 't': timed = true; break;
+        case 'x': fixed = true; break;
+        case 'm': cached = true; break;
+        case 'p': cfg.full_page_prog = false; cfg.prog_unit = strtoul(optarg, NULL, 0); break;
+        case 'g': unit = strtoul(optarg, NULL, 0); break;
+        case 'r': cfg.realtime = true; break;
+        case 'i': init = CREATE_INIT_ALWAYS; break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (len == 0 || len > RB_MAX_APPEND_SIZE || sectors == 0 ||
+        (timed && len < sizeof(uint64_t)) || erase_ahead >= sectors ||
+        (churn && (compact_pct > 100 || erase_ahead == 0 || timed)) ||
+        (fixed && (len > RB_MAX_FIXED_SIZE || timed || churn || erase_ahead || checkpoints)) ||
+        (fixed && unit != FLASH_SECTOR_SIZE) || (sectors + 1) * unit > __PERSISTENT_LEN * 64) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (unit != FLASH_SECTOR_SIZE) {
+        //W25Q16JV block erases, 32K and 64K take about 120ms and 150ms
+        cfg.sector_size = unit;
+        cfg.unmapped = true;
+        cfg.erase_ns = unit >= 0x10000 ? 150000000 : 120000000;
+        cfg.block_size = MAX(cfg.block_size, unit);
+    }
+    if (flash_sim_open(&sim, &cfg)) {
+        printf("could not open flash simulator %s\n", cfg.path ? cfg.path : "");
+        return 1;
+    }
+    flash_sim_bind(&sim);
+    flash_sim_dev(&sim, &dev);
+    dev.sched = &flash_default_sched; //the same flash as flash_default_dev
+    //place the ring at the end of flash, like the linker script does
+    uint32_t base = XIP_BASE + cfg.size - (sectors + checkpoints) * unit;
+
+    uint64_t t0 = time_us_64();
+    rb_errors_t err = checkpoints ? rb_mount_on(&rb, &dev, base, sectors + 1, init) :
+                      fixed ? rb_create_fixed(&rb, base, sectors, len, init) :
+                              rb_recreate_on(&rb, &dev, base, sectors, init);
+    if (!(err == RB_OK || err == RB_BLANK_HDR || err == RB_HDR_LOOP)) {
+        printf("starting flash error %d, quitting\n", err);
+        return 2;
+    }
+    print_sim("mount", &sim, time_us_64() - t0, 1);
+
+    for (uint32_t i = 0; i < len; i++) {
+        workdata[i] = (uint8_t) i;
+    }
+    uint32_t failures = 0;
+    if (buffered) {
+        rb_set_buffered(&rb, pagebuff, deadline_us);
+    }
+    if (timed) {
+        rb_set_timestamps(&rb, record_time);
+    }
+    rb_set_erase_ahead(&rb, erase_ahead);
+    if (cached) {
+        rb_set_cache(&rb, &cache);
+    }
+    if (churn) {
+        if (rb_set_compaction(&rb, compact_pct, pagebuff) != RB_OK) {
+            printf("compaction needs a memory mapped device, not -g\n");
+            return 1;
+        }
+        for (uint32_t i = 0; i < KEEP_RECORDS; i++) {
+            workdata[0] = (uint8_t) i;
+            rb_append(&rb, KEEP_ID, workdata, len, pagebuff, true);
+        }
+    }
+    flash_sim_stats_t before, after;
+    uint64_t max_append_ns = 0;
+    uint32_t erasing_appends = 0;
+    t0 = time_us_64();
+    for (uint32_t i = 0; i < appends; i++) {
+        if (timed) {
+            uint64_t ts = i;
+            memcpy(workdata, &ts, sizeof(ts));
+        } else {
+            workdata[0] = (uint8_t) i;
+        }
+        flash_sim_get_stats(&sim, &before);
+        err = fixed ? rb_fixed_append(&rb, workdata, pagebuff, true) :
+                      rb_append(&rb, TEST_ID, workdata, len, pagebuff, true);
+        flash_sim_get_stats(&sim, &after);
+        max_append_ns = MAX(max_append_ns, after.modeled_ns - before.modeled_ns);
+        erasing_appends += after.erases != before.erases;
+        if (err != RB_OK) {
+            failures++;
+        }
+        if (churn && i) {
+            //the record before this one is replaced
+            workdata[0] = (uint8_t) (i - 1);
+            rb_delete(&rb, TEST_ID, workdata, len, pagebuff);
+        }
+        if (erase_ahead) {
+            rb_poll(&rb); //idle time between records
+        }
+    }
+    rb_sync(&rb);
+    print_sim("append", &sim, time_us_64() - t0, appends);
+    printf("latency max_append_flash_us=%.1f erasing_appends=%" PRIu32 "\n",
+           max_append_ns / 1e3, erasing_appends);
+
+    uint32_t reads = 0;
+    if (fixed) {
+        uint32_t first, end;
+        rb_fixed_range(&rb, &first, &end);
+        t0 = time_us_64();
+        for (uint32_t r = first; r < end; r++) {
+            reads += rb_fixed_read(&rb, r, workdata) > 0;
+        }
+        print_sim("read", &sim, time_us_64() - t0, reads);
+        //any record is one sector header away, no walk from the oldest
+        uint32_t from = end - (end - first) / 10;
+        reads = 0;
+        t0 = time_us_64();
+        for (uint32_t r = from; r < end; r++) {
+            reads += rb_fixed_read(&rb, r, workdata) > 0;
+        }
+        print_sim("seek", &sim, time_us_64() - t0, reads);
+        printf("fixed   records=%" PRIu32 "..%" PRIu32 " per_sector=%" PRIu32 "\n",
+               first, end, rb.slots);
+    } else {
+        //the oldest sector at create may be gone, read what the ring holds now
+        rb_cursor_t all;
+        t0 = time_us_64();
+        rb_cursor_open(&all, &rb);
+        while (rb_cursor_read(&all, TEST_ID, workdata, len) > 0) {
+            reads++;
+        }
+        print_sim("read", &sim, time_us_64() - t0, reads);
+
+        //a dashboard of the newest few, read newest first
+        rb_rcursor_t recent;
+        uint32_t newest = 0;
+        t0 = time_us_64();
+        rb_rcursor_open(&recent, &rb);
+        while (newest < NEWEST_RECORDS && rb_read_prev(&recent, TEST_ID, workdata, len) > 0) {
+            newest++;
+        }
+        print_sim("newest", &sim, time_us_64() - t0, newest);
+        if (churn) {
+            uint32_t kept = 0;
+            rb_cursor_open(&all, &rb);
+            while (rb_cursor_read(&all, KEEP_ID, workdata, len) > 0) {
+                kept++;
+            }
+            printf("churn   kept=%" PRIu32 "/%u compact_pct=%" PRIu32 "\n", kept, KEEP_RECORDS,
+                   compact_pct);
+        }
+    }
+
+    if (timed) {
+        rb_cursor_t c;
+        uint64_t from = appends - appends / 10;
+        uint32_t skipped = 0;
+        reads = 0;
+        t0 = time_us_64();
+        rb_cursor_open(&c, &rb);
+        rb_seek_time(&c, from);
+        while (rb_cursor_read(&c, TEST_ID, workdata, len) > 0) {
+            if (record_time(workdata) < from) {
+                skipped++;
+            } else {
+                reads++;
+            }
+        }
+        print_sim("seek", &sim, time_us_64() - t0, reads);
+        printf("seek    from=%" PRIu64 " found=%" PRIu32 " skipped=%" PRIu32 "\n",
+               from, reads, skipped);
+    }
+
+    if (checkpoints) {
+        rb_checkpoint(&rb, pagebuff); //the next run with -f mounts from here
+    }
+
+    print_rb_stats(&rb);
+    if (cached) {
+        printf("cache   hits=%" PRIu32 " misses=%" PRIu32 " header_hits=%" PRIu32
+               " header_misses=%" PRIu32 "\n", cache.hits, cache.misses, cache.header_hits,
+               cache.header_misses);
+    }
+    uint32_t lo, hi;
+    flash_sim_wear(&sim, base % XIP_BASE, sectors * unit, &lo, &hi);
+    printf("wear    sectors=%" PRIu32 " min_erases=%" PRIu32 " max_erases=%" PRIu32
+           " append_failures=%" PRIu32 "\n", sectors, lo, hi, failures);
+    flash_sim_close(&sim);
+    return failures ? 3 : 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host test of erase ahead. rb_maintain keeps the sectors after the tail
+ * blank, so appends going round the ring many times never wait on an erase,
+ * and the newest records read back. rb_poll does the same work, an append
+ * without maintenance runs into the oldest sector, and no more sectors than
+ * the ring has less one can be kept ahead.
+ */
+#include "ring_buffer.h"
+#include "check.h"
+
+#define AHEAD_ID 2
+#define AHEAD_SECTORS 8
+#define AHEAD_KEEP 2
+#define AHEAD_LEN 300
+
+static uint8_t pagebuff[FLASH_PAGE_SIZE];
+static uint32_t base;
+static rb_t rb;
+
+static void ahead_fill(uint8_t *buf, uint32_t n) {
+    memset(buf, n, AHEAD_LEN);
+    memcpy(buf, &n, sizeof(n));
+}
+static rb_errors_t ahead_append(uint32_t n) {
+    uint8_t buf[AHEAD_LEN];
+    ahead_fill(buf, n);
+    return rb_append(&rb, AHEAD_ID, buf, sizeof(buf), pagebuff, false);
+}
+//the AHEAD_KEEP sectors after the one holding the last record are erased
+static void ahead_blank(flash_sim_t *sim) {
+    uint8_t got[FLASH_SECTOR_SIZE];
+    uint32_t sector = RB_SECTOR(&rb, (rb.tail + rb.number_of_bytes - 1) % rb.number_of_bytes);
+    for (uint32_t i = 1; i <= AHEAD_KEEP; i++) {
+        uint32_t at = base - XIP_BASE + (sector + i * FLASH_SECTOR_SIZE) % rb.number_of_bytes;
+        CHECK_EQ(flash_sim_read(sim, at, got, sizeof(got)), 0);
+        for (uint32_t b = 0; b < sizeof(got); b++) {
+            CHECK_EQ(got[b], 0xff);
+        }
+    }
+}
+//records first up to end - 1 read back, oldest first
+static void ahead_expect(uint32_t first, uint32_t end) {
+    uint8_t got[AHEAD_LEN];
+    uint8_t want[AHEAD_LEN];
+    //RB_BLANK_HDR if the first sector of the ring is one erased ahead
+    rb_errors_t err = rb_recreate(&rb, base, AHEAD_SECTORS, CREATE_FAIL);
+    CHECK(err == RB_OK || err == RB_BLANK_HDR);
+    int len;
+    uint32_t n;
+    //the oldest sector may start with the end of a record it lost the head of
+    do {
+        CHECK_EQ(len = rb_read(&rb, AHEAD_ID, got, sizeof(got)), AHEAD_LEN);
+        memcpy(&n, got, sizeof(n));
+    } while (n < first);
+    for (; n < end; n++) {
+        ahead_fill(want, n);
+        CHECK(!memcmp(got, want, AHEAD_LEN));
+        len = rb_read(&rb, AHEAD_ID, got, sizeof(got));
+    }
+    CHECK(len < 0);
+}
+//appends round the ring five times, only rb_maintain erases
+static void test_maintain(flash_sim_t *sim) {
+    uint32_t per_ring = AHEAD_SECTORS * FLASH_SECTOR_SIZE / (AHEAD_LEN + 4);
+    CHECK_EQ(rb_create(&rb, base, AHEAD_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_set_erase_ahead(&rb, AHEAD_KEEP), RB_OK);
+    uint64_t erases = sim->stats.erases;
+    uint32_t n;
+    for (n = 0; n < 5 * per_ring; n++) {
+        uint64_t before = sim->stats.erases;
+        CHECK_EQ(ahead_append(n), RB_OK);
+        CHECK_EQ(sim->stats.erases, before);
+        CHECK_EQ(rb_maintain(&rb), RB_OK);
+        ahead_blank(sim);
+    }
+    CHECK(sim->stats.erases - erases >= 4 * AHEAD_SECTORS);
+    //what is kept is the ring less the sectors ahead and the one in use
+    ahead_expect(n - (AHEAD_SECTORS - AHEAD_KEEP - 1) * per_ring / AHEAD_SECTORS, n);
+}
+//rb_poll maintains too, without it the ring fills up
+static void test_poll(flash_sim_t *sim) {
+    CHECK_EQ(rb_create(&rb, base, AHEAD_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_set_erase_ahead(&rb, AHEAD_KEEP), RB_OK);
+    uint32_t n = 0;
+    while (rb.erases == 0) {
+        CHECK_EQ(ahead_append(n++), RB_OK);
+        CHECK_EQ(rb_poll(&rb), RB_OK);
+    }
+    ahead_blank(sim);
+    rb_errors_t res;
+    while ((res = ahead_append(n)) == RB_OK) {
+        n++;
+    }
+    CHECK(res < 0);
+    CHECK_EQ(rb_poll(&rb), RB_OK);
+    ahead_blank(sim);
+    CHECK_EQ(ahead_append(n), RB_OK);
+}
+static void test_limits(void) {
+    CHECK_EQ(rb_create(&rb, base, AHEAD_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_set_erase_ahead(&rb, AHEAD_SECTORS), RB_BAD_CALLER_DATA);
+    CHECK_EQ(rb_set_erase_ahead(&rb, AHEAD_SECTORS - 1), RB_OK);
+    CHECK_EQ(rb_maintain(NULL), RB_BAD_CALLER_DATA);
+    //a blank ring has nothing to erase
+    CHECK_EQ(rb_maintain(&rb), RB_OK);
+    CHECK_EQ(rb.erases, 0);
+}
+int main(void) {
+    flash_sim_t sim;
+    check_flash(&sim);
+    base = __PERSISTENT_TABLE - 32 * FLASH_SECTOR_SIZE;
+    test_maintain(&sim);
+    test_poll(&sim);
+    test_limits();
+    printf("test_ahead passed\n");
+    return 0;
+}
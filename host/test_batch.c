@@ -0,0 +1,128 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host test of rb_append_batch. A batch finds the tail once and programs
+ * each page it touches once, also when records end on page ends, and its
+ * records read back in order, with and
+ * without payload crcs. Batches erasing the oldest sector as they wrap keep
+ * the newest records, and a batch that runs out of room without erasing
+ * appends what fits.
+ */
+#include "ring_buffer.h"
+#include "check.h"
+
+#define BATCH_SECTORS 4
+#define BATCH_MAX 40
+#define BATCH_LEN 90
+//4 of these with their headers and a sector header fill a sector exactly
+#define BATCH_QUARTER ((FLASH_SECTOR_SIZE - 4) / 4 - 4)
+
+static uint8_t pagebuff[FLASH_PAGE_SIZE];
+static uint8_t data[BATCH_MAX][FLASH_SECTOR_SIZE / 4];
+static rb_batch_entry_t batch[BATCH_MAX];
+static uint32_t base;
+static rb_t rb;
+
+static uint8_t batch_id(uint32_t n) {
+    return 1 + n % 3;
+}
+//payloads are made again from their number and size when read back
+static void batch_fill(uint8_t *buf, uint32_t n, uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+        buf[i] = n * 11 + i * 3;
+    }
+    memcpy(buf, &n, sizeof(n));
+}
+//entries for records first up to first + count - 1, each size long or varied
+static void batch_make(uint32_t first, uint32_t count, uint32_t size) {
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t n = first + i;
+        batch[i].id = batch_id(n);
+        batch[i].data = data[i];
+        batch[i].size = size ? size : 4 + n * 13 % BATCH_LEN;
+        batch_fill(data[i], n, batch[i].size);
+    }
+}
+//the ring holds records first up to end - 1, oldest first
+static void batch_expect(uint32_t first, uint32_t end, uint32_t size) {
+    static uint8_t got[FLASH_SECTOR_SIZE];
+    static uint8_t want[FLASH_SECTOR_SIZE];
+    CHECK_EQ(rb_recreate(&rb, base, BATCH_SECTORS, CREATE_FAIL), RB_OK);
+    for (uint32_t n = first; n < end; n++) {
+        uint32_t len = size ? size : 4 + n * 13 % BATCH_LEN;
+        batch_fill(want, n, len);
+        CHECK_EQ(rb_read(&rb, batch_id(n), got, sizeof(got)), len);
+        CHECK(!memcmp(got, want, len));
+    }
+    CHECK(rb_read(&rb, batch_id(end), got, sizeof(got)) < 0);
+}
+//one batch in one sector, every page it touches programmed once
+static void test_pages(bool payload_crc) {
+    rb_stats_t st;
+    CHECK_EQ(rb_create(&rb, base, BATCH_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_set_payload_crc(&rb, payload_crc), RB_OK);
+    CHECK_EQ(rb_append(&rb, batch_id(0), "x", 1, pagebuff, false), RB_OK);
+    uint32_t first_page = FLASH_PAGE(rb.tail);
+    CHECK_EQ(rb_get_stats(&rb, &st), RB_OK);
+    uint32_t programs = st.programs;
+    uint32_t rescans = st.rescans;
+    batch_make(1, BATCH_MAX, 0);
+    CHECK_EQ(rb_append_batch(&rb, batch, BATCH_MAX, pagebuff, false), BATCH_MAX);
+    CHECK(rb.tail < FLASH_SECTOR_SIZE);
+    CHECK_EQ(rb_get_stats(&rb, &st), RB_OK);
+    CHECK_EQ(st.programs - programs, (FLASH_PAGE(rb.tail - 1) - first_page) / FLASH_PAGE_SIZE + 1);
+    CHECK_EQ(st.rescans, rescans);
+    CHECK_EQ(rb_recreate(&rb, base, BATCH_SECTORS, CREATE_FAIL), RB_OK);
+    CHECK_EQ(rb_read(&rb, batch_id(0), data[0], sizeof(data[0])), 1);
+    batch_expect(1, BATCH_MAX + 1, 0);
+}
+//records ending on page ends leave nothing staged, the tail is still not looked for again
+static void test_page_ends(void) {
+    flash_sim_t *sim = flash_sim_bound();
+    CHECK_EQ(rb_create(&rb, base, BATCH_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    batch_make(0, 8, FLASH_PAGE_SIZE - 4);
+    batch[0].size -= 4; //after the sector header
+    CHECK_EQ(rb_append_batch(&rb, batch, 8, pagebuff, false), 8);
+    CHECK_EQ(rb.tail, 8 * FLASH_PAGE_SIZE);
+    batch_make(8, 4, FLASH_PAGE_SIZE - 4);
+    uint64_t reads = sim->stats.reads;
+    CHECK_EQ(rb_append_batch(&rb, batch, 4, pagebuff, false), 4);
+    //one check of the cached tail, the header there and its sector header
+    CHECK_EQ(sim->stats.reads - reads, 2);
+}
+//batches of records a quarter sector long go round the ring many times
+static void test_wrap(void) {
+    uint32_t size = BATCH_QUARTER;
+    uint32_t n;
+    CHECK_EQ(rb_create(&rb, base, BATCH_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    for (n = 0; n < 20 * BATCH_SECTORS; n += 5) {
+        batch_make(n, 5, size);
+        CHECK_EQ(rb_append_batch(&rb, batch, 5, pagebuff, true), 5);
+    }
+    CHECK(rb.erases > 0);
+    //the last record filled its sector, so every sector is full
+    batch_expect(n - 4 * BATCH_SECTORS, n, size);
+}
+//without erasing, a batch stops at the first record that does not fit
+static void test_full(void) {
+    uint32_t size = BATCH_QUARTER;
+    CHECK_EQ(rb_create(&rb, base, BATCH_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    batch_make(0, BATCH_MAX, size);
+    int got = rb_append_batch(&rb, batch, BATCH_MAX, pagebuff, false);
+    CHECK_EQ(got, 4 * BATCH_SECTORS);
+    CHECK(rb_append_batch(&rb, batch + got, BATCH_MAX - got, pagebuff, false) < 0);
+    batch_expect(0, got, size);
+}
+int main(void) {
+    flash_sim_t sim;
+    check_flash(&sim);
+    base = __PERSISTENT_TABLE - 32 * FLASH_SECTOR_SIZE;
+    test_pages(false);
+    test_pages(true);
+    test_page_ends();
+    test_wrap();
+    test_full();
+    printf("test_batch passed\n");
+    return 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host test of buffered writes. Small records share a page and are only
+ * programmed when it fills or on rb_sync. Until then the buffered rb reads
+ * them back and another rb_t on the same flash does not see them. A quiet
+ * ring is flushed by rb_poll once its deadline passes, deadline 0 flushes
+ * every append, and rb_clear_buffered flushes what is left.
+ */
+#include "ring_buffer.h"
+#include "check.h"
+
+#define BUF_ID 6
+#define BUF_SECTORS 4
+#define BUF_LEN 20
+
+static uint8_t pagebuff[FLASH_PAGE_SIZE];
+static uint8_t ringpage[FLASH_PAGE_SIZE];
+static uint32_t base;
+static rb_t rb;
+static rb_t other;
+
+//payloads are made again from their number when read back
+static void buf_fill(uint8_t *buf, uint32_t n) {
+    for (uint32_t i = 0; i < BUF_LEN; i++) {
+        buf[i] = n * 23 + i;
+    }
+}
+static void buf_append(uint32_t n) {
+    uint8_t buf[BUF_LEN];
+    buf_fill(buf, n);
+    CHECK_EQ(rb_append(&rb, BUF_ID, buf, sizeof(buf), NULL, false), RB_OK);
+}
+//r holds records first up to end - 1 and nothing after them
+static void buf_expect(rb_t *r, uint32_t first, uint32_t end) {
+    uint8_t got[BUF_LEN];
+    uint8_t want[BUF_LEN];
+    for (uint32_t n = first; n < end; n++) {
+        buf_fill(want, n);
+        CHECK_EQ(rb_read(r, BUF_ID, got, sizeof(got)), BUF_LEN);
+        CHECK(!memcmp(got, want, BUF_LEN));
+    }
+    CHECK(rb_read(r, BUF_ID, got, sizeof(got)) < 0);
+}
+//staged records reach flash when their page fills or on rb_sync
+static void test_group(flash_sim_t *sim) {
+    CHECK_EQ(rb_create(&rb, base, BUF_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_set_buffered(&rb, ringpage, 1000000000), RB_OK);
+    uint64_t programs = sim->stats.programs;
+    buf_append(0);
+    buf_append(1);
+    buf_append(2);
+    CHECK(rb.staged);
+    CHECK_EQ(sim->stats.programs, programs);
+    //only this rb sees them, the flash is still blank
+    CHECK_EQ(rb_recreate(&other, base, BUF_SECTORS, CREATE_FAIL), RB_BLANK_HDR);
+    buf_expect(&rb, 0, 3);
+    CHECK_EQ(rb_sync(&rb), RB_OK);
+    CHECK(!rb.staged);
+    CHECK_EQ(sim->stats.programs - programs, 1);
+    CHECK_EQ(rb_recreate(&other, base, BUF_SECTORS, CREATE_FAIL), RB_OK);
+    buf_expect(&other, 0, 3);
+    //a page of records is one program, the next page waits
+    uint32_t n = 3;
+    programs = sim->stats.programs;
+    while (FLASH_PAGE(rb.tail) == FLASH_PAGE(rb.tail + BUF_LEN + 4)) {
+        buf_append(n++);
+    }
+    CHECK_EQ(sim->stats.programs, programs);
+    buf_append(n++);
+    buf_append(n++);
+    CHECK_EQ(sim->stats.programs - programs, 1);
+    CHECK(rb.staged);
+    CHECK_EQ(rb_clear_buffered(&rb), RB_OK);
+    CHECK(!rb.staged);
+    CHECK_EQ(rb_recreate(&other, base, BUF_SECTORS, CREATE_FAIL), RB_OK);
+    buf_expect(&other, 0, n);
+    //unbuffered again, every append is programmed
+    programs = sim->stats.programs;
+    uint8_t buf[BUF_LEN];
+    buf_fill(buf, n);
+    CHECK_EQ(rb_append(&rb, BUF_ID, buf, sizeof(buf), pagebuff, false), RB_OK);
+    CHECK_EQ(sim->stats.programs - programs, 1);
+}
+//a quiet ring is flushed by rb_poll after its deadline, not before
+static void test_deadline(void) {
+    CHECK_EQ(rb_create(&rb, base, BUF_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_set_buffered(&rb, ringpage, 20000), RB_OK);
+    buf_append(0);
+    CHECK_EQ(rb_poll(&rb), RB_OK);
+    CHECK(rb.staged);
+    sleep_ms(30);
+    CHECK_EQ(rb_poll(&rb), RB_OK);
+    CHECK(!rb.staged);
+    CHECK_EQ(rb_recreate(&other, base, BUF_SECTORS, CREATE_FAIL), RB_OK);
+    buf_expect(&other, 0, 1);
+    //the next append after the deadline flushes too
+    buf_append(1);
+    sleep_ms(30);
+    buf_append(2);
+    CHECK(!rb.staged);
+    //deadline 0 flushes at the end of every append
+    CHECK_EQ(rb_set_buffered(&rb, ringpage, 0), RB_OK);
+    buf_append(3);
+    CHECK(!rb.staged);
+    CHECK_EQ(rb_recreate(&other, base, BUF_SECTORS, CREATE_FAIL), RB_OK);
+    buf_expect(&other, 0, 4);
+    CHECK_EQ(rb_clear_buffered(&rb), RB_OK);
+}
+//a flush that fails is returned, by the call that made it
+static void test_fail(flash_sim_t *sim) {
+    CHECK_EQ(rb_create(&rb, base, BUF_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_set_buffered(&rb, ringpage, 1000000000), RB_OK);
+    buf_append(0);
+    flash_sim_fail_progs(sim, 0, 1);
+    CHECK_EQ(rb_set_buffered(&rb, ringpage, 1000000000), RB_FLASH_ERROR);
+    CHECK_EQ(sim->stats.failed_programs, 1);
+    CHECK_EQ(rb_clear_buffered(&rb), RB_OK);
+}
+int main(void) {
+    flash_sim_t sim;
+    check_flash(&sim);
+    base = __PERSISTENT_TABLE - 32 * FLASH_SECTOR_SIZE;
+    test_group(&sim);
+    test_deadline();
+    test_fail(&sim);
+    printf("test_buffered passed\n");
+    return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host test of the read cache. A walk over small records reads each page
+ * from flash once instead of each header apart, and sector headers read
+ * again come from the cache. Records appended, deleted and erased through
+ * the cached rb read back as a plain rb on the same flash sees them, and
+ * rb_recreate drops the cache.
+ */
+#include "ring_buffer.h"
+#include "check.h"
+
+#define CACHE_ID 3
+#define CACHE_SECTORS 4
+#define CACHE_RECORDS 300
+#define CACHE_LEN 12
+
+static uint8_t pagebuff[FLASH_PAGE_SIZE];
+static uint32_t base;
+static rb_cache_t cache;
+static rb_t rb;
+
+static void cache_fill(uint8_t *buf, uint32_t n) {
+    memset(buf, n * 9, CACHE_LEN);
+    memcpy(buf, &n, sizeof(n));
+}
+static void cache_append(uint32_t n, bool erase_if_full) {
+    uint8_t buf[CACHE_LEN];
+    cache_fill(buf, n);
+    CHECK_EQ(rb_append(&rb, CACHE_ID, buf, sizeof(buf), pagebuff, erase_if_full), RB_OK);
+}
+//reopen r and read every record, the number of the first in *first
+static uint32_t cache_walk(rb_t *r, bool cached, uint32_t *first) {
+    uint8_t got[CACHE_LEN];
+    uint8_t want[CACHE_LEN];
+    uint32_t count = 0;
+    uint32_t n = 0;
+    rb_errors_t err = rb_recreate(r, base, CACHE_SECTORS, CREATE_FAIL);
+    CHECK(err == RB_OK || err == RB_BLANK_HDR);
+    CHECK(r->cache == NULL);
+    if (cached) {
+        CHECK_EQ(rb_set_cache(r, &cache), RB_OK);
+    }
+    while (rb_read(r, CACHE_ID, got, sizeof(got)) == CACHE_LEN) {
+        memcpy(&n, got, sizeof(n));
+        if (count++ == 0) {
+            *first = n;
+        }
+        cache_fill(want, n);
+        CHECK(!memcmp(got, want, CACHE_LEN));
+    }
+    return count;
+}
+//the same walk with and without the cache, counting flash reads
+static void test_walk(flash_sim_t *sim) {
+    uint8_t got[CACHE_LEN];
+    uint32_t first;
+    CHECK_EQ(rb_create(&rb, base, CACHE_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    for (uint32_t n = 0; n < CACHE_RECORDS; n++) {
+        cache_append(n, false);
+    }
+    uint64_t reads = sim->stats.reads;
+    CHECK_EQ(cache_walk(&rb, false, &first), CACHE_RECORDS);
+    uint64_t plain = sim->stats.reads - reads;
+    reads = sim->stats.reads;
+    CHECK_EQ(cache_walk(&rb, true, &first), CACHE_RECORDS);
+    CHECK_EQ(first, 0);
+    uint64_t cached = sim->stats.reads - reads;
+    CHECK(cached * 4 < plain);
+    CHECK(cache.misses <= CACHE_RECORDS * (CACHE_LEN + 4) / FLASH_PAGE_SIZE + CACHE_SECTORS);
+    CHECK(cache.hits > CACHE_RECORDS);
+    //a missing id walks the ring, again with the sector headers known
+    rb_cursor_t c;
+    CHECK_EQ(rb_cursor_open(&c, &rb), RB_OK);
+    CHECK_EQ(rb_cursor_find(&c, CACHE_ID + 1, got, sizeof(got), pagebuff), RB_BLANK_HDR);
+    uint32_t header_hits = cache.header_hits;
+    reads = sim->stats.reads;
+    CHECK_EQ(rb_cursor_open(&c, &rb), RB_OK);
+    CHECK_EQ(rb_cursor_find(&c, CACHE_ID + 1, got, sizeof(got), pagebuff), RB_BLANK_HDR);
+    CHECK(cache.header_hits > header_hits);
+    CHECK(sim->stats.reads - reads <= CACHE_RECORDS * (CACHE_LEN + 4) / FLASH_PAGE_SIZE + 2);
+    CHECK_EQ(rb_set_cache(NULL, &cache), RB_BAD_CALLER_DATA);
+}
+//appends, deletes and erases through the cached rb, read back as others see them
+static void test_coherent(void) {
+    uint8_t got[CACHE_LEN];
+    uint8_t want[CACHE_LEN];
+    rb_cursor_t c;
+    rb_t plain;
+    uint32_t first;
+    uint32_t plain_first;
+    CHECK_EQ(rb_create(&rb, base, CACHE_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_set_cache(&rb, &cache), RB_OK);
+    uint32_t per_ring = CACHE_SECTORS * FLASH_SECTOR_SIZE / (CACHE_LEN + 4);
+    uint32_t n;
+    for (n = 0; n < 3 * per_ring; n++) {
+        cache_append(n, true);
+        if (n % 100 == 0) {
+            //the newest record, in the page the append just changed
+            cache_fill(want, n);
+            CHECK_EQ(rb_cursor_open(&c, &rb), RB_OK);
+            int at = rb_cursor_find(&c, CACHE_ID, want, sizeof(want), got);
+            CHECK(at >= 0);
+            CHECK_EQ(rb_delete_at(&rb, at, pagebuff), RB_OK);
+            CHECK_EQ(rb_cursor_find(&c, CACHE_ID, want, sizeof(want), got), RB_BLANK_HDR);
+        }
+    }
+    CHECK(rb.erases > 2 * CACHE_SECTORS);
+    uint32_t count = cache_walk(&rb, true, &first);
+    CHECK_EQ(cache_walk(&plain, false, &plain_first), count);
+    CHECK_EQ(first, plain_first);
+    //the deleted ones are gone, the rest all there
+    CHECK(count > per_ring / 2);
+    rb_errors_t err = rb_recreate(&rb, base, CACHE_SECTORS, CREATE_FAIL);
+    CHECK(err == RB_OK || err == RB_BLANK_HDR);
+    CHECK_EQ(rb_set_cache(&rb, &cache), RB_OK);
+    uint32_t last = first - 1;
+    for (uint32_t i = 0; i < count; i++) {
+        CHECK_EQ(rb_read(&rb, CACHE_ID, got, sizeof(got)), CACHE_LEN);
+        memcpy(&n, got, sizeof(n));
+        CHECK(n % 100 != 0);
+        CHECK_EQ(n, last + 1 + ((last + 1) % 100 == 0));
+        last = n;
+    }
+    CHECK_EQ(last, 3 * per_ring - 1);
+}
+int main(void) {
+    flash_sim_t sim;
+    check_flash(&sim);
+    base = __PERSISTENT_TABLE - 32 * FLASH_SECTOR_SIZE;
+    test_walk(&sim);
+    test_coherent();
+    printf("test_cache passed\n");
+    return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host test of compaction. rb_compact copies the live records of the oldest
+ * sector to the tail and erases it, deleted ones are gone and none is lost.
+ * With erase ahead, rb_maintain compacts a sector when little enough of it
+ * is live, so a record kept while many others come and go survives the ring
+ * wrapping, and with compaction off it cycles out. Time rings and rings
+ * with one sector in use are left alone.
+ */
+#include "ring_buffer.h"
+#include "check.h"
+
+#define KEEP_ID 1
+#define JUNK_ID 2
+#define COMPACT_SECTORS 8
+#define COMPACT_LEN 100
+
+static uint8_t pagebuff[FLASH_PAGE_SIZE];
+static uint8_t copypage[FLASH_PAGE_SIZE];
+static uint32_t base;
+static rb_t rb;
+
+static void compact_fill(uint8_t *buf, uint32_t n) {
+    memset(buf, n * 3, COMPACT_LEN);
+    memcpy(buf, &n, sizeof(n));
+}
+static void compact_append(uint8_t id, uint32_t n) {
+    uint8_t buf[COMPACT_LEN];
+    compact_fill(buf, n);
+    CHECK_EQ(rb_append(&rb, id, buf, sizeof(buf), pagebuff, false), RB_OK);
+}
+//delete record n of id, found from the cursor on
+static void compact_delete(rb_cursor_t *c, uint8_t id, uint32_t n) {
+    uint8_t want[COMPACT_LEN];
+    uint8_t scratch[COMPACT_LEN];
+    compact_fill(want, n);
+    int at = rb_cursor_find(c, id, want, sizeof(want), scratch);
+    CHECK(at >= 0);
+    CHECK_EQ(rb_delete_at(&rb, at, pagebuff), RB_OK);
+}
+//RB_BLANK_HDR when the first sector of the ring is one that was erased
+static void compact_reopen(void) {
+    rb_errors_t err = rb_recreate(&rb, base, COMPACT_SECTORS, CREATE_FAIL);
+    CHECK(err == RB_OK || err == RB_BLANK_HDR);
+}
+static uint32_t compact_number(const uint8_t *got) {
+    uint32_t n;
+    memcpy(&n, got, sizeof(n));
+    return n;
+}
+//the records of the oldest sector not deleted are copied behind the others
+static void test_oldest(void) {
+    uint8_t got[COMPACT_LEN];
+    uint8_t want[COMPACT_LEN];
+    rb_cursor_t c;
+    uint32_t per_sector = (FLASH_SECTOR_SIZE - 4) / (COMPACT_LEN + 4);
+    uint32_t n = 3 * per_sector;
+    CHECK_EQ(rb_create(&rb, base, COMPACT_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_compact(&rb, pagebuff), 0); //blank
+    for (uint32_t i = 0; i < per_sector; i++) {
+        compact_append(JUNK_ID, i);
+    }
+    CHECK_EQ(rb_compact(&rb, pagebuff), 0); //only the sector being written
+    for (uint32_t i = per_sector; i < n; i++) {
+        compact_append(JUNK_ID, i);
+    }
+    CHECK_EQ(rb_cursor_open(&c, &rb), RB_OK);
+    for (uint32_t i = 0; i < per_sector; i++) {
+        if (i % 5) {
+            compact_delete(&c, JUNK_ID, i);
+        }
+    }
+    int freed = rb_compact(&rb, pagebuff);
+    CHECK(freed > (int)(per_sector * 4 / 5 * COMPACT_LEN));
+    CHECK_EQ(rb.erases, 1);
+    //the rest in order, then the copies. Record per_sector starts in the
+    //oldest sector too, split over its end
+    compact_reopen();
+    for (uint32_t i = per_sector + 1; i < n + per_sector + 1; i++) {
+        uint32_t want_n = i < n ? i : i - n;
+        if (i >= n && want_n % 5 && want_n != per_sector) {
+            continue;
+        }
+        compact_fill(want, want_n);
+        CHECK_EQ(rb_read(&rb, JUNK_ID, got, sizeof(got)), COMPACT_LEN);
+        CHECK_EQ(compact_number(got), want_n);
+        CHECK(!memcmp(got, want, COMPACT_LEN));
+    }
+    CHECK(rb_read(&rb, JUNK_ID, got, sizeof(got)) < 0);
+}
+/*
+ one KEEP_ID record, then JUNK_ID records going round the ring five times,
+ each deleted once written. Returns whether the kept one is still there.
+*/
+static bool compact_keeps(uint8_t pct) {
+    uint8_t got[COMPACT_LEN];
+    rb_cursor_t c;
+    uint32_t per_ring = COMPACT_SECTORS * FLASH_SECTOR_SIZE / (COMPACT_LEN + 4);
+    CHECK_EQ(rb_create(&rb, base, COMPACT_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_set_erase_ahead(&rb, 2), RB_OK);
+    CHECK_EQ(rb_set_compaction(&rb, pct, copypage), RB_OK);
+    compact_append(KEEP_ID, 0);
+    CHECK_EQ(rb_cursor_open(&c, &rb), RB_OK);
+    for (uint32_t n = 1; n < 5 * per_ring; n++) {
+        compact_append(JUNK_ID, n);
+        compact_delete(&c, JUNK_ID, n);
+        CHECK_EQ(rb_maintain(&rb), RB_OK);
+    }
+    CHECK(rb.erases > 4 * COMPACT_SECTORS);
+    compact_reopen();
+    CHECK(rb_read(&rb, JUNK_ID, got, sizeof(got)) < 0);
+    compact_reopen();
+    int len = rb_read(&rb, KEEP_ID, got, sizeof(got));
+    if (len < 0) {
+        return false;
+    }
+    CHECK_EQ(len, COMPACT_LEN);
+    CHECK_EQ(compact_number(got), 0);
+    return true;
+}
+static void test_maintain(void) {
+    CHECK(compact_keeps(50));
+    CHECK(!compact_keeps(0));
+}
+static uint64_t compact_time(void *entry) {
+    return compact_number(entry);
+}
+static void test_refused(void) {
+    CHECK_EQ(rb_create(&rb, base, COMPACT_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_set_compaction(&rb, 101, copypage), RB_BAD_CALLER_DATA);
+    CHECK_EQ(rb_set_compaction(&rb, 50, NULL), RB_BAD_CALLER_DATA);
+    CHECK_EQ(rb_set_timestamps(&rb, compact_time), RB_OK);
+    for (uint32_t i = 0; i < 2 * FLASH_SECTOR_SIZE / COMPACT_LEN; i++) {
+        compact_append(JUNK_ID, i);
+    }
+    CHECK_EQ(rb_compact(&rb, pagebuff), RB_BAD_CALLER_DATA);
+}
+int main(void) {
+    flash_sim_t sim;
+    check_flash(&sim);
+    base = __PERSISTENT_TABLE - 32 * FLASH_SECTOR_SIZE;
+    test_oldest();
+    test_maintain();
+    test_refused();
+    printf("test_compact passed\n");
+    return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host test of the header and payload crcs. The table driven crc_update must
+ * match the bitwise one it replaced, a payload crc must catch a damaged
+ * payload, and a ring filled with records of RB_MAX_APPEND_SIZE, each taking
+ * a whole sector, must read back record for record and then end.
+ */
+#include "ring_buffer.h"
+#include "crc.h"
+#include "check.h"
+
+#define CRC_SECTORS 4
+
+static uint8_t pagebuff[FLASH_PAGE_SIZE];
+static uint32_t base;
+static rb_t rb;
+static uint32_t seed = 1;
+
+static uint32_t crc_random(void) {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+//the bitwise crc_update ring_buffer.c had before crc.c
+static crc_t crc_update_bitwise(crc_t crc, const void *data, size_t data_len) {
+    const unsigned char *d = (const unsigned char *)data;
+    unsigned int i;
+    crc_t bit;
+    unsigned char c;
+
+    while (data_len--) {
+        c = *d++;
+        for (i = 0x01; i & 0xff; i <<= 1) {
+            bit = (crc & 0x10) ^ ((c & i) ? 0x10 : 0);
+            crc <<= 1;
+            if (bit) {
+                crc ^= 0x05;
+            }
+        }
+        crc &= 0x1f;
+    }
+    return crc & 0x1f;
+}
+static void test_crc_table(void) {
+    uint8_t buf[64];
+    for (int n = 0; n < 20000; n++) {
+        size_t len = crc_random() % sizeof(buf);
+        crc_t start = crc_random() & 0x1f;
+        for (size_t i = 0; i < len; i++) {
+            buf[i] = crc_random();
+        }
+        crc_t crc = crc_update(start, buf, len);
+        CHECK_EQ(crc, crc_update_bitwise(start, buf, len));
+        //in pieces too, as the headers are checked
+        size_t cut = len ? crc_random() % len : 0;
+        CHECK_EQ(crc_update(crc_update(start, buf, cut), buf + cut, len - cut), crc);
+    }
+    //a payload followed by its crc32 always ends on the residue
+    for (int n = 0; n < 1000; n++) {
+        size_t len = crc_random() % (sizeof(buf) - 4);
+        for (size_t i = 0; i < len; i++) {
+            buf[i] = crc_random();
+        }
+        uint32_t crc = crc32_finalize(crc32_update(crc32_init(), buf, len));
+        for (int i = 0; i < 4; i++) {
+            buf[len + i] = crc >> (8 * i);
+        }
+        CHECK_EQ(crc32_update(crc32_init(), buf, len + 4) ^ 0xffffffffu, CRC32_RESIDUE);
+    }
+}
+static void crc_fill(uint8_t *buf, uint32_t n, uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+        buf[i] = n * 31 + i * 7 + (i >> 8);
+    }
+    memcpy(buf, &n, sizeof(n));
+}
+//a payload crc catches a payload bit the header crc does not cover
+static void test_payload_crc(void) {
+    uint8_t got[300];
+    rb_segment_t seg[RB_PEEK_SEGMENTS];
+    CHECK_EQ(rb_create(&rb, base, CRC_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_set_payload_crc(&rb, true), RB_OK);
+    crc_fill(got, 0, 100);
+    CHECK_EQ(rb_append(&rb, 1, got, 100, pagebuff, false), RB_OK);
+    CHECK_EQ(rb_recreate(&rb, base, CRC_SECTORS, CREATE_FAIL), RB_OK);
+    CHECK_EQ(rb_read(&rb, 1, got, sizeof(got)), 100);
+    CHECK_EQ(rb_recreate(&rb, base, CRC_SECTORS, CREATE_FAIL), RB_OK);
+    CHECK_EQ(rb_peek(&rb, 1, seg), 100);
+    uint32_t at = seg[0].data + 50 - flash_mapped(0);
+    CHECK(seg[0].data[50] != 0);
+    memset(pagebuff, 0xff, FLASH_PAGE_SIZE);
+    pagebuff[MOD_PAGE(at)] = seg[0].data[50] & (seg[0].data[50] - 1); //one bit cleared
+    CHECK_EQ(flash_prog_range(&flash_default_dev, FLASH_PAGE(at), pagebuff,
+                              MOD_PAGE(at), MOD_PAGE(at) + 1), 0);
+    CHECK_EQ(rb_recreate(&rb, base, CRC_SECTORS, CREATE_FAIL), RB_OK);
+    CHECK_EQ(rb_read(&rb, 1, got, sizeof(got)), RB_BAD_PAYLOAD_CRC);
+}
+/*
+ the records first to first + count - 1 must be all the ring holds, read by
+ rb_read, a cursor and a reader. None leaves a blank header to stop at.
+*/
+static void crc_read_all(uint32_t first, uint32_t count, uint32_t size) {
+    static uint8_t got[FLASH_SECTOR_SIZE];
+    static uint8_t want[FLASH_SECTOR_SIZE];
+    rb_cursor_t c;
+    rb_reader_t r;
+    uint32_t n;
+    int len;
+    CHECK_EQ(rb_recreate(&rb, base, CRC_SECTORS, CREATE_FAIL), RB_OK);
+    CHECK_EQ(rb_cursor_open(&c, &rb), RB_OK);
+    for (n = first; (len = rb_read(&rb, 1, got, sizeof(got))) > 0; n++) {
+        CHECK(n < first + count);
+        crc_fill(want, n, size);
+        CHECK_EQ(len, size);
+        CHECK(!memcmp(got, want, size));
+        CHECK_EQ(rb_cursor_read(&c, 1, got, sizeof(got)), size);
+        CHECK(!memcmp(got, want, size));
+    }
+    CHECK_EQ(n, first + count);
+    CHECK(rb_cursor_read(&c, 1, got, sizeof(got)) < 0);
+    CHECK(rb_find(&rb, 1, "none", 4, got) < 0);
+    CHECK_EQ(rb_cursor_open(&c, &rb), RB_OK);
+    for (n = 0; rb_cursor_reader_open(&r, &c, 1) > 0; n++) {
+        CHECK(n < count);
+    }
+    CHECK_EQ(n, count);
+}
+static void test_full_ring(bool payload_crc) {
+    static uint8_t buf[FLASH_SECTOR_SIZE];
+    uint32_t size = RB_MAX_APPEND_SIZE - (payload_crc ? sizeof(uint32_t) : 0);
+    uint32_t n;
+    CHECK_EQ(rb_create(&rb, base, CRC_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_set_payload_crc(&rb, payload_crc), RB_OK);
+    for (n = 0; n < CRC_SECTORS; n++) {
+        crc_fill(buf, n, size);
+        CHECK_EQ(rb_append(&rb, 1, buf, size, pagebuff, false), RB_OK);
+    }
+    crc_read_all(0, CRC_SECTORS, size);
+    //and wrapped, each append erases the oldest sector
+    CHECK_EQ(rb_set_payload_crc(&rb, payload_crc), RB_OK);
+    for (; n < 3 * CRC_SECTORS + 1; n++) {
+        crc_fill(buf, n, size);
+        CHECK_EQ(rb_append(&rb, 1, buf, size, pagebuff, true), RB_OK);
+    }
+    crc_read_all(n - CRC_SECTORS, CRC_SECTORS, size);
+    //a longer record, with its crc, does not fit. It is refused before any erase
+    CHECK_EQ(rb_set_payload_crc(&rb, payload_crc), RB_OK);
+    uint32_t erases = rb.erases;
+    CHECK_EQ(rb_append(&rb, 1, buf, size + 1, pagebuff, true), RB_BAD_CALLER_DATA);
+    CHECK_EQ(rb.erases, erases);
+}
+int main(void) {
+    flash_sim_t sim;
+    check_flash(&sim);
+    base = __PERSISTENT_TABLE - 32 * FLASH_SECTOR_SIZE;
+    test_crc_table();
+    test_payload_crc();
+    test_full_ring(false);
+    test_full_ring(true);
+    printf("test_crc passed\n");
+    return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host test of read cursors. Cursors on one ring each keep their own
+ * position, interleaved with each other and with rb_read, and reading,
+ * finding, peeking and chunked reads all move only the cursor used. A cursor
+ * opens at the oldest record, also after the ring wrapped, a saved position
+ * is set back to read again, and a blank ring reads as empty.
+ */
+#include "ring_buffer.h"
+#include "check.h"
+
+#define CURSOR_SECTORS 4
+#define CURSOR_RECORDS 60
+#define CURSOR_MAX 40
+
+static uint8_t pagebuff[FLASH_PAGE_SIZE];
+static uint32_t base;
+static rb_t rb;
+
+static uint8_t cursor_id(uint32_t n) {
+    return 1 + n % 2;
+}
+static uint32_t cursor_size(uint32_t n) {
+    return 4 + n * 7 % (CURSOR_MAX - 4);
+}
+//payloads start with their number, the rest is made from it
+static void cursor_fill(uint8_t *buf, uint32_t n) {
+    memcpy(buf, &n, sizeof(n));
+    for (uint32_t i = sizeof(n); i < cursor_size(n); i++) {
+        buf[i] = n * 5 + i;
+    }
+}
+static void cursor_write(uint32_t first, uint32_t end, bool erase_if_full) {
+    uint8_t buf[CURSOR_MAX];
+    for (uint32_t n = first; n < end; n++) {
+        cursor_fill(buf, n);
+        CHECK_EQ(rb_append(&rb, cursor_id(n), buf, cursor_size(n), pagebuff, erase_if_full),
+                 RB_OK);
+    }
+}
+//read the next record of id, rb_read takes no RB_ANY_ID but the reader does
+static int cursor_read(rb_cursor_t *c, uint8_t id, uint8_t *got) {
+    rb_reader_t r;
+    if (id != RB_ANY_ID) {
+        return rb_cursor_read(c, id, got, CURSOR_MAX);
+    }
+    int len = rb_cursor_reader_open(&r, c, id);
+    if (len > 0) {
+        CHECK_EQ(rb_reader_read(&r, got, len), len);
+    }
+    return len;
+}
+//the next record of id the cursor reads is number n
+static void cursor_expect(rb_cursor_t *c, uint8_t id, uint32_t n) {
+    uint8_t got[CURSOR_MAX];
+    uint8_t want[CURSOR_MAX];
+    cursor_fill(want, n);
+    CHECK_EQ(cursor_read(c, id, got), cursor_size(n));
+    CHECK(!memcmp(got, want, cursor_size(n)));
+}
+static void test_blank(void) {
+    uint8_t got[CURSOR_MAX];
+    rb_cursor_t c;
+    CHECK_EQ(rb_create(&rb, base, CURSOR_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_cursor_open(&c, &rb), RB_OK);
+    CHECK_EQ(cursor_read(&c, RB_ANY_ID, got), RB_BLANK_HDR);
+    CHECK_EQ(rb_cursor_open(NULL, &rb), RB_BAD_CALLER_DATA);
+    CHECK_EQ(rb_cursor_read(NULL, 1, got, sizeof(got)), RB_BAD_CALLER_DATA);
+    CHECK_EQ(rb_cursor_read(&c, RB_ANY_ID, got, sizeof(got)), RB_BAD_CALLER_DATA);
+}
+//two cursors and rb_read walk the same records, each at its own pace
+static void test_independent(void) {
+    uint8_t got[CURSOR_MAX];
+    rb_cursor_t odd, any;
+    CHECK_EQ(rb_create(&rb, base, CURSOR_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    cursor_write(0, CURSOR_RECORDS, false);
+    CHECK_EQ(rb_recreate(&rb, base, CURSOR_SECTORS, CREATE_FAIL), RB_OK);
+    uint32_t next = rb.next;
+    CHECK_EQ(rb_cursor_open(&odd, &rb), RB_OK);
+    CHECK_EQ(rb_cursor_open(&any, &rb), RB_OK);
+    CHECK_EQ(odd.next, any.next);
+    uint32_t reads = 0;
+    for (uint32_t n = 0; n < CURSOR_RECORDS; n++) {
+        if (cursor_id(n) == 2) {
+            cursor_expect(&odd, 2, n);
+        }
+        cursor_expect(&any, RB_ANY_ID, n);
+        if (n % 10 == 0) {
+            CHECK_EQ(rb_read(&rb, 1, got, sizeof(got)), cursor_size(2 * reads++));
+        }
+    }
+    CHECK_EQ(rb_cursor_read(&odd, 2, got, sizeof(got)), RB_BLANK_HDR);
+    CHECK_EQ(cursor_read(&any, RB_ANY_ID, got), RB_BLANK_HDR);
+    //rb_read went on from where it was, the cursors did not move it
+    CHECK(rb.next != next);
+    rb.next = next;
+    for (uint32_t n = 0; n < CURSOR_RECORDS; n += 2) {
+        CHECK_EQ(rb_read(&rb, 1, got, sizeof(got)), cursor_size(n));
+    }
+}
+//find, peek and the chunked reader go on from the cursor and move it
+static void test_calls(void) {
+    uint8_t want[CURSOR_MAX];
+    uint8_t scratch[CURSOR_MAX];
+    rb_segment_t seg[RB_PEEK_SEGMENTS];
+    rb_reader_t r;
+    rb_cursor_t c;
+    CHECK_EQ(rb_recreate(&rb, base, CURSOR_SECTORS, CREATE_FAIL), RB_OK);
+    CHECK_EQ(rb_cursor_open(&c, &rb), RB_OK);
+    uint32_t start = c.next;
+    cursor_fill(want, 21);
+    int at = rb_cursor_find(&c, cursor_id(21), want, cursor_size(21), scratch);
+    CHECK(at >= 0);
+    cursor_expect(&c, cursor_id(23), 23);
+    CHECK_EQ(rb_cursor_peek(&c, cursor_id(25), seg), cursor_size(25));
+    cursor_fill(want, 25);
+    CHECK(!memcmp(seg[0].data, want, seg[0].len));
+    CHECK_EQ(rb_cursor_reader_open(&r, &c, cursor_id(27)), cursor_size(27));
+    cursor_expect(&c, cursor_id(29), 29);
+    //set back, the same record is found at the same place
+    c.next = start;
+    cursor_fill(want, 21);
+    CHECK_EQ(rb_cursor_find(&c, cursor_id(21), want, cursor_size(21), scratch), at);
+    //rb itself still reads from the oldest record
+    CHECK_EQ(rb_read(&rb, cursor_id(0), scratch, sizeof(scratch)), cursor_size(0));
+    //deleted, the search runs on to the end of the records
+    CHECK_EQ(rb_delete_at(&rb, at, pagebuff), RB_OK);
+    c.next = start;
+    CHECK_EQ(rb_cursor_find(&c, cursor_id(21), want, cursor_size(21), scratch), RB_BLANK_HDR);
+}
+//once the ring wrapped, a cursor opens at the oldest record left
+static void test_wrapped(void) {
+    uint8_t got[CURSOR_MAX];
+    rb_cursor_t c;
+    uint32_t n = 0;
+    CHECK_EQ(rb_create(&rb, base, CURSOR_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    while (rb.erases < 2) {
+        cursor_write(n, n + 1, true);
+        n++;
+    }
+    CHECK_EQ(rb_cursor_open(&c, &rb), RB_OK);
+    CHECK(cursor_read(&c, RB_ANY_ID, got) > 0);
+    uint32_t first;
+    memcpy(&first, got, sizeof(first));
+    CHECK(first > 0);
+    for (uint32_t i = first + 1; i < n; i++) {
+        cursor_expect(&c, RB_ANY_ID, i);
+    }
+    CHECK_EQ(cursor_read(&c, RB_ANY_ID, got), RB_BLANK_HDR);
+    CHECK_EQ(rb_recreate(&rb, base, CURSOR_SECTORS, CREATE_FAIL), RB_OK);
+    CHECK_EQ(rb_read(&rb, cursor_id(first), got, sizeof(got)), cursor_size(first));
+}
+int main(void) {
+    flash_sim_t sim;
+    check_flash(&sim);
+    base = __PERSISTENT_TABLE - 32 * FLASH_SECTOR_SIZE;
+    test_blank();
+    test_independent();
+    test_calls();
+    test_wrapped();
+    printf("test_cursor passed\n");
+    return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host test of rings bound to their own flash device. A ring on a simulated
+ * external SPI NOR, erasing 64K blocks and not memory mapped, uses the
+ * device erase unit as its sector, wraps, and reopens. A ring on the onboard
+ * flash next to it is not touched by it, and rings that do not fit their
+ * device or its sectors are refused.
+ */
+#include "ring_buffer.h"
+#include "check.h"
+
+#define DEV_ID 5
+#define DEV_SECTORS 4
+#define DEV_SECTOR_SIZE (64 * 1024)
+#define DEV_SIZE (16 * DEV_SECTOR_SIZE)
+#define DEV_LEN 1000
+
+static uint8_t pagebuff[FLASH_PAGE_SIZE];
+static uint32_t base;
+
+static void dev_fill(uint8_t *buf, uint32_t n) {
+    memset(buf, n * 3, DEV_LEN);
+    memcpy(buf, &n, sizeof(n));
+}
+static void dev_append(rb_t *rb, uint32_t n) {
+    uint8_t buf[DEV_LEN];
+    dev_fill(buf, n);
+    CHECK_EQ(rb_append(rb, DEV_ID, buf, sizeof(buf), pagebuff, true), RB_OK);
+}
+//the next record read is the newest of those from first, up to end - 1
+static void dev_expect(rb_t *rb, uint32_t first, uint32_t end) {
+    uint8_t got[DEV_LEN];
+    uint8_t want[DEV_LEN];
+    uint32_t n;
+    //the oldest sector may start with the end of a record it lost the head of
+    do {
+        CHECK_EQ(rb_read(rb, DEV_ID, got, sizeof(got)), DEV_LEN);
+        memcpy(&n, got, sizeof(n));
+    } while (n < first);
+    CHECK_EQ(n, first);
+    for (n++; n < end; n++) {
+        dev_fill(want, n);
+        CHECK_EQ(rb_read(rb, DEV_ID, got, sizeof(got)), DEV_LEN);
+        CHECK(!memcmp(got, want, DEV_LEN));
+    }
+    CHECK(rb_read(rb, DEV_ID, got, sizeof(got)) < 0);
+}
+static void dev_open(flash_sim_t *spi, flash_dev_t *dev) {
+    flash_sim_config_t cfg;
+    flash_sim_default_config(&cfg);
+    cfg.size = DEV_SIZE;
+    cfg.sector_size = DEV_SECTOR_SIZE;
+    cfg.block_size = DEV_SECTOR_SIZE;
+    cfg.unmapped = true;
+    CHECK_EQ(flash_sim_open(spi, &cfg), 0);
+    flash_sim_dev(spi, dev);
+}
+//a ring of 64K sectors round a few times, the onboard ring left alone
+static void test_spi(flash_sim_t *sim) {
+    flash_sim_t spi;
+    flash_dev_t dev;
+    rb_t rb;
+    rb_t onboard;
+    dev_open(&spi, &dev);
+    CHECK_EQ(rb_create(&onboard, base, DEV_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    dev_append(&onboard, 0);
+    CHECK_EQ(rb_create_on(&rb, &dev, DEV_SECTOR_SIZE, DEV_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb.sector_size, DEV_SECTOR_SIZE);
+    CHECK_EQ(rb.number_of_bytes, DEV_SECTORS * DEV_SECTOR_SIZE);
+    flash_sim_stats_t onboard_stats = sim->stats;
+    uint64_t erases = spi.stats.erases;
+    uint32_t per_sector = DEV_SECTOR_SIZE / (DEV_LEN + 4);
+    uint32_t n = 3 * DEV_SECTORS * per_sector;
+    for (uint32_t i = 0; i < n; i++) {
+        dev_append(&rb, i);
+    }
+    //each erase to make room is one 64K sector of the device
+    CHECK(spi.stats.erases - erases >= 2 * DEV_SECTORS);
+    CHECK_EQ(rb.erases, spi.stats.erases - erases);
+    CHECK_EQ(sim->stats.programs, onboard_stats.programs);
+    CHECK_EQ(sim->stats.erases, onboard_stats.erases);
+    //nothing outside the ring was written
+    for (uint32_t a = 0; a < DEV_SECTOR_SIZE; a++) {
+        CHECK_EQ(spi.mem[a], 0xff);
+    }
+    for (uint32_t a = (DEV_SECTORS + 1) * DEV_SECTOR_SIZE; a < DEV_SIZE; a++) {
+        CHECK_EQ(spi.mem[a], 0xff);
+    }
+    rb_errors_t err = rb_recreate_on(&rb, &dev, DEV_SECTOR_SIZE, DEV_SECTORS, CREATE_FAIL);
+    CHECK(err == RB_OK || err == RB_BLANK_HDR);
+    dev_expect(&rb, n - (DEV_SECTORS - 1) * per_sector, n);
+    CHECK_EQ(rb_recreate(&onboard, base, DEV_SECTORS, CREATE_FAIL), RB_OK);
+    dev_expect(&onboard, 0, 1);
+    flash_sim_close(&spi);
+}
+static void test_refused(void) {
+    flash_sim_t spi;
+    flash_dev_t dev;
+    rb_t rb;
+    dev_open(&spi, &dev);
+    CHECK_EQ(rb_create_on(&rb, &dev, FLASH_SECTOR_SIZE, DEV_SECTORS, CREATE_INIT_ALWAYS),
+             RB_BAD_CALLER_DATA);
+    CHECK_EQ(rb_create_on(&rb, &dev, 0, DEV_SIZE / DEV_SECTOR_SIZE + 1, CREATE_INIT_ALWAYS),
+             RB_BAD_CALLER_DATA);
+    CHECK_EQ(rb_create_on(&rb, &dev, DEV_SIZE - DEV_SECTOR_SIZE, 2, CREATE_INIT_ALWAYS),
+             RB_BAD_CALLER_DATA);
+    CHECK_EQ(rb_create_on(&rb, &dev, 0, DEV_SIZE / DEV_SECTOR_SIZE, CREATE_INIT_ALWAYS),
+             RB_OK);
+    flash_sim_close(&spi);
+}
+int main(void) {
+    flash_sim_t sim;
+    check_flash(&sim);
+    base = __PERSISTENT_TABLE - 32 * FLASH_SECTOR_SIZE;
+    test_spi(&sim);
+    test_refused();
+    printf("test_dev passed\n");
+    return 0;
+}
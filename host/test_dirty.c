@@ -0,0 +1,84 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host test of programming only the dirty bytes. The same appends and
+ * deletes are run on a simulator taking whole pages only, like the pico sdk,
+ * and on ones taking aligned programs of 1 and 4 bytes, like the bare part.
+ * The flash ends up the same on all of them, the partial ones send a small
+ * part of the bytes and take less modeled time, and a delete sends just the
+ * program unit holding the header byte it clears.
+ */
+#include "ring_buffer.h"
+#include "check.h"
+
+#define DIRTY_SECTORS 4
+#define DIRTY_RECORDS 200
+#define DIRTY_LEN 10
+
+static uint8_t pagebuff[FLASH_PAGE_SIZE];
+static uint32_t base;
+static rb_t rb;
+
+//the same appends and deletes on whatever simulator is bound
+static void dirty_run(flash_sim_t *sim, uint32_t unit) {
+    uint8_t buf[DIRTY_LEN];
+    CHECK_EQ(rb_create(&rb, base, DIRTY_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    flash_sim_reset_stats(sim);
+    for (uint32_t n = 0; n < DIRTY_RECORDS; n++) {
+        memset(buf, n, sizeof(buf));
+        CHECK_EQ(rb_append(&rb, 1 + n % 2, buf, sizeof(buf), pagebuff, false), RB_OK);
+    }
+    //record 1, the first of id 2
+    uint8_t scratch[DIRTY_LEN];
+    memset(buf, 1, sizeof(buf));
+    CHECK_EQ(rb_recreate(&rb, base, DIRTY_SECTORS, CREATE_FAIL), RB_OK);
+    int at = rb_find(&rb, 2, buf, sizeof(buf), scratch);
+    CHECK(at >= 0);
+    uint64_t bytes = sim->stats.program_bytes;
+    CHECK_EQ(rb_delete_at(&rb, at, pagebuff), RB_OK);
+    CHECK_EQ(sim->stats.program_bytes - bytes, unit);
+}
+static void dirty_open(flash_sim_t *sim, uint32_t unit) {
+    flash_sim_config_t cfg;
+    flash_sim_default_config(&cfg);
+    if (unit < FLASH_PAGE_SIZE) {
+        cfg.full_page_prog = false;
+        cfg.prog_unit = unit;
+    }
+    CHECK_EQ(flash_sim_open(sim, &cfg), 0);
+    flash_sim_bind(sim);
+}
+static void test_units(void) {
+    flash_sim_t page;
+    flash_sim_t byte;
+    flash_sim_t word;
+    dirty_open(&page, FLASH_PAGE_SIZE);
+    dirty_run(&page, FLASH_PAGE_SIZE);
+    dirty_open(&byte, 1);
+    dirty_run(&byte, 1);
+    dirty_open(&word, 4);
+    dirty_run(&word, 4);
+    uint32_t at = base - XIP_BASE;
+    uint32_t len = DIRTY_SECTORS * FLASH_SECTOR_SIZE;
+    CHECK(!memcmp(page.mem + at, byte.mem + at, len));
+    CHECK(!memcmp(page.mem + at, word.mem + at, len));
+    //every program of the page simulator is a whole page
+    CHECK_EQ(page.stats.program_bytes, page.stats.programs * FLASH_PAGE_SIZE);
+    CHECK(page.stats.ff_bytes > page.stats.program_bytes / 2);
+    //a header and a few bytes each, not a page
+    CHECK(byte.stats.program_bytes < page.stats.program_bytes / 8);
+    CHECK(byte.stats.program_bytes <= word.stats.program_bytes);
+    CHECK(word.stats.program_bytes < page.stats.program_bytes / 8);
+    CHECK(byte.stats.modeled_ns < page.stats.modeled_ns / 2);
+    CHECK(word.stats.modeled_ns < page.stats.modeled_ns / 2);
+    flash_sim_close(&page);
+    flash_sim_close(&byte);
+    flash_sim_close(&word);
+}
+int main(void) {
+    base = __PERSISTENT_TABLE - 32 * FLASH_SECTOR_SIZE;
+    test_units();
+    printf("test_dirty passed\n");
+    return 0;
+}
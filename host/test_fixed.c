@@ -0,0 +1,145 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host test of fixed size record rings. Records are packed a slot each with
+ * no record header, any record number reads back with a sector header read
+ * and the record itself, deleted ones are not returned. After wrapping the
+ * records of erased sectors are gone, the numbering goes on across a
+ * reopen, and bad sizes or calls on a plain ring are refused.
+ */
+#include "ring_buffer.h"
+#include "check.h"
+
+#define FIXED_SECTORS 8
+#define FIXED_LEN 20
+
+static uint8_t pagebuff[FLASH_PAGE_SIZE];
+static uint32_t base;
+static rb_t rb;
+
+static void fixed_fill(uint8_t *buf, uint32_t n) {
+    memset(buf, n * 5, FIXED_LEN);
+    memcpy(buf, &n, sizeof(n));
+}
+static void fixed_append(uint32_t n, bool erase_if_full) {
+    uint8_t buf[FIXED_LEN];
+    fixed_fill(buf, n);
+    CHECK_EQ(rb_fixed_append(&rb, buf, pagebuff, erase_if_full), RB_OK);
+}
+static void fixed_expect(uint32_t n) {
+    uint8_t got[FIXED_LEN];
+    uint8_t want[FIXED_LEN];
+    fixed_fill(want, n);
+    CHECK_EQ(rb_fixed_read(&rb, n, got), FIXED_LEN);
+    CHECK(!memcmp(got, want, FIXED_LEN));
+}
+static void fixed_range(uint32_t first, uint32_t end) {
+    uint32_t f;
+    uint32_t e;
+    CHECK_EQ(rb_fixed_range(&rb, &f, &e), RB_OK);
+    CHECK_EQ(f, first);
+    CHECK_EQ(e, end);
+}
+//records a few sectors deep, each read with two flash reads
+static void test_index(flash_sim_t *sim) {
+    uint8_t got[FIXED_LEN];
+    CHECK_EQ(rb_create_fixed(&rb, base, FIXED_SECTORS, FIXED_LEN, CREATE_INIT_ALWAYS), RB_OK);
+    //a flag byte per slot is all a record costs besides its data
+    CHECK_EQ(rb.slots, (FLASH_SECTOR_SIZE - sizeof(rb_sector_header)) / (FIXED_LEN + 1));
+    fixed_range(0, 0);
+    CHECK_EQ(rb_fixed_read(&rb, 0, got), RB_BLANK_HDR);
+    uint32_t n = 3 * rb.slots + rb.slots / 2;
+    for (uint32_t i = 0; i < n; i++) {
+        fixed_append(i, false);
+    }
+    fixed_range(0, n);
+    for (uint32_t i = n; i-- > 0;) {
+        uint64_t reads = sim->stats.reads;
+        fixed_expect(i);
+        CHECK(sim->stats.reads - reads <= 3);
+    }
+    CHECK_EQ(rb_fixed_read(&rb, n, got), RB_BLANK_HDR);
+    CHECK_EQ(rb_fixed_read(&rb, n + FIXED_SECTORS * rb.slots, got), RB_BLANK_HDR);
+}
+//deleted records are not found, the rest are
+static void test_delete(void) {
+    uint8_t got[FIXED_LEN];
+    uint32_t first;
+    uint32_t end;
+    CHECK_EQ(rb_fixed_range(&rb, &first, &end), RB_OK);
+    for (uint32_t i = first; i < end; i += 3) {
+        CHECK_EQ(rb_fixed_delete(&rb, i, pagebuff), RB_OK);
+    }
+    for (uint32_t i = first; i < end; i++) {
+        if (i % 3 == 0) {
+            CHECK_EQ(rb_fixed_read(&rb, i, got), RB_HDR_ID_NOT_FOUND);
+        } else {
+            fixed_expect(i);
+        }
+    }
+    CHECK_EQ(rb_fixed_delete(&rb, end, pagebuff), RB_BLANK_HDR);
+    //a delete does not move the tail
+    fixed_append(end, false);
+    fixed_range(first, end + 1);
+    fixed_expect(end);
+}
+//round the ring a few times, then open it again and append on
+static void test_wrapped(void) {
+    uint8_t got[FIXED_LEN];
+    CHECK_EQ(rb_create_fixed(&rb, base, FIXED_SECTORS, FIXED_LEN, CREATE_INIT_ALWAYS), RB_OK);
+    uint32_t n = 3 * FIXED_SECTORS * rb.slots + 7;
+    for (uint32_t i = 0; i < n; i++) {
+        fixed_append(i, true);
+    }
+    uint32_t first;
+    uint32_t end;
+    CHECK_EQ(rb_fixed_range(&rb, &first, &end), RB_OK);
+    CHECK_EQ(end, n);
+    CHECK(first > 0);
+    CHECK_EQ(first % rb.slots, 0);
+    CHECK(end - first <= FIXED_SECTORS * rb.slots);
+    CHECK(end - first > (FIXED_SECTORS - 2) * rb.slots);
+    CHECK_EQ(rb_fixed_read(&rb, first - 1, got), RB_HDR_ID_NOT_FOUND);
+    CHECK_EQ(rb_fixed_read(&rb, 0, got), RB_HDR_ID_NOT_FOUND);
+    for (uint32_t i = first; i < end; i++) {
+        fixed_expect(i);
+    }
+    //the sector headers carry the numbering
+    rb_errors_t err = rb_create_fixed(&rb, base, FIXED_SECTORS, FIXED_LEN, CREATE_FAIL);
+    CHECK(err == RB_OK || err == RB_BLANK_HDR);
+    fixed_range(first, end);
+    fixed_append(n, true);
+    fixed_expect(n);
+    fixed_expect(first);
+    fixed_range(first, n + 1);
+}
+static void test_refused(void) {
+    uint8_t got[FIXED_LEN];
+    rb_t plain;
+    uint32_t first;
+    uint32_t end;
+    CHECK_EQ(rb_create_fixed(&rb, base, FIXED_SECTORS, 0, CREATE_INIT_ALWAYS),
+             RB_BAD_CALLER_DATA);
+    CHECK_EQ(rb_create_fixed(&rb, base, FIXED_SECTORS, RB_MAX_FIXED_SIZE + 1,
+                             CREATE_INIT_ALWAYS), RB_BAD_CALLER_DATA);
+    CHECK_EQ(rb_create_fixed(&rb, base, FIXED_SECTORS, RB_MAX_FIXED_SIZE, CREATE_INIT_ALWAYS),
+             RB_OK);
+    CHECK_EQ(rb.slots, 1);
+    CHECK_EQ(rb_create(&plain, base, FIXED_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_fixed_append(&plain, got, pagebuff, false), RB_BAD_CALLER_DATA);
+    CHECK_EQ(rb_fixed_read(&plain, 0, got), RB_BAD_CALLER_DATA);
+    CHECK_EQ(rb_fixed_delete(&plain, 0, pagebuff), RB_BAD_CALLER_DATA);
+    CHECK_EQ(rb_fixed_range(&plain, &first, &end), RB_BAD_CALLER_DATA);
+}
+int main(void) {
+    flash_sim_t sim;
+    check_flash(&sim);
+    base = __PERSISTENT_TABLE - 32 * FLASH_SECTOR_SIZE;
+    test_index(&sim);
+    test_delete();
+    test_wrapped();
+    test_refused();
+    printf("test_fixed passed\n");
+    return 0;
+}
@@ -0,0 +1,211 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host test of the key/value store: put, overwrite and delete, reopening
+ * (also with more replaced versions of a key than RB_KV_RETIRE holds), and
+ * the index after appends erased the oldest sector or filled every sector.
+ * Every value is read back and compared, a failure exits non zero.
+ */
+#include "ring_buffer.h"
+#include "rb_kv.h"
+#include "check.h"
+
+#define KV_ID 0x21
+#define KV_SECTORS 3
+#define KV_KEYS 6
+#define KV_MIXED 40
+#define KV_MIXED_SECTORS 32
+
+static uint8_t pagebuff[FLASH_PAGE_SIZE];
+static uint32_t base;
+static uint32_t sectors = KV_SECTORS;
+static rb_t rb;
+static rb_kv_t kv;
+
+//keys are \0 terminated strings at the start of the payload, like flash_io
+static uint32_t kv_keylen(uint8_t id, const uint8_t *payload, uint32_t len) {
+    (void)id;
+    const uint8_t *end = memchr(payload, 0, len);
+    return end ? end - payload + 1 : len + 1;
+}
+static void kv_reopen(void) {
+    CHECK_EQ(rb_recreate(&rb, base, sectors, CREATE_FAIL), RB_OK);
+    rb_errors_t err = rb_kv_open(&kv, &rb, kv_keylen);
+    CHECK(err == RB_OK || err == RB_FULL);
+}
+static void kv_put(const char *key, const char *value) {
+    CHECK_EQ(rb_kv_put(&kv, KV_ID, key, strlen(key) + 1, value, strlen(value) + 1, pagebuff),
+             RB_OK);
+}
+//the value of key must be value, or the key gone if value is NULL
+static void kv_expect(const char *key, const char *value) {
+    char got[64];
+    int n = rb_kv_get(&kv, KV_ID, key, strlen(key) + 1, got, sizeof(got));
+    if (value == NULL) {
+        CHECK_EQ(n, RB_HDR_ID_NOT_FOUND);
+        return;
+    }
+    CHECK_EQ(n, strlen(value) + 1);
+    if (strcmp(got, value)) {
+        printf("key %s is \"%s\", not \"%s\"\n", key, got, value);
+        exit(1);
+    }
+}
+static void test_put_overwrite_delete(void) {
+    kv_put("ssid", "one");
+    kv_put("host", "pico");
+    kv_expect("ssid", "one");
+    kv_expect("host", "pico");
+    kv_put("ssid", "two");
+    kv_expect("ssid", "two");
+    CHECK_EQ(rb_kv_delete(&kv, KV_ID, "host", 5, pagebuff), RB_OK);
+    kv_expect("host", NULL);
+    kv_expect("ssid", "two");
+    CHECK_EQ(rb_kv_delete(&kv, KV_ID, "host", 5, pagebuff), RB_HDR_ID_NOT_FOUND);
+    kv_expect("none", NULL);
+    kv_reopen();
+    kv_expect("ssid", "two");
+    kv_expect("host", NULL);
+}
+/*
+ a ring with more replaced versions of a key than retire holds, appended
+ before the store was opened, so none of them are smudged. The scan at open
+ can not queue them all. A delete must still stick, also after a reopen.
+*/
+static void test_many_versions(void) {
+    char rec[32];
+    for (int i = 0; i < 3 * RB_KV_RETIRE; i++) {
+        int len = snprintf(rec, sizeof(rec), "pass%cpw%d", 0, i);
+        CHECK_EQ(rb_append(&rb, KV_ID, rec, len + 1, pagebuff, false), RB_OK);
+    }
+    kv_reopen();
+    CHECK(kv.overflow);
+    snprintf(rec, sizeof(rec), "pw%d", 3 * RB_KV_RETIRE - 1);
+    kv_expect("pass", rec);
+    CHECK_EQ(rb_kv_delete(&kv, KV_ID, "pass", 5, pagebuff), RB_OK);
+    kv_expect("pass", NULL);
+    kv_reopen();
+    kv_expect("pass", NULL);
+    kv_expect("ssid", "two");
+    //replaced through the store, retire is smudged as it fills
+    for (int i = 0; i < 3 * RB_KV_RETIRE; i++) {
+        snprintf(rec, sizeof(rec), "again%d", i);
+        kv_put("pass", rec);
+    }
+    kv_expect("pass", rec);
+    kv_reopen();
+    kv_expect("pass", rec);
+    CHECK_EQ(rb_kv_delete(&kv, KV_ID, "pass", 5, pagebuff), RB_OK);
+    kv_reopen();
+    kv_expect("pass", NULL);
+}
+//put far more than the ring holds, the oldest sector is erased again and again
+static void test_erase_on_full(void) {
+    char key[8];
+    char value[48];
+    char want[KV_KEYS][48];
+    uint32_t erases = rb.erases;
+    for (int i = 0; i < 200 * KV_KEYS; i++) {
+        snprintf(key, sizeof(key), "k%d", i % KV_KEYS);
+        snprintf(value, sizeof(value), "value %d of %s, padded to fill", i, key);
+        kv_put(key, value);
+        strcpy(want[i % KV_KEYS], value);
+        if (i % 7 == 0) {
+            kv_expect(key, value);
+        }
+    }
+    CHECK(rb.erases > erases);
+    for (int k = 0; k < KV_KEYS; k++) {
+        snprintf(key, sizeof(key), "k%d", k);
+        kv_expect(key, want[k]);
+    }
+    CHECK_EQ(rb_kv_delete(&kv, KV_ID, "k0", 3, pagebuff), RB_OK);
+    kv_reopen();
+    kv_expect("k0", NULL);
+    for (int k = 1; k < KV_KEYS; k++) {
+        snprintf(key, sizeof(key), "k%d", k);
+        kv_expect(key, want[k]);
+    }
+}
+//values filling every sector exactly leave no blank header to end the scan
+static void test_full_ring(void) {
+    static char big[RB_MAX_APPEND_SIZE];
+    char key[8];
+    CHECK_EQ(rb_create(&rb, base, KV_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_kv_open(&kv, &rb, kv_keylen), RB_OK);
+    for (int k = 0; k < KV_SECTORS; k++) {
+        uint32_t keylen = snprintf(key, sizeof(key), "b%d", k) + 1;
+        memset(big, 'a' + k, sizeof(big));
+        CHECK_EQ(rb_kv_put(&kv, KV_ID, key, keylen, big, sizeof(big) - keylen, pagebuff),
+                 RB_OK);
+    }
+    kv_reopen();
+    CHECK_EQ(kv.count, KV_SECTORS);
+    for (int k = 0; k < KV_SECTORS; k++) {
+        uint32_t keylen = snprintf(key, sizeof(key), "b%d", k) + 1;
+        CHECK_EQ(rb_kv_get(&kv, KV_ID, key, keylen, big, sizeof(big)), sizeof(big) - keylen);
+        CHECK(big[0] == 'a' + k && big[sizeof(big) - keylen - 1] == 'a' + k);
+    }
+}
+/*
+ puts and deletes of many keys in a fixed pseudo random order, checked
+ against what was last written. Raw appends and a reopen make retire
+ overflow now and then, new keys then land in slots a scan would not pick.
+ The ring is big enough to never erase, so no key is lost with its sector.
+*/
+static void test_mixed(void) {
+    char key[8];
+    char value[24];
+    char want[KV_MIXED][24];
+    uint32_t seed = 1;
+    memset(want, 0, sizeof(want));
+    sectors = KV_MIXED_SECTORS;
+    base -= sectors * FLASH_SECTOR_SIZE;
+    CHECK_EQ(rb_create(&rb, base, sectors, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_kv_open(&kv, &rb, kv_keylen), RB_OK);
+    for (int i = 0; i < 2000; i++) {
+        seed = seed * 1103515245 + 12345;
+        int k = (seed >> 16) % KV_MIXED;
+        snprintf(key, sizeof(key), "m%d", k);
+        switch ((seed >> 8) % 8) {
+        case 0:
+            CHECK_EQ(rb_kv_delete(&kv, KV_ID, key, strlen(key) + 1, pagebuff),
+                     want[k][0] ? RB_OK : RB_HDR_ID_NOT_FOUND);
+            want[k][0] = 0;
+            break;
+        case 1:
+            for (int v = 0; v < RB_KV_RETIRE + 2; v++) {
+                int len = snprintf(value, sizeof(value), "%s%craw%d", key, 0, i);
+                CHECK_EQ(rb_append(&rb, KV_ID, value, len + 1, pagebuff, true), RB_OK);
+            }
+            snprintf(want[k], sizeof(want[k]), "raw%d", i);
+            kv_reopen();
+            break;
+        default:
+            snprintf(value, sizeof(value), "v%d", i);
+            kv_put(key, value);
+            strcpy(want[k], value);
+            break;
+        }
+        for (k = 0; k < KV_MIXED; k++) {
+            snprintf(key, sizeof(key), "m%d", k);
+            kv_expect(key, want[k][0] ? want[k] : NULL);
+        }
+    }
+    CHECK_EQ(rb.erases, 0);
+}
+int main(void) {
+    flash_sim_t sim;
+    check_flash(&sim);
+    base = __PERSISTENT_TABLE - KV_SECTORS * FLASH_SECTOR_SIZE;
+    CHECK_EQ(rb_create(&rb, base, KV_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_kv_open(&kv, &rb, kv_keylen), RB_OK);
+    test_put_overwrite_delete();
+    test_many_versions();
+    test_erase_on_full();
+    test_full_ring();
+    test_mixed();
+    printf("test_kv passed\n");
+    return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host test of mounting from checkpoints. A mounted ring reads back and
+ * appends where it left off, also after wrapping many times and after the
+ * checkpoint sector filled and was erased. Mounting and appending reads far
+ * fewer bytes than doing so after the full scan of rb_recreate. Records
+ * written after the newest checkpoint are found, a damaged checkpoint falls
+ * back to the one before or to the full scan, and rb_checkpoint writes one
+ * on request.
+ */
+#include "ring_buffer.h"
+#include "check.h"
+
+#define MOUNT_ID 4
+#define MOUNT_SECTORS 17 //16 for the ring, the last keeps the checkpoints
+#define MOUNT_RING (MOUNT_SECTORS - 1)
+#define MOUNT_LEN 200
+#define MOUNT_ANY 0xffffffff //first record of a ring that wrapped
+
+static uint8_t pagebuff[FLASH_PAGE_SIZE];
+static uint32_t base;
+static rb_t rb;
+
+static void mount_fill(uint8_t *buf, uint32_t n) {
+    memset(buf, n * 7, MOUNT_LEN);
+    memcpy(buf, &n, sizeof(n));
+}
+static void mount_write(uint32_t first, uint32_t end) {
+    uint8_t buf[MOUNT_LEN];
+    for (uint32_t n = first; n < end; n++) {
+        mount_fill(buf, n);
+        CHECK_EQ(rb_append(&rb, MOUNT_ID, buf, sizeof(buf), pagebuff, true), RB_OK);
+    }
+}
+//the ring holds records first up to end - 1 and nothing after
+static void mount_expect(uint32_t first, uint32_t end) {
+    uint8_t got[MOUNT_LEN];
+    uint8_t want[MOUNT_LEN];
+    uint32_t n;
+    CHECK_EQ(rb_read(&rb, MOUNT_ID, got, sizeof(got)), MOUNT_LEN);
+    memcpy(&n, got, sizeof(n));
+    if (first != MOUNT_ANY) {
+        CHECK_EQ(n, first);
+    }
+    CHECK(n < end);
+    for (n++; n < end; n++) {
+        mount_fill(want, n);
+        CHECK_EQ(rb_read(&rb, MOUNT_ID, got, sizeof(got)), MOUNT_LEN);
+        CHECK(!memcmp(got, want, MOUNT_LEN));
+    }
+    CHECK(rb_read(&rb, MOUNT_ID, got, sizeof(got)) < 0);
+}
+//a few sectors written, mounted again, written on
+static void test_remount(flash_sim_t *sim) {
+    uint32_t per_sector = FLASH_SECTOR_SIZE / (MOUNT_LEN + 4);
+    uint32_t n = 5 * per_sector + 3;
+    CHECK_EQ(rb_mount(&rb, base, MOUNT_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK(rb.checkpoints);
+    mount_write(0, n);
+    CHECK_EQ(rb_mount(&rb, base, MOUNT_SECTORS, CREATE_FAIL), RB_OK);
+    mount_expect(0, n);
+    mount_write(n, n + 10);
+    n += 10;
+    CHECK_EQ(rb_mount(&rb, base, MOUNT_SECTORS, CREATE_FAIL), RB_OK);
+    mount_expect(0, n);
+    //the tail is known once mounted, the full scan has to look for it
+    uint64_t bytes = sim->stats.read_bytes;
+    CHECK_EQ(rb_mount(&rb, base, MOUNT_SECTORS, CREATE_FAIL), RB_OK);
+    mount_write(n, n + 1);
+    uint64_t mount_bytes = sim->stats.read_bytes - bytes;
+    bytes = sim->stats.read_bytes;
+    CHECK_EQ(rb_recreate(&rb, base, MOUNT_RING, CREATE_FAIL), RB_OK);
+    mount_write(n + 1, n + 2);
+    CHECK(2 * mount_bytes < sim->stats.read_bytes - bytes);
+}
+//round the ring many times, the checkpoint sector fills and is erased
+static void test_wrapped(void) {
+    uint32_t per_ring = MOUNT_RING * FLASH_SECTOR_SIZE / (MOUNT_LEN + 4);
+    uint32_t n = 0;
+    CHECK_EQ(rb_mount(&rb, base, MOUNT_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    for (uint32_t pass = 0; pass < 10; pass++) {
+        mount_write(n, n + per_ring);
+        n += per_ring;
+        CHECK_EQ(rb_mount(&rb, base, MOUNT_SECTORS, CREATE_FAIL), RB_OK);
+        mount_expect(MOUNT_ANY, n);
+    }
+    CHECK(n / (FLASH_SECTOR_SIZE / (MOUNT_LEN + 4)) > FLASH_SECTOR_SIZE / RB_CHECKPOINT_SLOT);
+}
+//the newest checkpoint damaged, or all of them, the ring still mounts right
+static void test_damaged(void) {
+    uint32_t n = 3 * FLASH_SECTOR_SIZE / (MOUNT_LEN + 4);
+    CHECK_EQ(rb_mount(&rb, base, MOUNT_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    mount_write(0, n);
+    uint32_t slot = rb.checkpoint_slot;
+    CHECK(slot >= 2 * RB_CHECKPOINT_SLOT);
+    uint32_t at = base - XIP_BASE + MOUNT_RING * FLASH_SECTOR_SIZE + slot - RB_CHECKPOINT_SLOT;
+    memset(pagebuff, 0xff, FLASH_PAGE_SIZE);
+    pagebuff[MOD_PAGE(at) + 1] = 0;
+    CHECK_EQ(flash_prog_range(&flash_default_dev, FLASH_PAGE(at), pagebuff, MOD_PAGE(at),
+                              MOD_PAGE(at) + 2), 0);
+    CHECK_EQ(rb_mount(&rb, base, MOUNT_SECTORS, CREATE_FAIL), RB_OK);
+    CHECK_EQ(rb.checkpoint_slot, slot);
+    mount_expect(0, n);
+    //every checkpoint wrong, the full scan finds the ring and starts them over
+    for (uint32_t s = 0; s < slot; s += RB_CHECKPOINT_SLOT) {
+        at = base - XIP_BASE + MOUNT_RING * FLASH_SECTOR_SIZE + s;
+        pagebuff[MOD_PAGE(at) + 1] = 0;
+        CHECK_EQ(flash_prog_range(&flash_default_dev, FLASH_PAGE(at), pagebuff, MOD_PAGE(at),
+                                  MOD_PAGE(at) + 2), 0);
+        pagebuff[MOD_PAGE(at) + 1] = 0xff;
+    }
+    CHECK_EQ(rb_mount(&rb, base, MOUNT_SECTORS, CREATE_FAIL), RB_OK);
+    CHECK_EQ(rb.checkpoint_slot, 0);
+    mount_expect(0, n);
+    mount_write(n, n + 1);
+    CHECK_EQ(rb_mount(&rb, base, MOUNT_SECTORS, CREATE_FAIL), RB_OK);
+    CHECK(rb.checkpoint_slot > 0);
+    mount_expect(0, n + 1);
+}
+//rb_checkpoint saves the tail inside a sector, mounting starts from it
+static void test_checkpoint(void) {
+    rb_t plain;
+    CHECK_EQ(rb_mount(&rb, base, MOUNT_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    mount_write(0, 5);
+    uint32_t slot = rb.checkpoint_slot;
+    CHECK_EQ(rb_checkpoint(&rb, pagebuff), RB_OK);
+    CHECK_EQ(rb.checkpoint_slot, slot + RB_CHECKPOINT_SLOT);
+    uint32_t tail = rb.tail;
+    CHECK_EQ(rb_mount(&rb, base, MOUNT_SECTORS, CREATE_FAIL), RB_OK);
+    CHECK_EQ(rb.tail, tail);
+    mount_expect(0, 5);
+    CHECK_EQ(rb_create(&plain, base, MOUNT_RING, CREATE_FAIL), RB_OK);
+    CHECK_EQ(rb_checkpoint(&plain, pagebuff), RB_BAD_CALLER_DATA);
+    CHECK_EQ(rb_mount(&rb, base, 1, CREATE_FAIL), RB_BAD_CALLER_DATA);
+}
+int main(void) {
+    flash_sim_t sim;
+    check_flash(&sim);
+    base = __PERSISTENT_TABLE - 32 * FLASH_SECTOR_SIZE;
+    test_remount(&sim);
+    test_wrapped();
+    test_damaged();
+    test_checkpoint();
+    printf("test_mount passed\n");
+    return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host test of rb_peek and aligned rings. Peeked segments point into the
+ * mapped flash and hold the payload, two of them for a record split over a
+ * sector end. Aligned rings start every payload on a uint32, also after a
+ * reopen. A buffered ring flushes before a peek, a record streamed over more
+ * sectors is too big to peek, and an unmapped device can not be peeked.
+ */
+#include "ring_buffer.h"
+#include "check.h"
+
+#define PEEK_ID 4
+#define PEEK_SECTORS 4
+#define PEEK_RECORDS 40
+
+static uint8_t pagebuff[FLASH_PAGE_SIZE];
+static uint32_t base;
+static rb_t rb;
+
+static uint32_t peek_size(uint32_t n) {
+    return 1 + n * 53 % 250;
+}
+//payloads are made again from their number and size when read back
+static void peek_fill(uint8_t *buf, uint32_t n, uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+        buf[i] = n * 17 + i * 5;
+    }
+}
+//the segments of a peek hold want, inside the ring's flash
+static void peek_expect(const rb_segment_t seg[RB_PEEK_SEGMENTS], const uint8_t *want,
+                        uint32_t size) {
+    const uint8_t *lo = flash_mapped(base - XIP_BASE);
+    const uint8_t *hi = lo + PEEK_SECTORS * FLASH_SECTOR_SIZE;
+    CHECK_EQ(seg[0].len + seg[1].len, size);
+    CHECK(seg[0].data >= lo && seg[0].data + seg[0].len <= hi);
+    CHECK(!memcmp(seg[0].data, want, seg[0].len));
+    if (seg[1].len) {
+        CHECK(seg[1].data >= lo && seg[1].data + seg[1].len <= hi);
+        CHECK(!memcmp(seg[1].data, want + seg[0].len, seg[1].len));
+    }
+}
+//records of varied sizes, some split over sector ends, peeked in order
+static void test_peek(bool aligned) {
+    uint8_t buf[256];
+    rb_segment_t seg[RB_PEEK_SEGMENTS];
+    uint32_t splits = 0;
+    CHECK_EQ(rb_create(&rb, base, PEEK_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_set_aligned(&rb, aligned), RB_OK);
+    for (uint32_t n = 0; n < PEEK_RECORDS; n++) {
+        peek_fill(buf, n, peek_size(n));
+        CHECK_EQ(rb_append(&rb, PEEK_ID, buf, peek_size(n), pagebuff, false), RB_OK);
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        CHECK_EQ(rb_recreate(&rb, base, PEEK_SECTORS, CREATE_FAIL), RB_OK);
+        CHECK_EQ(rb.aligned, aligned); //kept in the sector headers
+        for (uint32_t n = 0; n < PEEK_RECORDS; n++) {
+            peek_fill(buf, n, peek_size(n));
+            CHECK_EQ(rb_peek(&rb, PEEK_ID, seg), peek_size(n));
+            peek_expect(seg, buf, peek_size(n));
+            if (aligned) {
+                CHECK(((uintptr_t)seg[0].data & 3) == 0);
+            }
+            splits += seg[1].len != 0;
+        }
+        CHECK_EQ(rb_peek(&rb, PEEK_ID, seg), RB_BLANK_HDR);
+    }
+    CHECK(splits > 0);
+    //the format of a ring holding records is fixed
+    CHECK_EQ(rb_set_aligned(&rb, !aligned), RB_BAD_CALLER_DATA);
+}
+//a buffered record is only staged, a peek flushes it to flash first
+static void test_buffered(void) {
+    uint8_t buf[40];
+    rb_segment_t seg[RB_PEEK_SEGMENTS];
+    CHECK_EQ(rb_create(&rb, base, PEEK_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_set_buffered(&rb, pagebuff, 1000000000), RB_OK);
+    peek_fill(buf, 1, sizeof(buf));
+    CHECK_EQ(rb_append(&rb, PEEK_ID, buf, sizeof(buf), NULL, false), RB_OK);
+    CHECK(rb.staged);
+    CHECK_EQ(rb_peek(&rb, PEEK_ID, seg), sizeof(buf));
+    CHECK(!rb.staged);
+    peek_expect(seg, buf, sizeof(buf));
+    CHECK_EQ(rb_clear_buffered(&rb), RB_OK);
+}
+//a record streamed over three sectors has more fragments than segments
+static void test_too_big(void) {
+    static uint8_t big[2 * FLASH_SECTOR_SIZE + 100];
+    uint8_t got[8];
+    rb_segment_t seg[RB_PEEK_SEGMENTS];
+    rb_writer_t w;
+    rb_reader_t r;
+    CHECK_EQ(rb_create(&rb, base, PEEK_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_append(&rb, PEEK_ID, "small", 5, pagebuff, false), RB_OK);
+    CHECK_EQ(rb_writer_open(&w, &rb, PEEK_ID, sizeof(big), pagebuff, false), RB_OK);
+    CHECK_EQ(rb_writer_write(&w, big, sizeof(big)), RB_OK);
+    CHECK_EQ(rb_writer_close(&w), RB_OK);
+    CHECK_EQ(rb_recreate(&rb, base, PEEK_SECTORS, CREATE_FAIL), RB_OK);
+    CHECK_EQ(rb_peek(&rb, PEEK_ID, seg), 5);
+    CHECK_EQ(rb_peek(&rb, PEEK_ID, seg), RB_RECORD_TOO_BIG);
+    CHECK_EQ(rb_recreate(&rb, base, PEEK_SECTORS, CREATE_FAIL), RB_OK);
+    CHECK_EQ(rb_read(&rb, PEEK_ID, got, sizeof(got)), 5);
+    CHECK_EQ(rb_reader_open(&r, &rb, PEEK_ID), sizeof(big));
+}
+//without a mapped call there is no flash to point at, reads still work
+static void test_unmapped(void) {
+    flash_sim_config_t cfg;
+    flash_sim_t spi;
+    flash_dev_t dev;
+    rb_t other;
+    uint8_t got[8];
+    rb_segment_t seg[RB_PEEK_SEGMENTS];
+    flash_sim_default_config(&cfg);
+    cfg.unmapped = true;
+    CHECK(flash_sim_open(&spi, &cfg) == 0);
+    flash_sim_dev(&spi, &dev);
+    CHECK_EQ(rb_create_on(&other, &dev, 0, PEEK_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_append(&other, PEEK_ID, "spi", 3, pagebuff, false), RB_OK);
+    CHECK_EQ(rb_recreate_on(&other, &dev, 0, PEEK_SECTORS, CREATE_FAIL), RB_OK);
+    CHECK_EQ(rb_peek(&other, PEEK_ID, seg), RB_BAD_CALLER_DATA);
+    CHECK_EQ(rb_read(&other, PEEK_ID, got, sizeof(got)), 3);
+    flash_sim_close(&spi);
+}
+int main(void) {
+    flash_sim_t sim;
+    check_flash(&sim);
+    base = __PERSISTENT_TABLE - 32 * FLASH_SECTOR_SIZE;
+    test_peek(false);
+    test_peek(true);
+    test_buffered();
+    test_too_big();
+    test_unmapped();
+    printf("test_peek passed\n");
+    return 0;
+}
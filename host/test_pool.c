@@ -0,0 +1,116 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host test of the sector pool: a cold stream written once and a hot stream
+ * appended until the pool moved cold sectors, then a remount. Both streams
+ * are read back and compared byte for byte with what was written, and the
+ * erase counts the remount loads from their snapshot must match the erases
+ * the simulated flash counted.
+ */
+#include "ring_buffer.h"
+#include "rb_pool.h"
+#include "check.h"
+
+#define POOL_SECTORS 13 //12 data sectors, the last keeps the erase counts
+#define HOT 0
+#define COLD 1
+#define HOT_ID 2
+#define COLD_ID 1
+#define HOT_LEN 200
+#define COLD_RECORDS 20
+
+static uint8_t pagebuff[FLASH_PAGE_SIZE];
+static const uint8_t quota[2] = {3, 3};
+static uint32_t base;
+static rb_pool_t pool;
+static rb_t hot, cold;
+
+//payloads are made again from their number when read back
+static uint32_t pool_record(uint8_t *buf, uint32_t n, bool is_hot) {
+    uint32_t len = is_hot ? HOT_LEN : 16 + n % 37;
+    for (uint32_t i = 0; i < len; i++) {
+        buf[i] = n * 7 + i * (is_hot ? 13 : 5);
+    }
+    memcpy(buf, &n, sizeof(n));
+    return len;
+}
+//the pool's counts must be what the simulated flash really erased
+static void pool_check_counts(flash_sim_t *sim) {
+    for (uint32_t s = 0; s < POOL_SECTORS - 1; s++) {
+        CHECK_EQ(pool.erases[s], flash_sim_erase_count(sim, pool.base_address +
+                                                       s * FLASH_SECTOR_SIZE));
+    }
+}
+static void pool_mount(enum init_choices init_choice) {
+    CHECK_EQ(rb_pool_mount(&pool, base, POOL_SECTORS, quota, 2, init_choice), RB_OK);
+    CHECK_EQ(rb_create_pooled(&hot, &pool, HOT, init_choice), RB_OK);
+    CHECK_EQ(rb_create_pooled(&cold, &pool, COLD, init_choice), RB_OK);
+}
+//every cold record, and the newest hot ones in order up to hot_next
+static void pool_compare(uint32_t hot_next) {
+    uint8_t got[HOT_LEN + 8];
+    uint8_t want[HOT_LEN];
+    uint32_t n;
+    int len;
+    for (n = 0; (len = rb_read(&cold, COLD_ID, got, sizeof(got))) > 0; n++) {
+        CHECK_EQ(len, pool_record(want, n, false));
+        CHECK(!memcmp(got, want, len));
+    }
+    CHECK_EQ(n, COLD_RECORDS);
+    uint32_t count = 0;
+    uint32_t first = 0;
+    while ((len = rb_read(&hot, HOT_ID, got, sizeof(got))) > 0) {
+        if (count == 0) {
+            memcpy(&first, got, sizeof(first));
+        }
+        CHECK_EQ(len, pool_record(want, first + count, true));
+        CHECK(!memcmp(got, want, len));
+        count++;
+    }
+    CHECK(count > 0);
+    CHECK_EQ(first + count, hot_next);
+}
+int main(void) {
+    uint8_t buf[HOT_LEN];
+    flash_sim_t sim;
+    uint32_t n;
+    check_flash(&sim);
+    base = __PERSISTENT_TABLE - 64 * FLASH_SECTOR_SIZE;
+    pool_mount(CREATE_INIT_ALWAYS);
+    for (n = 0; n < COLD_RECORDS; n++) {
+        uint32_t len = pool_record(buf, n, false);
+        CHECK_EQ(rb_append(&cold, COLD_ID, buf, len, pagebuff, true), RB_OK);
+    }
+    //churn the hot stream until a free sector is worn enough to take cold data
+    for (n = 0; pool.moves == 0 || n % 100; n++) {
+        CHECK(n < 100000);
+        uint32_t len = pool_record(buf, n, true);
+        CHECK_EQ(rb_append(&hot, HOT_ID, buf, len, pagebuff, true), RB_OK);
+    }
+    pool_compare(n);
+    //every data sector was erased, the cold ones moved onto worn sectors
+    uint32_t min, max;
+    rb_pool_wear(&pool, &min, &max);
+    CHECK(min > 0);
+    CHECK(max - min <= 2 * RB_POOL_WEAR_GAP);
+    pool_check_counts(&sim);
+
+    memset(&pool, 0x5a, sizeof(pool));
+    memset(&hot, 0x5a, sizeof(hot));
+    memset(&cold, 0x5a, sizeof(cold));
+    pool_mount(CREATE_FAIL);
+    CHECK_EQ(pool.moves, 0);
+    pool_check_counts(&sim);
+    pool_compare(n);
+    //the streams carry on after the remount
+    for (uint32_t end = n + 50; n < end; n++) {
+        uint32_t len = pool_record(buf, n, true);
+        CHECK_EQ(rb_append(&hot, HOT_ID, buf, len, pagebuff, true), RB_OK);
+    }
+    CHECK_EQ(rb_create_pooled(&cold, &pool, COLD, CREATE_FAIL), RB_OK);
+    CHECK_EQ(rb_create_pooled(&hot, &pool, HOT, CREATE_FAIL), RB_OK);
+    pool_compare(n);
+    printf("test_pool passed, %u hot records, wear %u to %u\n", n, min, max);
+    return 0;
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host test of reverse cursors. Records read back newest first, by id or
+ * any id, with sectors holding more records than a cursor keeps at a time
+ * and records streamed over sector ends. Deleted records and records
+ * appended after the open are not returned, the walk ends at the oldest
+ * record left once the ring wrapped, and the newest record is found without
+ * reading the whole ring.
+ */
+#include "ring_buffer.h"
+#include "check.h"
+
+#define RC_SECTORS 8
+#define RC_RECORDS 300
+#define RC_BIG (FLASH_SECTOR_SIZE + 700)
+
+static uint8_t pagebuff[FLASH_PAGE_SIZE];
+static uint8_t buf[RC_BIG];
+static uint8_t got[RC_BIG];
+static uint32_t base;
+static rb_t rb;
+
+static uint8_t rc_id(uint32_t n) {
+    return 1 + n % 3;
+}
+//mostly tiny records, many to a sector, and a few over a sector long
+static uint32_t rc_size(uint32_t n) {
+    return n % 97 == 50 ? RC_BIG - n : 4 + n % 21;
+}
+static void rc_fill(uint8_t *p, uint32_t n) {
+    for (uint32_t i = 0; i < rc_size(n); i++) {
+        p[i] = n * 11 + i;
+    }
+    memcpy(p, &n, sizeof(n));
+}
+static rb_errors_t rc_append(uint32_t n, bool erase_if_full) {
+    rc_fill(buf, n);
+    if (rc_size(n) < RB_MAX_APPEND_SIZE - sizeof(uint32_t)) {
+        return rb_append(&rb, rc_id(n), buf, rc_size(n), pagebuff, erase_if_full);
+    }
+    rb_writer_t w;
+    rb_errors_t res = rb_writer_open(&w, &rb, rc_id(n), rc_size(n), pagebuff, erase_if_full);
+    if (res == RB_OK) {
+        res = rb_writer_write(&w, buf, rc_size(n));
+    }
+    rb_errors_t close_res = rb_writer_close(&w);
+    return res != RB_OK ? res : close_res;
+}
+//the next record back of id is number n, RB_ANY_ID goes through a reader
+static void rc_expect(rb_rcursor_t *c, uint8_t id, uint32_t n) {
+    rc_fill(buf, n);
+    if (id == RB_ANY_ID) {
+        rb_reader_t r;
+        CHECK_EQ(rb_rcursor_reader_open(&r, c, id), rc_size(n));
+        CHECK_EQ(r.id, rc_id(n));
+        CHECK_EQ(rb_reader_read(&r, got, rc_size(n)), rc_size(n));
+    } else {
+        CHECK_EQ(rb_read_prev(c, id, got, sizeof(got)), rc_size(n));
+    }
+    CHECK(!memcmp(got, buf, rc_size(n)));
+}
+static void test_blank(void) {
+    rb_rcursor_t c;
+    CHECK_EQ(rb_create(&rb, base, RC_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_rcursor_open(&c, &rb), RB_OK);
+    CHECK_EQ(rb_read_prev(&c, 1, got, sizeof(got)), RB_BLANK_HDR);
+    CHECK_EQ(rb_read_prev(&c, RB_ANY_ID, got, sizeof(got)), RB_BAD_CALLER_DATA);
+    CHECK_EQ(rb_rcursor_open(NULL, &rb), RB_BAD_CALLER_DATA);
+}
+//every record newest first, then those of each id
+static void test_order(flash_sim_t *sim) {
+    rb_rcursor_t c;
+    CHECK_EQ(rb_create(&rb, base, RC_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    for (uint32_t n = 0; n < RC_RECORDS; n++) {
+        CHECK_EQ(rc_append(n, false), RB_OK);
+    }
+    //the newest record costs its sector and the sector headers
+    uint64_t reads = sim->stats.reads;
+    CHECK_EQ(rb_rcursor_open(&c, &rb), RB_OK);
+    rc_expect(&c, RB_ANY_ID, RC_RECORDS - 1);
+    CHECK(sim->stats.reads - reads < RC_RECORDS / 4);
+    //not seen by a cursor opened before
+    CHECK_EQ(rc_append(RC_RECORDS, false), RB_OK);
+    for (uint32_t n = RC_RECORDS - 1; n-- > 0;) {
+        rc_expect(&c, RB_ANY_ID, n);
+    }
+    CHECK_EQ(rb_read_prev(&c, 1, got, sizeof(got)), RB_BLANK_HDR);
+    for (uint8_t id = 1; id <= 3; id++) {
+        CHECK_EQ(rb_rcursor_open(&c, &rb), RB_OK);
+        for (uint32_t n = RC_RECORDS + 1; n-- > 0;) {
+            if (rc_id(n) == id) {
+                rc_expect(&c, id, n);
+            }
+        }
+        CHECK_EQ(rb_read_prev(&c, id, got, sizeof(got)), RB_BLANK_HDR);
+    }
+}
+//deleted records are passed over
+static void test_deleted(void) {
+    rb_rcursor_t c;
+    rb_reader_t r;
+    uint32_t last = RC_RECORDS;
+    CHECK_EQ(rb_rcursor_open(&c, &rb), RB_OK);
+    for (uint32_t n = last; n > last - 40; n--) {
+        CHECK_EQ(rb_rcursor_reader_open(&r, &c, RB_ANY_ID), rc_size(n));
+        if (n % 2) {
+            CHECK_EQ(rb_delete_at(&rb, r.at, pagebuff), RB_OK);
+        }
+    }
+    CHECK_EQ(rb_rcursor_open(&c, &rb), RB_OK);
+    for (uint32_t n = last; n > last - 40; n--) {
+        if (n % 2 == 0) {
+            rc_expect(&c, RB_ANY_ID, n);
+        }
+    }
+    rc_expect(&c, RB_ANY_ID, last - 40);
+}
+//round the ring a few times, the walk ends at the oldest record left
+static void test_wrapped(void) {
+    rb_rcursor_t c;
+    rb_cursor_t f;
+    uint32_t n;
+    CHECK_EQ(rb_create(&rb, base, RC_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    for (n = 0; n < 4 * RC_RECORDS; n++) {
+        CHECK_EQ(rc_append(n, true), RB_OK);
+    }
+    CHECK(rb.erases > RC_SECTORS);
+    //the first record a forward cursor reads is the oldest
+    rb_reader_t r;
+    CHECK_EQ(rb_cursor_open(&f, &rb), RB_OK);
+    CHECK(rb_cursor_reader_open(&r, &f, RB_ANY_ID) > 0);
+    CHECK_EQ(rb_reader_read(&r, got, sizeof(uint32_t)), sizeof(uint32_t));
+    uint32_t oldest;
+    memcpy(&oldest, got, sizeof(oldest));
+    CHECK(oldest > 0);
+    CHECK_EQ(rb_rcursor_open(&c, &rb), RB_OK);
+    while (n-- > oldest) {
+        rc_expect(&c, RB_ANY_ID, n);
+    }
+    CHECK_EQ(rb_rcursor_reader_open(&r, &c, RB_ANY_ID), RB_BLANK_HDR);
+}
+int main(void) {
+    flash_sim_t sim;
+    check_flash(&sim);
+    base = __PERSISTENT_TABLE - 32 * FLASH_SECTOR_SIZE;
+    test_blank();
+    test_order(&sim);
+    test_deleted();
+    test_wrapped();
+    printf("test_rcursor passed\n");
+    return 0;
+}
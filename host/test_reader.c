@@ -0,0 +1,152 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host test of the chunked reader. Appended records and records streamed
+ * over several sectors read back in pieces of random size, with skips, and
+ * with and without payload crcs. A damaged payload fails its last read
+ * unless part of it was skipped. Records of any id are opened in turn, a
+ * record left half read does not stop the next one, and the header offset
+ * a reader keeps deletes its record.
+ */
+#include "ring_buffer.h"
+#include "check.h"
+
+#define READER_SECTORS 16
+#define READER_RECORDS 12
+#define READER_BIG (2 * FLASH_SECTOR_SIZE + 500)
+
+static uint8_t pagebuff[FLASH_PAGE_SIZE];
+static uint8_t buf[READER_BIG];
+static uint8_t got[READER_BIG];
+static uint32_t base;
+static rb_t rb;
+static uint32_t seed = 1;
+
+static uint32_t reader_random(void) {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+//payloads are made again from their number and size when read back
+static void reader_fill(uint8_t *p, uint32_t n, uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+        p[i] = n * 19 + i * 7 + (i >> 8);
+    }
+}
+static uint32_t reader_size(uint32_t n) {
+    return n % 4 == 3 ? READER_BIG - n : 1 + n * 331 % 3000;
+}
+static uint8_t reader_id(uint32_t n) {
+    return 1 + n % 3;
+}
+//records up to RB_MAX_APPEND_SIZE are appended, bigger ones streamed
+static void reader_write(void) {
+    for (uint32_t n = 0; n < READER_RECORDS; n++) {
+        uint32_t size = reader_size(n);
+        reader_fill(buf, n, size);
+        if (size <= RB_MAX_APPEND_SIZE - sizeof(uint32_t)) {
+            CHECK_EQ(rb_append(&rb, reader_id(n), buf, size, pagebuff, false), RB_OK);
+            continue;
+        }
+        rb_writer_t w;
+        CHECK_EQ(rb_writer_open(&w, &rb, reader_id(n), size, pagebuff, false), RB_OK);
+        CHECK_EQ(rb_writer_write(&w, buf, size), RB_OK);
+        CHECK_EQ(rb_writer_close(&w), RB_OK);
+    }
+}
+//read record n of the open reader in random pieces, some skipped
+static void reader_pieces(rb_reader_t *r, uint32_t n, bool skips) {
+    uint32_t size = reader_size(n);
+    reader_fill(buf, n, size);
+    memset(got, 0, size);
+    for (uint32_t done = 0, piece; done < size; done += piece) {
+        piece = 1 + reader_random() % 700; //MIN evaluates both sides twice
+        piece = MIN(size - done, piece);
+        if (skips && reader_random() % 4 == 0) {
+            CHECK_EQ(rb_reader_skip(r, piece), piece);
+            memcpy(got + done, buf + done, piece);
+            continue;
+        }
+        CHECK_EQ(rb_reader_read(r, got + done, piece), piece);
+    }
+    CHECK_EQ(rb_reader_read(r, got, 1), 0);
+    CHECK(!memcmp(got, buf, size));
+}
+static void test_pieces(bool payload_crc, bool skips) {
+    rb_reader_t r;
+    CHECK_EQ(rb_create(&rb, base, READER_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_set_payload_crc(&rb, payload_crc), RB_OK);
+    reader_write();
+    CHECK_EQ(rb_recreate(&rb, base, READER_SECTORS, CREATE_FAIL), RB_OK);
+    for (uint32_t n = 0; n < READER_RECORDS; n++) {
+        CHECK_EQ(rb_reader_open(&r, &rb, reader_id(n)), reader_size(n));
+        CHECK_EQ(r.id, reader_id(n));
+        CHECK_EQ(r.has_crc, payload_crc);
+        CHECK(r.fragments >= 1 + reader_size(n) / FLASH_SECTOR_SIZE);
+        reader_pieces(&r, n, skips);
+    }
+    CHECK_EQ(rb_reader_open(&r, &rb, reader_id(0)), RB_BLANK_HDR);
+}
+//RB_ANY_ID opens every record in turn, half read ones too
+static void test_any_id(void) {
+    rb_reader_t r;
+    CHECK_EQ(rb_recreate(&rb, base, READER_SECTORS, CREATE_FAIL), RB_OK);
+    for (uint32_t n = 0; n < READER_RECORDS; n++) {
+        CHECK_EQ(rb_reader_open(&r, &rb, RB_ANY_ID), reader_size(n));
+        CHECK_EQ(r.id, reader_id(n));
+        uint32_t half = reader_size(n) / 2;
+        CHECK_EQ(rb_reader_read(&r, got, half), half);
+        reader_fill(buf, n, half);
+        CHECK(!memcmp(got, buf, half));
+    }
+    CHECK(rb_reader_open(&r, &rb, RB_ANY_ID) < 0);
+}
+//one bit of a payload cleared, reading all of it finds out
+static void test_damage(void) {
+    rb_reader_t r;
+    CHECK_EQ(rb_create(&rb, base, READER_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_set_payload_crc(&rb, true), RB_OK);
+    reader_fill(buf, 1, 600);
+    CHECK_EQ(rb_append(&rb, 1, buf, 600, pagebuff, false), RB_OK);
+    CHECK_EQ(rb_recreate(&rb, base, READER_SECTORS, CREATE_FAIL), RB_OK);
+    CHECK_EQ(rb_reader_open(&r, &rb, 1), 600);
+    uint32_t at = base - XIP_BASE + r.pos + 300;
+    CHECK(buf[300] != 0);
+    memset(pagebuff, 0xff, FLASH_PAGE_SIZE);
+    pagebuff[MOD_PAGE(at)] = buf[300] & (buf[300] - 1);
+    CHECK_EQ(flash_prog_range(&flash_default_dev, FLASH_PAGE(at), pagebuff,
+                              MOD_PAGE(at), MOD_PAGE(at) + 1), 0);
+    CHECK_EQ(rb_reader_read(&r, got, 599), 599);
+    CHECK_EQ(rb_reader_read(&r, got, 1), RB_BAD_PAYLOAD_CRC);
+    //not checked once anything was skipped
+    CHECK_EQ(rb_recreate(&rb, base, READER_SECTORS, CREATE_FAIL), RB_OK);
+    CHECK_EQ(rb_reader_open(&r, &rb, 1), 600);
+    CHECK_EQ(rb_reader_skip(&r, 1), 1);
+    CHECK_EQ(rb_reader_read(&r, got, 599), 599);
+}
+//the header offset of an open reader deletes its record
+static void test_delete_at(void) {
+    rb_reader_t r;
+    CHECK_EQ(rb_create(&rb, base, READER_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    reader_write();
+    CHECK_EQ(rb_recreate(&rb, base, READER_SECTORS, CREATE_FAIL), RB_OK);
+    CHECK_EQ(rb_reader_open(&r, &rb, reader_id(3)), reader_size(0)); //same id
+    CHECK_EQ(rb_reader_open(&r, &rb, reader_id(3)), reader_size(3));
+    CHECK_EQ(rb_delete_at(&rb, r.at, pagebuff), RB_OK);
+    CHECK_EQ(rb_recreate(&rb, base, READER_SECTORS, CREATE_FAIL), RB_OK);
+    CHECK_EQ(rb_reader_open(&r, &rb, reader_id(3)), reader_size(0));
+    CHECK_EQ(rb_reader_open(&r, &rb, reader_id(3)), reader_size(6));
+}
+int main(void) {
+    flash_sim_t sim;
+    check_flash(&sim);
+    base = __PERSISTENT_TABLE - 32 * FLASH_SECTOR_SIZE;
+    test_pieces(false, false);
+    test_pieces(true, false);
+    test_pieces(true, true);
+    test_any_id();
+    test_damage();
+    test_delete_at();
+    printf("test_reader passed\n");
+    return 0;
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host test of the flash scheduler: formatting a block aligned ring merges
+ * its sector erases into block erases, and a program the simulated flash
+ * fails is returned as RB_FLASH_ERROR by every write call that staged it.
+ * The ring must carry on after such a failure, the next write finding the
+ * tail in flash again.
+ */
+#include "ring_buffer.h"
+#include "flash_sched.h"
+#include "check.h"
+
+#define SCHED_ID 3
+#define SCHED_SECTORS 16 //one 64K block
+#define SCHED_BLOCK (SCHED_SECTORS * FLASH_SECTOR_SIZE)
+
+static uint8_t pagebuff[FLASH_PAGE_SIZE];
+static uint32_t base;
+static flash_sim_t sim;
+static rb_t rb;
+
+static void sched_fill(uint8_t *buf, uint32_t n, uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+        buf[i] = n * 13 + i;
+    }
+}
+static void test_block_erase(void) {
+    uint32_t sectors = flash_default_sched.sectors;
+    uint32_t commands = flash_default_sched.erase_commands;
+    uint64_t blocks = sim.stats.block_erases;
+    CHECK_EQ(rb_create(&rb, base, SCHED_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(flash_default_sched.sectors - sectors, SCHED_SECTORS);
+    CHECK_EQ(flash_default_sched.erase_commands - commands, 1);
+    CHECK_EQ(sim.stats.block_erases - blocks, 1);
+}
+//records 0 and 2 made it, 1 did not
+static void sched_expect(uint32_t size) {
+    uint8_t got[FLASH_PAGE_SIZE];
+    uint8_t want[FLASH_PAGE_SIZE];
+    CHECK_EQ(rb_recreate(&rb, base, SCHED_SECTORS, CREATE_FAIL), RB_OK);
+    for (uint32_t n = 0; n < 3; n += 2) {
+        sched_fill(want, n, size);
+        CHECK_EQ(rb_read(&rb, SCHED_ID, got, sizeof(got)), size);
+        CHECK(!memcmp(got, want, size));
+    }
+    CHECK(rb_read(&rb, SCHED_ID, got, sizeof(got)) < 0);
+}
+static void test_append_fail(void) {
+    uint8_t buf[100];
+    CHECK_EQ(rb_create(&rb, base, SCHED_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    for (uint32_t n = 0; n < 3; n++) {
+        sched_fill(buf, n, sizeof(buf));
+        flash_sim_fail_progs(&sim, 0, n == 1);
+        CHECK_EQ(rb_append(&rb, SCHED_ID, buf, sizeof(buf), pagebuff, false),
+                 n == 1 ? RB_FLASH_ERROR : RB_OK);
+    }
+    CHECK_EQ(sim.stats.failed_programs, 1);
+    sched_expect(sizeof(buf));
+}
+//a buffered ring only programs on rb_sync, that is where the failure shows
+static void test_sync_fail(void) {
+    uint8_t buf[40];
+    CHECK_EQ(rb_create(&rb, base, SCHED_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_set_buffered(&rb, pagebuff, 1000000000), RB_OK);
+    for (uint32_t n = 0; n < 3; n++) {
+        sched_fill(buf, n, sizeof(buf));
+        CHECK_EQ(rb_append(&rb, SCHED_ID, buf, sizeof(buf), NULL, false), RB_OK);
+        flash_sim_fail_progs(&sim, 0, n == 1);
+        CHECK_EQ(rb_sync(&rb), n == 1 ? RB_FLASH_ERROR : RB_OK);
+    }
+    CHECK_EQ(rb_clear_buffered(&rb), RB_OK);
+    sched_expect(sizeof(buf));
+}
+//a delete on a buffered ring flushes first, a failed flush deletes nothing
+static void test_delete_fail(void) {
+    static uint8_t delpage[FLASH_PAGE_SIZE];
+    uint8_t buf[40];
+    uint8_t got[40];
+    CHECK_EQ(rb_create(&rb, base, SCHED_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_set_buffered(&rb, pagebuff, 1000000000), RB_OK);
+    sched_fill(buf, 0, sizeof(buf));
+    CHECK_EQ(rb_append(&rb, SCHED_ID, buf, sizeof(buf), NULL, false), RB_OK);
+    CHECK_EQ(rb_sync(&rb), RB_OK);
+    CHECK_EQ(rb_append(&rb, SCHED_ID + 1, buf, sizeof(buf), NULL, false), RB_OK);
+    flash_sim_fail_progs(&sim, 0, 1);
+    CHECK_EQ(rb_delete(&rb, SCHED_ID, buf, sizeof(buf), delpage), RB_FLASH_ERROR);
+    CHECK_EQ(rb_clear_buffered(&rb), RB_OK);
+    CHECK_EQ(rb_recreate(&rb, base, SCHED_SECTORS, CREATE_FAIL), RB_OK);
+    CHECK_EQ(rb_read(&rb, SCHED_ID, got, sizeof(got)), sizeof(got));
+    CHECK(!memcmp(got, buf, sizeof(buf)));
+}
+//the first page of a writer record goes in, the next does not
+static void test_writer_fail(void) {
+    static uint8_t big[3 * FLASH_PAGE_SIZE];
+    rb_writer_t w;
+    CHECK_EQ(rb_create(&rb, base, SCHED_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_writer_open(&w, &rb, SCHED_ID, sizeof(big), pagebuff, false), RB_OK);
+    flash_sim_fail_progs(&sim, 1, 1);
+    CHECK_EQ(rb_writer_write(&w, big, sizeof(big)), RB_FLASH_ERROR);
+    CHECK(rb_writer_close(&w) < 0);
+    flash_sim_fail_progs(&sim, 0, 0);
+    CHECK_EQ(rb_append(&rb, SCHED_ID, big, 10, pagebuff, false), RB_OK);
+}
+static void test_fixed_fail(void) {
+    uint32_t rec[4] = {1, 2, 3, 4};
+    uint32_t got[4];
+    uint32_t first, end;
+    CHECK_EQ(rb_create_fixed(&rb, base, SCHED_SECTORS, sizeof(rec), CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_fixed_append(&rb, rec, pagebuff, false), RB_OK);
+    flash_sim_fail_progs(&sim, 0, 1);
+    rec[0] = 5;
+    CHECK_EQ(rb_fixed_append(&rb, rec, pagebuff, false), RB_FLASH_ERROR);
+    rec[0] = 6;
+    CHECK_EQ(rb_fixed_append(&rb, rec, pagebuff, false), RB_OK);
+    CHECK_EQ(rb_fixed_range(&rb, &first, &end), RB_OK);
+    CHECK_EQ(end - first, 2);
+    CHECK_EQ(rb_fixed_read(&rb, end - 1, got), sizeof(got));
+    CHECK_EQ(got[0], 6);
+}
+int main(void) {
+    check_flash(&sim);
+    base = (__PERSISTENT_TABLE - 2 * SCHED_BLOCK) & ~(SCHED_BLOCK - 1);
+    test_block_erase();
+    test_append_fail();
+    test_sync_fail();
+    test_delete_fail();
+    test_writer_fail();
+    test_fixed_fail();
+    printf("test_sched passed\n");
+    return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host test of the flash writer service, its thread playing core1. Records
+ * submitted from here are appended in order and read back, a full queue
+ * waits or returns RB_FULL, and each ticket gives the status its append
+ * returned, until the slot is reused. A buffered ring is synced by the stop,
+ * which returns a flush that failed, and bad submits are refused.
+ */
+#include "ring_buffer.h"
+#include "rb_service.h"
+#include "check.h"
+
+#define SVC_ID 3
+#define SVC_SECTORS 8
+#define SVC_RECORDS 500
+
+static uint8_t pagebuff[FLASH_PAGE_SIZE];
+static uint32_t base;
+static rb_service_t svc;
+static rb_t rb;
+
+static void svc_fill(uint8_t *buf, uint32_t n) {
+    for (uint32_t i = 0; i < RB_SERVICE_MAX_RECORD; i++) {
+        buf[i] = n * 7 + i;
+    }
+    memcpy(buf, &n, sizeof(n));
+}
+static uint32_t svc_size(uint32_t n) {
+    return 4 + n % (RB_SERVICE_MAX_RECORD - 3);
+}
+static int svc_submit(uint32_t n, bool wait) {
+    uint8_t buf[RB_SERVICE_MAX_RECORD];
+    svc_fill(buf, n);
+    return rb_service_submit(&svc, SVC_ID, buf, svc_size(n), wait);
+}
+//records first up to end - 1 are in the ring, read by r
+static void svc_expect(rb_t *r, uint32_t first, uint32_t end) {
+    uint8_t got[RB_SERVICE_MAX_RECORD];
+    uint8_t want[RB_SERVICE_MAX_RECORD];
+    CHECK_EQ(rb_recreate(r, base, SVC_SECTORS, CREATE_FAIL), RB_OK);
+    for (uint32_t n = first; n < end; n++) {
+        svc_fill(want, n);
+        CHECK_EQ(rb_read(r, SVC_ID, got, sizeof(got)), svc_size(n));
+        CHECK(!memcmp(got, want, svc_size(n)));
+    }
+    CHECK(rb_read(r, SVC_ID, got, sizeof(got)) < 0);
+}
+//a stream of records through the queue, waiting whenever it is full
+static void test_stream(void) {
+    int ticket = 0;
+    CHECK_EQ(rb_create(&rb, base, SVC_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_service_init(&svc, &rb, pagebuff, false), RB_OK);
+    CHECK_EQ(rb_service_start(&svc), RB_OK);
+    CHECK_EQ(rb_service_start(&svc), RB_BAD_CALLER_DATA);
+    for (uint32_t n = 0; n < SVC_RECORDS; n++) {
+        ticket = svc_submit(n, true);
+        CHECK_EQ(ticket, n + 1);
+    }
+    CHECK_EQ(rb_service_wait(&svc, ticket), RB_OK);
+    CHECK(rb_service_done(&svc, 1));
+    CHECK_EQ(rb_service_pending(&svc), 0);
+    //the slot of the first ticket was used again long ago
+    CHECK_EQ(rb_service_wait(&svc, 1), RB_BAD_CALLER_DATA);
+    CHECK_EQ(rb_service_stop(&svc), RB_OK);
+    CHECK_EQ(rb_service_stop(&svc), RB_BAD_CALLER_DATA);
+    svc_expect(&rb, 0, SVC_RECORDS);
+}
+//with the service not yet started the queue fills, then drains in order
+static void test_full(void) {
+    uint32_t n;
+    CHECK_EQ(rb_create(&rb, base, SVC_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_service_init(&svc, &rb, pagebuff, false), RB_OK);
+    for (n = 0; n < RB_SERVICE_QUEUE_LEN; n++) {
+        CHECK_EQ(svc_submit(n, false), n + 1);
+    }
+    CHECK_EQ(rb_service_pending(&svc), RB_SERVICE_QUEUE_LEN);
+    CHECK_EQ(svc_submit(n, false), RB_FULL);
+    CHECK_EQ(svc.full_waits, 1);
+    //nobody will make room
+    CHECK_EQ(svc_submit(n, true), RB_BAD_CALLER_DATA);
+    CHECK(!rb_service_done(&svc, 1));
+    CHECK_EQ(rb_service_start(&svc), RB_OK);
+    CHECK_EQ(rb_service_wait(&svc, n), RB_OK);
+    CHECK_EQ(rb_service_stop(&svc), RB_OK);
+    svc_expect(&rb, 0, n);
+}
+//appends that do not fit and may not erase give their error to the ticket
+static void test_status(void) {
+    int ticket;
+    CHECK_EQ(rb_create(&rb, base, SVC_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_service_init(&svc, &rb, pagebuff, false), RB_OK);
+    CHECK_EQ(rb_service_start(&svc), RB_OK);
+    uint32_t n = 0;
+    do {
+        ticket = svc_submit(n++, true);
+        CHECK(ticket > 0);
+    } while (rb_service_wait(&svc, ticket) == RB_OK);
+    CHECK(rb_service_wait(&svc, ticket) < 0);
+    CHECK_EQ(rb_service_stop(&svc), RB_OK);
+    svc_expect(&rb, 0, n - 1);
+    //bad records never reach the queue
+    uint8_t buf[RB_SERVICE_MAX_RECORD + 1];
+    CHECK_EQ(rb_service_submit(&svc, SVC_ID, buf, sizeof(buf), false), RB_BAD_CALLER_DATA);
+    CHECK_EQ(rb_service_submit(&svc, SVC_ID, buf, 0, false), RB_BAD_CALLER_DATA);
+    CHECK_EQ(rb_service_submit(&svc, RB_SYSTEM_ID, buf, 1, false), RB_BAD_CALLER_DATA);
+    CHECK_EQ(rb_service_submit(&svc, RB_ANY_ID, buf, 1, false), RB_BAD_CALLER_DATA);
+    CHECK_EQ(rb_service_init(&svc, &rb, NULL, false), RB_BAD_CALLER_DATA);
+}
+//a buffered ring is synced when the service stops, a failed flush is returned
+static void test_buffered(flash_sim_t *sim) {
+    rb_t other;
+    int ticket = 0;
+    CHECK_EQ(rb_create(&rb, base, SVC_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_set_buffered(&rb, pagebuff, 1000000000), RB_OK);
+    CHECK_EQ(rb_service_init(&svc, &rb, NULL, false), RB_OK);
+    CHECK_EQ(rb_service_start(&svc), RB_OK);
+    for (uint32_t n = 0; n < 3; n++) {
+        ticket = svc_submit(n, true);
+    }
+    CHECK_EQ(rb_service_wait(&svc, ticket), RB_OK);
+    CHECK_EQ(rb_service_stop(&svc), RB_OK);
+    CHECK(!rb.staged);
+    svc_expect(&other, 0, 3);
+    CHECK_EQ(rb_service_start(&svc), RB_OK);
+    ticket = svc_submit(3, true);
+    CHECK_EQ(rb_service_wait(&svc, ticket), RB_OK);
+    flash_sim_fail_progs(sim, 0, 1);
+    CHECK_EQ(rb_service_stop(&svc), RB_FLASH_ERROR);
+    CHECK_EQ(sim->stats.failed_programs, 1);
+    CHECK_EQ(rb_clear_buffered(&rb), RB_OK);
+}
+int main(void) {
+    flash_sim_t sim;
+    check_flash(&sim);
+    base = __PERSISTENT_TABLE - 32 * FLASH_SECTOR_SIZE;
+    test_stream();
+    test_full();
+    test_status();
+    test_buffered(&sim);
+    printf("test_service passed\n");
+    return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host test of the flash simulator. Programs only clear bits and erases set
+ * whole sectors, misaligned or out of range requests fail and are counted,
+ * the timing model charges what the datasheet says, and a file backed flash
+ * keeps a ring from one open to the next. Records appended to it read back
+ * byte for byte, also after the reopen.
+ */
+#include <unistd.h>
+#include "ring_buffer.h"
+#include "check.h"
+
+#define SIM_FILE "test_sim.flash"
+#define SIM_SECTORS 6
+#define SIM_RECORDS 24
+
+static uint8_t pagebuff[FLASH_PAGE_SIZE];
+
+//nor flash: erased is 0xff, a program ands into what is there
+static void test_nor(flash_sim_t *sim) {
+    uint8_t page[FLASH_PAGE_SIZE];
+    uint8_t got[FLASH_PAGE_SIZE];
+    uint32_t at = PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE;
+    CHECK_EQ(flash_sim_erase(sim, at, FLASH_SECTOR_SIZE), 0);
+    CHECK_EQ(flash_sim_read(sim, at, got, sizeof(got)), 0);
+    for (uint32_t i = 0; i < sizeof(got); i++) {
+        CHECK_EQ(got[i], 0xff);
+    }
+    memset(page, 0xf0, sizeof(page));
+    CHECK_EQ(flash_sim_prog(sim, at, page, sizeof(page)), 0);
+    memset(page, 0x3c, sizeof(page));
+    CHECK_EQ(flash_sim_prog(sim, at, page, sizeof(page)), 0);
+    CHECK_EQ(flash_sim_read(sim, at, got, sizeof(got)), 0);
+    CHECK_EQ(got[0], 0x30);
+    CHECK_EQ(got[FLASH_PAGE_SIZE - 1], 0x30);
+    CHECK_EQ(flash_sim_erase_count(sim, at), 1);
+    CHECK_EQ(flash_sim_erase(sim, at, FLASH_SECTOR_SIZE), 0);
+    CHECK_EQ(flash_sim_read(sim, at, got, 1), 0);
+    CHECK_EQ(got[0], 0xff);
+    CHECK_EQ(flash_sim_erase_count(sim, at), 2);
+}
+//the pico sdk takes whole aligned pages and sectors, in range
+static void test_errors(flash_sim_t *sim) {
+    uint8_t page[2 * FLASH_PAGE_SIZE];
+    uint64_t errors = sim->stats.errors;
+    memset(page, 0xff, sizeof(page));
+    CHECK(flash_sim_prog(sim, 1, page, FLASH_PAGE_SIZE) < 0);
+    CHECK(flash_sim_prog(sim, 0, page, FLASH_PAGE_SIZE - 1) < 0);
+    CHECK(flash_sim_prog(sim, PICO_FLASH_SIZE_BYTES, page, FLASH_PAGE_SIZE) < 0);
+    CHECK(flash_sim_erase(sim, FLASH_PAGE_SIZE, FLASH_SECTOR_SIZE) < 0);
+    CHECK(flash_sim_erase(sim, 0, FLASH_PAGE_SIZE) < 0);
+    CHECK(flash_sim_read(sim, PICO_FLASH_SIZE_BYTES - 1, page, 2) < 0);
+    CHECK_EQ(sim->stats.errors - errors, 6);
+    //two pages in one call are two program commands
+    uint64_t programs = sim->stats.programs;
+    CHECK_EQ(flash_sim_prog(sim, 0, page, sizeof(page)), 0);
+    CHECK_EQ(sim->stats.programs - programs, 2);
+}
+//a page program, a sector erase and a block erase, at the datasheet times
+static void test_timing(flash_sim_t *sim) {
+    flash_sim_config_t cfg;
+    uint8_t page[FLASH_PAGE_SIZE];
+    flash_sim_default_config(&cfg);
+    memset(page, 0xff, sizeof(page));
+    flash_sim_reset_stats(sim);
+    CHECK_EQ(flash_sim_prog(sim, 0, page, sizeof(page)), 0);
+    CHECK_EQ(sim->stats.modeled_ns, cfg.prog_setup_ns + FLASH_PAGE_SIZE * cfg.prog_ns_per_byte);
+    flash_sim_reset_stats(sim);
+    CHECK_EQ(flash_sim_erase(sim, 0, FLASH_SECTOR_SIZE), 0);
+    CHECK_EQ(sim->stats.modeled_ns, cfg.erase_ns);
+    flash_sim_reset_stats(sim);
+    CHECK_EQ(flash_sim_erase(sim, 0, FLASH_BLOCK_SIZE), 0);
+    CHECK_EQ(sim->stats.modeled_ns, cfg.block_erase_ns);
+    CHECK_EQ(sim->stats.block_erases, 1);
+    CHECK_EQ(sim->stats.erases, FLASH_BLOCK_SIZE / FLASH_SECTOR_SIZE);
+    uint32_t min, max;
+    flash_sim_wear(sim, 0, FLASH_BLOCK_SIZE, &min, &max);
+    CHECK_EQ(min, 1);
+    CHECK_EQ(max, 2); //sector 0 was erased on its own before
+}
+//payloads are made again from their number and size when read back
+static void sim_fill(uint8_t *buf, uint32_t n, uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+        buf[i] = n * 31 + i * 7 + (i >> 8);
+    }
+}
+static uint32_t sim_size(uint32_t n) {
+    return n == SIM_RECORDS / 2 ? 4000 : 1 + n * 37 % 300;
+}
+static void sim_expect(rb_t *rb, uint32_t base) {
+    static uint8_t got[4000];
+    static uint8_t want[4000];
+    CHECK_EQ(rb_recreate(rb, base, SIM_SECTORS, CREATE_FAIL), RB_OK);
+    for (uint32_t n = 0; n < SIM_RECORDS; n++) {
+        sim_fill(want, n, sim_size(n));
+        CHECK_EQ(rb_read(rb, 1 + n % 5, got, sizeof(got)), sim_size(n));
+        CHECK(!memcmp(got, want, sim_size(n)));
+    }
+    CHECK(rb_read(rb, 1, got, sizeof(got)) < 0);
+}
+//a ring in a backing file is still there after the simulator is closed
+static void test_file(void) {
+    static uint8_t buf[4000];
+    flash_sim_config_t cfg;
+    flash_sim_t sim;
+    rb_t rb;
+    uint32_t base = __PERSISTENT_TABLE - 32 * FLASH_SECTOR_SIZE;
+    unlink(SIM_FILE);
+    flash_sim_default_config(&cfg);
+    cfg.path = SIM_FILE;
+    CHECK_EQ(flash_sim_open(&sim, &cfg), 0);
+    flash_sim_bind(&sim);
+    CHECK_EQ(rb_create(&rb, base, SIM_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    for (uint32_t n = 0; n < SIM_RECORDS; n++) {
+        sim_fill(buf, n, sim_size(n));
+        CHECK_EQ(rb_append(&rb, 1 + n % 5, buf, sim_size(n), pagebuff, false), RB_OK);
+    }
+    sim_expect(&rb, base);
+    flash_sim_close(&sim);
+    memset(&sim, 0x5a, sizeof(sim));
+    CHECK_EQ(flash_sim_open(&sim, &cfg), 0);
+    flash_sim_bind(&sim);
+    sim_expect(&rb, base);
+    flash_sim_close(&sim);
+    unlink(SIM_FILE);
+}
+int main(void) {
+    flash_sim_t sim;
+    check_flash(&sim);
+    test_nor(&sim);
+    test_errors(&sim);
+    test_timing(&sim);
+    flash_sim_close(&sim);
+    test_file();
+    printf("test_sim passed\n");
+    return 0;
+}
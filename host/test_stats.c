@@ -0,0 +1,115 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host test of the operation counters. The programs, erases and read bytes
+ * an rb counts are those the simulated flash saw, records split over a
+ * sector end and erases to make room are counted, every public call lands
+ * in one latency bucket and failing ones under their error. The global set
+ * adds up all rings, rb_create and rb_reset_stats start a set over.
+ */
+#include "ring_buffer.h"
+#include "check.h"
+
+#define STATS_ID 6
+#define STATS_SECTORS 4
+#define STATS_LEN 300
+
+static uint8_t pagebuff[FLASH_PAGE_SIZE];
+static uint8_t buf[STATS_LEN];
+static uint8_t scratch[STATS_LEN];
+static uint32_t base;
+static rb_t rb;
+
+static uint32_t stats_calls(const rb_stats_t *st, rb_op_t op) {
+    uint32_t n = 0;
+    for (uint32_t b = 0; b < RB_STATS_BUCKETS; b++) {
+        n += st->latency[op][b];
+    }
+    CHECK_EQ(n, st->calls[op]);
+    return n;
+}
+//appends until the ring is full, counted against what the flash did
+static void test_flash(flash_sim_t *sim) {
+    rb_stats_t st;
+    CHECK_EQ(rb_create(&rb, base, STATS_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_get_stats(&rb, &st), RB_OK);
+    CHECK_EQ(stats_calls(&st, RB_OP_CREATE), 1);
+    CHECK_EQ(stats_calls(&st, RB_OP_APPEND), 0);
+    rb_reset_stats(&rb);
+    flash_sim_stats_t before = sim->stats;
+    uint32_t n = 0;
+    memset(buf, 0x5a, sizeof(buf));
+    while (rb_append(&rb, STATS_ID, buf, sizeof(buf), pagebuff, false) == RB_OK) {
+        n++;
+    }
+    CHECK_EQ(rb_get_stats(&rb, &st), RB_OK);
+    CHECK_EQ(st.programs, sim->stats.programs - before.programs);
+    CHECK_EQ(st.erases, sim->stats.erases - before.erases);
+    CHECK_EQ(st.erases, 0);
+    CHECK(st.programs >= n);
+    //each sector end a record of STATS_LEN runs over takes a continuation
+    CHECK(st.splits >= STATS_SECTORS - 2);
+    CHECK_EQ(stats_calls(&st, RB_OP_APPEND), n + 1);
+    CHECK_EQ(st.errors[-RB_FULL], 1);
+    CHECK_EQ(st.full_erases, 0);
+    //one more, erasing the oldest sector for it
+    CHECK_EQ(rb_append(&rb, STATS_ID, buf, sizeof(buf), pagebuff, true), RB_OK);
+    CHECK_EQ(rb_get_stats(&rb, &st), RB_OK);
+    CHECK_EQ(st.full_erases, 1);
+    CHECK(st.erases >= 1);
+    CHECK_EQ(st.erases, sim->stats.erases - before.erases);
+    //reads count what they fetched, a missing id counts an error
+    rb_errors_t err = rb_recreate(&rb, base, STATS_SECTORS, CREATE_FAIL);
+    CHECK(err == RB_OK || err == RB_BLANK_HDR);
+    rb_reset_stats(&rb);
+    before = sim->stats;
+    CHECK_EQ(rb_find(&rb, STATS_ID + 1, buf, sizeof(buf), scratch), RB_BLANK_HDR);
+    CHECK_EQ(rb_get_stats(&rb, &st), RB_OK);
+    CHECK(st.headers >= n / 2);
+    CHECK(st.reads > 0);
+    CHECK_EQ(stats_calls(&st, RB_OP_FIND), 1);
+    CHECK_EQ(st.errors[-RB_BLANK_HDR], 1);
+    CHECK_EQ(stats_calls(&st, RB_OP_APPEND), 0);
+    CHECK(st.read_bytes <= sim->stats.read_bytes - before.read_bytes);
+}
+//the global set counts every ring, each rb only its own
+static void test_global(void) {
+    rb_t other;
+    rb_stats_t all;
+    rb_stats_t st;
+    rb_reset_stats(NULL);
+    CHECK_EQ(rb_create(&rb, base, STATS_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_create(&other, base + STATS_SECTORS * FLASH_SECTOR_SIZE, STATS_SECTORS,
+                       CREATE_INIT_ALWAYS), RB_OK);
+    for (uint32_t i = 0; i < 3; i++) {
+        CHECK_EQ(rb_append(&rb, STATS_ID, buf, 10, pagebuff, false), RB_OK);
+    }
+    CHECK_EQ(rb_append(&other, STATS_ID, buf, 10, pagebuff, false), RB_OK);
+    CHECK_EQ(rb_read(&other, STATS_ID, buf, sizeof(buf)), 10);
+    CHECK_EQ(rb_get_stats(NULL, &all), RB_OK);
+    CHECK_EQ(stats_calls(&all, RB_OP_CREATE), 2);
+    CHECK_EQ(stats_calls(&all, RB_OP_APPEND), 4);
+    CHECK_EQ(stats_calls(&all, RB_OP_READ), 1);
+    CHECK_EQ(rb_get_stats(&rb, &st), RB_OK);
+    CHECK_EQ(stats_calls(&st, RB_OP_APPEND), 3);
+    CHECK_EQ(stats_calls(&st, RB_OP_READ), 0);
+    CHECK_EQ(rb_get_stats(&other, &st), RB_OK);
+    CHECK_EQ(stats_calls(&st, RB_OP_APPEND), 1);
+    CHECK_EQ(all.programs, rb.stats.programs + other.stats.programs);
+    rb_reset_stats(NULL);
+    CHECK_EQ(rb_get_stats(NULL, &all), RB_OK);
+    CHECK_EQ(all.calls[RB_OP_APPEND], 0);
+    CHECK_EQ(rb_get_stats(&rb, &st), RB_OK);
+    CHECK_EQ(st.calls[RB_OP_APPEND], 3);
+    CHECK_EQ(rb_get_stats(&rb, NULL), RB_BAD_CALLER_DATA);
+}
+int main(void) {
+    flash_sim_t sim;
+    check_flash(&sim);
+    base = __PERSISTENT_TABLE - 32 * FLASH_SECTOR_SIZE;
+    test_flash(&sim);
+    test_global();
+    printf("test_stats passed\n");
+    return 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host test of time rings. Appends index each sector by the timestamp of its
+ * first record, readers never see the time records, and rb_seek_time moves a
+ * cursor to at most one sector before the first record at or after a time,
+ * reading a few sectors, not all of them. Times before the oldest record
+ * seek to it, also after the ring wrapped, and a ring without time records
+ * seeks to its oldest sector.
+ */
+#include "ring_buffer.h"
+#include "check.h"
+
+#define TIME_ID 7
+#define TIME_SECTORS 16
+#define TIME_LEN 150
+#define TIME_STEP 10
+//records of one sector, a seek reads at most this many older ones
+#define TIME_PER_SECTOR (FLASH_SECTOR_SIZE / (TIME_LEN + 4) + 1)
+
+static uint8_t pagebuff[FLASH_PAGE_SIZE];
+static uint32_t base;
+static rb_t rb;
+
+//each payload starts with its little endian timestamp
+static uint64_t time_of(void *entry) {
+    uint64_t ts;
+    memcpy(&ts, entry, sizeof(ts));
+    return ts;
+}
+//all times are multiples of TIME_STEP
+static uint64_t time_ts(uint32_t n) {
+    return 1000 + n * TIME_STEP;
+}
+static void time_write(uint32_t first, uint32_t end, bool erase_if_full) {
+    uint8_t buf[TIME_LEN];
+    for (uint32_t n = first; n < end; n++) {
+        uint64_t ts = time_ts(n);
+        memset(buf, n, sizeof(buf));
+        memcpy(buf, &ts, sizeof(ts));
+        CHECK_EQ(rb_append(&rb, TIME_ID, buf, sizeof(buf), pagebuff, erase_if_full), RB_OK);
+    }
+}
+//seek to ts, the first record read is older than ts (or the oldest) and
+//the first one at or after it is no more than a sector further
+static void time_seek(uint64_t ts, uint64_t oldest, uint64_t newest) {
+    uint8_t got[TIME_LEN];
+    rb_cursor_t c;
+    int len;
+    CHECK_EQ(rb_cursor_open(&c, &rb), RB_OK);
+    CHECK_EQ(rb_seek_time(&c, ts), RB_OK);
+    CHECK_EQ(rb_cursor_read(&c, TIME_ID, got, sizeof(got)), TIME_LEN);
+    uint64_t first = time_of(got);
+    CHECK(first >= oldest);
+    if (ts <= oldest) {
+        CHECK_EQ(first, oldest);
+        return;
+    }
+    CHECK(first < ts);
+    uint32_t older = 1;
+    while ((len = rb_cursor_read(&c, TIME_ID, got, sizeof(got))) == TIME_LEN &&
+           time_of(got) < ts) {
+        older++;
+    }
+    CHECK(older <= TIME_PER_SECTOR);
+    if (ts > newest) {
+        CHECK_EQ(len, RB_BLANK_HDR);
+    } else {
+        CHECK_EQ(len, TIME_LEN);
+        CHECK_EQ(time_of(got), (ts + TIME_STEP - 1) / TIME_STEP * TIME_STEP);
+    }
+}
+//records fill most of the ring, every time in it is found
+static void test_seek(flash_sim_t *sim) {
+    uint32_t n = 12 * TIME_PER_SECTOR;
+    CHECK_EQ(rb_create(&rb, base, TIME_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_set_timestamps(&rb, time_of), RB_OK);
+    time_write(0, n, false);
+    CHECK_EQ(rb_recreate(&rb, base, TIME_SECTORS, CREATE_FAIL), RB_OK);
+    for (uint64_t ts = 0; ts < time_ts(n) + 100; ts += 37) {
+        time_seek(ts, time_ts(0), time_ts(n - 1));
+    }
+    //a binary search looks at a few time records, not one per sector
+    rb_cursor_t c;
+    CHECK_EQ(rb_cursor_open(&c, &rb), RB_OK);
+    uint64_t reads = sim->stats.reads;
+    CHECK_EQ(rb_seek_time(&c, time_ts(n / 3)), RB_OK);
+    uint64_t seek = sim->stats.reads - reads;
+    reads = sim->stats.reads;
+    CHECK_EQ(rb_cursor_open(&c, &rb), RB_OK);
+    //past finding the oldest sector, log2(sectors) + 1 steps of 3 reads each
+    CHECK(seek - (sim->stats.reads - reads) <= 3 * 5);
+    //readers do not see the time records
+    uint8_t got[TIME_LEN];
+    rb_reader_t r;
+    CHECK_EQ(rb_cursor_open(&c, &rb), RB_OK);
+    for (uint32_t i = 0; i < n; i++) {
+        CHECK_EQ(rb_cursor_reader_open(&r, &c, RB_ANY_ID), TIME_LEN);
+        CHECK_EQ(r.id, TIME_ID);
+        CHECK_EQ(rb_reader_read(&r, got, TIME_LEN), TIME_LEN);
+        CHECK_EQ(time_of(got), time_ts(i));
+    }
+    CHECK_EQ(rb_cursor_reader_open(&r, &c, RB_ANY_ID), RB_BLANK_HDR);
+}
+//after wrapping, the oldest sectors are gone and seeks before them start at the oldest left
+static void test_wrapped(void) {
+    uint8_t got[TIME_LEN];
+    rb_cursor_t c;
+    uint32_t n = 40 * TIME_PER_SECTOR;
+    CHECK_EQ(rb_create(&rb, base, TIME_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_set_timestamps(&rb, time_of), RB_OK);
+    time_write(0, n, true);
+    CHECK(rb.erases > TIME_SECTORS);
+    CHECK_EQ(rb_recreate(&rb, base, TIME_SECTORS, CREATE_FAIL), RB_OK);
+    CHECK_EQ(rb_cursor_open(&c, &rb), RB_OK);
+    CHECK_EQ(rb_cursor_read(&c, TIME_ID, got, sizeof(got)), TIME_LEN);
+    uint64_t oldest = time_of(got);
+    CHECK(oldest > time_ts(0));
+    for (uint64_t ts = oldest - 500; ts < time_ts(n) + 100; ts += 53) {
+        time_seek(ts, oldest, time_ts(n - 1));
+    }
+}
+//without time records every seek goes to the oldest sector
+static void test_untimed(void) {
+    uint8_t got[TIME_LEN];
+    rb_cursor_t c;
+    CHECK_EQ(rb_create(&rb, base, TIME_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_cursor_open(&c, &rb), RB_OK);
+    CHECK_EQ(rb_seek_time(&c, 5000), RB_OK); //blank
+    CHECK_EQ(rb_cursor_read(&c, TIME_ID, got, sizeof(got)), RB_BLANK_HDR);
+    time_write(0, 3 * TIME_PER_SECTOR, false);
+    CHECK_EQ(rb_seek_time(&c, time_ts(2 * TIME_PER_SECTOR)), RB_OK);
+    CHECK_EQ(rb_cursor_read(&c, TIME_ID, got, sizeof(got)), TIME_LEN);
+    CHECK_EQ(time_of(got), time_ts(0));
+    CHECK_EQ(rb_seek_time(NULL, 0), RB_BAD_CALLER_DATA);
+}
+int main(void) {
+    flash_sim_t sim;
+    check_flash(&sim);
+    base = __PERSISTENT_TABLE - 32 * FLASH_SECTOR_SIZE;
+    test_seek(&sim);
+    test_wrapped();
+    test_untimed();
+    printf("test_time passed\n");
+    return 0;
+}
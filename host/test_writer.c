@@ -0,0 +1,132 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host test of the streaming writer. Records of up to several sectors,
+ * written in pieces of random size, read back byte for byte, with and
+ * without payload crcs. A record closed short is smudged and skipped, other
+ * appends wait for the writer, a record too big for the ring is refused, and
+ * a writer erasing as it wraps keeps the newest records.
+ */
+#include "ring_buffer.h"
+#include "check.h"
+
+#define WRITER_ID 5
+#define WRITER_SECTORS 10
+#define WRITER_BIG (3 * FLASH_SECTOR_SIZE + 300)
+
+static uint8_t pagebuff[FLASH_PAGE_SIZE];
+static uint8_t buf[WRITER_BIG];
+static uint8_t got[WRITER_BIG];
+static uint32_t base;
+static rb_t rb;
+static uint32_t seed = 1;
+
+static uint32_t writer_random(void) {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+//payloads are made again from their number and size when read back
+static void writer_fill(uint8_t *p, uint32_t n, uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+        p[i] = n * 29 + i * 3 + (i >> 8);
+    }
+}
+//record n of size bytes, written in random pieces. The first error is returned
+static rb_errors_t writer_put(uint32_t n, uint32_t size, bool erase_if_full) {
+    rb_writer_t w;
+    rb_errors_t res = rb_writer_open(&w, &rb, WRITER_ID, size, pagebuff, erase_if_full);
+    if (res != RB_OK) {
+        return res;
+    }
+    writer_fill(buf, n, size);
+    for (uint32_t done = 0, piece; res == RB_OK && done < size; done += piece) {
+        piece = 1 + writer_random() % 900; //MIN evaluates both sides twice
+        piece = MIN(size - done, piece);
+        res = rb_writer_write(&w, buf + done, piece);
+    }
+    rb_errors_t close_res = rb_writer_close(&w);
+    return res != RB_OK ? res : close_res;
+}
+static void writer_expect(uint32_t n, uint32_t size) {
+    writer_fill(buf, n, size);
+    memset(got, 0, size);
+    CHECK_EQ(rb_read(&rb, WRITER_ID, got, sizeof(got)), size);
+    CHECK(!memcmp(got, buf, size));
+}
+static uint32_t writer_size(uint32_t n) {
+    return n % 3 == 1 ? WRITER_BIG - n * 100 : 1 + n * 211 % 2000;
+}
+static void test_sizes(bool payload_crc) {
+    CHECK_EQ(rb_create(&rb, base, WRITER_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_set_payload_crc(&rb, payload_crc), RB_OK);
+    uint32_t n;
+    for (n = 0; n < 5; n++) {
+        CHECK_EQ(writer_put(n, writer_size(n), false), RB_OK);
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        CHECK_EQ(rb_recreate(&rb, base, WRITER_SECTORS, CREATE_FAIL), RB_OK);
+        for (uint32_t i = 0; i < n; i++) {
+            writer_expect(i, writer_size(i));
+        }
+        CHECK(rb_read(&rb, WRITER_ID, got, sizeof(got)) < 0);
+    }
+}
+//closed before all of it was written, readers skip it
+static void test_short(void) {
+    rb_writer_t w;
+    CHECK_EQ(rb_create(&rb, base, WRITER_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_writer_open(&w, &rb, WRITER_ID, 2 * FLASH_SECTOR_SIZE, pagebuff, false), RB_OK);
+    CHECK_EQ(rb_append(&rb, WRITER_ID, "no", 2, pagebuff, false), RB_BAD_CALLER_DATA);
+    writer_fill(buf, 0, FLASH_SECTOR_SIZE);
+    CHECK_EQ(rb_writer_write(&w, buf, FLASH_SECTOR_SIZE), RB_OK);
+    CHECK_EQ(rb_writer_close(&w), RB_BAD_CALLER_DATA);
+    CHECK_EQ(writer_put(1, 500, false), RB_OK);
+    CHECK_EQ(rb_recreate(&rb, base, WRITER_SECTORS, CREATE_FAIL), RB_OK);
+    writer_expect(1, 500);
+    CHECK(rb_read(&rb, WRITER_ID, got, sizeof(got)) < 0);
+}
+//a record needs a sector more than it fills, the one it must not wrap onto
+static void test_too_big(void) {
+    rb_writer_t w;
+    CHECK_EQ(rb_create(&rb, base, WRITER_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    CHECK_EQ(rb_writer_open(&w, &rb, WRITER_ID, WRITER_SECTORS * FLASH_SECTOR_SIZE, pagebuff,
+                            true), RB_BAD_CALLER_DATA);
+    CHECK_EQ(rb_append(&rb, WRITER_ID, "ok", 2, pagebuff, false), RB_OK);
+}
+//many big records round a small ring, the oldest sectors are erased for them
+static void test_wrap(void) {
+    uint32_t n;
+    CHECK_EQ(rb_create(&rb, base, WRITER_SECTORS, CREATE_INIT_ALWAYS), RB_OK);
+    for (n = 0; n < 7; n++) {
+        CHECK_EQ(writer_put(n, WRITER_BIG - 2 * FLASH_SECTOR_SIZE, false), RB_OK);
+    }
+    //it starts, but runs into the oldest sector
+    CHECK_EQ(writer_put(n, WRITER_BIG, false), RB_WRAPPED_SECTOR_USED);
+    for (; n < 40; n++) {
+        CHECK_EQ(writer_put(n, n % 2 ? WRITER_BIG : 1000, true), RB_OK);
+    }
+    CHECK(rb.erases > 0);
+    //the newest one is whole, whatever older ones lost their heads
+    CHECK_EQ(rb_recreate(&rb, base, WRITER_SECTORS, CREATE_FAIL), RB_OK);
+    int len;
+    uint32_t last = 0;
+    while ((len = rb_read(&rb, WRITER_ID, got, sizeof(got))) > 0) {
+        last = len;
+    }
+    CHECK_EQ(last, n % 2 ? 1000 : WRITER_BIG);
+    writer_fill(buf, n - 1, last);
+    CHECK(!memcmp(got, buf, last));
+}
+int main(void) {
+    flash_sim_t sim;
+    check_flash(&sim);
+    base = __PERSISTENT_TABLE - 32 * FLASH_SECTOR_SIZE;
+    test_sizes(false);
+    test_sizes(true);
+    test_short();
+    test_too_big();
+    test_wrap();
+    printf("test_writer passed\n");
+    return 0;
+}
@@ -109,6 +109,30 @@ static inline crc_t crc_finalize(crc_t crc)
 }
 
 
+/**
+ * Payload crc-32 (reflected, poly 0xedb88320, as used by zlib). Used the same
+ * way as the 5 bit crc: crc32_init(), any number of crc32_update() calls and
+ * crc32_finalize().
+ *
+ * Running crc32_update() over a message followed by its finalized crc stored
+ * little endian, then finalizing, always gives CRC32_RESIDUE. That lets a
+ * reader check a record without knowing where its payload ends.
+ */
+#define CRC32_RESIDUE 0x2144df1cu
+
+static inline uint32_t crc32_init(void)
+{
+    return 0xffffffffu;
+}
+
+uint32_t crc32_update(uint32_t crc, const void *data, size_t data_len);
+
+static inline uint32_t crc32_finalize(uint32_t crc)
+{
+    return crc ^ 0xffffffffu;
+}
+
+
 #ifdef __cplusplus
 }           /* closing brace for extern "C" */
 #endif
@@ -8,5 +8,39 @@
 int flash_read(uint32_t block, void *buffer, size_t size);
 int flash_prog(uint32_t block, const void *buffer, size_t size);
 int flash_erase(uint32_t block, size_t size);
+//memory mapped view of flash, for scanning without copying
+const uint8_t *flash_mapped(uint32_t block);
+
+/*
+ A flash device a ring is bound to, its calls and its geometry. The calls
+ above are the default device, flash_default_dev. Others, an external SPI NOR
+ say, fill in their own: rings on them use the device erase unit as their
+ sector size.
+*/
+typedef struct flash_dev {
+    int (*read)(const struct flash_dev *dev, uint32_t block, void *buffer, size_t size);
+    int (*prog)(const struct flash_dev *dev, uint32_t block, const void *buffer, size_t size);
+    int (*erase)(const struct flash_dev *dev, uint32_t block, size_t size);
+    //NULL if the device is not memory mapped, scans read it instead
+    const uint8_t *(*mapped)(const struct flash_dev *dev, uint32_t block);
+    uint32_t size; //bytes of flash
+    uint32_t sector_size; //erase unit, a power of 2 of at least FLASH_SECTOR_SIZE
+    uint32_t block_size; //an aligned erase of this is one faster command, see flash_sched.h
+    uint32_t page_size; //programs stay inside one page, a power of 2 up to FLASH_PAGE_SIZE
+    uint32_t prog_unit; //prog address and size must be multiples of this, page_size if only whole pages
+    struct flash_sched *sched; //queue everyone using the device submits to, NULL to call it directly
+    void *ctx; //for the calls
+} flash_dev_t;
+
+extern flash_dev_t flash_default_dev;
+
+/*
+ program bytes lo up to hi of the page at block from page, a FLASH_PAGE_SIZE
+ buffer that is 0xff outside them. Widened to what dev takes, whole pages on
+ the pico, one program for each device page. Goes through dev->sched, see
+ flash_sched.c.
+*/
+int flash_prog_range(const flash_dev_t *dev, uint32_t block, const uint8_t *page,
+                     uint32_t lo, uint32_t hi);
 
 #endif
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#ifndef _FLASH_SCHED_H_
+#define _FLASH_SCHED_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <hardware/flash.h>
+#include <pico/stdlib.h>
+
+#include "flash.h"
+
+/*
+ Flash operation scheduler. Erases and programs for one device are queued,
+ then run together. Erases queued one after another are sorted and
+ adjacent ones merged, and every aligned block_size of them goes as one
+ block erase. A 64K block erase takes about 150ms where 16 sector erases take
+ over 700ms. Each command is its own device call, and the onboard calls
+ only turn interrupts off for one call. So no interrupt-off window is longer
+ than one max_erase, even while formatting many rings. Set max_erase to the
+ sector size to keep each window at one sector erase.
+
+ A device has one scheduler, dev->sched, that rings, pools and flash_io all
+ submit to; flash_default_sched is the one of flash_default_dev. The library
+ runs the queue before it returns, so its own reads always see flash. A
+ caller can queue erases of several rings or pool sectors, then run them as
+ one batch.
+
+ Programs and erases still run in the order they were queued. A program
+ queued after an erase reaches flash after it, and the other way round.
+ Reads do not see the queue, run it first.
+*/
+#ifndef FLASH_SCHED_OPS
+#define FLASH_SCHED_OPS 8
+#endif
+
+typedef enum {
+    FLASH_OP_ERASE,
+    FLASH_OP_PROG,
+} flash_op_kind_t;
+
+typedef struct {
+    uint8_t kind;
+    uint32_t address; //offset in flash, not system address
+    uint32_t size;
+    const void *data; //bytes to program, must stay valid until the run
+} flash_op_t;
+
+typedef struct flash_sched {
+    const flash_dev_t *dev;
+    uint32_t max_erase; //largest single erase, 0 for dev->block_size
+    uint32_t count; //ops queued
+    flash_op_t ops[FLASH_SCHED_OPS];
+    uint32_t sectors; //sectors erased since init
+    uint32_t erase_commands; //erase calls made for them
+} flash_sched_t;
+
+extern flash_sched_t flash_default_sched;
+
+void flash_sched_init(flash_sched_t *sched, const flash_dev_t *dev);
+/*
+ queue an erase of whole sectors or a program, a full queue runs first.
+ Returns 0, or a negative device status if running the queue failed.
+*/
+int flash_sched_erase(flash_sched_t *sched, uint32_t address, uint32_t size);
+int flash_sched_prog(flash_sched_t *sched, uint32_t address, const void *data, uint32_t size);
+//run and empty the queue, stops at the first device error and returns it
+int flash_sched_run(flash_sched_t *sched);
+/*
+ erase whole sectors of dev or program it now, through dev->sched so queued
+ work goes first and touching erases merge. Without one dev is called
+ directly. Returns 0 or the first device error.
+*/
+int flash_dev_erase(const flash_dev_t *dev, uint32_t address, uint32_t size);
+int flash_dev_prog(const flash_dev_t *dev, uint32_t address, const void *data, uint32_t size);
+
+#endif //_FLASH_SCHED_H_
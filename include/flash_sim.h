@@ -0,0 +1,102 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#ifndef _FLASH_SIM_H_
+#define _FLASH_SIM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ Simulated NOR flash for host builds. Behaves like the onboard W25Q16JV as far
+ as the ring buffer can tell: erase sets a whole sector to 0xff, programming
+ can only clear bits (new = old & data), and reads are plain memory copies.
+
+ The flash can live in RAM or in a file (mmap'ed) so a ring can survive
+ between runs, just like a real board. Every operation is counted and charged
+ against a simple timing model, so host runs can report what the same
+ workload would have cost on the real part. Times default to the typical
+ values in the W25Q16JV datasheet.
+
+ flash_sim_bind() makes one simulator the target of the flash.h functions, so
+ ring_buffer.c and flash_io.c run unchanged on top of it. More simulators,
+ with other geometry, are used through their own flash_sim_dev() devices.
+*/
+typedef struct {
+    uint32_t size;              //total bytes of flash
+    uint32_t sector_size;       //erase unit
+    uint32_t page_size;         //program unit
+    bool full_page_prog;        //like the pico sdk, only allow whole page programs
+    uint32_t prog_unit;         //else programs are multiples of this, aligned
+    uint32_t read_ns_per_byte;
+    uint32_t prog_setup_ns;     //fixed cost of any program command
+    uint32_t prog_ns_per_byte;
+    uint32_t erase_ns;          //cost of one sector erase
+    uint32_t block_size;        //aligned blocks of this, inside one erase call, are one command
+    uint32_t block_erase_ns;    //cost of such a block erase
+    bool realtime;              //really sleep for the modeled time
+    bool unmapped;              //like an spi part without xip, its device has no mapped call
+    const char *path;           //NULL for ram backing, else a backing file
+} flash_sim_config_t;
+
+typedef struct {
+    uint64_t reads;
+    uint64_t read_bytes;
+    uint64_t programs;
+    uint64_t program_bytes;
+    uint64_t ff_bytes;          //0xff bytes sent, the padding of short writes and 0xff data
+    uint64_t erases;            //sectors erased
+    uint64_t block_erases;      //of them, block erase commands
+    uint64_t errors;            //misaligned or out of range requests
+    uint64_t failed_programs;   //programs failed by flash_sim_fail_progs
+    uint64_t modeled_ns;        //total modeled flash busy time
+} flash_sim_stats_t;
+
+typedef struct {
+    flash_sim_config_t cfg;
+    uint8_t *mem;
+    uint32_t *erase_counts;     //one per sector, wear tracking
+    int fd;                     //backing file or -1
+    flash_sim_stats_t stats;
+    uint32_t progs_before_fail; //programs that still succeed before failing ones
+    uint32_t progs_to_fail;     //programs that then fail, leaving flash as it was
+} flash_sim_t;
+
+//fill cfg with the pico w onboard flash defaults
+void flash_sim_default_config(flash_sim_config_t *cfg);
+//open a simulator, cfg NULL uses defaults. returns 0 or negative on error
+int flash_sim_open(flash_sim_t *sim, const flash_sim_config_t *cfg);
+void flash_sim_close(flash_sim_t *sim);
+//route flash_read/flash_prog/flash_erase, and flash_default_dev, to this simulator
+void flash_sim_bind(flash_sim_t *sim);
+flash_sim_t *flash_sim_bound(void);
+/*
+ fill in a flash device for this simulator, with its geometry, for rb_create_on.
+ It has no scheduler, a device of the bound simulator can share
+ flash_default_sched.
+*/
+struct flash_dev;
+void flash_sim_dev(flash_sim_t *sim, struct flash_dev *dev);
+
+int flash_sim_read(flash_sim_t *sim, uint32_t address, void *buffer, size_t size);
+int flash_sim_prog(flash_sim_t *sim, uint32_t address, const void *buffer, size_t size);
+int flash_sim_erase(flash_sim_t *sim, uint32_t address, size_t size);
+
+/*
+ fault injection for tests: after the next after program calls succeed, the
+ count following ones fail without changing flash, like a part that stopped
+ answering. count 0 turns it off.
+*/
+void flash_sim_fail_progs(flash_sim_t *sim, uint32_t after, uint32_t count);
+
+void flash_sim_get_stats(const flash_sim_t *sim, flash_sim_stats_t *stats);
+void flash_sim_reset_stats(flash_sim_t *sim);
+//erase count of the sector holding address
+uint32_t flash_sim_erase_count(const flash_sim_t *sim, uint32_t address);
+//min and max erase counts over [address, address + size), a quick wear summary
+void flash_sim_wear(const flash_sim_t *sim, uint32_t address, size_t size,
+                    uint32_t *min_erases, uint32_t *max_erases);
+
+#endif //_FLASH_SIM_H_
@@ -0,0 +1,67 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#ifndef _RB_KV_H_
+#define _RB_KV_H_
+
+#include "ring_buffer.h"
+
+/*
+ Latest value key/value store over a ring. A key is a record id plus the key
+ bytes at the start of the payload, the value follows them. The newest
+ record of a key is its value. rb_kv_open scans the ring once and builds a
+ hash index of where the newest record of each key is; after that get, put
+ and delete go straight to it.
+
+ How long the key of a record is comes from a rb_kv_keylen_t, given the id
+ and the first bytes of a payload (at most RB_KV_MAX_KEY). NULL means every
+ key is just the id, one value per id. That way a ring written before the
+ store existed can be opened as one, as long as its keys can be told apart.
+*/
+//index slots, a power of 2. At most 3/4 of them hold keys
+#ifndef RB_KV_SLOTS
+#define RB_KV_SLOTS 64
+#endif
+//longest key, in payload bytes
+#ifndef RB_KV_MAX_KEY
+#define RB_KV_MAX_KEY 32
+#endif
+//replaced records waiting to be smudged
+#ifndef RB_KV_RETIRE
+#define RB_KV_RETIRE 8
+#endif
+
+typedef uint32_t (*rb_kv_keylen_t)(uint8_t id, const uint8_t *payload, uint32_t len);
+
+typedef struct {
+    uint32_t hash;
+    uint32_t offset; //newest record of the key, or empty or deleted
+} rb_kv_slot_t;
+
+typedef struct {
+    rb_t *rb;
+    rb_kv_keylen_t keylen;
+    uint32_t erases; //rb->erases when the index was built
+    uint32_t count; //keys in the index
+    uint32_t used; //slots holding keys or deleted marks
+    uint32_t retired; //records in retire
+    bool overflow; //more replaced records than retire holds
+    uint32_t retire[RB_KV_RETIRE];
+    rb_kv_slot_t slot[RB_KV_SLOTS];
+} rb_kv_t;
+
+//rb must be created, and be written only through kv from now on
+rb_errors_t rb_kv_open(rb_kv_t *kv, rb_t *rb, rb_kv_keylen_t keylen);
+//read the value of a key, returns its length read or a negative status
+int rb_kv_get(rb_kv_t *kv, uint8_t id, const void *key, uint32_t keylen,
+              void *value, uint32_t size);
+//append a new value of a key, keylen must be what the rb_kv_keylen_t says
+rb_errors_t rb_kv_put(rb_kv_t *kv, uint8_t id, const void *key, uint32_t keylen,
+                      const void *value, uint32_t size, uint8_t *pagebuffer);
+rb_errors_t rb_kv_delete(rb_kv_t *kv, uint8_t id, const void *key, uint32_t keylen,
+                         uint8_t *pagebuffer);
+//smudge the records replaced by newer values
+rb_errors_t rb_kv_retire(rb_kv_t *kv, uint8_t *pagebuffer);
+
+#endif //_RB_KV_H_
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#ifndef _RB_POOL_H_
+#define _RB_POOL_H_
+
+#include "ring_buffer.h"
+
+/*
+ Shared sector pool. Instead of each ring owning a fixed range of flash,
+ several rings (streams) take their sectors from one area. Each stream is a
+ normal ring of quota sectors, but its ring sectors map to any pool sectors.
+ When a stream erases a sector it gets the least worn free pool sector in
+ its place, so a hot stream wears all the spare sectors and not just its own.
+ Scans of a stream still only read the sectors it has.
+
+ - a stream's sector indexes start at RB_POOL_INDEX(stream), so the sector
+   headers say which stream a pool sector belongs to
+ - pooled sectors have RB_SECTOR_LIVE set in their header. It is cleared when
+   the sector goes back to the pool, a sector is only erased when taken again
+ - when a free sector has RB_POOL_WEAR_GAP more erases than the least worn
+   sector of another stream, that cold sector is copied onto the worn one and
+   its sector is freed, so cold data does not keep the least worn sectors
+ - erase counts are kept in the last sector of the pool, a snapshot after
+   each erase. They only steer which sector is taken, losing some is harmless
+
+ Mount the pool with rb_pool_mount, then create each stream ring with
+ rb_create_pooled. Every stream must be used from the same core, the pool
+ state is shared. A sector move can leave rb_peek segments of a cold stream
+ pointing at the old sector, read them before the next append.
+*/
+//most data sectors in a pool
+#ifndef RB_POOL_SECTORS
+#define RB_POOL_SECTORS 16
+#endif
+#ifndef RB_POOL_STREAMS
+#define RB_POOL_STREAMS 4
+#endif
+//erases between a free and a cold sector before the cold one is moved
+#ifndef RB_POOL_WEAR_GAP
+#define RB_POOL_WEAR_GAP 32
+#endif
+//the stream is kept in the upper bits of its sector indexes
+#define RB_POOL_INDEX_BITS 22
+#define RB_POOL_INDEX(stream) ((uint32_t)(stream) << RB_POOL_INDEX_BITS)
+//owner of a sector no stream has
+#define RB_POOL_FREE 0xff
+//erase count snapshots are written this far apart
+#define RB_POOL_SLOT 128
+
+#if RB_POOL_SECTORS > 31
+#error "a pool erase count snapshot holds at most 31 sectors"
+#endif
+
+//erase counts as kept in flash
+typedef struct {
+    uint32_t erases[RB_POOL_SECTORS];
+    uint32_t crc; //crc32 of the above
+} rb_pool_counts_t;
+
+typedef struct rb_pool {
+    uint32_t base_address; //offset in flash, not system address
+    uint32_t sectors; //data sectors, the one after them keeps the erase counts
+    uint8_t streams;
+    uint8_t quota[RB_POOL_STREAMS]; //ring sectors of each stream
+    uint8_t map[RB_POOL_STREAMS][RB_POOL_SECTORS]; //pool sector of each ring sector
+    uint8_t owner[RB_POOL_SECTORS]; //stream of each pool sector, or RB_POOL_FREE
+    uint32_t blank; //free sectors known to be erased, a bit each
+    uint32_t slot; //offset of the next erase count snapshot
+    uint32_t moves; //cold sectors moved since the mount
+    uint32_t erases[RB_POOL_SECTORS];
+    uint8_t page[FLASH_PAGE_SIZE];
+} rb_pool_t;
+
+/*
+ the last of number_of_sectors keeps the erase counts, the others are shared
+ by streams rings of quota[stream] sectors. Always mount the same flash with
+ the same number of sectors and streams.
+*/
+rb_errors_t rb_pool_mount(rb_pool_t *pool, uint32_t base_address, size_t number_of_sectors,
+                          const uint8_t *quota, uint8_t streams,
+                          enum init_choices init_choice);
+//pool sector erases, fewest and most
+void rb_pool_wear(rb_pool_t *pool, uint32_t *min, uint32_t *max);
+/*
+ used by ring_buffer.c: give ring sector of stream a blank pool sector,
+ returns erases done or RB_FLASH_ERROR
+*/
+int rb_pool_replace(rb_pool_t *pool, uint8_t stream, uint32_t sector);
+
+#endif //_RB_POOL_H_
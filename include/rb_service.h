@@ -0,0 +1,77 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#ifndef _RB_SERVICE_H_
+#define _RB_SERVICE_H_
+
+#include <stdatomic.h>
+#if !PICO_ON_DEVICE
+#include <pthread.h>
+#endif
+#include "ring_buffer.h"
+
+/*
+ Flash writer service. One rb_service_t owns an rb_t and its page buffer and
+ does every append on its own core (core1 on the pico, a thread on the host),
+ so the producing core never waits on a page program or an erase. Records are
+ copied into a lock-free single producer, single consumer queue; when it is
+ full the producer gets RB_FULL or waits, that is the backpressure.
+
+ Each submit returns a ticket. rb_service_done() tells if that record has been
+ appended, rb_service_wait() waits for it and returns the rb_append status.
+*/
+//queue slots, a power of 2
+#ifndef RB_SERVICE_QUEUE_LEN
+#define RB_SERVICE_QUEUE_LEN 16
+#endif
+//largest record the queue holds, larger ones use rb_append directly
+#ifndef RB_SERVICE_MAX_RECORD
+#define RB_SERVICE_MAX_RECORD 64
+#endif
+
+typedef struct {
+    uint8_t id;
+    uint16_t size;
+    rb_errors_t status; //rb_append result, set by the service
+    uint8_t data[RB_SERVICE_MAX_RECORD];
+} rb_service_slot_t;
+
+typedef struct {
+    rb_t *rb;
+    uint8_t *pagebuffer;
+    bool erase_if_full;
+    atomic_uint head; //records submitted, only the producer writes it
+    atomic_uint tail; //records appended, only the service writes it
+    atomic_bool stop;
+    atomic_bool running;
+    uint32_t full_waits; //submits that found the queue full, producer side
+    rb_errors_t flush_status; //first rb_poll or rb_sync error, service side
+#if !PICO_ON_DEVICE
+    pthread_t thread;
+#endif
+    rb_service_slot_t slot[RB_SERVICE_QUEUE_LEN];
+} rb_service_t;
+
+//the service appends to rb with pagebuffer, rb must not be used elsewhere
+rb_errors_t rb_service_init(rb_service_t *svc, rb_t *rb, uint8_t *pagebuffer,
+                            bool erase_if_full);
+//start the service on the other core (or thread), then submit from this one
+rb_errors_t rb_service_start(rb_service_t *svc);
+//append everything queued, rb_sync and stop the service. Returns the first
+//error of a flush not made by an append, those are in each slot status
+rb_errors_t rb_service_stop(rb_service_t *svc);
+//the service loop, for callers that start their own core or thread
+void rb_service_run(rb_service_t *svc);
+/*
+ queue a copy of one record, returns a ticket >= 0. If the queue is full,
+ wait for room or return RB_FULL.
+*/
+int rb_service_submit(rb_service_t *svc, uint8_t id, const void *data, uint32_t size,
+                      bool wait);
+bool rb_service_done(rb_service_t *svc, uint32_t ticket);
+rb_errors_t rb_service_wait(rb_service_t *svc, uint32_t ticket);
+//records queued but not yet appended
+uint32_t rb_service_pending(rb_service_t *svc);
+
+#endif //_RB_SERVICE_H_
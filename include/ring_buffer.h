@@ -21,6 +21,7 @@
 
 
 typedef uint64_t (*timestamp_extractor_t)(void *entry);
+struct rb_pool;
 
 /* 
  re-engineered to allow variable length flash storage.
@@ -41,9 +42,12 @@ typedef uint64_t (*timestamp_extractor_t)(void *entry);
 
  Rings will be checked when used, if invalid, status is returned so caller can
  erase and start over. Writes are especially risky and should be rare. If
- multiple writers are used, the ring must be checked before every write. ring
- buffer headers cache local accessor data, but not global, so must be rebuilt
- before every write. Write speed will be sacrificed to assure data integrity.
+ multiple writers are used, the ring must be checked before every write. Each
+ rb_t caches the tail (where the next append goes) after a successful append.
+ Before the next append the cache is checked in O(1): the tail must still be
+ blank and the sector last written must still hold the newest sector index.
+ If another writer, an erase or a power cut changed either, the whole ring is
+ scanned again as before.
 
  Erased sectors are all 0xff bytes. Sectors start at the lowest addressed
  sector, and rb_header(s) can be followed to find the last sector used on any
@@ -121,11 +125,20 @@ static inline uint32_t get_crc (rb_sector_header *p) {return p->header & 0xff;}
 static inline void set_index (rb_sector_header *p, uint32_t n) { p->header = (n & RB_INDEX_MASK) << 8 | get_crc(p);}
 static inline uint32_t get_index (rb_sector_header *p) {return p->header >> 8;}
 static inline void set_crc (rb_sector_header *p, uint32_t n) { p->header = get_index(p) << 8 | (n & 0xff);}
+//the sector crc is 5 bits too, the upper 3 bits of its byte are ring flags
+#define RB_SECTOR_CRC_MASK 0x1f
+//records in this ring start on uint32 boundaries
+#define RB_SECTOR_ALIGNED (1<<7)
+//sector of a pooled ring, cleared when the sector goes back to its pool
+#define RB_SECTOR_LIVE (1<<6)
+//sector of a fixed size record ring, see rb_create_fixed
+#define RB_SECTOR_FIXED (1<<5)
 
 #define HEADER_SIZE (sizeof(rb_header))
 //get highest legal value for len in rb_header
 #define RB_MAX_LEN_VALUE ((uint16_t) -1)
-//highest legal write size
+//highest legal record size, payload and crc. rb_append takes 4 bytes less with
+//payload crcs on, a longer record is RB_BAD_CALLER_DATA
 #define RB_MAX_APPEND_SIZE (FLASH_SECTOR_SIZE - sizeof(rb_sector_header) - sizeof(rb_header))
 //given a binary power, return the modulo2 mask of its value
 #define MOD_MASK(a) (a - 1)
@@ -133,31 +146,235 @@ static inline void set_crc (rb_sector_header *p, uint32_t n) { p->header = get_i
 #define MOD_SECTOR(a) ((a) & MOD_MASK(FLASH_SECTOR_SIZE))
 #define MOD_PAGE(a) ((a) & MOD_MASK(FLASH_PAGE_SIZE))
 //define amount to round an address to a uint32 boundary
-#define ROUND_UP(a) ((sizeof(uint32_t)) - ((a) & MOD_MASK(sizeof(uint32_t))) & (MOD_MASK(sizeof(uint32_t))))
+#define ROUND_UP(a) (((sizeof(uint32_t)) - ((a) & MOD_MASK(sizeof(uint32_t)))) & MOD_MASK(sizeof(uint32_t)))
 // change arg to page or sector without offset in page or sector
 #define FLASH_PAGE(a) ((a) / FLASH_PAGE_SIZE * FLASH_PAGE_SIZE)
 #define FLASH_SECTOR(a) ((a) / FLASH_SECTOR_SIZE * FLASH_SECTOR_SIZE)
+//the same for a ring offset, ring sectors are the erase unit of the ring's device
+#define RB_MOD_SECTOR(rb, a) ((a) & MOD_MASK((rb)->sector_size))
+#define RB_SECTOR(rb, a) ((a) - RB_MOD_SECTOR(rb, a))
 //the crc is only 5 bits, use upper 3 bits as flags written to flash
 #define RB_HEADER_SPLIT (1<<7)
 //and there are 2 other non-crc bits that can be used
 //they are created as 1 bits and can be erased anytime to zero as needed
 #define RB_HEADER_NOT_SMUDGED (1<<6)
-#define RB_HEADER_UNUSED (1<<5)
+//set when the payload is followed by its crc32, older records have it clear
+#define RB_HEADER_PAYLOAD_CRC (1<<5)
+//id 0 is never a user record, it marks records the ring keeps for itself
+#define RB_SYSTEM_ID 0
+//never a record id either, rb_reader_open takes it to mean any user record
+#define RB_ANY_ID 0xff
+//first payload byte of a system record says what kind it is
+#define RB_SYSTEM_TIME 1
+//kind, 3 blank bytes, then a little endian uint64 timestamp
+#define RB_TIME_RECORD_LEN 12
+//flag byte after each record of a fixed size ring, cleared when it is written
+#define RB_SLOT_BLANK (1<<0)
+//and cleared by rb_fixed_delete
+#define RB_SLOT_NOT_DELETED (1<<1)
+//largest record of a fixed size ring, one slot per sector
+#define RB_MAX_FIXED_SIZE (FLASH_SECTOR_SIZE - sizeof(rb_sector_header) - 1)
 #define ARRAY_LENGTH(array) (sizeof (array) / sizeof (const char *))
 
+/*
+ Operation counters, built in when RB_STATS is 1. Each rb counts what was done
+ through it and a global set counts all rings; rb_get_stats reads them. The
+ public calls of each kind below are timed into log2 histograms: bucket 0 is
+ under 1us, bucket n holds calls taking 2^(n-1) up to 2^n us, the last one
+ everything longer. Without RB_STATS nothing is counted and no time is read.
+*/
+#ifndef RB_STATS
+#define RB_STATS 0
+#endif
+#define RB_STATS_BUCKETS 16
+//calls returning each error, indexed by -error up to -RB_FLASH_ERROR
+#define RB_STATS_ERRORS 12
+
+typedef enum {
+    RB_OP_CREATE, //rb_create, rb_recreate, rb_mount
+    RB_OP_APPEND, //rb_append, rb_append_batch
+    RB_OP_READ, //rb_read, rb_cursor_read, rb_read_prev
+    RB_OP_FIND, //rb_find, rb_cursor_find
+    RB_OP_DELETE, //rb_delete, rb_delete_at
+    RB_OP_COUNT
+} rb_op_t;
+
+typedef struct {
+    uint32_t reads; //flash reads, and memory mapped scans
+    uint32_t read_bytes;
+    uint32_t programs; //page programs
+    uint32_t erases; //sectors erased
+    uint32_t headers; //record and sector headers looked at while scanning
+    uint32_t splits; //continuation headers, one per sector a record runs on into
+    uint32_t rescans; //appends that could not use the cached tail
+    uint32_t loops; //tail scans that went around a full ring, RB_HDR_LOOP
+    uint32_t full_erases; //oldest sectors erased to make room, erase_if_full
+    uint32_t retries; //appends tried again after such an erase
+    uint32_t errors[RB_STATS_ERRORS]; //calls of the kinds above failing, by -error
+    uint32_t calls[RB_OP_COUNT];
+    uint32_t latency[RB_OP_COUNT][RB_STATS_BUCKETS];
+} rb_stats_t;
+
+/*
+ read cache of one rb, see rb_set_cache. Sector headers of the first
+ RB_CACHE_SECTORS sectors, and RB_CACHE_PAGES page windows kept least
+ recently used first out. Reads of a page or more go around it.
+*/
+#ifndef RB_CACHE_PAGES
+#define RB_CACHE_PAGES 4
+#endif
+#ifndef RB_CACHE_SECTORS
+#define RB_CACHE_SECTORS 32
+#endif
+#if RB_CACHE_SECTORS > 32
+#error "the cached sector headers are kept in a 32 bit mask"
+#endif
+//ring offset of a page window holding nothing
+#define RB_CACHE_EMPTY 0xffffffff
+
+typedef struct {
+    uint32_t page[RB_CACHE_PAGES]; //ring offset of each window, or RB_CACHE_EMPTY
+    uint32_t used[RB_CACHE_PAGES]; //clock of its last use
+    uint8_t data[RB_CACHE_PAGES][FLASH_PAGE_SIZE];
+    rb_sector_header headers[RB_CACHE_SECTORS];
+    uint32_t header_valid; //a bit for each sector header held
+    uint32_t clock;
+    uint32_t hits; //reads served from the windows
+    uint32_t misses; //windows read from flash
+    uint32_t header_hits;
+    uint32_t header_misses;
+} rb_cache_t;
+
 /* Variable size ring buffer, need one struct per accessor to/from flash. next
    entry could be used to determine amount used, except for the ring wrapping,
    which is data dependent.
 */
 typedef struct {
+    const flash_dev_t *dev; //flash the ring is on, see rb_create_on
+    uint32_t sector_size; //its erase unit
     uint32_t base_address; //offset in flash, not system address
     uint32_t number_of_bytes;
     uint32_t next; //working read pointer into flash ring 0<=next<number_of_bytes
     uint32_t last_wrote; //info for caller as to where in rb last written
     uint32_t sector_index; //track for ring wraps.
     uint8_t *rb_page; //only required for writes.
+    uint32_t tail; //cached append offset, rechecked before every append
+    bool tail_valid; //false forces a full ring scan on the next append
+    uint32_t stage_page; //offset of the page held in rb_page
+    uint32_t stage_lo; //bytes of that page staged, only they are programmed
+    uint32_t stage_hi;
+    bool staged; //rb_page holds bytes not yet programmed
+    bool buffered; //rb owns rb_page, staged records wait for a flush
+    uint32_t deadline_us; //max age of staged bytes when buffered
+    uint64_t stage_time; //when the staged page was started
+    bool payload_crc; //append a crc32 of the payload to new records
+    bool aligned; //records start on uint32 boundaries, kept in sector headers
+    bool writing; //an rb_writer_t owns the tail
+    timestamp_extractor_t timestamp_of; //time ring if set, see rb_set_timestamps
+    uint32_t erase_ahead; //sectors after the tail rb_maintain keeps blank
+    uint8_t compact_pct; //rb_maintain copies out sectors at most this % live
+    uint8_t *compact_page; //page buffer for those copies
+    uint32_t erases; //sectors erased through rb, offsets kept from before may be stale
+    bool checkpoints; //the sector after the ring keeps checkpoints, see rb_mount
+    uint32_t checkpoint_slot; //offset in that sector of the next checkpoint
+    uint32_t checkpoint_index; //newest sector index in the last checkpoint
+    struct rb_pool *pool; //sectors come from a shared pool, see rb_pool.h
+    uint8_t *map; //pool sector of each ring sector
+    uint8_t stream; //which of the pool streams rb is
+    uint32_t record_size; //fixed size record ring if not 0, see rb_create_fixed
+    uint32_t slots; //records in each sector of such a ring
+    uint32_t oldest; //its oldest sector as last seen
+    uint32_t oldest_index; //and that sector's index
+    rb_cache_t *cache; //read cache, see rb_set_cache
+#if RB_STATS
+    rb_stats_t stats; //started over by rb_create
+#endif
 } rb_t;
 
+/*
+ where a ring was, kept in the sector after a mounted ring. Never blank, the
+ tail is always less than the ring size.
+*/
+typedef struct {
+    uint32_t tail; //append offset
+    uint32_t newest; //sector holding the last written byte
+    uint32_t sector_index; //its sector index
+    uint32_t oldest; //oldest sector, for the record
+    uint32_t number_of_bytes; //size of the ring it was written for
+    uint32_t crc; //crc32 of the above
+} rb_checkpoint_t;
+//checkpoints are written this far apart
+#define RB_CHECKPOINT_SLOT 32
+
+//state of one streaming append, see rb_writer_open
+typedef struct {
+    rb_t *rb;
+    uint8_t id;
+    uint8_t flags; //header flags of every fragment
+    bool erase_if_full;
+    uint32_t size; //payload size given to open
+    uint32_t written; //payload bytes written so far
+    uint32_t remaining; //record bytes not yet staged, payload and crc
+    uint32_t left; //bytes left in the current fragment
+    uint32_t head; //offset of the first fragment, for smudging
+    uint32_t first_sector; //the record must not wrap onto this sector
+    uint32_t pos; //write offset, rb->next is left to the reader
+    uint32_t readnext; //rb->next saved during a write
+    uint32_t crc; //running payload crc
+} rb_writer_t;
+
+//an independent read position in rb, see rb_cursor_open
+typedef struct {
+    rb_t *rb;
+    uint32_t next; //read pointer into the flash ring, like rb->next
+} rb_cursor_t;
+
+//records of one sector a reverse cursor holds at a time
+#ifndef RB_RCURSOR_SLOTS
+#define RB_RCURSOR_SLOTS 16
+#endif
+//a newest first read position in rb, see rb_rcursor_open
+typedef struct {
+    rb_t *rb;
+    uint32_t sector; //sector being read
+    uint32_t index; //its sector index
+    uint32_t limit; //records from here on were returned already
+    uint32_t count; //records left in at
+    bool more; //the sector has records before at[0] too
+    uint16_t at[RB_RCURSOR_SLOTS]; //sector offsets of the next records, oldest first
+    uint8_t id[RB_RCURSOR_SLOTS];
+} rb_rcursor_t;
+
+//state of one chunked read, see rb_reader_open
+typedef struct {
+    rb_t *rb;
+    uint8_t id; //id of the record
+    uint32_t at; //offset of its header, for rb_delete_at
+    uint32_t length; //payload length
+    uint32_t taken; //record bytes read or skipped, the crc trailer counts too
+    uint32_t pos; //offset of the next byte to read
+    uint32_t left; //bytes left in the current fragment
+    uint32_t fragments; //number of sectors the record is in
+    uint32_t crc; //running payload crc
+    bool has_crc; //record ends with a crc trailer
+    bool check; //crc still being checked
+} rb_reader_t;
+
+//one record for rb_append_batch
+typedef struct {
+    uint8_t id;
+    const void *data;
+    uint32_t size;
+} rb_batch_entry_t;
+
+//part of a record in memory mapped flash, see rb_peek
+typedef struct {
+    const uint8_t *data;
+    uint32_t len;
+} rb_segment_t;
+//rb_append splits a record over at most two sectors
+#define RB_PEEK_SEGMENTS 2
+
 typedef enum rberrors {
     RB_OK = 0,
     RB_BAD_CALLER_DATA = -1,
@@ -168,6 +385,9 @@ typedef enum rberrors {
     RB_HDR_LOOP = -6,
     RB_HDR_ID_NOT_FOUND = -7,
     RB_FULL = -8,
+    RB_BAD_PAYLOAD_CRC = -9,
+    RB_RECORD_TOO_BIG = -10,
+    RB_FLASH_ERROR = -11, //the device failed an erase or program
     RB_REALLY_BIG_VALUE = 1<<17
 } rb_errors_t;
 
@@ -183,19 +403,131 @@ rb_errors_t rb_create(rb_t *rb, uint32_t base_address,
 //helper to create and re-create (if data is bad) a buffer control block
 rb_errors_t rb_recreate(rb_t *rb, uint32_t base_address,
                             size_t number_of_sectors, enum init_choices init_choice);
+/*
+ the same on flash device dev, in sectors of its erase unit. The calls above
+ use flash_default_dev, the pool and fixed size rings are only on that.
+*/
+rb_errors_t rb_create_on(rb_t *rb, const flash_dev_t *dev, uint32_t base_address,
+                         size_t number_of_sectors, enum init_choices init_choice);
+rb_errors_t rb_recreate_on(rb_t *rb, const flash_dev_t *dev, uint32_t base_address,
+                           size_t number_of_sectors, enum init_choices init_choice);
+/*
+ like rb_recreate, but the last of number_of_sectors keeps checkpoints, so
+ mounting reads a few headers instead of scanning the ring. Always mount the
+ flash with rb_mount and the same number of sectors.
+*/
+rb_errors_t rb_mount(rb_t *rb, uint32_t base_address, size_t number_of_sectors,
+                     enum init_choices init_choice);
+rb_errors_t rb_mount_on(rb_t *rb, const flash_dev_t *dev, uint32_t base_address,
+                        size_t number_of_sectors, enum init_choices init_choice);
+//create rb over the sectors of one stream of a mounted pool, see rb_pool.h
+rb_errors_t rb_create_pooled(rb_t *rb, struct rb_pool *pool, uint8_t stream,
+                             enum init_choices init_choice);
+/*
+ ring of records all record_size long, without record headers. Records are
+ numbered from the first the ring ever had, rb_fixed_read finds any of them
+ reading one sector header. Only use the rb_fixed calls on such a ring.
+*/
+rb_errors_t rb_create_fixed(rb_t *rb, uint32_t base_address, size_t number_of_sectors,
+                            uint32_t record_size, enum init_choices init_choice);
+rb_errors_t rb_fixed_append(rb_t *rb, const void *data, uint8_t *pagebuffer,
+                            bool erase_if_full);
+//read record number record, returns record_size or a negative status
+int rb_fixed_read(rb_t *rb, uint32_t record, void *data);
+rb_errors_t rb_fixed_delete(rb_t *rb, uint32_t record, uint8_t *pagebuffer);
+//number of the oldest record still in the ring, and one past the newest
+rb_errors_t rb_fixed_range(rb_t *rb, uint32_t *first, uint32_t *end);
+//write a checkpoint of the current tail now, before a power off say
+rb_errors_t rb_checkpoint(rb_t *rb, uint8_t *pagebuffer);
+//copy the counters of rb, or of all rings with rb NULL. All 0 without RB_STATS
+rb_errors_t rb_get_stats(rb_t *rb, rb_stats_t *stats);
+void rb_reset_stats(rb_t *rb);
 //page buffer must be passed with a full page of temp buffer for writes
 rb_errors_t rb_append(rb_t *rb, uint8_t id, const void *data, uint32_t size,
                       uint8_t *pagebuffer, bool erase_if_full);
+//append many records, programming each touched page once. returns number appended
+int rb_append_batch(rb_t *rb, const rb_batch_entry_t *entries, uint32_t count,
+                    uint8_t *pagebuffer, bool erase_if_full);
+/*
+ buffered (group commit) writes, see ring_buffer.c for the durability window.
+ While buffered, appends may pass a NULL pagebuffer, rb keeps its own.
+*/
+rb_errors_t rb_set_buffered(rb_t *rb, uint8_t *pagebuffer, uint32_t deadline_us);
+rb_errors_t rb_clear_buffered(rb_t *rb);
+rb_errors_t rb_sync(rb_t *rb);
+rb_errors_t rb_poll(rb_t *rb);
+//keep sectors after the tail erased, so appends do not wait on an erase
+rb_errors_t rb_set_erase_ahead(rb_t *rb, uint32_t sectors);
+rb_errors_t rb_maintain(rb_t *rb);
+//copy the live records of the oldest sector to the tail before erasing it
+rb_errors_t rb_set_compaction(rb_t *rb, uint8_t max_live_pct, uint8_t *pagebuffer);
+int rb_compact(rb_t *rb, uint8_t *pagebuffer);
+//store a crc32 after each new record payload, rb_read verifies it
+rb_errors_t rb_set_payload_crc(rb_t *rb, bool on);
+/*
+ streaming append of one record of any size that fits the ring less one
+ sector. pagebuffer (if rb is not buffered) must stay valid until close.
+*/
+rb_errors_t rb_writer_open(rb_writer_t *w, rb_t *rb, uint8_t id, uint32_t size,
+                           uint8_t *pagebuffer, bool erase_if_full);
+rb_errors_t rb_writer_write(rb_writer_t *w, const void *data, uint32_t size);
+rb_errors_t rb_writer_close(rb_writer_t *w);
+/*
+ keep a read cache for rb, or none with cache NULL. Our own programs and
+ erases through rb keep it up to date, so only cache an rb that is the only
+ writer of its flash. rb_create and the like drop it, set it again after.
+*/
+rb_errors_t rb_set_cache(rb_t *rb, rb_cache_t *cache);
+//pad records so each starts uint32 aligned, only for an empty ring
+rb_errors_t rb_set_aligned(rb_t *rb, bool on);
 int rb_read(rb_t *rb, uint8_t id, void *data, uint32_t size);
+/*
+ chunked rb_read: open returns the record length, then read it in pieces of
+ any size (0 at the end) or skip parts of it
+*/
+int rb_reader_open(rb_reader_t *r, rb_t *rb, uint8_t id);
+int rb_reader_read(rb_reader_t *r, void *data, uint32_t size);
+int rb_reader_skip(rb_reader_t *r, uint32_t size);
+//zero copy rb_read, returns the record length and where it is in flash
+int rb_peek(rb_t *rb, uint8_t id, rb_segment_t seg[RB_PEEK_SEGMENTS]);
 int rb_find(rb_t *rb, uint8_t id, const void *data, uint32_t size, uint8_t *scratch);
 /* given a writeable page, delete a matching id, string entry */
 rb_errors_t rb_delete(rb_t *rb, uint8_t id, const void *data, uint32_t size, uint8_t *pagebuffer);
+rb_errors_t rb_delete_at(rb_t *rb, uint32_t offset, uint8_t *pagebuffer);
 rb_errors_t rb_check_sector_ring(rb_t *rb);
+//RB_OK, RB_BLANK_HDR or RB_BAD_HDR
+rb_errors_t rb_sector_header_good(rb_sector_header *shdr);
+/*
+ read cursors, each with its own position at the oldest record of a created
+ rb. The calls work like the rb ones without touching rb->next.
+*/
+rb_errors_t rb_cursor_open(rb_cursor_t *c, rb_t *rb);
+int rb_cursor_read(rb_cursor_t *c, uint8_t id, void *data, uint32_t size);
+int rb_cursor_reader_open(rb_reader_t *r, rb_cursor_t *c, uint8_t id);
+int rb_cursor_peek(rb_cursor_t *c, uint8_t id, rb_segment_t seg[RB_PEEK_SEGMENTS]);
+int rb_cursor_find(rb_cursor_t *c, uint8_t id, const void *data, uint32_t size,
+                   uint8_t *scratch);
+/*
+ reverse cursors read newest first, from the records there were at open on
+ back to the oldest. The end is RB_BLANK_HDR, as for rb_read.
+*/
+rb_errors_t rb_rcursor_open(rb_rcursor_t *c, rb_t *rb);
+int rb_read_prev(rb_rcursor_t *c, uint8_t id, void *data, uint32_t size);
+int rb_rcursor_reader_open(rb_reader_t *r, rb_rcursor_t *c, uint8_t id);
+/*
+ time rings: appends index each sector by the timestamp of its first record,
+ rb_seek_time then moves a cursor near the first record at or after ts
+*/
+rb_errors_t rb_set_timestamps(rb_t *rb, timestamp_extractor_t timestamp_of);
+rb_errors_t rb_seek_time(rb_cursor_t *c, uint64_t ts);
 //get defines from the .ld link map
 //users can divide this flash space as they wish
+//host builds define these without a linker script
+#ifndef __PERSISTENT_TABLE
 extern char __flash_persistent_start;
 extern char __flash_persistent_length;
 #define __PERSISTENT_TABLE  ((uint32_t) &__flash_persistent_start)
 #define __PERSISTENT_LEN    ((uint32_t) &__flash_persistent_length)
+#endif
 
 #endif
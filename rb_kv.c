@@ -0,0 +1,299 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "rb_kv.h"
+
+/*
+ The index is an open addressed hash table of record offsets, probed
+ linearly. Only a hash of each key is kept in RAM; a hit is confirmed by
+ reading the key back from flash, so every get or put reads one record
+ header and key. A deleted key leaves a mark so probing goes on past it,
+ rebuilding the index clears them.
+
+ A put does not smudge the record it replaces right away. The old offset
+ waits in retire until it fills up or rb_kv_retire is called, so a burst of
+ puts costs one page program each and the smudges come later. Until then a
+ power cut just leaves both records, and the newer one still wins when the
+ ring is scanned again. Compacting rings copy live records to the tail and
+ would make an unsmudged old value the newest, so there every put retires
+ at once.
+
+ Any erase moves or removes records under the index. rb->erases tells, and
+ the index is then built again by scanning the ring.
+*/
+#define RB_KV_EMPTY 0xffffffff
+#define RB_KV_DELETED 0xfffffffe
+
+//fnv-1a over the id and key
+static uint32_t rb_kv_hash(uint8_t id, const uint8_t *key, uint32_t keylen) {
+    uint32_t h = 2166136261u;
+    h = (h ^ id) * 16777619u;
+    for (uint32_t i = 0; i < keylen; i++) {
+        h = (h ^ key[i]) * 16777619u;
+    }
+    return h;
+}
+//readers give the offset after a sector header, the writer the one before
+static uint32_t rb_kv_at(rb_t *rb, uint32_t offset) {
+    return RB_MOD_SECTOR(rb, offset) ? offset : offset + sizeof(rb_sector_header);
+}
+//read the start of an opened record, returns its key length
+static int rb_kv_key(rb_kv_t *kv, rb_reader_t *r, uint8_t key[RB_KV_MAX_KEY]) {
+    int n = rb_reader_read(r, key, MIN(r->length, RB_KV_MAX_KEY));
+    if (n < 0) {
+        return n;
+    }
+    uint32_t keylen = kv->keylen ? kv->keylen(r->id, key, n) : 0;
+    return keylen <= (uint32_t)n ? (int)keylen : RB_RECORD_TOO_BIG;
+}
+//open the record of id at offset, if it is still there
+static int rb_kv_open_at(rb_kv_t *kv, uint32_t offset, uint8_t id, rb_reader_t *r) {
+    rb_cursor_t c = {kv->rb, offset};
+    int len = rb_cursor_reader_open(r, &c, id);
+    if (len >= 0 && r->at != offset) {
+        return RB_HDR_ID_NOT_FOUND; //gone, this is a later one
+    }
+    return len;
+}
+//slot of the key or -1, and in *spot where a new key would go (-1 if none)
+static int rb_kv_find(rb_kv_t *kv, uint8_t id, const uint8_t *key, uint32_t keylen,
+                      uint32_t hash, int *spot) {
+    uint8_t stored[RB_KV_MAX_KEY];
+    rb_reader_t r;
+    *spot = -1;
+    for (uint32_t i = 0; i < RB_KV_SLOTS; i++) {
+        int n = (hash + i) & (RB_KV_SLOTS - 1);
+        rb_kv_slot_t *s = &kv->slot[n];
+        if (s->offset == RB_KV_EMPTY || s->offset == RB_KV_DELETED) {
+            if (*spot < 0) {
+                *spot = n;
+            }
+            if (s->offset == RB_KV_EMPTY) {
+                break;
+            }
+            continue;
+        }
+        if (s->hash == hash && rb_kv_open_at(kv, s->offset, id, &r) >= 0 &&
+            rb_kv_key(kv, &r, stored) == (int)keylen && !memcmp(stored, key, keylen)) {
+            return n;
+        }
+    }
+    return -1;
+}
+//a new key fits at spot
+static bool rb_kv_room(rb_kv_t *kv, int spot) {
+    return spot >= 0 && (kv->slot[spot].offset == RB_KV_DELETED ||
+                         kv->used < RB_KV_SLOTS * 3 / 4);
+}
+//queue a replaced record to be smudged
+static void rb_kv_replaced(rb_kv_t *kv, uint32_t offset, uint8_t *pagebuffer) {
+    if (kv->retired == RB_KV_RETIRE) {
+        if (pagebuffer == NULL) {
+            kv->overflow = true; //found again by the next scan
+            return;
+        }
+        rb_kv_retire(kv, pagebuffer);
+    }
+    kv->retire[kv->retired++] = offset;
+}
+//make offset the newest record of the key in slot n, or a new key at spot
+static void rb_kv_set(rb_kv_t *kv, int n, int spot, uint32_t hash, uint32_t offset,
+                      uint8_t *pagebuffer) {
+    if (n >= 0) {
+        rb_kv_replaced(kv, kv->slot[n].offset, pagebuffer);
+    } else {
+        n = spot;
+        if (kv->slot[n].offset == RB_KV_EMPTY) {
+            kv->used++;
+        }
+        kv->count++;
+    }
+    kv->slot[n].hash = hash;
+    kv->slot[n].offset = offset;
+}
+/*
+ scan the ring oldest first, so the last record of a key seen is the newest.
+ Returns RB_FULL if some keys did not fit the index.
+*/
+static rb_errors_t rb_kv_build(rb_kv_t *kv, uint8_t *pagebuffer) {
+    rb_cursor_t c;
+    rb_reader_t r;
+    uint8_t key[RB_KV_MAX_KEY];
+    rb_errors_t res = RB_OK;
+    rb_t *rb = kv->rb;
+    if (pagebuffer == NULL && rb->compact_pct) {
+        pagebuffer = rb->compact_page; //replaced records must not be compacted
+    }
+    for (uint32_t i = 0; i < RB_KV_SLOTS; i++) {
+        kv->slot[i].offset = RB_KV_EMPTY;
+    }
+    kv->count = kv->used = kv->retired = 0;
+    kv->overflow = false;
+    kv->erases = rb->erases;
+    rb_errors_t hdr_res = rb_cursor_open(&c, rb);
+    if (hdr_res != RB_OK) {
+        return hdr_res;
+    }
+    while (true) {
+        int len = rb_cursor_reader_open(&r, &c, RB_ANY_ID);
+        if (len == RB_BAD_PAYLOAD_CRC) {
+            continue; //too damaged to be anything
+        }
+        if (len < 0) {
+            break; //the end of the ring
+        }
+        int keylen = rb_kv_key(kv, &r, key);
+        if (keylen < 0) {
+            continue; //damaged, or not a record of this store
+        }
+        int spot;
+        uint32_t hash = rb_kv_hash(r.id, key, keylen);
+        int n = rb_kv_find(kv, r.id, key, keylen, hash, &spot);
+        if (n < 0 && !rb_kv_room(kv, spot)) {
+            res = RB_FULL;
+            continue;
+        }
+        rb_kv_set(kv, n, spot, hash, r.at, pagebuffer);
+    }
+    if (rb->compact_pct && pagebuffer != NULL) {
+        rb_kv_retire(kv, pagebuffer);
+    }
+    return res;
+}
+/*
+ build the index again if an erase may have moved records, or when writing
+ and retire overflowed. Retiring an overflowed queue scans again, which would
+ move the slots under a put or delete that already looked its key up.
+*/
+static rb_errors_t rb_kv_refresh(rb_kv_t *kv, uint8_t *pagebuffer) {
+    if (kv->erases != kv->rb->erases || (kv->overflow && pagebuffer != NULL)) {
+        return rb_kv_build(kv, pagebuffer);
+    }
+    return RB_OK;
+}
+static bool rb_kv_bad_key(rb_kv_t *kv, uint8_t id, const void *key, uint32_t keylen) {
+    return kv == NULL || kv->rb == NULL || id == RB_SYSTEM_ID || id == 0xff ||
+           keylen > RB_KV_MAX_KEY || (key == NULL && keylen);
+}
+rb_errors_t rb_kv_open(rb_kv_t *kv, rb_t *rb, rb_kv_keylen_t keylen) {
+    if (kv == NULL || rb == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    kv->rb = rb;
+    kv->keylen = keylen;
+    return rb_kv_build(kv, NULL);
+}
+int rb_kv_get(rb_kv_t *kv, uint8_t id, const void *key, uint32_t keylen,
+              void *value, uint32_t size) {
+    uint8_t stored[RB_KV_MAX_KEY];
+    rb_reader_t r;
+    int spot;
+    if (rb_kv_bad_key(kv, id, key, keylen) || value == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    rb_kv_refresh(kv, NULL);
+    int n = rb_kv_find(kv, id, key, keylen, rb_kv_hash(id, key, keylen), &spot);
+    if (n < 0) {
+        return RB_HDR_ID_NOT_FOUND;
+    }
+    int res = rb_kv_open_at(kv, kv->slot[n].offset, id, &r);
+    if (res >= 0) {
+        //read the key again rather than skip it, so the crc is checked
+        res = rb_reader_read(&r, stored, keylen);
+    }
+    return res < 0 ? res : rb_reader_read(&r, value, size);
+}
+rb_errors_t rb_kv_put(rb_kv_t *kv, uint8_t id, const void *key, uint32_t keylen,
+                      const void *value, uint32_t size, uint8_t *pagebuffer) {
+    rb_writer_t w;
+    int spot;
+    if (rb_kv_bad_key(kv, id, key, keylen) || (value == NULL && size) ||
+        keylen + size == 0 || (pagebuffer == NULL && !kv->rb->buffered)) {
+        return RB_BAD_CALLER_DATA;
+    }
+    rb_errors_t hdr_res = rb_kv_refresh(kv, pagebuffer);
+    if (hdr_res != RB_OK && hdr_res != RB_FULL) {
+        return hdr_res;
+    }
+    uint32_t hash = rb_kv_hash(id, key, keylen);
+    int n = rb_kv_find(kv, id, key, keylen, hash, &spot);
+    if (n < 0 && !rb_kv_room(kv, spot) && kv->used > kv->count) {
+        rb_kv_build(kv, pagebuffer); //clear the deleted marks
+        n = rb_kv_find(kv, id, key, keylen, hash, &spot);
+    }
+    if (n < 0 && !rb_kv_room(kv, spot)) {
+        return RB_FULL;
+    }
+    hdr_res = rb_writer_open(&w, kv->rb, id, keylen + size, pagebuffer, true);
+    if (hdr_res != RB_OK) {
+        return hdr_res;
+    }
+    if (keylen) {
+        hdr_res = rb_writer_write(&w, key, keylen);
+    }
+    if (hdr_res == RB_OK && size) {
+        hdr_res = rb_writer_write(&w, value, size);
+    }
+    //close smudges the record if a write failed
+    rb_errors_t close_res = rb_writer_close(&w);
+    if (hdr_res == RB_OK) {
+        hdr_res = close_res;
+    }
+    if (hdr_res != RB_OK) {
+        return hdr_res;
+    }
+    if (kv->erases != kv->rb->erases) {
+        //the put erased a sector, the scan finds the new record too
+        hdr_res = rb_kv_build(kv, pagebuffer);
+        return hdr_res == RB_FULL ? RB_OK : hdr_res;
+    }
+    rb_kv_set(kv, n, spot, hash, rb_kv_at(kv->rb, w.head), pagebuffer);
+    if (kv->retired == RB_KV_RETIRE || kv->rb->compact_pct) {
+        return rb_kv_retire(kv, pagebuffer);
+    }
+    return RB_OK;
+}
+//remove a key, its records are smudged now so it stays deleted
+rb_errors_t rb_kv_delete(rb_kv_t *kv, uint8_t id, const void *key, uint32_t keylen,
+                         uint8_t *pagebuffer) {
+    int spot;
+    if (rb_kv_bad_key(kv, id, key, keylen) || pagebuffer == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    //after an overflow older versions of the key were dropped from retire,
+    //and would be the newest once this one is smudged. The scan queues them
+    rb_errors_t hdr_res = rb_kv_refresh(kv, pagebuffer);
+    if (hdr_res != RB_OK && hdr_res != RB_FULL) {
+        return hdr_res;
+    }
+    int n = rb_kv_find(kv, id, key, keylen, rb_kv_hash(id, key, keylen), &spot);
+    if (n < 0) {
+        return RB_HDR_ID_NOT_FOUND;
+    }
+    rb_kv_replaced(kv, kv->slot[n].offset, pagebuffer);
+    kv->slot[n].offset = RB_KV_DELETED;
+    kv->count--;
+    return rb_kv_retire(kv, pagebuffer);
+}
+rb_errors_t rb_kv_retire(rb_kv_t *kv, uint8_t *pagebuffer) {
+    rb_errors_t res = RB_OK;
+    if (kv == NULL || kv->rb == NULL || pagebuffer == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    if (kv->erases != kv->rb->erases) {
+        //the queued offsets may point anywhere now, scanning finds them again
+        return rb_kv_build(kv, pagebuffer);
+    }
+    for (uint32_t i = 0; i < kv->retired; i++) {
+        rb_errors_t err = rb_delete_at(kv->rb, kv->retire[i], pagebuffer);
+        if (err != RB_OK) {
+            res = err;
+        }
+    }
+    kv->retired = 0;
+    if (kv->overflow) {
+        return rb_kv_build(kv, pagebuffer);
+    }
+    return res;
+}
@@ -0,0 +1,315 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "rb_pool.h"
+#include "flash_sched.h"
+#include "crc.h"
+
+/*
+ shared sector pool, see rb_pool.h. Erases are queued on flash_default_sched
+ and run together before the pool is used again, so the sectors a mount
+ takes go as block erases where they line up.
+*/
+
+//flash address of pool sector
+static uint32_t rb_pool_address(rb_pool_t *pool, uint32_t sector) {
+    return pool->base_address + sector * FLASH_SECTOR_SIZE;
+}
+//where the erase count snapshots are, in flash
+static uint32_t rb_pool_counts_base(rb_pool_t *pool) {
+    return rb_pool_address(pool, pool->sectors);
+}
+static bool rb_pool_blank(const uint8_t *p, uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+        if (p[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+static uint32_t rb_pool_counts_crc(rb_pool_counts_t *c) {
+    return crc32_finalize(crc32_update(crc32_init(), c, offsetof(rb_pool_counts_t, crc)));
+}
+//snapshots are written in order, binary search for the first blank slot
+static uint32_t rb_pool_counts_end(rb_pool_t *pool) {
+    uint32_t lo = 0;
+    uint32_t hi = FLASH_SECTOR_SIZE / RB_POOL_SLOT;
+    uint32_t word;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        flash_read(rb_pool_counts_base(pool) + mid * RB_POOL_SLOT, &word, sizeof(word));
+        if (word == 0xffffffff) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo * RB_POOL_SLOT;
+}
+//load the newest snapshot, the newest may be torn, then the one before will do
+static void rb_pool_load_counts(rb_pool_t *pool) {
+    rb_pool_counts_t c;
+    pool->slot = rb_pool_counts_end(pool);
+    memset(pool->erases, 0, sizeof(pool->erases));
+    for (uint32_t back = 1; back <= 2 && back * RB_POOL_SLOT <= pool->slot; back++) {
+        flash_read(rb_pool_counts_base(pool) + pool->slot - back * RB_POOL_SLOT, &c, sizeof(c));
+        if (c.crc == rb_pool_counts_crc(&c)) {
+            memcpy(pool->erases, c.erases, sizeof(pool->erases));
+            return;
+        }
+    }
+}
+//runs the queued erases first, returns 0 or the first device error
+static int rb_pool_save_counts(rb_pool_t *pool) {
+    rb_pool_counts_t c;
+    memcpy(c.erases, pool->erases, sizeof(c.erases));
+    c.crc = rb_pool_counts_crc(&c);
+    if (pool->slot >= FLASH_SECTOR_SIZE) {
+        int err = flash_dev_erase(&flash_default_dev, rb_pool_counts_base(pool),
+                                  FLASH_SECTOR_SIZE);
+        if (err) {
+            return err;
+        }
+        pool->slot = 0;
+    }
+    memset(pool->page, 0xff, FLASH_PAGE_SIZE);
+    memcpy(pool->page + MOD_PAGE(pool->slot), &c, sizeof(c));
+    pool->slot += RB_POOL_SLOT;
+    return flash_prog_range(&flash_default_dev, rb_pool_counts_base(pool) +
+                            FLASH_PAGE(pool->slot - RB_POOL_SLOT), pool->page,
+                            MOD_PAGE(pool->slot - RB_POOL_SLOT),
+                            MOD_PAGE(pool->slot - RB_POOL_SLOT) + sizeof(c));
+}
+//queue the erase of a pool sector, it is run before the sector is read or written
+static int rb_pool_erase(rb_pool_t *pool, uint8_t sector) {
+    pool->erases[sector]++;
+    return flash_sched_erase(&flash_default_sched, rb_pool_address(pool, sector),
+                             FLASH_SECTOR_SIZE);
+}
+//hand a free sector to stream, erasing it unless it is known blank
+static int rb_pool_take(rb_pool_t *pool, uint8_t sector, uint8_t stream) {
+    int erased = 0;
+    if (!(pool->blank & (1u << sector))) {
+        erased = rb_pool_erase(pool, sector) ? RB_FLASH_ERROR : 1;
+    }
+    pool->blank &= ~(1u << sector);
+    pool->owner[sector] = stream;
+    return erased;
+}
+/*
+ the free sector that ends up least worn once taken, a dirty one still needs
+ an erase. On a tie blank sectors go first, then prefer.
+*/
+static uint8_t rb_pool_pick(rb_pool_t *pool, uint8_t prefer) {
+    uint8_t best = RB_POOL_FREE;
+    uint32_t best_wear = 0;
+    uint32_t best_rank = 0;
+    for (uint32_t s = 0; s < pool->sectors; s++) {
+        if (pool->owner[s] != RB_POOL_FREE) {
+            continue;
+        }
+        bool blank = pool->blank & (1u << s);
+        uint32_t wear = pool->erases[s] + (blank ? 0 : 1);
+        uint32_t rank = (blank ? 2 : 0) + (s == prefer ? 1 : 0);
+        if (best == RB_POOL_FREE || wear < best_wear || (wear == best_wear && rank > best_rank)) {
+            best = s;
+            best_wear = wear;
+            best_rank = rank;
+        }
+    }
+    return best;
+}
+//clear the live flag of a sector going back to the pool, so mounting skips it
+static void rb_pool_release(rb_pool_t *pool, uint8_t sector) {
+    rb_sector_header hdr;
+    pool->owner[sector] = RB_POOL_FREE;
+    pool->blank &= ~(1u << sector);
+    flash_read(rb_pool_address(pool, sector), &hdr, sizeof(hdr));
+    if (rb_sector_header_good(&hdr) == RB_OK && (get_crc(&hdr) & RB_SECTOR_LIVE)) {
+        //the flag byte is the first byte of the sector, programming only clears bits
+        memset(pool->page, 0xff, FLASH_PAGE_SIZE);
+        pool->page[0] = get_crc(&hdr) & ~RB_SECTOR_LIVE;
+        flash_prog_range(&flash_default_dev, rb_pool_address(pool, sector), pool->page, 0, 1);
+    }
+}
+/*
+ static wear leveling. Streams written rarely keep their sectors and those
+ never wear, so when the most worn free sector is RB_POOL_WEAR_GAP erases
+ ahead of the least worn sector of another stream, copy that cold sector onto
+ the worn one and free it for the hot streams.
+*/
+static int rb_pool_level(rb_pool_t *pool, uint8_t stream) {
+    uint8_t cold = RB_POOL_FREE;
+    uint8_t worn = RB_POOL_FREE;
+    for (uint32_t s = 0; s < pool->sectors; s++) {
+        if (pool->owner[s] == RB_POOL_FREE) {
+            if (worn == RB_POOL_FREE || pool->erases[s] > pool->erases[worn]) {
+                worn = s;
+            }
+        } else if (pool->owner[s] != stream) {
+            if (cold == RB_POOL_FREE || pool->erases[s] < pool->erases[cold]) {
+                cold = s;
+            }
+        }
+    }
+    if (cold == RB_POOL_FREE || worn == RB_POOL_FREE ||
+        pool->erases[worn] < pool->erases[cold] + RB_POOL_WEAR_GAP) {
+        return 0;
+    }
+    uint8_t owner = pool->owner[cold];
+    int erased = rb_pool_take(pool, worn, owner);
+    //blank pages are left out, the worn sector is blank there already
+    for (uint32_t page = 0; page < FLASH_SECTOR_SIZE && erased >= 0; page += FLASH_PAGE_SIZE) {
+        flash_read(rb_pool_address(pool, cold) + page, pool->page, FLASH_PAGE_SIZE);
+        if (!rb_pool_blank(pool->page, FLASH_PAGE_SIZE) &&
+            flash_prog_range(&flash_default_dev, rb_pool_address(pool, worn) + page,
+                             pool->page, 0, FLASH_PAGE_SIZE)) {
+            erased = RB_FLASH_ERROR;
+        }
+    }
+    if (erased < 0) {
+        //the cold sector stays where it is, worn goes back to the pool
+        pool->owner[worn] = RB_POOL_FREE;
+        return erased;
+    }
+    for (uint32_t i = 0; i < pool->quota[owner]; i++) {
+        if (pool->map[owner][i] == cold) {
+            pool->map[owner][i] = worn;
+        }
+    }
+    //until released both copies are live, mounting keeps just one
+    rb_pool_release(pool, cold);
+    pool->moves++;
+    return erased;
+}
+int rb_pool_replace(rb_pool_t *pool, uint8_t stream, uint32_t sector) {
+    uint8_t old = pool->map[stream][sector];
+    //the old sector can be taken again, if it is still the least worn
+    pool->owner[old] = RB_POOL_FREE;
+    pool->blank &= ~(1u << old);
+    uint8_t taken = rb_pool_pick(pool, old);
+    if (taken != old) {
+        rb_pool_release(pool, old);
+    }
+    int erased = rb_pool_take(pool, taken, stream);
+    pool->map[stream][sector] = taken;
+    if (erased < 0 || flash_sched_run(&flash_default_sched)) {
+        return RB_FLASH_ERROR;
+    }
+    int moved = rb_pool_level(pool, stream);
+    if (moved < 0 || flash_sched_run(&flash_default_sched)) {
+        return RB_FLASH_ERROR;
+    }
+    erased += moved;
+    if (erased && rb_pool_save_counts(pool)) {
+        return RB_FLASH_ERROR;
+    }
+    return erased;
+}
+/*
+ add a live sector to the ones of its stream, kept in index order, oldest
+ first. Only the newest quota of them are kept, the rest are older than the
+ ring and are released. The same index twice is a copy left by a cut off move.
+*/
+static void rb_pool_keep(rb_pool_t *pool, uint32_t *index, uint8_t *count, uint8_t stream,
+                         uint8_t sector, uint32_t sector_index) {
+    uint8_t *map = pool->map[stream];
+    uint32_t n = *count;
+    uint32_t i;
+    for (i = 0; i < n; i++) {
+        if (index[i] == sector_index) {
+            rb_pool_release(pool, sector);
+            return;
+        }
+    }
+    if (n == pool->quota[stream]) {
+        if (sector_index < index[0]) {
+            rb_pool_release(pool, sector);
+            return;
+        }
+        rb_pool_release(pool, map[0]);
+        n--;
+        memmove(index, index + 1, n * sizeof(*index));
+        memmove(map, map + 1, n);
+    }
+    for (i = n; i > 0 && index[i - 1] > sector_index; i--) {
+        index[i] = index[i - 1];
+        map[i] = map[i - 1];
+    }
+    index[i] = sector_index;
+    map[i] = sector;
+    pool->owner[sector] = stream;
+    *count = n + 1;
+}
+rb_errors_t rb_pool_mount(rb_pool_t *pool, uint32_t base_address, size_t number_of_sectors,
+                          const uint8_t *quota, uint8_t streams,
+                          enum init_choices init_choice) {
+    uint32_t index[RB_POOL_STREAMS][RB_POOL_SECTORS];
+    uint8_t count[RB_POOL_STREAMS];
+    uint32_t needed = 0;
+    int erased = 0;
+    rb_sector_header hdr;
+
+    if (pool == NULL || quota == NULL || streams < 1 || streams > RB_POOL_STREAMS ||
+        number_of_sectors < 2 || number_of_sectors - 1 > RB_POOL_SECTORS) {
+        return RB_BAD_CALLER_DATA;
+    }
+    for (uint32_t st = 0; st < streams; st++) {
+        if (quota[st] < 1) {
+            return RB_BAD_CALLER_DATA;
+        }
+        needed += quota[st];
+        count[st] = 0;
+    }
+    if (needed > number_of_sectors - 1) {
+        return RB_BAD_CALLER_DATA;
+    }
+    pool->base_address = base_address % XIP_BASE;
+    pool->sectors = number_of_sectors - 1;
+    pool->streams = streams;
+    memcpy(pool->quota, quota, streams);
+    pool->blank = 0;
+    pool->moves = 0;
+    rb_pool_load_counts(pool);
+    //find the live sectors of each stream, and the ones known blank
+    for (uint32_t s = 0; s < pool->sectors; s++) {
+        pool->owner[s] = RB_POOL_FREE;
+        flash_read(rb_pool_address(pool, s), &hdr, sizeof(hdr));
+        rb_errors_t t = rb_sector_header_good(&hdr);
+        uint32_t st = get_index(&hdr) >> RB_POOL_INDEX_BITS;
+        if (t == RB_BLANK_HDR) {
+            if (rb_pool_blank(flash_mapped(rb_pool_address(pool, s)), FLASH_SECTOR_SIZE)) {
+                pool->blank |= 1u << s;
+            }
+        } else if (t == RB_OK && init_choice != CREATE_INIT_ALWAYS &&
+                   (get_crc(&hdr) & RB_SECTOR_LIVE) && st < streams) {
+            rb_pool_keep(pool, index[st], &count[st], st, s, get_index(&hdr));
+        }
+    }
+    //the rest of each ring are blank sectors after its newest, their erases
+    //are queued and run at once
+    for (uint32_t st = 0; st < streams; st++) {
+        for (uint32_t i = count[st]; i < quota[st]; i++) {
+            uint8_t s = rb_pool_pick(pool, RB_POOL_FREE);
+            int took = rb_pool_take(pool, s, st);
+            if (took < 0) {
+                return RB_FLASH_ERROR;
+            }
+            erased += took;
+            pool->map[st][i] = s;
+        }
+    }
+    if (flash_sched_run(&flash_default_sched) || (erased && rb_pool_save_counts(pool))) {
+        return RB_FLASH_ERROR;
+    }
+    return RB_OK;
+}
+void rb_pool_wear(rb_pool_t *pool, uint32_t *min, uint32_t *max) {
+    *min = UINT32_MAX;
+    *max = 0;
+    for (uint32_t s = 0; s < pool->sectors; s++) {
+        *min = MIN(*min, pool->erases[s]);
+        *max = MAX(*max, pool->erases[s]);
+    }
+}
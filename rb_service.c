@@ -0,0 +1,201 @@
+/*
+ * Copyright 2024, Steve Calfee. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "rb_service.h"
+#if PICO_ON_DEVICE
+#include <pico/multicore.h>
+#endif
+
+/*
+ The queue is a ring of RB_SERVICE_QUEUE_LEN slots between two counters.
+ head is only written by the producer, after it filled the slot, and tail
+ only by the service, after it appended the slot and set its status. Each
+ side publishes its counter with release and reads the other's with acquire,
+ so no locks and no read-modify-write atomics are needed, which the M0+ does
+ not have. Counters run modulo 2^31 so tickets fit the int return values.
+*/
+#define RB_SERVICE_COUNT_MASK 0x7fffffff
+
+static uint32_t rb_service_count(uint32_t n) {
+    return n & RB_SERVICE_COUNT_MASK;
+}
+static rb_service_slot_t *rb_service_slot(rb_service_t *svc, uint32_t count) {
+    return &svc->slot[count % RB_SERVICE_QUEUE_LEN];
+}
+
+rb_errors_t rb_service_init(rb_service_t *svc, rb_t *rb, uint8_t *pagebuffer,
+                            bool erase_if_full) {
+    if (svc == NULL || rb == NULL || (pagebuffer == NULL && !rb->buffered)) {
+        return RB_BAD_CALLER_DATA;
+    }
+    svc->rb = rb;
+    svc->pagebuffer = pagebuffer;
+    svc->erase_if_full = erase_if_full;
+    atomic_init(&svc->head, 0);
+    atomic_init(&svc->tail, 0);
+    atomic_init(&svc->stop, false);
+    atomic_init(&svc->running, false);
+    svc->full_waits = 0;
+    svc->flush_status = RB_OK;
+    return RB_OK;
+}
+//keep the first error of the flushes between appends
+static void rb_service_flushed(rb_service_t *svc, rb_errors_t err) {
+    if (svc->flush_status == RB_OK) {
+        svc->flush_status = err;
+    }
+}
+/*
+ Append queued records until stopped. With nothing queued, rb_poll keeps a
+ buffered rb within its deadline and an erase ahead rb erased, so the idle
+ time of the service core goes to the flash work appends would wait on.
+*/
+void rb_service_run(rb_service_t *svc) {
+    uint32_t tail = atomic_load_explicit(&svc->tail, memory_order_relaxed);
+    bool dirty = false; //appended since the last poll
+    do {
+        if (atomic_load_explicit(&svc->head, memory_order_acquire) == tail) {
+            if (dirty || svc->rb->staged) {
+                rb_service_flushed(svc, rb_poll(svc->rb));
+                dirty = false;
+            }
+            //the producer submits its last records before setting stop
+            if (atomic_load(&svc->stop) &&
+                atomic_load_explicit(&svc->head, memory_order_acquire) == tail) {
+                break;
+            }
+            tight_loop_contents();
+            continue;
+        }
+        rb_service_slot_t *s = rb_service_slot(svc, tail);
+        s->status = rb_append(svc->rb, s->id, s->data, s->size, svc->pagebuffer,
+                              svc->erase_if_full);
+        dirty = true;
+        tail = rb_service_count(tail + 1);
+        atomic_store_explicit(&svc->tail, tail, memory_order_release);
+    } while (1);
+    rb_service_flushed(svc, rb_sync(svc->rb));
+    atomic_store(&svc->running, false);
+}
+#if PICO_ON_DEVICE
+//core1 takes no argument, and there is only one core1
+static rb_service_t *core1_service;
+
+static void rb_service_core1(void) {
+    rb_service_run(core1_service);
+}
+#else
+static void *rb_service_thread(void *arg) {
+    rb_service_run(arg);
+    return NULL;
+}
+#endif
+/*
+ On the pico the service runs on core1. Flash can not be read while it is
+ programmed, so this core is set up to be locked out (see flash_onboard.c)
+ for each program and erase. It only stops for the flash operation itself,
+ not for a whole append, and keeps its interrupts.
+*/
+rb_errors_t rb_service_start(rb_service_t *svc) {
+    if (svc == NULL || svc->rb == NULL || atomic_load(&svc->running)) {
+        return RB_BAD_CALLER_DATA;
+    }
+    atomic_store(&svc->stop, false);
+    svc->flush_status = RB_OK;
+    atomic_store(&svc->running, true);
+#if PICO_ON_DEVICE
+    if (core1_service != NULL) {
+        atomic_store(&svc->running, false);
+        return RB_BAD_CALLER_DATA; //core1 already runs a service
+    }
+    core1_service = svc;
+    multicore_lockout_victim_init();
+    multicore_launch_core1(rb_service_core1);
+#else
+    if (pthread_create(&svc->thread, NULL, rb_service_thread, svc)) {
+        atomic_store(&svc->running, false);
+        return RB_BAD_CALLER_DATA;
+    }
+#endif
+    return RB_OK;
+}
+rb_errors_t rb_service_stop(rb_service_t *svc) {
+    if (svc == NULL || !atomic_load(&svc->running)) {
+        return RB_BAD_CALLER_DATA;
+    }
+    atomic_store(&svc->stop, true);
+#if PICO_ON_DEVICE
+    while (atomic_load(&svc->running)) {
+        tight_loop_contents();
+    }
+    multicore_reset_core1();
+    core1_service = NULL;
+#else
+    pthread_join(svc->thread, NULL);
+#endif
+    return svc->flush_status;
+}
+int rb_service_submit(rb_service_t *svc, uint8_t id, const void *data, uint32_t size,
+                      bool wait) {
+    if (svc == NULL || data == NULL || size == 0 || size > RB_SERVICE_MAX_RECORD ||
+        id == 0xff || id == RB_SYSTEM_ID) {
+        return RB_BAD_CALLER_DATA;
+    }
+    uint32_t head = atomic_load_explicit(&svc->head, memory_order_relaxed);
+    if (rb_service_pending(svc) == RB_SERVICE_QUEUE_LEN) {
+        svc->full_waits++;
+        if (!wait) {
+            return RB_FULL;
+        }
+        while (rb_service_pending(svc) == RB_SERVICE_QUEUE_LEN) {
+            if (!atomic_load(&svc->running)) {
+                return RB_BAD_CALLER_DATA; //nobody will make room
+            }
+            tight_loop_contents();
+        }
+    }
+    rb_service_slot_t *s = rb_service_slot(svc, head);
+    s->id = id;
+    s->size = size;
+    memcpy(s->data, data, size);
+    head = rb_service_count(head + 1);
+    atomic_store_explicit(&svc->head, head, memory_order_release);
+    return head; //ticket of this record
+}
+//true once the record with ticket has been appended
+bool rb_service_done(rb_service_t *svc, uint32_t ticket) {
+    if (svc == NULL) {
+        return false;
+    }
+    uint32_t tail = atomic_load_explicit(&svc->tail, memory_order_acquire);
+    return rb_service_count(tail - ticket) <= RB_SERVICE_COUNT_MASK / 2;
+}
+/*
+ wait until the record with ticket is appended and return its rb_append
+ status. The status of a slot is only kept until it is reused, so it is known
+ for the last RB_SERVICE_QUEUE_LEN tickets.
+*/
+rb_errors_t rb_service_wait(rb_service_t *svc, uint32_t ticket) {
+    if (svc == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    while (!rb_service_done(svc, ticket)) {
+        if (!atomic_load(&svc->running)) {
+            return RB_BAD_CALLER_DATA;
+        }
+        tight_loop_contents();
+    }
+    uint32_t head = atomic_load_explicit(&svc->head, memory_order_relaxed);
+    if (rb_service_count(head - ticket) >= RB_SERVICE_QUEUE_LEN) {
+        return RB_BAD_CALLER_DATA; //too old, the slot was reused
+    }
+    return rb_service_slot(svc, ticket - 1)->status;
+}
+uint32_t rb_service_pending(rb_service_t *svc) {
+    if (svc == NULL) {
+        return 0;
+    }
+    return rb_service_count(atomic_load_explicit(&svc->head, memory_order_relaxed) -
+                            atomic_load_explicit(&svc->tail, memory_order_acquire));
+}
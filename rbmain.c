@@ -54,9 +54,9 @@ static rb_errors_t writer(rb_t *rb, uint8_t *data, uint32_t size) {
     cb_entry_t entry;
     entry.timestamp = timestamp;
     entry.data = temperature;
-    printf("Writing timestamp=%.1f,temperature=%.2f size=0x%lx ", (double)entry.timestamp / 1000000, entry.data, size);
+    printf("Writing timestamp=%.1f,temperature=%.2f size=0x%" PRIx32 " ", (double)entry.timestamp / 1000000, entry.data, size);
     rb_errors_t err = rb_append(rb, 0x7, data, size, pagebuff, true);
-    printf(" @0x%lx stat=%d\n", rb->last_wrote, err);
+    printf(" @0x%" PRIx32 " stat=%d\n", rb->last_wrote, err);
     // hexdump(stdout, rb, 16, 16, 8);
     if (err != RB_OK) {
         printf("some write failure %d\n", err);
@@ -69,7 +69,7 @@ rb_errors_t reader(rb_t *rb, uint8_t *data, uint32_t size) {
     uint32_t oldnext = rb->next;
     err = rb_read(rb, 7, data, size);
     if (err >= 0) {
-        printf("Just read from 0x%lx to 0x%lx stat=%d size=0x%x\n", oldnext, rb->next, -err, err);
+        printf("Just read from 0x%" PRIx32 " to 0x%" PRIx32 " stat=%d size=0x%x\n", oldnext, rb->next, -err, err);
         hexdump(stdout, data, MIN(size, 8), 16, 8);
         return RB_OK; //return after 1 read
     } else {
@@ -130,7 +130,7 @@ static int read_ssids(rb_t *rb){
     while (true) {
         err = rb_read(rb, SSID_ID, pagebuff, sizeof(pagebuff));
 
-        printf("Reading ssid %ld starting at 0x%lx stat=%d\n\"%s\"\n", loopcount, rb->next, err, pagebuff);
+        printf("Reading ssid %" PRIu32 " starting at 0x%" PRIx32 " stat=%d\n\"%s\"\n", loopcount, rb->next, err, (char *) pagebuff);
         // hexdump(stdout, pagebuff, err + 1, 16, 8);
         if (err <= 0) {
             printf("some read failure %d\n", err);
@@ -172,7 +172,7 @@ static rb_errors_t write_ssids(rb_t *rb) {
         wrcnt++;
         rb_errors_t err = rb_append(rb, SSID_ID, tempssid, strlen(tempssid) + 1,
                                     pagebuff, true);
-        printf("Just wrote ssid %ld at 0x%lx stat=%d\n%s\n", i, rb->last_wrote, err, tempssid);
+        printf("Just wrote ssid %" PRIu32 " at 0x%" PRIx32 " stat=%d\n%s\n", i, rb->last_wrote, err, tempssid);
         // hexdump(stdout, tempssid, strlen(tempssid) + 1, 16, 8);
         if (err != RB_OK) {
             // printf("some write failure %d\n", err);
@@ -189,7 +189,7 @@ static rb_errors_t write_ssids(rb_t *rb) {
     tempssid[0] = '\x61';
     rb_errors_t terr = rb_append(rb, SSID_ID + 7, tempssid, strlen(tempssid) + 1,
                                 pagebuff, true);
-    printf("finally wrote ssid 0x%x at 0x%lx stat=%d\n%s\n", SSID_ID + 7, rb->last_wrote, terr, tempssid);
+    printf("finally wrote ssid 0x%x at 0x%" PRIx32 " stat=%d\n%s\n", SSID_ID + 7, rb->last_wrote, terr, tempssid);
 
     return terr;
 }
@@ -210,7 +210,7 @@ int main(void) {
     create_ssid_rb(&ssid_rb, CREATE_FAIL);
 
     sleep_ms(4000);
-    printf("linker defined persistent area 0x%lx, len 0x%lx st=%d\n", __PERSISTENT_TABLE, __PERSISTENT_LEN, err);
+    printf("linker defined persistent area 0x%" PRIx32 ", len 0x%" PRIx32 " st=%d\n", __PERSISTENT_TABLE, __PERSISTENT_LEN, err);
     sleep_ms(1000);
     if (write_ssids(&ssid_rb) != RB_OK) {
         //writes that fail are bad, reinit the flash
@@ -5,32 +5,57 @@
  * Copyright 2024, Hiroyuki OYAMA. All rights reserved.
  */
 #include "ring_buffer.h"
+#include "rb_pool.h"
+#include "flash_sched.h"
 #include <math.h>
 #include "crc.h"
+#include <inttypes.h>
 #include <string.h>
 
 //ring buffer code
 
-crc_t crc_update(crc_t crc, const void *data, size_t data_len)
-{
-    const unsigned char *d = (const unsigned char *)data;
-    unsigned int i;
-    crc_t bit;
-    unsigned char c;
-
-    while (data_len--) {
-        c = *d++;
-        for (i = 0x01; i & 0xff; i <<= 1) {
-            bit = (crc & 0x10) ^ ((c & i) ? 0x10 : 0);
-            crc <<= 1;
-            if (bit) {
-                crc ^= 0x05;
-            }
-        }
-        crc &= 0x1f;
+#if RB_STATS
+static rb_stats_t rb_all_stats; //every ring, see rb_get_stats
+//add n to a counter of rb and of all rings
+#define RB_COUNT(rb, field, n) do { (rb)->stats.field += (n); rb_all_stats.field += (n); } while (0)
+
+static uint64_t rb_op_start(void) {
+    return time_us_64();
+}
+static void rb_op_add(rb_stats_t *st, rb_op_t op, uint32_t bucket, int res) {
+    st->calls[op]++;
+    st->latency[op][bucket]++;
+    if (res < 0 && -res < RB_STATS_ERRORS) {
+        st->errors[-res]++;
     }
-    return crc & 0x1f;
 }
+//count a public call of kind op, begun at start, and pass its result on
+static int rb_op_end(rb_t *rb, rb_op_t op, uint64_t start, int res) {
+    uint64_t us = time_us_64() - start;
+    uint32_t bucket = 0;
+    while (us && bucket < RB_STATS_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    rb_op_add(&rb_all_stats, op, bucket, res);
+    if (rb != NULL) {
+        rb_op_add(&rb->stats, op, bucket, res);
+    }
+    return res;
+}
+#else
+#define RB_COUNT(rb, field, n) do { } while (0)
+
+static inline uint64_t rb_op_start(void) {
+    return 0;
+}
+static inline int rb_op_end(rb_t *rb, rb_op_t op, uint64_t start, int res) {
+    (void) rb;
+    (void) op;
+    (void) start;
+    return res;
+}
+#endif
 
 static rb_errors_t is_crc_good(rb_header *rbh) {
     crc_t crc = crc_init();
@@ -39,7 +64,7 @@ static rb_errors_t is_crc_good(rb_header *rbh) {
     //remove any used flags from crc check
     if ((rbh->crc & ~(RB_HEADER_SPLIT |
                       RB_HEADER_NOT_SMUDGED |
-                      RB_HEADER_UNUSED)) != crc) {
+                      RB_HEADER_PAYLOAD_CRC)) != crc) {
         return RB_BAD_HDR;
     }
     return RB_OK; //for now no crc check
@@ -62,11 +87,14 @@ static rb_errors_t is_sector_header_good(rb_sector_header *shdr) {
     crc_t crc = crc_init();
     crc = crc_update(crc, &data, 4);
     crc = crc_finalize(crc);
-    if (crc == get_crc(shdr)) {
+    if (crc == (get_crc(shdr) & RB_SECTOR_CRC_MASK)) {
         return RB_OK;
     }
     return RB_BAD_HDR;
 }
+rb_errors_t rb_sector_header_good(rb_sector_header *shdr) {
+    return is_sector_header_good(shdr);
+}
 
 static rb_errors_t make_sector_header(rb_t *rb, rb_sector_header *shdr) {
     if (shdr == NULL || rb == NULL) {
@@ -80,7 +108,8 @@ static rb_errors_t make_sector_header(rb_t *rb, rb_sector_header *shdr) {
     crc_t crc = crc_init();
     crc = crc_update(crc, &data, 4);
     crc = crc_finalize(crc);
-    set_crc(shdr, crc);
+    set_crc(shdr, crc | (rb->aligned ? RB_SECTOR_ALIGNED : 0) | (rb->pool ? RB_SECTOR_LIVE : 0) |
+            (rb->record_size ? RB_SECTOR_FIXED : 0));
     return RB_OK;
 }
 
@@ -102,14 +131,15 @@ static rb_errors_t make_header(rb_header *rbh, uint8_t id, uint32_t size) {
  next sector. Irregardless of len argument the max it will increment is to the
  next sector.
 */
-static uint32_t rb_incr(uint32_t oldlen, uint32_t len, uint32_t maxlen){
+static uint32_t rb_incr(rb_t *rb, uint32_t oldlen, uint32_t len) {
+    uint32_t maxlen = rb->number_of_bytes;
     uint32_t nextaddr;
-    if (len > FLASH_SECTOR_SIZE) {
+    if (len > rb->sector_size) {
         //take a really big step, skipping to next sector header
-        nextaddr = FLASH_SECTOR(oldlen) + FLASH_SECTOR_SIZE;
-    } else if (MOD_SECTOR(oldlen) + len > (FLASH_SECTOR_SIZE - (sizeof(rb_header) + 1) )) {
+        nextaddr = RB_SECTOR(rb, oldlen) + rb->sector_size;
+    } else if (RB_MOD_SECTOR(rb, oldlen) + len > (rb->sector_size - (sizeof(rb_header) + 1) )) {
         //doesnt fit in this sector go to next sector
-        nextaddr = FLASH_SECTOR(oldlen) + FLASH_SECTOR_SIZE;
+        nextaddr = RB_SECTOR(rb, oldlen) + rb->sector_size;
     } else {
         //fits in this sector, get new offset
         nextaddr = oldlen + len;
@@ -127,44 +157,251 @@ static void nextincr(rb_t *rb, int incr) {
         rb->next = 0; //wrap to next sector
     }
 }
+//flash address of ring offset, pooled rings go through the map of their sectors
+static uint32_t rb_address(rb_t *rb, uint32_t offset) {
+    if (rb->pool != NULL) {
+        return rb->base_address + rb->map[offset / rb->sector_size] * rb->sector_size +
+               RB_MOD_SECTOR(rb, offset);
+    }
+    return rb->base_address + offset;
+}
+/*
+ a sector of a cached rb was erased, or a pooled ring got a blank one in its
+ place. Its header is known blank.
+*/
+static void rb_cache_erased(rb_t *rb, uint32_t sector) {
+    rb_cache_t *c = rb->cache;
+    uint32_t n = sector / rb->sector_size;
+    for (uint32_t w = 0; w < RB_CACHE_PAGES; w++) {
+        if (RB_SECTOR(rb, c->page[w]) == sector) {
+            c->page[w] = RB_CACHE_EMPTY;
+        }
+    }
+    if (n < RB_CACHE_SECTORS) {
+        c->headers[n].header = 0xffffffff;
+        c->header_valid |= 1u << n;
+    }
+}
+/*
+ bytes lo up to hi of the staged page were programmed. Programming only
+ clears bits, so anding them into what is cached gives what flash holds.
+*/
+static void rb_cache_programmed(rb_t *rb, uint32_t lo, uint32_t hi) {
+    rb_cache_t *c = rb->cache;
+    uint32_t n = rb->stage_page / rb->sector_size;
+    for (uint32_t w = 0; w < RB_CACHE_PAGES; w++) {
+        if (c->page[w] == rb->stage_page) {
+            for (uint32_t i = lo; i < hi; i++) {
+                c->data[w][i] &= rb->rb_page[i];
+            }
+        }
+    }
+    if (RB_MOD_SECTOR(rb, rb->stage_page) == 0 && lo < sizeof(rb_sector_header) &&
+        n < RB_CACHE_SECTORS && (c->header_valid & (1u << n))) {
+        uint8_t *h = (uint8_t *)&c->headers[n];
+        for (uint32_t i = lo; i < MIN(hi, sizeof(rb_sector_header)); i++) {
+            h[i] &= rb->rb_page[i];
+        }
+    }
+}
+//a program of the staged page failed, what flash holds there is unknown
+static void rb_cache_forget(rb_t *rb) {
+    rb_cache_t *c = rb->cache;
+    uint32_t n = rb->stage_page / rb->sector_size;
+    for (uint32_t w = 0; w < RB_CACHE_PAGES; w++) {
+        if (c->page[w] == rb->stage_page) {
+            c->page[w] = RB_CACHE_EMPTY;
+        }
+    }
+    if (n < RB_CACHE_SECTORS) {
+        c->header_valid &= ~(1u << n);
+    }
+}
+/*
+ every sector erase goes through here, so saved offsets can tell they may be
+ stale. A pooled ring gets a blank pool sector in place of this one instead.
+ The erase goes through the device scheduler, after anything queued there.
+*/
+static rb_errors_t rb_erase_sector(rb_t *rb, uint32_t sector) {
+    int erased = 1;
+    if (rb->pool != NULL) {
+        erased = rb_pool_replace(rb->pool, rb->stream, sector / rb->sector_size);
+    } else if (flash_dev_erase(rb->dev, rb->base_address + sector, rb->sector_size)) {
+        erased = RB_FLASH_ERROR;
+    }
+    //a failed erase leaves the sector unknown, treat it as changed anyway
+    if (rb->cache != NULL) {
+        rb_cache_erased(rb, sector);
+    }
+    rb->erases++;
+    if (erased < 0) {
+        return RB_FLASH_ERROR;
+    }
+    RB_COUNT(rb, erases, erased);
+    return RB_OK;
+}
+//flash used by len bytes of record, aligned rings pad to the next uint32
+static uint32_t rb_span(rb_t *rb, uint32_t len) {
+    return rb->aligned ? len + ROUND_UP(len) : len;
+}
 
+//read ring offset from flash
+static void rb_device_read(rb_t *rb, uint32_t offset, void *buf, uint32_t size) {
+    if (rb->pool == NULL) {
+        rb->dev->read(rb->dev, rb->base_address + offset, buf, size);
+    } else {
+        //the sectors of a pooled ring are anywhere in the pool, read each apart
+        uint32_t n;
+        for (uint32_t done = 0; done < size; done += n) {
+            n = MIN(size - done, rb->sector_size - RB_MOD_SECTOR(rb, offset + done));
+            rb->dev->read(rb->dev, rb_address(rb, offset + done), (uint8_t *)buf + done, n);
+        }
+    }
+    RB_COUNT(rb, reads, 1);
+    RB_COUNT(rb, read_bytes, size);
+}
+//window of the cache holding page, read in over the least recently used one
+static uint32_t rb_cache_window(rb_t *rb, uint32_t page) {
+    rb_cache_t *c = rb->cache;
+    uint32_t lru = 0;
+    c->clock++;
+    for (uint32_t w = 0; w < RB_CACHE_PAGES; w++) {
+        if (c->page[w] == page) {
+            c->used[w] = c->clock;
+            c->hits++;
+            return w;
+        }
+        if (c->used[w] < c->used[lru]) {
+            lru = w;
+        }
+    }
+    c->misses++;
+    rb_device_read(rb, page, c->data[lru], FLASH_PAGE_SIZE);
+    c->page[lru] = page;
+    c->used[lru] = c->clock;
+    return lru;
+}
 /*
-    tricky side effect. if at the start of a sector, will change rb->next;
+ read through the cache. A sector header on its own comes from the header
+ array, anything else from page windows, so a walk over the record headers
+ of a page reads it from flash once.
 */
-static rb_errors_t fetch_and_check_header(rb_t *rb, rb_header *phdr, int jumpto) {
-    uint32_t nextoffs = (rb->next + jumpto);
+static void rb_cache_read(rb_t *rb, uint32_t offset, void *buf, uint32_t size) {
+    rb_cache_t *c = rb->cache;
+    uint32_t sector = offset / rb->sector_size;
+    uint32_t n;
+    if (RB_MOD_SECTOR(rb, offset) == 0 && size == sizeof(rb_sector_header) &&
+        sector < RB_CACHE_SECTORS) {
+        if (c->header_valid & (1u << sector)) {
+            c->header_hits++;
+        } else {
+            c->header_misses++;
+            rb_device_read(rb, offset, &c->headers[sector], size);
+            c->header_valid |= 1u << sector;
+        }
+        memcpy(buf, &c->headers[sector], size);
+        return;
+    }
+    for (uint32_t done = 0; done < size; done += n) {
+        uint32_t w = rb_cache_window(rb, FLASH_PAGE(offset + done));
+        n = MIN(size - done, FLASH_PAGE_SIZE - MOD_PAGE(offset + done));
+        memcpy((uint8_t *)buf + done, &c->data[w][MOD_PAGE(offset + done)], n);
+    }
+}
+/*
+ Read ring offset into buf. Bytes still staged in the page buffer by a
+ buffered writer are merged in, so the owner of rb sees its own records
+ before they reach flash. Programming only clears bits, so flash & staged is
+ exactly what flash will hold after the flush.
+*/
+static void rb_flash_read(rb_t *rb, uint32_t offset, void *buf, uint32_t size) {
+    if (rb->cache != NULL && size < FLASH_PAGE_SIZE) {
+        rb_cache_read(rb, offset, buf, size);
+    } else {
+        rb_device_read(rb, offset, buf, size);
+    }
+    if (rb->staged && offset < rb->stage_page + FLASH_PAGE_SIZE &&
+        rb->stage_page < offset + size) {
+        uint32_t lo = MAX(offset, rb->stage_page);
+        uint32_t hi = MIN(offset + size, rb->stage_page + FLASH_PAGE_SIZE);
+        uint8_t *p = (uint8_t *)buf + (lo - offset);
+        for (uint32_t i = lo; i < hi; i++) {
+            *p++ &= rb->rb_page[i - rb->stage_page];
+        }
+    }
+}
+/*
+    tricky side effect. if at the start of a sector, will change *next;
+*/
+static rb_errors_t fetch_header_at(rb_t *rb, uint32_t *next, rb_header *phdr, int jumpto) {
+    uint32_t nextoffs = (*next + jumpto);
     assert(nextoffs < rb->number_of_bytes);
-    flash_read(rb->base_address + nextoffs, phdr, sizeof(*phdr));
-    if (MOD_SECTOR(nextoffs) == 0) {
+    rb_flash_read(rb, nextoffs, phdr, sizeof(*phdr));
+    RB_COUNT(rb, headers, 1);
+    if (RB_MOD_SECTOR(rb, nextoffs) == 0) {
         //this is the start of a sector
         rb_errors_t t = is_sector_header_good((rb_sector_header *) phdr);
         if (t != RB_OK) {
             return t;
         }
-        rb->next += sizeof(*phdr); //skip sector header, check data header
-        flash_read(rb->base_address + rb->next + jumpto, phdr, sizeof(*phdr));
+        *next += sizeof(*phdr); //skip sector header, check data header
+        rb_flash_read(rb, *next + jumpto, phdr, sizeof(*phdr));
+        RB_COUNT(rb, headers, 1);
     }
     return is_header_good(phdr);
 }
+//same, at rb->next
+static rb_errors_t fetch_and_check_header(rb_t *rb, rb_header *phdr, int jumpto) {
+    return fetch_header_at(rb, &rb->next, phdr, jumpto);
+}
 
-static int count_blanks(uint8_t *buffer, uint8_t value, int maxscan) {
+static int count_blanks(const uint8_t *buffer, uint8_t value, int maxscan) {
     for (int i = 0; i < maxscan; i++){
         if (buffer[i] != value) return i; //count of matches
     }
     return maxscan; //all blank
 }
-static int sector_blank_scan(rb_t *rb) {
+/*
+ the same on flash from ring offset, in one sector. Memory mapped flash is
+ scanned in place, else it is read a piece at a time.
+*/
+static uint32_t rb_count_blanks(rb_t *rb, uint32_t offset, uint32_t maxscan) {
+    uint8_t chunk[32];
+    uint32_t n;
+    if (rb->dev->mapped != NULL) {
+        return count_blanks(rb->dev->mapped(rb->dev, rb_address(rb, offset)), 0xff, maxscan);
+    }
+    for (uint32_t i = 0; i < maxscan; i += n) {
+        n = MIN(maxscan - i, sizeof(chunk));
+        rb->dev->read(rb->dev, rb_address(rb, offset + i), chunk, n);
+        uint32_t blanks = count_blanks(chunk, 0xff, n);
+        if (blanks < n) {
+            return i + blanks;
+        }
+    }
+    return maxscan;
+}
+/*
+ count blanks from rb->next, into the next sector if the rest of this one is
+ blank. Stops as soon as needed blanks are found, appends only care whether
+ there is room.
+*/
+static int sector_blank_scan(rb_t *rb, uint32_t needed) {
     //count blanks remaining in sector
     uint32_t size_in_sector;
-    size_in_sector = FLASH_SECTOR_SIZE - MOD_SECTOR(rb->next);
-    uint32_t blanks = count_blanks((uint8_t *)XIP_NOCACHE_NOALLOC_BASE + rb->base_address + rb->next, 0xff, size_in_sector);
+    size_in_sector = rb->sector_size - RB_MOD_SECTOR(rb, rb->next);
+    uint32_t blanks = rb_count_blanks(rb, rb->next, MIN(size_in_sector, needed));
+    RB_COUNT(rb, reads, 1);
+    RB_COUNT(rb, read_bytes, MIN(blanks + 1, MIN(size_in_sector, needed)));
     if (blanks == size_in_sector) {
         //rest of this sector is blank, check next sector
-        uint32_t offs = FLASH_SECTOR(rb->next) + FLASH_SECTOR_SIZE;
+        uint32_t offs = RB_SECTOR(rb, rb->next) + rb->sector_size;
         if (offs >= rb->number_of_bytes) {
             offs = 0; //wrap around flash allocation
         }
-        uint32_t nextblanks = count_blanks((uint8_t *)XIP_NOCACHE_NOALLOC_BASE + rb->base_address + offs, 0xff, FLASH_SECTOR_SIZE);
+        uint32_t nextblanks = rb_count_blanks(rb, offs, MIN(rb->sector_size, needed - blanks));
+        RB_COUNT(rb, reads, 1);
+        RB_COUNT(rb, read_bytes, MIN(nextblanks + 1, MIN(rb->sector_size, needed - blanks)));
         blanks += nextblanks;
     } 
     return blanks;
@@ -184,9 +421,9 @@ static rb_errors_t rb_findnext_writeable(rb_t *rb) {
         return RB_BAD_CALLER_DATA; // Error handling: Null pointer passed
     }
     do {
-        if (MOD_SECTOR(rb->next) > FLASH_SECTOR_SIZE - sizeof(hdr) - 1) {
+        if (RB_MOD_SECTOR(rb, rb->next) > rb->sector_size - sizeof(hdr) - 1) {
             //skip last few bytes of sector
-            nextincr(rb, FLASH_SECTOR_SIZE - MOD_SECTOR(rb->next));
+            nextincr(rb, rb->sector_size - RB_MOD_SECTOR(rb, rb->next));
         }
         hdr_res = fetch_and_check_header(rb, &hdr, 0); //fetch and check header
         if (hdr_res != RB_OK) {
@@ -194,12 +431,13 @@ static rb_errors_t rb_findnext_writeable(rb_t *rb) {
          }
         //found a good header, use it to skip ahead
         //keep looking for end of rb
-        rb->next = rb_incr(rb->next, hdr.len + sizeof(hdr), rb->number_of_bytes);
+        rb->next = rb_incr(rb, rb->next, rb_span(rb, hdr.len) + sizeof(hdr));
 //fixme in a single sector system can I detect  a full sector? the following 
 //worked for multi sectors.
         if (rb->next == origrb){
             //data in flash is full, we wrapped.
-            rb->next = FLASH_SECTOR(rb->next);
+            rb->next = RB_SECTOR(rb, rb->next);
+            RB_COUNT(rb, loops, 1);
             return RB_HDR_LOOP;
         }
     } while (1);
@@ -212,7 +450,7 @@ static rb_errors_t rb_findnext_writeable(rb_t *rb) {
  always and then wrap back to the first. If there are no erased sectors the
  sector with the lowest number will be the oldest.
 */
-static rb_errors_t rb_find_ring_oldest_sector(rb_t *rb) {
+static rb_errors_t rb_oldest_sector_at(rb_t *rb, uint32_t *next) {
     uint32_t oldnext = 0;
     rb_sector_header hdr;
     rb_errors_t hdr_res = RB_BAD_HDR;
@@ -232,34 +470,65 @@ static rb_errors_t rb_find_ring_oldest_sector(rb_t *rb) {
         Erased sectors are always assumed grouped, generally only 1 sector
         unless entire flash was erased.
     */
-    int offs = rb->number_of_bytes - FLASH_SECTOR_SIZE; //start on last sector
+    int offs = rb->number_of_bytes - rb->sector_size; //start on last sector
     do {
-        rb->next = offs;
-        flash_read(rb->base_address + rb->next, &hdr, sizeof(hdr));
+        rb_flash_read(rb, offs, &hdr, sizeof(hdr));
+        RB_COUNT(rb, headers, 1);
         hdr_res = is_sector_header_good(&hdr);
         switch (hdr_res) {
         case RB_OK: //legit hdr, update ptrs, start here
             if (get_index(&hdr) < oldest_sector_number) {
                 //lower indexes are always older
                 oldest_sector_number = get_index(&hdr);
-                oldnext = rb->next; //save ptr to oldest
+                oldnext = offs; //save ptr to oldest
             }
             if (get_index(&hdr) >= rb->sector_index) {
                 //update largest index for new sector creation
                 rb->sector_index = get_index(&hdr);
             }
+            //the whole ring is written in one mode
+            rb->aligned = get_crc(&hdr) & RB_SECTOR_ALIGNED;
             break;
         case RB_BLANK_HDR: //header is erased
             break;
         default:
             return hdr_res; //some error finding start
         }
-        offs -= FLASH_SECTOR_SIZE;
+        offs -= rb->sector_size;
     } while (offs >= 0);
     //we have searched the ring, no hdr found, so start at ring start
-    rb->next = oldnext;
+    *next = oldnext;
     return hdr_res;
 }
+static rb_errors_t rb_find_ring_oldest_sector(rb_t *rb) {
+    return rb_oldest_sector_at(rb, &rb->next);
+}
+/*
+ A read position at the start of a sector means the reader came to it from
+ the end of the sector before. Reading a sector from its start begins past
+ its header instead, so the start and the end of a full ring, the same
+ offset, can be told apart.
+*/
+static uint32_t rb_read_start(rb_t *rb, uint32_t sector) {
+    rb_sector_header shdr;
+    rb_flash_read(rb, sector, &shdr, sizeof(shdr));
+    return is_sector_header_good(&shdr) == RB_OK ? sector + sizeof(shdr) : sector;
+}
+/*
+ a read coming off the end of the sector before goes on into sector only if
+ sector was started after it. When every sector is full there is no blank
+ header to stop at, the newest sector is followed by the oldest.
+*/
+static bool rb_sector_follows(rb_t *rb, uint32_t sector) {
+    rb_sector_header shdr;
+    rb_sector_header before;
+    rb_flash_read(rb, sector, &shdr, sizeof(shdr));
+    rb_flash_read(rb, (sector ? sector : rb->number_of_bytes) - rb->sector_size,
+                  &before, sizeof(before));
+    RB_COUNT(rb, headers, 2);
+    return is_sector_header_good(&shdr) != RB_OK || is_sector_header_good(&before) != RB_OK ||
+           get_index(&shdr) == ((get_index(&before) + 1) & RB_INDEX_MASK);
+}
 /*
  check entire flash for reasonable order. ie oldest < next < nextnext etc, with
  any sector startinq at blank, is followed by other sectors starting at blank.
@@ -275,12 +544,16 @@ rb_errors_t rb_check_sector_ring(rb_t *rb) {
 
     //first just check the sector headers, if bad, we will erase everything
     //back through all sectors
-    // for (int i = rb->number_of_bytes - FLASH_SECTOR_SIZE; i >= 0 ; i -= FLASH_SECTOR_SIZE) {
-    for (uint32_t i = 0; i < rb->number_of_bytes; i += FLASH_SECTOR_SIZE) {
+    // for (int i = rb->number_of_bytes - rb->sector_size; i >= 0 ; i -= rb->sector_size) {
+    for (uint32_t i = 0; i < rb->number_of_bytes; i += rb->sector_size) {
         rb->next = i;
-        flash_read(rb->base_address + rb->next, &hdr, sizeof(hdr));
+        rb_flash_read(rb, rb->next, &hdr, sizeof(hdr));
+        RB_COUNT(rb, headers, 1);
         hdr_res = is_sector_header_good(&hdr);
-        if (hdr_res == RB_OK) {
+        if (hdr_res == RB_OK && !(get_crc(&hdr) & RB_SECTOR_FIXED) != !rb->record_size) {
+            //fixed size record sectors can not be read as records, or the other way
+            check_status = RB_BAD_HDR;
+        } else if (hdr_res == RB_OK) {
             if (get_index(&hdr) < oldest_sector_number) {
                 //lower indexes are always older
                 oldest_sector_number = get_index(&hdr);
@@ -307,12 +580,13 @@ rb_errors_t rb_check_sector_ring(rb_t *rb) {
         last_blank_sector = rb->next; //where the ring should start
     }
     uint32_t low = 0;
-    for (uint32_t i = 0; i < rb->number_of_bytes && check_status == RB_OK; i += FLASH_SECTOR_SIZE) {
+    for (uint32_t i = 0; i < rb->number_of_bytes && check_status == RB_OK; i += rb->sector_size) {
         rb->next = i + last_blank_sector;
-        if (rb->next > rb->number_of_bytes) {
+        if (rb->next >= rb->number_of_bytes) {
             rb->next -= rb->number_of_bytes; //wrap in ring buffer
         }
-        flash_read(rb->base_address + rb->next, &hdr, sizeof(hdr));
+        rb_flash_read(rb, rb->next, &hdr, sizeof(hdr));
+        RB_COUNT(rb, headers, 1);
         hdr_res = is_sector_header_good(&hdr);
         if (hdr_res == RB_OK) {
             if (get_index(&hdr) < low) {
@@ -333,23 +607,69 @@ rb_errors_t rb_check_sector_ring(rb_t *rb) {
     // }
     return check_status;
 }
+/*
+  Program the staged bytes into flash, if anything is staged. Where the flash
+  takes partial programs only the staged range is sent, the pico sdk rounds
+  it out to the page. Every byte not staged is still 0xff in the page buffer,
+  so it does not change flash. If the program fails the cached tail is
+  dropped, the next write looks for the tail in flash again.
+*/
+static rb_errors_t rb_flush(rb_t *rb) {
+    rb_errors_t res = RB_OK;
+    if (!rb->staged) {
+        return RB_OK;
+    }
+    if (flash_prog_range(rb->dev, rb_address(rb, rb->stage_page), rb->rb_page, rb->stage_lo,
+                         rb->stage_hi)) {
+        res = RB_FLASH_ERROR;
+        rb->tail_valid = false;
+    }
+    RB_COUNT(rb, programs, 1);
+    if (rb->cache != NULL && res != RB_OK) {
+        rb_cache_forget(rb);
+    } else if (rb->cache != NULL) {
+        rb_cache_programmed(rb, rb->stage_lo, rb->stage_hi);
+    }
+    memset(rb->rb_page, 0xff, FLASH_PAGE_SIZE); //get page buffer ready
+    rb->staged = false;
+    return res;
+}
 /*
   Here I know entire write will be in this sector, maybe multiple pages. call
-  with a block to write. If it fits in the page, fine write it. If not, write
-  as much as will fit. return either negative error number of positive number
-  of bytes still to be written in the next sector. Will flash write to flash
-  memory either if fills a page or if flush is true.
+  with a block to write. If it fits in the page, fine stage it. If not, stage
+  as much as will fit. return the positive number of bytes still to be
+  written, or RB_FLASH_ERROR if programming a page failed. A staged page is
+  only programmed into flash when it fills up or by rb_flush, so headers and
+  data landing in the same page cost one program.
 */
 static int rb_partial(rb_t *rb, const void *data, uint32_t size) {
     uint32_t pagerem = FLASH_PAGE_SIZE - MOD_PAGE(rb->next);
     uint32_t wrlen = MIN(pagerem, size); //amount I can write
+    rb_errors_t res = RB_OK;
 
+    if (rb->staged && rb->stage_page != FLASH_PAGE(rb->next)) {
+        res = rb_flush(rb); //moved to another page, finish the old one
+        if (res != RB_OK) {
+            return res;
+        }
+    }
+    if (!rb->staged) {
+        memset(rb->rb_page, 0xff, FLASH_PAGE_SIZE);
+        rb->stage_page = FLASH_PAGE(rb->next);
+        rb->stage_lo = MOD_PAGE(rb->next);
+        rb->stage_hi = rb->stage_lo;
+        rb->staged = true;
+        rb->stage_time = time_us_64();
+    }
     memcpy(&rb->rb_page[MOD_PAGE(rb->next)], data, wrlen);
-    //write buffered page into flash
-    flash_prog(rb->base_address + FLASH_PAGE(rb->next), rb->rb_page, FLASH_PAGE_SIZE);
-    memset(rb->rb_page, 0xff, FLASH_PAGE_SIZE); //get page buffer ready
+    rb->stage_lo = MIN(rb->stage_lo, MOD_PAGE(rb->next));
+    rb->stage_hi = MAX(rb->stage_hi, MOD_PAGE(rb->next) + wrlen);
+    if (wrlen == pagerem) {
+        //page is full, write buffered page into flash
+        res = rb_flush(rb);
+    }
     nextincr(rb, wrlen);
-    return size - wrlen; //amount not written
+    return res != RB_OK ? (int)res : (int)(size - wrlen); //amount not written
 }
 /*
  the problem is there are two things to be written, the hdr and the data either
@@ -358,22 +678,12 @@ static int rb_partial(rb_t *rb, const void *data, uint32_t size) {
  of the write which we know will fit in the sector.
 */
 static rb_errors_t rb_append_page(rb_t *rb, const void *data, uint32_t size) {
-
-    if (MOD_PAGE(rb->next)) {
-        //need to load previously written data page aligned
-        //fixme I don't think I ever need to read old data, just write 0xff to old bytes
-        // flash_read(rb->base_address + FLASH_PAGE(rb->next), rb->rb_page, FLASH_PAGE_SIZE);
-        memset(rb->rb_page, 0xff, FLASH_PAGE_SIZE);
-    } else {
-        //new page, no need to read current stuff
-        memset(rb->rb_page, 0xff, FLASH_PAGE_SIZE);
-    }
     int remaining = rb_partial(rb, data, size);
-    while (remaining) {
+    while (remaining > 0) {
         //header was split over a page, write rest to next page
         remaining = rb_partial(rb, data + size - remaining, remaining);
     }
-    return RB_OK;
+    return remaining < 0 ? (rb_errors_t)remaining : RB_OK;
 }
 /*
     helper to make page header, and occasionally also a sector header - and
@@ -384,7 +694,7 @@ static rb_errors_t write_headers(rb_t *rb, rb_header * hdr, uint32_t size, uint8
     rb_errors_t hdr_res;
     rb_sector_header rbsh;
     rb->last_wrote = rb->next; //info to caller
-    if (MOD_SECTOR(rb->next) == 0) {
+    if (RB_MOD_SECTOR(rb, rb->next) == 0) {
         hdr_res = make_sector_header(rb, &rbsh);
         hdr_res = rb_append_page(rb, &rbsh, sizeof(rbsh));
         if (hdr_res != RB_OK) {
@@ -392,45 +702,168 @@ static rb_errors_t write_headers(rb_t *rb, rb_header * hdr, uint32_t size, uint8
         }
     }
     hdr_res = make_header(hdr, hdr->id, size);
+    if (hdr_res != RB_OK) {
+        return hdr_res;
+    }
     hdr->crc |= flag;       //set special flags in unused crc bits
     hdr_res = rb_append_page(rb, hdr, sizeof(*hdr));
     return hdr_res;
 }
 
+/*
+ Source of the bytes of one record. Optionally the payload is followed by its
+ crc32, computed as the payload is staged, so the record stream written to
+ flash is payload + trailer without a second pass over the data. The payload
+ can be in two pieces, like a record split over two sectors of flash.
+*/
+typedef struct {
+    const uint8_t *data;
+    uint32_t size;      //payload bytes
+    uint32_t crc;       //running crc32 of the payload staged so far
+    bool has_crc;
+    uint32_t split;     //payload bytes at data, the rest are at more
+    const uint8_t *more;
+} rb_src_t;
+
+static uint32_t rb_src_len(rb_src_t *src) {
+    return src->size + (src->has_crc ? sizeof(uint32_t) : 0);
+}
+//stage len bytes of the record stream starting at off
+static rb_errors_t rb_append_src(rb_t *rb, rb_src_t *src, uint32_t off, uint32_t len) {
+    rb_errors_t hdr_res;
+    while (off < src->size && len) {
+        const uint8_t *p = off < src->split ? src->data + off : src->more + off - src->split;
+        uint32_t n = MIN(len, (off < src->split ? src->split : src->size) - off);
+        if (src->has_crc) {
+            src->crc = crc32_update(src->crc, p, n);
+        }
+        hdr_res = rb_append_page(rb, p, n);
+        if (hdr_res != RB_OK) {
+            return hdr_res;
+        }
+        off += n;
+        len -= n;
+    }
+    if (len) {
+        //trailer, all of the payload has been staged so its crc is complete
+        uint32_t crc = crc32_finalize(src->crc);
+        uint8_t trailer[sizeof(crc)] = {crc, crc >> 8, crc >> 16, crc >> 24};
+        return rb_append_page(rb, trailer + off - src->size, len);
+    }
+    return RB_OK;
+}
+/*
+ Time rings. Before the first record that starts in a sector, a system record
+ (id RB_SYSTEM_ID) holding that record's timestamp is written. Timestamps
+ only go up, so these make a sorted index of the sectors that rb_seek_time
+ can binary search. Sectors that only hold part of a streamed record have
+ none, the search just looks at an older one.
+*/
+static void rb_save_tail(rb_t *rb);
+//offset of the first record header in sector that is not a continuation
+static uint32_t rb_first_start(rb_t *rb, uint32_t sector) {
+    rb_header hdr;
+    uint32_t offs = sector + sizeof(rb_sector_header);
+    rb_flash_read(rb, offs, &hdr, sizeof(hdr));
+    if (is_header_good(&hdr) == RB_OK && (hdr.crc & RB_HEADER_SPLIT)) {
+        offs = rb_incr(rb, offs, sizeof(hdr) + rb_span(rb, hdr.len));
+    }
+    return offs;
+}
+//room a time record needs before the record about to be written at rb->next
+static uint32_t rb_time_size(rb_t *rb) {
+    uint32_t needed = sizeof(rb_header) + RB_TIME_RECORD_LEN;
+    if (rb->timestamp_of == NULL) {
+        return 0;
+    }
+    uint32_t room = rb->sector_size - RB_MOD_SECTOR(rb, rb->next);
+    if (RB_MOD_SECTOR(rb, rb->next) == 0) {
+        room -= sizeof(rb_sector_header);
+    } else if (rb_first_start(rb, RB_SECTOR(rb, rb->next)) != rb->next) {
+        return 0; //some record already started in this sector
+    }
+    //too near the end, the record starts its sector without one
+    return room > needed + sizeof(rb_header) ? needed : 0;
+}
+static rb_errors_t rb_append_time(rb_t *rb, const void *data) {
+    rb_header hdr;
+    uint64_t ts = rb->timestamp_of((void *)data);
+    uint8_t rec[RB_TIME_RECORD_LEN] = {RB_SYSTEM_TIME, 0xff, 0xff, 0xff};
+    for (int i = 0; i < 8; i++) {
+        rec[4 + i] = ts >> (8 * i);
+    }
+    hdr.id = RB_SYSTEM_ID;
+    rb_errors_t hdr_res = write_headers(rb, &hdr, sizeof(rec), RB_HEADER_NOT_SMUDGED);
+    if (hdr_res != RB_OK) {
+        return hdr_res;
+    }
+    return rb_append_page(rb, rec, sizeof(rec));
+}
+//timestamp of the first record starting in a used sector, if it has one
+static bool rb_sector_time(rb_t *rb, uint32_t sector, uint64_t *ts) {
+    rb_header hdr;
+    uint8_t rec[RB_TIME_RECORD_LEN];
+    uint32_t offs = rb_first_start(rb, sector);
+    if (RB_SECTOR(rb, offs) != sector || RB_MOD_SECTOR(rb, offs) == 0) {
+        return false;
+    }
+    rb_flash_read(rb, offs, &hdr, sizeof(hdr));
+    if (is_header_good(&hdr) != RB_OK || hdr.id != RB_SYSTEM_ID ||
+        hdr.len != RB_TIME_RECORD_LEN) {
+        return false;
+    }
+    rb_flash_read(rb, offs + sizeof(hdr), rec, sizeof(rec));
+    if (rec[0] != RB_SYSTEM_TIME) {
+        return false;
+    }
+    *ts = 0;
+    for (int i = 7; i >= 0; i--) {
+        *ts = *ts << 8 | rec[4 + i];
+    }
+    return true;
+}
 /*
   We have weird sector and page boundaries to deal with. If a write will fit in
   a sector, go ahead and write the pages. If it won't fit in a sector split the
   write at the sector boundary. For the first part, it will now fit, do a page
   write. For the last part over the current sector, Create a new header and
-  write the next part. It is possible the next part will itself split over a
-  sector boundary, but repeat as necessary.
+  write the next part. RB_MAX_APPEND_SIZE guarantees the last part fits in the
+  next sector.
 */
-static rb_errors_t rb_sector_append(rb_t *rb, rb_header * hdr, const void *data, uint32_t size) {
+static rb_errors_t rb_sector_append(rb_t *rb, rb_header * hdr, rb_src_t *src) {
     rb_errors_t hdr_res;
     int hdrsize = sizeof(*hdr);
-    uint32_t size_needed = size + hdrsize;;
-    if (rb == NULL || data == NULL || size == 0 || hdr == NULL ||
+    uint32_t size = rb_src_len(src);
+    uint32_t size_needed = size + hdrsize;
+    uint8_t flags = RB_HEADER_NOT_SMUDGED | (src->has_crc ? RB_HEADER_PAYLOAD_CRC : 0);
+    if (rb == NULL || src->data == NULL || src->size == 0 || hdr == NULL ||
         hdr->id >= 0xff || size_needed > rb->number_of_bytes ||
         size > RB_MAX_APPEND_SIZE) {
         return RB_BAD_CALLER_DATA;
     }
-    uint32_t blank_cnt = sector_blank_scan(rb);
-    if (blank_cnt < size_needed) return RB_FULL;
+    uint32_t time_size = rb_time_size(rb);
+    uint32_t blank_cnt = sector_blank_scan(rb, size_needed + time_size);
+    if (blank_cnt < size_needed + time_size) return RB_FULL;
+    if (time_size) {
+        hdr_res = rb_append_time(rb, src->data);
+        if (hdr_res != RB_OK) {
+            return hdr_res;
+        }
+        rb_save_tail(rb); //a retry after erasing goes on after it
+    }
 
-    if (size_needed < FLASH_SECTOR_SIZE - MOD_SECTOR(rb->next)) {
+    if (size_needed <= rb->sector_size - RB_MOD_SECTOR(rb, rb->next)) {
         //write will fit this flash sector, write pages
-        hdr_res = write_headers(rb, hdr, size, RB_HEADER_NOT_SMUDGED);
+        hdr_res = write_headers(rb, hdr, size, flags);
         if (hdr_res != RB_OK) {
             return hdr_res;
         }
-        hdr_res = rb_append_page(rb, data, size);
+        hdr_res = rb_append_src(rb, src, 0, size);
     } else {
         //write will span two sectors, I assume current sector is good
-        //fixme assumes will not be more than 2 sectors.
         rb_header rbh2;
-        uint32_t size_in_first_sector = FLASH_SECTOR_SIZE - MOD_SECTOR(rb->next) - hdrsize;
-        size_in_first_sector = MIN(size_in_first_sector, size);
-        uint32_t nextsector =  FLASH_SECTOR(rb->next) + FLASH_SECTOR_SIZE;
+        uint32_t size_in_first_sector = rb->sector_size - RB_MOD_SECTOR(rb, rb->next) - hdrsize;
+        uint32_t nextsector =  RB_SECTOR(rb, rb->next) + rb->sector_size;
         if (nextsector >= rb->number_of_bytes) {
             nextsector = 0; //wrap to first sector allocated
         }
@@ -440,32 +873,24 @@ static rb_errors_t rb_sector_append(rb_t *rb, rb_header * hdr, const void *data,
         if (hdr_res == RB_BLANK_HDR) {
             //Only continue if next sector is blank, otherwise caller handles it.
             //first write current sector until filled
-            hdr_res = write_headers(rb, hdr, size_in_first_sector, RB_HEADER_NOT_SMUDGED);
+            hdr_res = write_headers(rb, hdr, size_in_first_sector, flags);
             if (hdr_res != RB_OK){
                 return hdr_res;
             }
-            hdr_res = rb_append_page(rb, data, size_in_first_sector);
+            hdr_res = rb_append_src(rb, src, 0, size_in_first_sector);
             if (hdr_res != RB_OK){
                 return hdr_res;
             }
             //second write next sector header, split data header.
             uint32_t size_in_second_sector = size - size_in_first_sector;
-            size_in_second_sector = MIN(size_in_second_sector,
-                                        FLASH_SECTOR_SIZE - MOD_SECTOR(rb->next) - hdrsize);
-
             hdr_res = write_headers(rb, hdr, size_in_second_sector,
-                                    RB_HEADER_SPLIT | RB_HEADER_NOT_SMUDGED);
-            //write second sector.
-            hdr_res = rb_append_page(rb, data + size_in_second_sector, size_in_second_sector);
-            if (size - size_in_first_sector - size_in_second_sector > 0) {
-                //recurse and write remainder fixme will this work for writes greater than sector size?
-                hdr_res = rb_sector_append(rb, hdr,
-                            data + size_in_second_sector + size_in_first_sector,
-                            size - size_in_second_sector - size_in_first_sector);
-                if (hdr_res != RB_OK) {
-                    return hdr_res;
-                }
+                                    RB_HEADER_SPLIT | flags);
+            if (hdr_res != RB_OK){
+                return hdr_res;
             }
+            RB_COUNT(rb, splits, 1);
+            //write second sector.
+            hdr_res = rb_append_src(rb, src, size_in_first_sector, size_in_second_sector);
         } else {
             // not enough space is available, let caller know so he can erase.
             rb->next = savenext;
@@ -475,219 +900,1585 @@ static rb_errors_t rb_sector_append(rb_t *rb, rb_header * hdr, const void *data,
             return hdr_res;
         }
     }
+    if (hdr_res == RB_OK && rb->aligned) {
+        //leave the padding blank, the next header starts on a uint32
+        nextincr(rb, ROUND_UP(rb->next));
+    }
     return hdr_res;
 }
-// every call will flash the involved sector(s), even tiny data
-rb_errors_t rb_append(rb_t *rb, uint8_t id, const void *data, uint32_t size,
-                      uint8_t *pagebuffer, bool erase_if_full) {
-    rb_errors_t hdr_res;
-    rb_header rbh;
-    if (rb == NULL || data == NULL || size == 0 || id == 0xff || 
-        pagebuffer == NULL || size > (rb->number_of_bytes - sizeof(rbh))) {
-        return RB_BAD_CALLER_DATA;
+//sector holding the last written byte before the tail
+static uint32_t rb_tail_sector(rb_t *rb) {
+    uint32_t last = RB_SECTOR(rb, rb->tail);
+    if (RB_MOD_SECTOR(rb, rb->tail) == 0) {
+        last = (last ? last : rb->number_of_bytes) - rb->sector_size;
     }
-
-    rb->rb_page = pagebuffer; //set temp pointer
-    uint32_t oldnext = rb->next;
-    //rbcreate and other appends guarantee pointers are good in rb
-    do {
-        hdr_res = rb_find_ring_oldest_sector(rb);
-        if (!(hdr_res == RB_OK || hdr_res == RB_BLANK_HDR)) {
-            return hdr_res;
-        }
-        hdr_res = rb_findnext_writeable(rb); //get pointers in rb
-        if (hdr_res == RB_HDR_LOOP && erase_if_full) {
-            rb_find_ring_oldest_sector(rb);
-            // rb->next = FLASH_SECTOR(rb->next);
-            flash_erase(rb->base_address + rb->next, FLASH_SECTOR_SIZE);
-            hdr_res = RB_BLANK_HDR;
-        }
-        if (hdr_res == RB_BLANK_HDR) {
-            rbh.id = id; //only thing needed from here on the header
-            hdr_res = rb_sector_append(rb, &rbh, data, size);
-            if ((hdr_res == RB_WRAPPED_SECTOR_USED || hdr_res == RB_FULL) && erase_if_full) {
-                rb_find_ring_oldest_sector(rb);
-                flash_erase(rb->base_address + rb->next, FLASH_SECTOR_SIZE);
-                continue; //try append again
-            }
-        }
-        break; //done with loop
-    } while (1);
-    rb->next = oldnext;
-    return hdr_res;
+    return last;
 }
-/* search flash for an existing entry id and data match. return positive offset
-   of match or negative error number. scratch must be at least size bytes
-   longs */
-rb_errors_t rb_find(rb_t *rb, uint8_t id, const void *data, uint32_t size, uint8_t *scratch) {
-    rb_errors_t hdr_res;
+/*
+ The cached tail is only trusted if nothing changed behind our back: the bytes
+ at the tail are still blank and the sector we last wrote still carries the
+ newest sector index. Another writer appending, an erase or a power cut
+ during someone else's write all fail one of these checks.
+*/
+static bool rb_tail_is_valid(rb_t *rb) {
     rb_header hdr;
-    uint32_t orignext = FLASH_SECTOR(rb->next); //save start of search
-    if (rb == NULL || data == NULL || size == 0 || id == 0xff || id == 00 ||
-        size > (rb->number_of_bytes - sizeof(hdr))) {
-        return RB_BAD_CALLER_DATA;
+    rb_sector_header shdr;
+    if (!rb->tail_valid) {
+        return false;
     }
-    do {
-        hdr_res = fetch_and_check_header(rb, &hdr, 0); //fetch and check header
-        if (hdr_res != RB_OK) {
-            return hdr_res; //return errors here
-        }
-        if (hdr.id != id || !(hdr.crc & RB_HEADER_NOT_SMUDGED)) {
-            //not my data, or it was erased, skip the header and the data
-            rb->next = rb_incr(rb->next, hdr.len + sizeof(hdr), rb->number_of_bytes);
-            if (orignext == rb->next) return RB_HDR_ID_NOT_FOUND;
-            continue; //do loop again
-        }
-        //found next entry, read it into scratch buffer
-        uint32_t oldnext = rb->next;
-        hdr_res = rb_read(rb, id, scratch, size);
-        if (hdr_res > 0) {
-            // now see if it is the correct entry, and found.
-            if (!memcmp(data, scratch, size)) {
-                return oldnext; //found match, return its location
-            }
-            continue; //keep searching.
-        } else {
-            return hdr_res;
+    rb_flash_read(rb, rb->tail, &hdr, sizeof(hdr));
+    if (is_header_good(&hdr) != RB_BLANK_HDR) {
+        return false;
+    }
+    rb_flash_read(rb, rb_tail_sector(rb), &shdr, sizeof(shdr));
+    return is_sector_header_good(&shdr) == RB_OK &&
+           get_index(&shdr) == rb->sector_index;
+}
+//remember where the next append goes, skipping sector ends too small to use
+static void rb_save_tail(rb_t *rb) {
+    rb->tail = rb->next;
+    if (RB_MOD_SECTOR(rb, rb->tail) > rb->sector_size - sizeof(rb_header) - 1) {
+        rb->tail = RB_SECTOR(rb, rb->tail) + rb->sector_size;
+        if (rb->tail >= rb->number_of_bytes) {
+            rb->tail = 0;
         }
-    } while (true);
+    }
+    rb->tail_valid = true;
 }
-//this function effectively deletes a flash record, by smudging it, which can be
-//done after it is already written. Due to nand flash implementations, I can
-//write 1 bits to 0 bits, but not vice-versa
-static rb_errors_t rb_smudge(rb_t *rb, uint32_t offset_to_smudge) {
-    rb_header hdr;
-    uint32_t savenext = rb->next;
-    rb->next = offset_to_smudge;
-    rb_errors_t hdr_res = fetch_and_check_header(rb, &hdr, 0); //fetch and check header
-    if (hdr_res != RB_OK) {
-        return hdr_res; //return errors here
+/*
+ point rb->next at the append position. Uses the cached tail when it still
+ checks out, otherwise falls back to scanning the whole ring.
+*/
+static rb_errors_t rb_find_tail(rb_t *rb) {
+    rb_errors_t hdr_res;
+    //while a page is staged flash is behind, but nothing else can have moved
+    if (rb->staged || rb_tail_is_valid(rb)) {
+        rb->next = rb->tail;
+        return RB_BLANK_HDR;
     }
-    //overwrite the old crc byte clearing the smudge bit
-    hdr.crc &= ~RB_HEADER_NOT_SMUDGED;
-    rb->next += offsetof(rb_header, crc);
-    printf("rb_smudge erasing 0x%lx\n", rb->next);
-    int res = rb_append_page(rb, &hdr.crc, 1);
-    rb->next = savenext; //return offset to entry deleted
-    return res;
+    rb->tail_valid = false;
+    RB_COUNT(rb, rescans, 1);
+    hdr_res = rb_find_ring_oldest_sector(rb);
+    if (!(hdr_res == RB_OK || hdr_res == RB_BLANK_HDR)) {
+        return hdr_res;
+    }
+    return rb_findnext_writeable(rb); //get pointers in rb
 }
-/* given a writable page, delete a matching id, string entry */
-rb_errors_t rb_delete(rb_t *rb, uint8_t id, const void *data, uint32_t size, uint8_t *pagebuffer) {
-    if (rb == NULL || data == NULL || id == 0 || id == 0xff ||
-        pagebuffer == NULL) {
-        return RB_BAD_CALLER_DATA;
+//set up the page buffer for a write, buffered rings keep their own
+static void rb_start_write(rb_t *rb, uint8_t *pagebuffer) {
+    if (!rb->buffered) {
+        rb->rb_page = pagebuffer; //set temp pointer
+        rb->staged = false;
     }
-    rb->rb_page = pagebuffer; //set temp area pointer
-    uint32_t oldnext = rb->next;
-    //I think it makes sense to always delete the first match?
-    rb_errors_t hdr_err = rb_find_ring_oldest_sector(rb);
-    if (hdr_err != RB_OK) {
-        return hdr_err;
+}
+//flush the staged page if its oldest byte is past the deadline
+static rb_errors_t rb_check_deadline(rb_t *rb) {
+    if (rb->staged && time_us_64() - rb->stage_time >= rb->deadline_us) {
+        return rb_flush(rb);
     }
-    int res = rb_find(rb, id, data, size, pagebuffer);
-    if (res < 0) {
-        //some error
-        printf("some delete find failure %d looking for \"%s\"\n", res, (char *) data);
+    return RB_OK;
+}
+static rb_errors_t rb_write_checkpoint(rb_t *rb);
+/*
+ unbuffered writes always reach flash before returning. A mounted ring
+ checkpoints each new sector, flushing a buffered one first so the
+ checkpoint never points past flash. Returns the first flash error.
+*/
+static rb_errors_t rb_end_write(rb_t *rb) {
+    rb_errors_t res;
+    if (!rb->buffered) {
+        res = rb_flush(rb);
     } else {
-        printf("rb_delete erasing at 0x%lx\n%s\n", rb->next, (char *) data);
-        res = rb_smudge(rb, res); //this deletes the entry
+        res = rb_check_deadline(rb);
+    }
+    if (res == RB_OK && rb->checkpoints && rb->tail_valid &&
+        rb->checkpoint_index != rb->sector_index) {
+        res = rb_flush(rb);
+        if (res == RB_OK) {
+            res = rb_write_checkpoint(rb);
+        }
     }
-    rb->next = oldnext;
     return res;
 }
 /*
-    read up to size data bytes into data buffer, of next flash which matches id.
-    If data is less than size, check to see if split into two sectors, and add
-    the second data to the read. If data is less than size, return only the
-    actual data.
-
-    side effect rb->next will point to the next rb data to read
-
-    Return actual amount read or a negative status code.
+ point rb->next at the tail for an append. A full ring has its oldest sector
+ erased first if the caller allows it. Returns RB_BLANK_HDR when rb->next is
+ ready to append at.
 */
-int rb_read(rb_t *rb, uint8_t id, void *data, uint32_t size) {
-    rb_errors_t hdr_res;
-    rb_header hdr;
-    int total_read = 0;
-    uint32_t remaining_size = size;
-    uint32_t orignext = FLASH_SECTOR(rb->next); //save start of search
-    if (rb == NULL || data == NULL || size == 0 || id == 0xff || id == 00 ||
-        size > (rb->number_of_bytes - sizeof(hdr))) {
-        return RB_BAD_CALLER_DATA;
-    }
-    do {
-        hdr_res = fetch_and_check_header(rb, &hdr, 0); //fetch and check header
+static rb_errors_t rb_append_tail(rb_t *rb, bool erase_if_full) {
+    rb_errors_t hdr_res = rb_find_tail(rb);
+    if (hdr_res == RB_HDR_LOOP && erase_if_full) {
+        hdr_res = rb_flush(rb);
         if (hdr_res != RB_OK) {
-            return hdr_res; //return errors here
+            return hdr_res;
+        }
+        rb_find_ring_oldest_sector(rb);
+        // rb->next = RB_SECTOR(rb, rb->next);
+        hdr_res = rb_erase_sector(rb, rb->next);
+        if (hdr_res != RB_OK) {
+            return hdr_res;
+        }
+        RB_COUNT(rb, full_erases, 1);
+        hdr_res = RB_BLANK_HDR;
+    }
+    return hdr_res;
+}
+/*
+ stage one record at rb->next, which rb_append_tail set. If it does not fit
+ and the caller allows it the oldest sector is erased and it is tried again.
+ Data is only staged, the caller flushes when done.
+*/
+static rb_errors_t rb_stage_record(rb_t *rb, uint8_t id, const rb_src_t *from,
+                                   bool erase_if_full) {
+    rb_errors_t hdr_res;
+    rb_header rbh;
+    do {
+        rb_src_t src = *from; //a retry starts the crc over
+        rbh.id = id; //only thing needed from here on the header
+        hdr_res = rb_sector_append(rb, &rbh, &src);
+        if ((hdr_res == RB_WRAPPED_SECTOR_USED || hdr_res == RB_FULL) && erase_if_full) {
+            //nothing of this record was staged, get flash current first
+            hdr_res = rb_flush(rb);
+            if (hdr_res != RB_OK) {
+                break;
+            }
+            rb_find_ring_oldest_sector(rb);
+            hdr_res = rb_erase_sector(rb, rb->next);
+            if (hdr_res != RB_OK) {
+                break;
+            }
+            RB_COUNT(rb, full_erases, 1);
+            RB_COUNT(rb, retries, 1);
+            hdr_res = rb_append_tail(rb, erase_if_full); //the cached tail is still good
+            if (hdr_res == RB_BLANK_HDR) {
+                continue; //try append again
+            }
+        }
+        break; //done with loop
+    } while (1);
+    return hdr_res;
+}
+//append one record at the tail, see rb_append_tail and rb_stage_record
+static rb_errors_t rb_append_src_record(rb_t *rb, uint8_t id, const rb_src_t *from,
+                                        bool erase_if_full) {
+    rb_errors_t hdr_res = rb_append_tail(rb, erase_if_full);
+    if (hdr_res == RB_BLANK_HDR) {
+        hdr_res = rb_stage_record(rb, id, from, erase_if_full);
+    }
+    if (hdr_res == RB_OK) {
+        rb_save_tail(rb);
+    } else {
+        rb->tail_valid = false;
+    }
+    return hdr_res;
+}
+//longest payload rb_append takes, its crc has to fit in RB_MAX_APPEND_SIZE too
+static uint32_t rb_max_append(rb_t *rb) {
+    return RB_MAX_APPEND_SIZE - (rb->payload_crc ? sizeof(uint32_t) : 0);
+}
+static rb_errors_t rb_append_record(rb_t *rb, uint8_t id, const void *data, uint32_t size,
+                                    bool erase_if_full) {
+    rb_src_t src = {data, size, crc32_init(), rb->payload_crc, size, NULL};
+    return rb_append_src_record(rb, id, &src, erase_if_full);
+}
+// every call will flash the involved page(s), even tiny data
+rb_errors_t rb_append(rb_t *rb, uint8_t id, const void *data, uint32_t size,
+                      uint8_t *pagebuffer, bool erase_if_full) {
+    uint64_t start = rb_op_start();
+    rb_errors_t hdr_res;
+    if (rb == NULL || data == NULL || size == 0 || id == 0xff || id == RB_SYSTEM_ID ||
+        (pagebuffer == NULL && !rb->buffered) || rb->writing || rb->record_size ||
+        size > rb_max_append(rb)) {
+        return rb_op_end(rb, RB_OP_APPEND, start, RB_BAD_CALLER_DATA);
+    }
+
+    rb_start_write(rb, pagebuffer);
+    uint32_t oldnext = rb->next;
+    //rbcreate and other appends guarantee pointers are good in rb
+    hdr_res = rb_append_record(rb, id, data, size, erase_if_full);
+    rb_errors_t end_res = rb_end_write(rb);
+    if (hdr_res == RB_OK) {
+        hdr_res = end_res;
+    }
+    rb->next = oldnext;
+    return rb_op_end(rb, RB_OP_APPEND, start, hdr_res);
+}
+/*
+ Append many records in one pass. The tail is found once, then all headers
+ and payloads are staged one after the other in the page buffer, so each
+ touched page is programmed exactly once (pages in a sector erased to make
+ room get flushed early). Records split over sectors just like single
+ appends.
+
+ Returns the number of records appended, or a negative error if the first
+ one failed. If fewer than count were appended, the rest did not fit.
+*/
+int rb_append_batch(rb_t *rb, const rb_batch_entry_t *entries, uint32_t count,
+                    uint8_t *pagebuffer, bool erase_if_full) {
+    uint64_t start = rb_op_start();
+    rb_errors_t hdr_res = RB_OK;
+    uint32_t i;
+    if (rb == NULL || entries == NULL || count == 0 ||
+        (pagebuffer == NULL && !rb->buffered) || rb->writing || rb->record_size) {
+        return rb_op_end(rb, RB_OP_APPEND, start, RB_BAD_CALLER_DATA);
+    }
+    for (i = 0; i < count; i++) {
+        if (entries[i].data == NULL || entries[i].size == 0 || entries[i].id == 0xff ||
+            entries[i].id == RB_SYSTEM_ID ||
+            entries[i].size > rb_max_append(rb)) {
+            return rb_op_end(rb, RB_OP_APPEND, start, RB_BAD_CALLER_DATA);
+        }
+    }
+    rb_start_write(rb, pagebuffer);
+    uint32_t oldnext = rb->next;
+    hdr_res = rb_append_tail(rb, erase_if_full);
+    for (i = 0; hdr_res == RB_BLANK_HDR && i < count; i++) {
+        const rb_batch_entry_t *e = &entries[i];
+        rb_src_t src = {e->data, e->size, crc32_init(), rb->payload_crc, e->size, NULL};
+        hdr_res = rb_stage_record(rb, e->id, &src, erase_if_full);
+        if (hdr_res != RB_OK) {
+            break;
+        }
+        rb_save_tail(rb);
+        rb->next = rb->tail; //the next record goes on right here
+        hdr_res = RB_BLANK_HDR;
+    }
+    if (hdr_res == RB_BLANK_HDR) {
+        hdr_res = RB_OK;
+    } else if (i == 0) {
+        rb->tail_valid = false;
+    }
+    rb_errors_t end_res = rb_end_write(rb);
+    rb->next = oldnext;
+    if (end_res != RB_OK) {
+        return rb_op_end(rb, RB_OP_APPEND, start, end_res); //staged records may be lost
+    }
+    return rb_op_end(rb, RB_OP_APPEND, start, i ? (int)i : hdr_res);
+}
+/*
+ Streaming writes, for records bigger than RB_MAX_APPEND_SIZE or not held in
+ RAM all at once. The total size is given up front, so every fragment header
+ can be written with its final length as the record reaches it: the rest of
+ the first sector, then a RB_HEADER_SPLIT continuation filling each following
+ sector, however many it takes. Only the page buffer is needed.
+
+ While a writer is open it owns the tail of rb, other appends and deletes on
+ rb fail. Reads still work, but a record being written is not complete until
+ rb_writer_close.
+*/
+static rb_errors_t rb_smudge(rb_t *rb, uint32_t offset_to_smudge);
+//start the continuation fragment at the sector rb->next points to
+static rb_errors_t rb_writer_fragment(rb_writer_t *w) {
+    rb_t *rb = w->rb;
+    rb_sector_header shdr;
+    rb_header hdr;
+    rb_errors_t hdr_res;
+    if (RB_SECTOR(rb, rb->next) == w->first_sector) {
+        return RB_FULL; //would overwrite its own start
+    }
+    rb_flash_read(rb, rb->next, &shdr, sizeof(shdr));
+    if (is_sector_header_good(&shdr) != RB_BLANK_HDR) {
+        if (!w->erase_if_full) {
+            return RB_WRAPPED_SECTOR_USED;
+        }
+        //ring is full, this is the oldest sector
+        if (rb_flush(rb) != RB_OK || rb_erase_sector(rb, rb->next) != RB_OK) {
+            return RB_FLASH_ERROR;
+        }
+        RB_COUNT(rb, full_erases, 1);
+    }
+    w->left = MIN(w->remaining, RB_MAX_APPEND_SIZE);
+    hdr.id = w->id;
+    hdr_res = write_headers(rb, &hdr, w->left, RB_HEADER_SPLIT | w->flags);
+    if (hdr_res == RB_OK) {
+        rb->tail_valid = false; //the ring moved under the cached tail
+        RB_COUNT(rb, splits, 1);
+    }
+    return hdr_res;
+}
+//stage stream bytes, starting new fragments at sector ends
+static rb_errors_t rb_writer_put(rb_writer_t *w, const uint8_t *data, uint32_t size) {
+    rb_errors_t hdr_res;
+    while (size) {
+        if (w->left == 0) {
+            hdr_res = rb_writer_fragment(w);
+            if (hdr_res != RB_OK) {
+                return hdr_res;
+            }
+        }
+        uint32_t n = MIN(size, w->left);
+        hdr_res = rb_append_page(w->rb, data, n);
+        if (hdr_res != RB_OK) {
+            return hdr_res;
+        }
+        w->left -= n;
+        w->remaining -= n;
+        data += n;
+        size -= n;
+    }
+    return RB_OK;
+}
+/*
+ Open a streaming append of one record of size bytes. Like rb_append the tail
+ is found first, erasing the oldest sector of a full ring if erase_if_full.
+ The record may not need every sector of the ring.
+*/
+rb_errors_t rb_writer_open(rb_writer_t *w, rb_t *rb, uint8_t id, uint32_t size,
+                           uint8_t *pagebuffer, bool erase_if_full) {
+    rb_errors_t hdr_res;
+    rb_header hdr;
+    if (w == NULL || rb == NULL || size == 0 || id == 0xff || id == RB_SYSTEM_ID ||
+        rb->writing || rb->record_size ||
+        (pagebuffer == NULL && !rb->buffered)) {
+        return RB_BAD_CALLER_DATA;
+    }
+    w->rb = rb;
+    w->id = id;
+    w->size = size;
+    w->written = 0;
+    w->crc = crc32_init();
+    w->flags = RB_HEADER_NOT_SMUDGED | (rb->payload_crc ? RB_HEADER_PAYLOAD_CRC : 0);
+    w->remaining = size + (rb->payload_crc ? sizeof(uint32_t) : 0);
+    w->erase_if_full = erase_if_full;
+    w->readnext = rb->next;
+    rb_start_write(rb, pagebuffer);
+    uint32_t room, overhead, first;
+    do {
+        hdr_res = rb_find_tail(rb);
+        if (hdr_res == RB_HDR_LOOP && erase_if_full) {
+            hdr_res = rb_flush(rb);
+            if (hdr_res == RB_OK) {
+                rb_find_ring_oldest_sector(rb);
+                hdr_res = rb_erase_sector(rb, rb->next);
+            }
+            if (hdr_res == RB_OK) {
+                RB_COUNT(rb, full_erases, 1);
+                hdr_res = RB_BLANK_HDR;
+            }
+        }
+        if (hdr_res != RB_BLANK_HDR) {
+            rb->next = w->readnext;
+            return hdr_res;
+        }
+        //first fragment gets the rest of this sector
+        room = rb->sector_size - RB_MOD_SECTOR(rb, rb->next);
+        overhead = sizeof(hdr) + (RB_MOD_SECTOR(rb, rb->next) ? 0 : sizeof(rb_sector_header));
+        first = MIN(w->remaining, room - overhead);
+        if (w->remaining > first) {
+            //each continuation needs a sector, never the one we start in
+            uint32_t more = (w->remaining - first + RB_MAX_APPEND_SIZE - 1) / RB_MAX_APPEND_SIZE;
+            if (more >= rb->number_of_bytes / rb->sector_size) {
+                rb->next = w->readnext;
+                return RB_BAD_CALLER_DATA;
+            }
+        }
+        if ((uint32_t)sector_blank_scan(rb, first + overhead) >= MIN(room, first + overhead)) {
+            break;
+        }
+        if (!erase_if_full) {
+            rb->next = w->readnext;
+            return RB_FULL;
+        }
+        //the tail wrapped onto the oldest sector, make room like rb_append
+        if (rb_flush(rb) != RB_OK) {
+            rb->next = w->readnext;
+            return RB_FLASH_ERROR;
+        }
+        rb_find_ring_oldest_sector(rb);
+        if (rb_erase_sector(rb, rb->next) != RB_OK) {
+            rb->next = w->readnext;
+            return RB_FLASH_ERROR;
+        }
+    } while (1);
+    w->first_sector = RB_SECTOR(rb, rb->next);
+    w->left = first;
+    hdr.id = id;
+    hdr_res = write_headers(rb, &hdr, first, w->flags);
+    if (hdr_res != RB_OK) {
+        rb->next = w->readnext;
+        return hdr_res;
+    }
+    w->head = rb->last_wrote;
+    w->pos = rb->next;
+    rb->next = w->readnext;
+    rb->writing = true;
+    return RB_OK;
+}
+//append the next size bytes of the record
+rb_errors_t rb_writer_write(rb_writer_t *w, const void *data, uint32_t size) {
+    rb_errors_t hdr_res;
+    if (w == NULL || w->rb == NULL || !w->rb->writing || data == NULL ||
+        size > w->size - w->written) {
+        return RB_BAD_CALLER_DATA;
+    }
+    rb_t *rb = w->rb;
+    w->readnext = rb->next; //the reader may have moved between writes
+    rb->next = w->pos;
+    if (rb->payload_crc) {
+        w->crc = crc32_update(w->crc, data, size);
+    }
+    hdr_res = rb_writer_put(w, data, size);
+    w->written += size;
+    w->pos = rb->next;
+    rb->next = w->readnext;
+    return hdr_res;
+}
+/*
+ Finish the record. If fewer than size bytes were written, or a write failed,
+ the record is smudged so readers skip it, and RB_BAD_CALLER_DATA returned,
+ or RB_FLASH_ERROR if it was flash that failed.
+*/
+rb_errors_t rb_writer_close(rb_writer_t *w) {
+    rb_errors_t hdr_res = RB_OK;
+    if (w == NULL || w->rb == NULL || !w->rb->writing) {
+        return RB_BAD_CALLER_DATA;
+    }
+    rb_t *rb = w->rb;
+    w->readnext = rb->next;
+    rb->next = w->pos;
+    if (w->written == w->size && (w->flags & RB_HEADER_PAYLOAD_CRC)) {
+        uint32_t crc = crc32_finalize(w->crc);
+        uint8_t trailer[sizeof(crc)] = {crc, crc >> 8, crc >> 16, crc >> 24};
+        hdr_res = rb_writer_put(w, trailer, sizeof(trailer));
+    }
+    if (w->written != w->size || w->remaining || hdr_res != RB_OK) {
+        //give up, the rest of this fragment stays blank
+        nextincr(rb, w->left);
+        if (rb_flush(rb) != RB_OK || rb_smudge(rb, w->head) != RB_OK ||
+            hdr_res == RB_FLASH_ERROR) {
+            hdr_res = RB_FLASH_ERROR;
+        } else {
+            hdr_res = RB_BAD_CALLER_DATA;
+        }
+    }
+    if (rb->aligned) {
+        nextincr(rb, ROUND_UP(rb->next));
+    }
+    if (hdr_res != RB_FLASH_ERROR) {
+        rb_save_tail(rb);
+    }
+    rb->writing = false;
+    rb_errors_t end_res = rb_end_write(rb);
+    rb->next = w->readnext;
+    return hdr_res != RB_OK ? hdr_res : end_res;
+}
+/*
+ With payload crc on, every record appended through rb gets a crc32 of its
+ payload stored after it (4 more bytes of flash), and flagged in its header.
+ rb_read checks flagged records whichever rb wrote them, so rings can hold a
+ mix of records with and without crcs.
+*/
+rb_errors_t rb_set_payload_crc(rb_t *rb, bool on) {
+    if (rb == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    rb->payload_crc = on;
+    return RB_OK;
+}
+/*
+ Aligned rings start every record header, and so every payload, on a uint32
+ boundary by leaving up to 3 blank bytes after each record. The mode is kept
+ in the sector headers so rb_create finds it again, and it can only be
+ changed while no sector has been written in the other mode.
+*/
+rb_errors_t rb_set_aligned(rb_t *rb, bool on) {
+    rb_sector_header shdr;
+    if (rb == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    for (uint32_t i = 0; i < rb->number_of_bytes; i += rb->sector_size) {
+        rb_flash_read(rb, i, &shdr, sizeof(shdr));
+        if (is_sector_header_good(&shdr) == RB_OK &&
+            !(get_crc(&shdr) & RB_SECTOR_ALIGNED) != !on) {
+            return RB_BAD_CALLER_DATA; //ring holds records in the other format
+        }
+    }
+    rb->aligned = on;
+    return RB_OK;
+}
+/*
+ Buffered writes. Records are staged in the page buffer owned by rb and only
+ programmed when the page fills, when the oldest staged byte is older than
+ deadline_us (checked by every append and by rb_poll) or by rb_sync. Many
+ tiny records then share one page program.
+
+ Durability window: until flushed, staged records live only in RAM and are
+ lost on a reset or power cut. At most one page (the partly filled last one)
+ is at risk, for at most deadline_us if rb_poll is called often enough. Only
+ this rb sees the staged records (rb_read merges them in), other rb_t on the
+ same flash see them after the flush. A buffered rb must be the only writer
+ of its ring, and must be rb_sync'ed before rb_create is called on it again.
+
+ deadline_us 0 flushes at the end of every append, like unbuffered writes.
+*/
+rb_errors_t rb_set_buffered(rb_t *rb, uint8_t *pagebuffer, uint32_t deadline_us) {
+    if (rb == NULL || pagebuffer == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    rb_errors_t err = rb_sync(rb); //anything staged in a previous buffer goes first
+    if (err != RB_OK) {
+        return err;
+    }
+    rb->rb_page = pagebuffer;
+    rb->buffered = true;
+    rb->deadline_us = deadline_us;
+    return RB_OK;
+}
+//write anything staged to flash, and go back to unbuffered writes
+rb_errors_t rb_clear_buffered(rb_t *rb) {
+    if (rb == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    rb_errors_t err = rb_sync(rb);
+    rb->buffered = false;
+    return err;
+}
+rb_errors_t rb_set_cache(rb_t *rb, rb_cache_t *cache) {
+    if (rb == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    rb->cache = cache;
+    if (cache != NULL) {
+        for (uint32_t w = 0; w < RB_CACHE_PAGES; w++) {
+            cache->page[w] = RB_CACHE_EMPTY;
+            cache->used[w] = 0;
+        }
+        cache->header_valid = 0;
+        cache->clock = 0;
+        cache->hits = 0;
+        cache->misses = 0;
+        cache->header_hits = 0;
+        cache->header_misses = 0;
+    }
+    return RB_OK;
+}
+//program any staged records into flash now
+rb_errors_t rb_sync(rb_t *rb) {
+    if (rb == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    return rb_flush(rb);
+}
+/*
+ call periodically (idle loop) so a quiet buffered ring still meets its
+ deadline, and an erase ahead ring gets its sectors erased
+*/
+rb_errors_t rb_poll(rb_t *rb) {
+    if (rb == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    rb_errors_t err = rb_check_deadline(rb);
+    if (err == RB_OK && rb->erase_ahead && !rb->writing) {
+        err = rb_maintain(rb);
+    }
+    return err;
+}
+/*
+ Erase ahead. A full ring normally makes room by erasing its oldest sector in
+ the middle of an append, and a sector erase takes far longer than any page
+ program. With erase ahead the next sectors after the tail are kept blank by
+ rb_maintain (or rb_poll) instead, called when the caller has time to spare,
+ so appends only program pages that are already blank. The ring holds that
+ many sectors less data.
+
+ An append only erases if maintenance fell so far behind that the ring is
+ full; pass erase_if_full false to get RB_FULL then instead, and a worst case
+ append that never waits for an erase.
+*/
+static int rb_reclaim(rb_t *rb, uint32_t sector);
+rb_errors_t rb_set_erase_ahead(rb_t *rb, uint32_t sectors) {
+    if (rb == NULL || sectors >= rb->number_of_bytes / rb->sector_size) {
+        return RB_BAD_CALLER_DATA; //the sector being written is never erased
+    }
+    rb->erase_ahead = sectors;
+    return RB_OK;
+}
+//sector n after the one holding the last written byte
+static uint32_t rb_ahead_sector(rb_t *rb, uint32_t n) {
+    uint32_t sector = RB_SECTOR(rb, rb->tail);
+    if (RB_MOD_SECTOR(rb, rb->tail)) {
+        n++;
+    }
+    return (sector + n * rb->sector_size) % rb->number_of_bytes;
+}
+/*
+ erase whatever is not blank of the erase_ahead sectors after the tail. With
+ compaction on, live records of a sector are copied to the tail first, which
+ moves the tail, so the sectors ahead are looked at again.
+*/
+rb_errors_t rb_maintain(rb_t *rb) {
+    rb_sector_header shdr;
+    if (rb == NULL || rb->writing) {
+        return RB_BAD_CALLER_DATA;
+    }
+    uint32_t oldnext = rb->next;
+    rb_errors_t hdr_res = rb_find_tail(rb);
+    if (hdr_res == RB_HDR_LOOP) {
+        //full, the oldest sector is where the tail goes next
+        hdr_res = rb_flush(rb);
+        if (hdr_res == RB_OK) {
+            rb_find_ring_oldest_sector(rb);
+            hdr_res = rb_erase_sector(rb, rb->next);
+        }
+        if (hdr_res == RB_OK) {
+            hdr_res = RB_BLANK_HDR;
+        }
+    }
+    if (hdr_res != RB_BLANK_HDR) {
+        rb->next = oldnext;
+        return hdr_res;
+    }
+    rb_save_tail(rb);
+    uint32_t i = 0;
+    uint32_t passes = 0;
+    while (i < rb->erase_ahead) {
+        uint32_t sector = rb_ahead_sector(rb, i);
+        rb_flash_read(rb, sector, &shdr, sizeof(shdr));
+        int copied = 0;
+        if (is_sector_header_good(&shdr) != RB_BLANK_HDR) {
+            copied = rb_reclaim(rb, sector);
+        }
+        if (copied < 0) {
+            rb->next = oldnext;
+            return copied;
+        }
+        if (copied && ++passes < rb->number_of_bytes / rb->sector_size) {
+            i = 0;
+            continue;
+        }
+        i++;
+    }
+    rb->next = oldnext;
+    return RB_OK;
+}
+/*
+ move *next to the header of the next live record with id (any user record
+ for RB_ANY_ID), skipping other ids, smudged records and split parts whose
+ start was erased. The header is returned in hdr.
+*/
+static rb_errors_t rb_seek_id(rb_t *rb, uint32_t *next, uint8_t id, rb_header *hdr) {
+    rb_errors_t hdr_res;
+    uint32_t orignext = RB_SECTOR(rb, *next); //save start of search
+    do {
+        if (RB_MOD_SECTOR(rb, *next) == 0 && !rb_sector_follows(rb, *next)) {
+            return RB_BLANK_HDR; //the end of a full ring
+        }
+        hdr_res = fetch_header_at(rb, next, hdr, 0); //fetch and check header
+        if (hdr_res != RB_OK) {
+            return hdr_res; //return errors here
+        }
+        if ((id == RB_ANY_ID ? hdr->id == RB_SYSTEM_ID : hdr->id != id) ||
+            !(hdr->crc & RB_HEADER_NOT_SMUDGED) || (hdr->crc & RB_HEADER_SPLIT)) {
+            //not my data, or it was erased, keep looking. A split part here
+            //lost its start when the sector before was erased
+            *next = rb_incr(rb, *next, rb_span(rb, hdr->len) + sizeof(*hdr));
+            if (orignext == *next) return RB_HDR_ID_NOT_FOUND;
+            continue; //do loop again
+        }
+        return RB_OK;
+    } while (1);
+}
+//continue a crc32 over size bytes of the ring without copying them out
+static uint32_t rb_crc_range(rb_t *rb, uint32_t crc, uint32_t offset, uint32_t size) {
+    uint8_t chunk[32];
+    while (size) {
+        uint32_t n = MIN(size, sizeof(chunk));
+        rb_flash_read(rb, offset, chunk, n);
+        crc = crc32_update(crc, chunk, n);
+        offset += n;
+        size -= n;
+    }
+    return crc;
+}
+/*
+ Chunked reads. rb_reader_open finds the next record with id, walks its
+ fragment headers to learn the length, and leaves rb->next after it like
+ rb_read. The reader keeps its own position, so rb_reader_read can return the
+ payload in pieces of any size, following the RB_HEADER_SPLIT continuations
+ however many there are.
+
+ A payload crc is checked as the data goes by, and the read reaching the end
+ of the payload returns RB_BAD_PAYLOAD_CRC instead of its count if the record
+ was damaged. rb_reader_skip moves on without reading flash, and gives up
+ checking the crc. Opened with RB_ANY_ID it takes the next user record of
+ whatever id, r->id tells which.
+*/
+static int rb_reader_open_at(rb_reader_t *r, rb_t *rb, uint32_t *next, uint8_t id) {
+    rb_errors_t hdr_res;
+    rb_header hdr;
+    if (r == NULL || rb == NULL || id == 00) {
+        return RB_BAD_CALLER_DATA;
+    }
+    hdr_res = rb_seek_id(rb, next, id, &hdr);
+    if (hdr_res != RB_OK) {
+        return hdr_res;
+    }
+    r->rb = rb;
+    r->id = hdr.id;
+    r->at = *next;
+    r->has_crc = hdr.crc & RB_HEADER_PAYLOAD_CRC;
+    r->check = r->has_crc;
+    r->crc = crc32_init();
+    r->pos = *next + sizeof(hdr);
+    r->left = hdr.len;
+    r->taken = 0;
+    r->fragments = 0;
+    uint32_t stream_len = 0;
+    do {
+        *next += sizeof(hdr);
+        *next = rb_incr(rb, *next, rb_span(rb, hdr.len));
+        stream_len += hdr.len;
+        r->fragments++;
+        if (RB_MOD_SECTOR(rb, *next) || !rb_sector_follows(rb, *next)) {
+            break; //record ended inside this sector, or the ring ends here
+        }
+        //we ended on a sector boundary, maybe the record goes on there.
+        //*next stays at the boundary unless it does
+        uint32_t at = *next;
+        hdr_res = fetch_header_at(rb, &at, &hdr, 0); //fetch and check header
+        if (hdr_res == RB_BLANK_HDR) {
+            break;
+        }
+        if (hdr_res != RB_OK) {
+            return hdr_res;
+        }
+        if (hdr.id != r->id || !(hdr.crc & RB_HEADER_SPLIT)) {
+            break;
+        }
+        *next = at;
+    } while (true);
+    if (r->has_crc && stream_len < sizeof(uint32_t)) {
+        return RB_BAD_PAYLOAD_CRC;
+    }
+    r->length = stream_len - (r->has_crc ? sizeof(uint32_t) : 0);
+    return r->length;
+}
+int rb_reader_open(rb_reader_t *r, rb_t *rb, uint8_t id) {
+    if (rb == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    return rb_reader_open_at(r, rb, &rb->next, id);
+}
+//step from the end of a fragment to the continuation in the next sector
+static rb_errors_t rb_reader_next_fragment(rb_reader_t *r) {
+    rb_t *rb = r->rb;
+    rb_header hdr;
+    uint32_t sector = r->pos >= rb->number_of_bytes ? 0 : r->pos;
+    //open checked these, but the ring may have wrapped over them since
+    rb_flash_read(rb, sector + sizeof(rb_sector_header), &hdr, sizeof(hdr));
+    if (is_header_good(&hdr) != RB_OK || !(hdr.crc & RB_HEADER_SPLIT)) {
+        return RB_BAD_HDR;
+    }
+    r->pos = sector + sizeof(rb_sector_header) + sizeof(hdr);
+    r->left = hdr.len;
+    return RB_OK;
+}
+//move over size record bytes, copying them to buf if there is one
+static rb_errors_t rb_reader_move(rb_reader_t *r, uint8_t *buf, uint32_t size) {
+    rb_errors_t hdr_res;
+    while (size) {
+        if (r->left == 0) {
+            hdr_res = rb_reader_next_fragment(r);
+            if (hdr_res != RB_OK) {
+                return hdr_res;
+            }
+        }
+        uint32_t n = MIN(size, r->left);
+        if (buf) {
+            rb_flash_read(r->rb, r->pos, buf, n);
+            if (r->check) {
+                r->crc = crc32_update(r->crc, buf, n);
+            }
+            buf += n;
+        } else if (r->check) {
+            r->crc = rb_crc_range(r->rb, r->crc, r->pos, n);
+        }
+        r->pos += n;
+        r->left -= n;
+        r->taken += n;
+        size -= n;
+    }
+    return RB_OK;
+}
+//payload bytes not yet read or skipped
+static uint32_t rb_reader_rest(rb_reader_t *r) {
+    return r->taken < r->length ? r->length - r->taken : 0;
+}
+//check the crc over whatever of the payload is left, then the trailer
+static rb_errors_t rb_reader_finish(rb_reader_t *r) {
+    rb_errors_t hdr_res;
+    uint8_t trailer[sizeof(uint32_t)];
+    if (!r->check) {
+        return RB_OK;
+    }
+    hdr_res = rb_reader_move(r, NULL, rb_reader_rest(r));
+    if (hdr_res == RB_OK) {
+        hdr_res = rb_reader_move(r, trailer, sizeof(trailer));
+    }
+    r->check = false; //only once
+    if (hdr_res != RB_OK) {
+        return hdr_res;
+    }
+    //payload followed by its crc always leaves the same residue
+    if (crc32_finalize(r->crc) != CRC32_RESIDUE) {
+        return RB_BAD_PAYLOAD_CRC;
+    }
+    return RB_OK;
+}
+//read the next size bytes of the record, 0 at its end
+int rb_reader_read(rb_reader_t *r, void *data, uint32_t size) {
+    rb_errors_t hdr_res;
+    if (r == NULL || r->rb == NULL || data == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    uint32_t n = MIN(size, rb_reader_rest(r));
+    hdr_res = rb_reader_move(r, data, n);
+    if (hdr_res == RB_OK && rb_reader_rest(r) == 0) {
+        hdr_res = rb_reader_finish(r);
+    }
+    return hdr_res != RB_OK ? hdr_res : (int)n;
+}
+//skip the next size bytes of the record without reading them
+int rb_reader_skip(rb_reader_t *r, uint32_t size) {
+    rb_errors_t hdr_res;
+    if (r == NULL || r->rb == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    r->check = false; //the crc can only be checked over all of it
+    uint32_t n = MIN(size, rb_reader_rest(r));
+    hdr_res = rb_reader_move(r, NULL, n);
+    return hdr_res != RB_OK ? hdr_res : (int)n;
+}
+//read an opened record into data, the whole rest of it is still checked
+static int rb_reader_take(rb_reader_t *r, void *data, uint32_t size) {
+    int total_read = rb_reader_read(r, data, size);
+    if (total_read < 0) {
+        return total_read;
+    }
+    rb_errors_t res = rb_reader_finish(r);
+    return res != RB_OK ? res : total_read;
+}
+/*
+    read up to size data bytes into data buffer, of next flash which matches id.
+    If the record is split into the following sector(s), the continuation
+    fragments are read too, however many there are. If data is less than
+    size, return only the actual data.
+
+    Records written with a payload crc are checked while they are read, even
+    the part that did not fit in data. A bad record returns
+    RB_BAD_PAYLOAD_CRC, but still moves rb->next past it.
+
+    side effect rb->next will point to the next rb data to read
+
+    Return actual amount read or a negative status code.
+*/
+static int rb_read_at(rb_t *rb, uint32_t *next, uint8_t id, void *data, uint32_t size) {
+    rb_reader_t r;
+    if (rb == NULL || data == NULL || size == 0 || id == 0xff || id == 00 ||
+        size > (rb->number_of_bytes - sizeof(rb_header))) {
+        return RB_BAD_CALLER_DATA;
+    }
+    int res = rb_reader_open_at(&r, rb, next, id);
+    if (res < 0) {
+        return res;
+    }
+    return rb_reader_take(&r, data, size);
+}
+int rb_read(rb_t *rb, uint8_t id, void *data, uint32_t size) {
+    if (rb == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    uint64_t start = rb_op_start();
+    return rb_op_end(rb, RB_OP_READ, start, rb_read_at(rb, &rb->next, id, data, size));
+}
+/*
+ Zero copy read. Instead of copying the next record with id, point seg at it
+ in the memory mapped flash: seg[0] is the part in the first sector and seg[1]
+ the part split into the next one, or len 0 if it was not split. The payload
+ crc, if any, is checked and left out of the segments. Records streamed over
+ more than two sectors are skipped with RB_RECORD_TOO_BIG.
+
+ The pointers stay good until the ring wraps and erases the sector, so use
+ them before appending much more. In an aligned ring seg[0].data is uint32
+ aligned, and a record with seg[1].len 0 can be used in place as a struct.
+
+ side effect rb->next will point to the next rb data to read, as for rb_read.
+ A buffered rb is flushed first, the pointers can only see flash.
+
+ Return the record length or a negative status code.
+*/
+static int rb_segments_at(rb_t *rb, uint32_t *next, uint8_t id,
+                          rb_segment_t seg[RB_PEEK_SEGMENTS]) {
+    rb_reader_t r;
+    rb_errors_t hdr_res;
+    uint32_t n;
+    int len = rb_reader_open_at(&r, rb, next, id);
+    if (len < 0) {
+        return len;
+    }
+    if (r.fragments > RB_PEEK_SEGMENTS) {
+        return RB_RECORD_TOO_BIG; //streamed over more sectors, use rb_read
+    }
+    for (n = 0; n < RB_PEEK_SEGMENTS; n++) {
+        seg[n].data = NULL;
+        seg[n].len = 0;
+    }
+    for (n = 0; rb_reader_rest(&r); n++) {
+        if (r.left == 0) {
+            hdr_res = rb_reader_next_fragment(&r);
+            if (hdr_res != RB_OK) {
+                return hdr_res;
+            }
+        }
+        seg[n].data = rb->dev->mapped(rb->dev, rb_address(rb, r.pos));
+        //the crc trailer can straddle both segments, leave it out
+        seg[n].len = MIN(r.left, rb_reader_rest(&r));
+        hdr_res = rb_reader_move(&r, NULL, seg[n].len);
+        if (hdr_res != RB_OK) {
+            return hdr_res;
+        }
+    }
+    hdr_res = rb_reader_finish(&r);
+    return hdr_res != RB_OK ? hdr_res : len;
+}
+static int rb_peek_at(rb_t *rb, uint32_t *next, uint8_t id,
+                      rb_segment_t seg[RB_PEEK_SEGMENTS]) {
+    if (rb == NULL || seg == NULL || id == 0xff || id == 00 || rb->dev->mapped == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    rb_errors_t res = rb_flush(rb);
+    if (res != RB_OK) {
+        return res;
+    }
+    return rb_segments_at(rb, next, id, seg);
+}
+int rb_peek(rb_t *rb, uint8_t id, rb_segment_t seg[RB_PEEK_SEGMENTS]) {
+    if (rb == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    return rb_peek_at(rb, &rb->next, id, seg);
+}
+/* search flash for an existing entry id and data match. return positive offset
+   of match or negative error number. scratch must be at least size bytes
+   longs. Records longer than size match on their first size bytes. */
+static int rb_find_at(rb_t *rb, uint32_t *next, uint8_t id, const void *data,
+                      uint32_t size, uint8_t *scratch) {
+    rb_errors_t hdr_res;
+    rb_header hdr;
+    if (rb == NULL || data == NULL || size == 0 || id == 0xff || id == 00 ||
+        scratch == NULL || size > (rb->number_of_bytes - sizeof(hdr))) {
+        return RB_BAD_CALLER_DATA;
+    }
+    //records filling their sectors exactly leave no blank header to stop
+    //at, so give up after going once around the ring
+    uint32_t walked = 0;
+    do {
+        uint32_t from = *next;
+        hdr_res = rb_seek_id(rb, next, id, &hdr);
+        if (hdr_res != RB_OK) {
+            return hdr_res; //return errors here
+        }
+        //found next entry, read it into scratch buffer
+        uint32_t oldnext = *next;
+        int res = rb_read_at(rb, next, id, scratch, size);
+        if (res == (int)size && !memcmp(data, scratch, size)) {
+            return oldnext; //found match, return its location
+        }
+        if (res < 0 && res != RB_BAD_PAYLOAD_CRC) {
+            return res;
+        }
+        //too short, different or damaged, keep searching.
+        walked += (*next + rb->number_of_bytes - from) % rb->number_of_bytes;
+        if (walked >= rb->number_of_bytes) {
+            return RB_HDR_ID_NOT_FOUND;
+        }
+    } while (true);
+}
+int rb_find(rb_t *rb, uint8_t id, const void *data, uint32_t size, uint8_t *scratch) {
+    if (rb == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    uint64_t start = rb_op_start();
+    return rb_op_end(rb, RB_OP_FIND, start,
+                     rb_find_at(rb, &rb->next, id, data, size, scratch));
+}
+//this function effectively deletes a flash record, by smudging it, which can be
+//done after it is already written. Due to nand flash implementations, I can
+//write 1 bits to 0 bits, but not vice-versa
+static rb_errors_t rb_smudge(rb_t *rb, uint32_t offset_to_smudge) {
+    rb_header hdr;
+    uint32_t savenext = rb->next;
+    rb->next = offset_to_smudge;
+    rb_errors_t hdr_res = fetch_and_check_header(rb, &hdr, 0); //fetch and check header
+    if (hdr_res != RB_OK) {
+        return hdr_res; //return errors here
+    }
+    //overwrite the old crc byte clearing the smudge bit
+    hdr.crc &= ~RB_HEADER_NOT_SMUDGED;
+    rb->next += offsetof(rb_header, crc);
+    printf("rb_smudge erasing 0x%" PRIx32 "\n", rb->next);
+    rb->staged = false;
+    int res = rb_append_page(rb, &hdr.crc, 1);
+    if (res == RB_OK) {
+        res = rb_flush(rb);
+    }
+    rb->next = savenext; //return offset to entry deleted
+    return res;
+}
+/* given a writable page, delete a matching id, string entry */
+//smudge the record at offset using pagebuffer, a buffered rb keeps its own page
+static rb_errors_t rb_smudge_with(rb_t *rb, uint32_t offset, uint8_t *pagebuffer) {
+    rb_errors_t err = rb_sync(rb);
+    if (err != RB_OK) {
+        return err;
+    }
+    uint8_t *ownpage = rb->rb_page;
+    rb->rb_page = pagebuffer; //set temp area pointer
+    rb_errors_t res = rb_smudge(rb, offset);
+    if (rb->buffered) {
+        rb->rb_page = ownpage;
+    }
+    return res;
+}
+rb_errors_t rb_delete(rb_t *rb, uint8_t id, const void *data, uint32_t size, uint8_t *pagebuffer) {
+    uint64_t start = rb_op_start();
+    if (rb == NULL || data == NULL || id == 0 || id == 0xff ||
+        pagebuffer == NULL || rb->writing) {
+        return rb_op_end(rb, RB_OP_DELETE, start, RB_BAD_CALLER_DATA);
+    }
+    //a buffered rb gets its records into flash first, and keeps its page
+    rb_errors_t err = rb_sync(rb);
+    if (err != RB_OK) {
+        return rb_op_end(rb, RB_OP_DELETE, start, err);
+    }
+    //I think it makes sense to always delete the first match?
+    rb_cursor_t c;
+    rb_errors_t hdr_err = rb_cursor_open(&c, rb);
+    if (hdr_err != RB_OK) {
+        return rb_op_end(rb, RB_OP_DELETE, start, hdr_err);
+    }
+    int res = rb_find_at(rb, &c.next, id, data, size, pagebuffer);
+    if (res < 0) {
+        //some error
+        printf("some delete find failure %d looking for \"%s\"\n", res, (char *) data);
+    } else {
+        printf("rb_delete erasing at 0x%" PRIx32 "\n%s\n", c.next, (char *) data);
+        res = rb_smudge_with(rb, res, pagebuffer); //this deletes the entry
+    }
+    return rb_op_end(rb, RB_OP_DELETE, start, res);
+}
+//delete the record at offset, as returned by rb_find or kept from a reader
+rb_errors_t rb_delete_at(rb_t *rb, uint32_t offset, uint8_t *pagebuffer) {
+    uint64_t start = rb_op_start();
+    if (rb == NULL || pagebuffer == NULL || rb->writing || offset >= rb->number_of_bytes) {
+        return rb_op_end(rb, RB_OP_DELETE, start, RB_BAD_CALLER_DATA);
+    }
+    return rb_op_end(rb, RB_OP_DELETE, start, rb_smudge_with(rb, offset, pagebuffer));
+}
+/*
+ Compaction. A deleted (smudged) record keeps its flash until the sector
+ holding it is erased, and that erase also throws away the live records next
+ to it. Only the oldest sector can be erased without breaking the order of
+ the sector indexes, so that is the one compaction works on: its live
+ records are copied to the tail, staged so each page is programmed once, and
+ only then is the sector erased. A power cut in between leaves a record
+ twice, never lost.
+
+ Copies become the newest records, so a ring where the latest record of an id
+ wins must smudge the versions it replaces. Time rings are never compacted,
+ their records have to stay in time order. Records streamed over more than
+ two sectors, or damaged ones, are not copied.
+*/
+typedef struct {
+    uint32_t live;  //sector bytes held by records to copy
+    uint32_t dead;  //sector bytes given back by compacting
+    uint32_t need;  //room the copies may take at the tail, worst case
+} rb_usage_t;
+
+//look at the records starting in sector, copying the live ones to the tail if copy
+static rb_errors_t rb_sector_walk(rb_t *rb, uint32_t sector, rb_usage_t *use, bool copy) {
+    rb_header hdr;
+    rb_segment_t seg[RB_PEEK_SEGMENTS];
+    uint32_t crc_len = rb->payload_crc ? sizeof(uint32_t) : 0;
+    uint32_t offs = sector + sizeof(rb_sector_header);
+    use->live = use->need = 0;
+    do {
+        rb_flash_read(rb, offs, &hdr, sizeof(hdr));
+        RB_COUNT(rb, headers, 1);
+        if (is_header_good(&hdr) != RB_OK) {
+            break; //the rest of the sector is blank
+        }
+        uint32_t next = rb_incr(rb, offs, sizeof(hdr) + rb_span(rb, hdr.len));
+        uint32_t at = offs;
+        int len;
+        if (hdr.id != RB_SYSTEM_ID && (hdr.crc & RB_HEADER_NOT_SMUDGED) &&
+            !(hdr.crc & RB_HEADER_SPLIT) &&
+            (len = rb_segments_at(rb, &at, hdr.id, seg)) > 0 &&
+            len + crc_len <= RB_MAX_APPEND_SIZE) {
+            use->live += MIN(sizeof(hdr) + rb_span(rb, hdr.len),
+                             rb->sector_size - RB_MOD_SECTOR(rb, offs));
+            //a header, maybe a split header, padding and a sector end skipped
+            use->need += 4 * sizeof(hdr) + rb_span(rb, len + crc_len);
+            if (copy) {
+                rb_src_t src = {seg[0].data, len, crc32_init(), rb->payload_crc,
+                                seg[0].len, seg[1].data};
+                rb_errors_t hdr_res = rb_append_src_record(rb, hdr.id, &src, false);
+                if (hdr_res != RB_OK) {
+                    return hdr_res;
+                }
+            }
+        }
+        offs = next;
+    } while (RB_SECTOR(rb, offs) == sector && RB_MOD_SECTOR(rb, offs));
+    use->dead = rb->sector_size - sizeof(rb_sector_header) - use->live;
+    return RB_OK;
+}
+//blank bytes from the tail up to sector
+static uint32_t rb_room_before(rb_t *rb, uint32_t sector) {
+    rb_sector_header shdr;
+    uint32_t room = 0;
+    if (RB_MOD_SECTOR(rb, rb->tail)) {
+        room = rb->sector_size - RB_MOD_SECTOR(rb, rb->tail);
+    }
+    for (uint32_t n = 0; rb_ahead_sector(rb, n) != sector; n++) {
+        rb_flash_read(rb, rb_ahead_sector(rb, n), &shdr, sizeof(shdr));
+        if (is_sector_header_good(&shdr) != RB_BLANK_HDR) {
+            break;
+        }
+        room += rb->sector_size - sizeof(shdr);
+    }
+    return room;
+}
+/*
+ compact the oldest sector if at most max_pct of it is live and the copies
+ fit, returning the bytes given back. rb->tail must be current.
+*/
+static int rb_compact_sector(rb_t *rb, uint32_t sector, uint8_t *pagebuffer, uint32_t max_pct) {
+    rb_usage_t use;
+    if (rb->timestamp_of != NULL || rb->dev->mapped == NULL || RB_SECTOR(rb, rb->tail) == sector) {
+        return RB_BAD_CALLER_DATA;
+    }
+    rb_errors_t hdr_res = rb_sector_walk(rb, sector, &use, false);
+    if (hdr_res != RB_OK) {
+        return hdr_res;
+    }
+    if (use.dead == 0) {
+        return 0; //nothing to give back
+    }
+    if (use.live * 100 > max_pct * (rb->sector_size - sizeof(rb_sector_header)) ||
+        use.need > rb_room_before(rb, sector)) {
+        return RB_FULL;
+    }
+    uint32_t oldnext = rb->next;
+    rb_start_write(rb, pagebuffer);
+    hdr_res = rb_sector_walk(rb, sector, &use, true);
+    rb_errors_t flush_res = rb_flush(rb); //the copies reach flash before the originals go
+    rb->next = oldnext;
+    if (hdr_res == RB_OK) {
+        hdr_res = flush_res;
+    }
+    if (hdr_res == RB_OK) {
+        hdr_res = rb_erase_sector(rb, sector);
+    }
+    return hdr_res != RB_OK ? hdr_res : (int)use.dead;
+}
+/*
+ rb_maintain needs sector blank. 1 if live records were copied to the tail,
+ 0 if it was just erased, or RB_FLASH_ERROR.
+*/
+static int rb_reclaim(rb_t *rb, uint32_t sector) {
+    if (rb->compact_pct) {
+        int res = rb_compact_sector(rb, sector, rb->compact_page, rb->compact_pct);
+        if (res > 0 || res == RB_FLASH_ERROR) {
+            return res > 0 ? 1 : res;
+        }
+    }
+    return rb_erase_sector(rb, sector);
+}
+/*
+ Compact from rb_maintain. Before an erase ahead sector is erased, its live
+ records are copied to the tail if they take at most max_live_pct of it. The
+ knob trades write amplification for keeping data: at 0 the ring never
+ copies and old records cycle out, at 100 every record still live is kept as
+ long as the sector has anything to give back. There has to be room at the
+ tail for the copies, so use it with erase ahead. pagebuffer is used for the
+ copies unless rb is buffered and must stay valid. Copies are made straight
+ from the memory mapped flash, so a device without mapped can not compact.
+*/
+rb_errors_t rb_set_compaction(rb_t *rb, uint8_t max_live_pct, uint8_t *pagebuffer) {
+    if (rb == NULL || max_live_pct > 100 || (max_live_pct && pagebuffer == NULL &&
+        !rb->buffered) || (max_live_pct && rb->dev->mapped == NULL)) {
+        return RB_BAD_CALLER_DATA;
+    }
+    rb->compact_pct = max_live_pct;
+    rb->compact_page = pagebuffer;
+    return RB_OK;
+}
+//compact the oldest sector now, returns the bytes given back
+int rb_compact(rb_t *rb, uint8_t *pagebuffer) {
+    rb_sector_header shdr;
+    uint32_t oldest;
+    if (rb == NULL || rb->writing || (pagebuffer == NULL && !rb->buffered) ||
+        rb->dev->mapped == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    uint32_t oldnext = rb->next;
+    rb_errors_t hdr_res = rb_find_tail(rb);
+    if (hdr_res == RB_BLANK_HDR) {
+        rb_save_tail(rb); //the tail is where rb_find_tail left rb->next
+    }
+    rb->next = oldnext;
+    if (hdr_res != RB_BLANK_HDR) {
+        return hdr_res == RB_HDR_LOOP ? RB_FULL : hdr_res;
+    }
+    hdr_res = rb_oldest_sector_at(rb, &oldest);
+    if (!(hdr_res == RB_OK || hdr_res == RB_BLANK_HDR)) {
+        return hdr_res;
+    }
+    rb_flash_read(rb, oldest, &shdr, sizeof(shdr));
+    if (is_sector_header_good(&shdr) != RB_OK || RB_SECTOR(rb, rb->tail) == oldest) {
+        return 0; //blank ring, or only one sector used
+    }
+    return rb_compact_sector(rb, oldest, pagebuffer, 100);
+}
+/*
+ Read cursors. rb->next is the one read position of rb; a cursor is another,
+ so any number of readers can walk the same ring each at their own pace.
+ Opening one only reads the sector headers to find the oldest sector, rb must
+ already be created. Reopen to rewind. next can be saved and set back, or set
+ to an offset returned by rb_cursor_find, like rb->next.
+*/
+rb_errors_t rb_cursor_open(rb_cursor_t *c, rb_t *rb) {
+    if (c == NULL || rb == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    c->rb = rb;
+    rb_errors_t hdr_res = rb_oldest_sector_at(rb, &c->next);
+    c->next = rb_read_start(rb, c->next);
+    //a blank ring is fine to read, there is just nothing there
+    return hdr_res == RB_BLANK_HDR ? RB_OK : hdr_res;
+}
+int rb_cursor_read(rb_cursor_t *c, uint8_t id, void *data, uint32_t size) {
+    if (c == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    uint64_t start = rb_op_start();
+    return rb_op_end(c->rb, RB_OP_READ, start, rb_read_at(c->rb, &c->next, id, data, size));
+}
+int rb_cursor_reader_open(rb_reader_t *r, rb_cursor_t *c, uint8_t id) {
+    if (c == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    return rb_reader_open_at(r, c->rb, &c->next, id);
+}
+int rb_cursor_peek(rb_cursor_t *c, uint8_t id, rb_segment_t seg[RB_PEEK_SEGMENTS]) {
+    if (c == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    return rb_peek_at(c->rb, &c->next, id, seg);
+}
+int rb_cursor_find(rb_cursor_t *c, uint8_t id, const void *data, uint32_t size,
+                   uint8_t *scratch) {
+    if (c == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    uint64_t start = rb_op_start();
+    return rb_op_end(c->rb, RB_OP_FIND, start,
+                     rb_find_at(c->rb, &c->next, id, data, size, scratch));
+}
+/*
+ Reverse cursors. Records can only be walked forward from the start of their
+ sector, so a reverse cursor walks one sector at a time: it notes the offsets
+ of the records it has not returned yet, hands them out newest first, then
+ steps to the sector before. Only the last RB_RCURSOR_SLOTS offsets are kept;
+ a sector with more is walked again for the rest. Reading the newest n
+ records costs the sectors they are in, not the whole ring.
+
+ The sector before must carry the index one lower, so the walk stops at the
+ oldest sector, at erased sectors and where the ring wrapped. Records
+ appended after open are not seen, reopen for those.
+*/
+static void rb_rcursor_scan(rb_rcursor_t *c) {
+    rb_t *rb = c->rb;
+    rb_header hdr;
+    uint32_t offs = c->sector + sizeof(rb_sector_header);
+    c->count = 0;
+    c->more = false;
+    while (offs < c->limit) {
+        rb_flash_read(rb, offs, &hdr, sizeof(hdr));
+        RB_COUNT(rb, headers, 1);
+        if (is_header_good(&hdr) != RB_OK) {
+            break; //the rest of the sector is blank
         }
-        if (hdr.id != id || !(hdr.crc & RB_HEADER_NOT_SMUDGED)) {
-            //not my data, or it was erased, keep looking
-            rb->next = rb_incr(rb->next, hdr.len + sizeof(hdr), rb->number_of_bytes);
-            if (orignext == rb->next) return RB_HDR_ID_NOT_FOUND;
-            continue; //do loop again
+        if (hdr.id != RB_SYSTEM_ID && (hdr.crc & RB_HEADER_NOT_SMUDGED) &&
+            !(hdr.crc & RB_HEADER_SPLIT)) {
+            if (c->count == RB_RCURSOR_SLOTS) {
+                //keep the newest, the older ones are found again later
+                memmove(c->at, c->at + 1, sizeof(c->at) - sizeof(c->at[0]));
+                memmove(c->id, c->id + 1, sizeof(c->id) - sizeof(c->id[0]));
+                c->count--;
+                c->more = true;
+            }
+            c->at[c->count] = RB_MOD_SECTOR(rb, offs);
+            c->id[c->count++] = hdr.id;
         }
-        //found a good header, use it to read data, maybe split into two reads
-        uint32_t read_size = MIN(hdr.len, remaining_size);
-        rb->next += sizeof(hdr);
-        // read data in current sector
-        flash_read(rb->base_address + rb->next, data, read_size);
-        // skip data so far, may be longer than amount just red
-        rb->next = rb_incr(rb->next, hdr.len, rb->number_of_bytes);
-        remaining_size -= read_size;
-        data += read_size;
-        total_read += read_size;
-        if (!MOD_SECTOR(rb->next)) {
-            //if we end on a sector boundary, maybe this data is split into the
-            //new sector - this needs big testing...
-            rb_errors_t prefetch_hdr_res = fetch_and_check_header(rb, &hdr, 0); //fetch and check header
-            if ( !(prefetch_hdr_res == RB_OK || prefetch_hdr_res == RB_BLANK_HDR)) {
-                return prefetch_hdr_res;
-            } else {
-                //fixme do I need to check here for deleted? what about a split
-                //deleted? should a smudged deleted also handle its split? I
-                //think yes.
-                if (hdr.id == id && (hdr.crc & RB_HEADER_SPLIT)) {
-                    // I have peeked ahead and this data is split into the next
-                    // sector, so recurse to read rest of it.
-                    int res = rb_read(rb, id, data, remaining_size);
-                    if (res > 0) {
-                        total_read += res; //fixme - this only will work once
-                    }
-                }
+        uint32_t next = rb_incr(rb, offs, sizeof(hdr) + rb_span(rb, hdr.len));
+        if (RB_SECTOR(rb, next) != c->sector || RB_MOD_SECTOR(rb, next) == 0) {
+            break; //the record ran into the next sector
+        }
+        offs = next;
+    }
+}
+//step to the sector before, false if it is not older than this one
+static bool rb_rcursor_back(rb_rcursor_t *c) {
+    rb_t *rb = c->rb;
+    rb_sector_header shdr;
+    uint32_t prev = (c->sector ? c->sector : rb->number_of_bytes) - rb->sector_size;
+    rb_flash_read(rb, prev, &shdr, sizeof(shdr));
+    if (is_sector_header_good(&shdr) != RB_OK ||
+        get_index(&shdr) != ((c->index - 1) & RB_INDEX_MASK)) {
+        return false;
+    }
+    c->sector = prev;
+    c->index = get_index(&shdr);
+    c->limit = prev + rb->sector_size;
+    rb_rcursor_scan(c);
+    return true;
+}
+//offset of the next record back with id, any user record for RB_ANY_ID
+static rb_errors_t rb_rcursor_prev(rb_rcursor_t *c, uint8_t id, uint32_t *next) {
+    do {
+        while (c->count) {
+            c->count--;
+            c->limit = c->sector + c->at[c->count];
+            if (id == RB_ANY_ID || c->id[c->count] == id) {
+                *next = c->limit;
+                return RB_OK;
             }
         }
-        break;
+        if (c->more) {
+            rb_rcursor_scan(c); //the older records of this sector
+        } else if (!rb_rcursor_back(c)) {
+            return RB_BLANK_HDR; //nothing older
+        }
     } while (1);
-    //If returned data is too short return actual size
-    return total_read;
 }
-/* 
-Create a new variable sized ringbuffer control block, optionally erasing the
-whole flash ringbuffer. Can be called at any time to re-init.
+/*
+ Open c after the newest record. Only sector headers are read to find the
+ newest sector, then that one sector is walked.
+*/
+rb_errors_t rb_rcursor_open(rb_rcursor_t *c, rb_t *rb) {
+    rb_sector_header shdr;
+    uint32_t oldest;
+    if (c == NULL || rb == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    c->rb = rb;
+    c->count = 0;
+    c->more = false;
+    rb_errors_t hdr_res = rb_oldest_sector_at(rb, &oldest);
+    if (!(hdr_res == RB_OK || hdr_res == RB_BLANK_HDR)) {
+        return hdr_res;
+    }
+    c->sector = oldest;
+    c->limit = oldest;
+    rb_flash_read(rb, oldest, &shdr, sizeof(shdr));
+    if (is_sector_header_good(&shdr) != RB_OK) {
+        //a blank ring, make the step back fail
+        c->index = 0;
+        return RB_OK;
+    }
+    c->index = get_index(&shdr);
+    //follow the sector indexes up to the newest sector
+    for (uint32_t n = 1; n < rb->number_of_bytes / rb->sector_size; n++) {
+        uint32_t sector = (oldest + n * rb->sector_size) % rb->number_of_bytes;
+        rb_flash_read(rb, sector, &shdr, sizeof(shdr));
+        if (is_sector_header_good(&shdr) != RB_OK ||
+            get_index(&shdr) != ((c->index + 1) & RB_INDEX_MASK)) {
+            break;
+        }
+        c->sector = sector;
+        c->index = get_index(&shdr);
+    }
+    c->limit = c->sector + rb->sector_size;
+    rb_rcursor_scan(c);
+    return RB_OK;
+}
+//like rb_cursor_reader_open, but the record before the last one returned
+int rb_rcursor_reader_open(rb_reader_t *r, rb_rcursor_t *c, uint8_t id) {
+    rb_header hdr;
+    uint32_t next;
+    if (c == NULL || c->rb == NULL || id == 00) {
+        return RB_BAD_CALLER_DATA;
+    }
+    do {
+        rb_errors_t hdr_res = rb_rcursor_prev(c, id, &next);
+        if (hdr_res != RB_OK) {
+            return hdr_res;
+        }
+        //it may have been smudged since the sector was walked
+        rb_flash_read(c->rb, next, &hdr, sizeof(hdr));
+    } while (is_header_good(&hdr) != RB_OK || !(hdr.crc & RB_HEADER_NOT_SMUDGED));
+    return rb_reader_open_at(r, c->rb, &next, id);
+}
+int rb_read_prev(rb_rcursor_t *c, uint8_t id, void *data, uint32_t size) {
+    rb_reader_t r;
+    if (c == NULL || c->rb == NULL || data == NULL || size == 0 || id == 0xff) {
+        return RB_BAD_CALLER_DATA;
+    }
+    uint64_t start = rb_op_start();
+    int res = rb_rcursor_reader_open(&r, c, id);
+    if (res >= 0) {
+        res = rb_reader_take(&r, data, size);
+    }
+    return rb_op_end(c->rb, RB_OP_READ, start, res);
+}
+/*
+ Make rb a time ring. timestamp_of gets the payload of each record appended
+ through rb and must return a time that never goes down. Records written by
+ rb_writer_open are not indexed. NULL turns indexing off again, the time
+ records already in flash stay and readers skip them.
+*/
+rb_errors_t rb_set_timestamps(rb_t *rb, timestamp_extractor_t timestamp_of) {
+    if (rb == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+    rb->timestamp_of = timestamp_of;
+    return RB_OK;
+}
+/*
+ Move c to the start of the newest sector whose first record is older than
+ ts, or to the oldest sector if there is none. Every record at or after ts is
+ then still ahead of c, and at most one sector of older records is read
+ before them, the caller checks its own timestamps to skip those.
 
-Every init points to the oldest sector and first item in the sector. So for
-reads it is like a rewind. Appends will go to the end of the ring always.
+ Sectors are taken oldest first by their monotonic sector index and binary
+ searched, so only about log2(sectors) time records are read. Works on any
+ ring, sectors without a time record are passed over.
 */
-rb_errors_t rb_create(rb_t *rb, uint32_t base_address, 
-                      size_t number_of_sectors, enum init_choices init_choice) {
-    rb_errors_t hdr_err = RB_BAD_HDR;
-#ifdef PICO_FLASH_SIZE_BYTES
-    if (number_of_sectors > PICO_FLASH_SIZE_BYTES / FLASH_SECTOR_SIZE) {
+rb_errors_t rb_seek_time(rb_cursor_t *c, uint64_t ts) {
+    rb_t *rb;
+    rb_sector_header shdr;
+    uint64_t sector_ts;
+    if (c == NULL || c->rb == NULL) {
         return RB_BAD_CALLER_DATA;
     }
-#endif
-    if (rb == NULL || number_of_sectors < 1) {
+    rb = c->rb;
+    uint32_t oldest;
+    rb_errors_t hdr_res = rb_oldest_sector_at(rb, &oldest);
+    if (!(hdr_res == RB_OK || hdr_res == RB_BLANK_HDR)) {
+        return hdr_res;
+    }
+    c->next = rb_read_start(rb, oldest);
+    rb_flash_read(rb, oldest, &shdr, sizeof(shdr));
+    if (is_sector_header_good(&shdr) != RB_OK) {
+        return RB_OK; //blank ring
+    }
+    uint32_t sectors = rb->number_of_bytes / rb->sector_size;
+    uint32_t used = MIN(rb->sector_index - get_index(&shdr) + 1, sectors);
+    //the answer is in [lo, hi], as a count of sectors after the oldest
+    int32_t lo = 0;
+    int32_t hi = used - 1;
+    while (lo <= hi) {
+        int32_t mid = lo + (hi - lo) / 2;
+        int32_t k = mid;
+        uint32_t sector;
+        //untimed sectors give no answer, look at the nearest older one
+        do {
+            sector = (oldest + k * rb->sector_size) % rb->number_of_bytes;
+        } while (!rb_sector_time(rb, sector, &sector_ts) && --k >= lo);
+        if (k < lo) {
+            lo = mid + 1; //nothing timed in [lo, mid]
+        } else if (sector_ts < ts) {
+            c->next = rb_read_start(rb, sector);
+            lo = mid + 1;
+        } else {
+            hi = k - 1;
+        }
+    }
+    return RB_OK;
+}
+/*
+ the geometry a ring can be on. Sectors are at most 64K, reverse cursors keep
+ 16 bit sector offsets, and the page buffers are FLASH_PAGE_SIZE.
+*/
+static bool is_pow2(uint32_t n) {
+    return n && !(n & (n - 1));
+}
+static bool rb_dev_good(const flash_dev_t *dev) {
+    return dev != NULL && dev->read != NULL && dev->prog != NULL && dev->erase != NULL &&
+           is_pow2(dev->sector_size) && dev->sector_size >= FLASH_SECTOR_SIZE &&
+           dev->sector_size <= 0x10000 && is_pow2(dev->page_size) &&
+           dev->page_size <= FLASH_PAGE_SIZE && is_pow2(dev->prog_unit) &&
+           dev->prog_unit <= dev->page_size;
+}
+//check the geometry and reset every field of rb
+static rb_errors_t rb_setup(rb_t *rb, const flash_dev_t *dev, uint32_t base_address,
+                            size_t number_of_sectors) {
+    //offset in flash, not system address
+    base_address %= XIP_BASE;
+    if (rb == NULL || number_of_sectors < 1 || !rb_dev_good(dev) ||
+        base_address % dev->sector_size || base_address > dev->size ||
+        number_of_sectors > (dev->size - base_address) / dev->sector_size) {
         return RB_BAD_CALLER_DATA;
     }
-     //offset in flash, not system address
-    rb->base_address = base_address % XIP_BASE;
-    rb->number_of_bytes = number_of_sectors * FLASH_SECTOR_SIZE;
+    rb_reset_stats(rb);
+    rb->dev = dev;
+    rb->sector_size = dev->sector_size;
+    rb->base_address = base_address;
+    rb->number_of_bytes = number_of_sectors * rb->sector_size;
     rb->next = 0;
+    rb->sector_index = 0;
+    rb->tail_valid = false;
+    rb->staged = false;
+    rb->buffered = false;
+    rb->payload_crc = false;
+    rb->aligned = false;
+    rb->writing = false;
+    rb->timestamp_of = NULL;
+    rb->erase_ahead = 0;
+    rb->compact_pct = 0;
+    rb->compact_page = NULL;
+    rb->erases = 0;
+    rb->checkpoints = false;
+    rb->pool = NULL;
+    rb->map = NULL;
+    rb->stream = 0;
+    rb->record_size = 0;
+    rb->slots = 0;
+    rb->oldest = 0;
+    rb->oldest_index = 0;
+    rb->cache = NULL;
+    return RB_OK;
+}
+/* 
+Create a new variable sized ringbuffer control block, optionally erasing the
+whole flash ringbuffer. Can be called at any time to re-init.
 
-    if (init_choice == CREATE_INIT_ALWAYS) {
-        printf("************initing flash addr 0x%lx, len 0x%lx\n", rb->base_address, rb->number_of_bytes);
-        flash_erase(rb->base_address, rb->number_of_bytes);
+Every init points to the oldest sector and first item in the sector. So for
+reads it is like a rewind. Appends will go to the end of the ring always.
+*/
+static rb_errors_t rb_open_ring(rb_t *rb, enum init_choices init_choice) {
+    rb_errors_t hdr_err;
+    if (init_choice == CREATE_INIT_ALWAYS && rb->pool != NULL) {
+        //sectors with a blank header were never written since their erase
+        rb_sector_header hdr;
         hdr_err = RB_OK;
+        for (uint32_t i = 0; i < rb->number_of_bytes && hdr_err == RB_OK; i += rb->sector_size) {
+            rb_flash_read(rb, i, &hdr, sizeof(hdr));
+            if (is_sector_header_good(&hdr) != RB_BLANK_HDR) {
+                hdr_err = rb_erase_sector(rb, i);
+            }
+        }
+    } else if (init_choice == CREATE_INIT_ALWAYS) {
+        //through the device scheduler: block erases where the ring is aligned
+        //for them, one at a time, after whatever was queued before
+        printf("************initing flash addr 0x%" PRIx32 ", len 0x%" PRIx32 "\n", rb->base_address, rb->number_of_bytes);
+        hdr_err = RB_OK;
+        if (flash_dev_erase(rb->dev, rb->base_address, rb->number_of_bytes)) {
+            hdr_err = RB_FLASH_ERROR;
+        }
+        RB_COUNT(rb, erases, rb->number_of_bytes / rb->sector_size);
     } else {
         /* Request was to continue in rb as exists in flash. First verify flash
            is in reasonable order. */
@@ -695,19 +2486,41 @@ rb_errors_t rb_create(rb_t *rb, uint32_t base_address,
         if (hdr_err == RB_OK) {
             //then set the pointer
             hdr_err = rb_find_ring_oldest_sector(rb);
+            rb->next = rb_read_start(rb, rb->next);
         }
     }
     //it is up to the user to deal with rb errors
     return hdr_err;
 }
+static rb_errors_t rb_create_ring(rb_t *rb, const flash_dev_t *dev, uint32_t base_address,
+                                  size_t number_of_sectors, enum init_choices init_choice) {
+    rb_errors_t hdr_err = rb_setup(rb, dev, base_address, number_of_sectors);
+    if (hdr_err != RB_OK) {
+        return hdr_err;
+    }
+    return rb_open_ring(rb, init_choice);
+}
+rb_errors_t rb_create(rb_t *rb, uint32_t base_address, 
+                      size_t number_of_sectors, enum init_choices init_choice) {
+    uint64_t start = rb_op_start();
+    return rb_op_end(rb, RB_OP_CREATE, start,
+                     rb_create_ring(rb, &flash_default_dev, base_address, number_of_sectors,
+                                    init_choice));
+}
+rb_errors_t rb_create_on(rb_t *rb, const flash_dev_t *dev, uint32_t base_address,
+                         size_t number_of_sectors, enum init_choices init_choice) {
+    uint64_t start = rb_op_start();
+    return rb_op_end(rb, RB_OP_CREATE, start,
+                     rb_create_ring(rb, dev, base_address, number_of_sectors, init_choice));
+}
 //helper to create and re-create (if data is bad) a buffer control block
-rb_errors_t rb_recreate(rb_t *rb, uint32_t base_address,
-                            size_t number_of_sectors, enum init_choices init_choice) {
-    rb_errors_t err = rb_create(rb, base_address, number_of_sectors, init_choice);
+static rb_errors_t rb_recreate_ring(rb_t *rb, const flash_dev_t *dev, uint32_t base_address,
+                                    size_t number_of_sectors, enum init_choices init_choice) {
+    rb_errors_t err = rb_create_ring(rb, dev, base_address, number_of_sectors, init_choice);
     if (init_choice != CREATE_FAIL) {
         if (!(err == RB_OK || err == RB_BLANK_HDR || err == RB_HDR_LOOP)) {
             printf("*****************starting flash error %d, reiniting\n", err);
-            err = rb_create(rb, base_address, number_of_sectors, CREATE_INIT_ALWAYS);
+            err = rb_create_ring(rb, dev, base_address, number_of_sectors, CREATE_INIT_ALWAYS);
             if (err != RB_OK) {
                 //init failed, bail
                 printf("starting flash error %d, quitting\n", err);
@@ -716,3 +2529,603 @@ rb_errors_t rb_recreate(rb_t *rb, uint32_t base_address,
     }
     return err;
 }
+rb_errors_t rb_recreate(rb_t *rb, uint32_t base_address,
+                            size_t number_of_sectors, enum init_choices init_choice) {
+    uint64_t start = rb_op_start();
+    return rb_op_end(rb, RB_OP_CREATE, start,
+                     rb_recreate_ring(rb, &flash_default_dev, base_address, number_of_sectors,
+                                      init_choice));
+}
+rb_errors_t rb_recreate_on(rb_t *rb, const flash_dev_t *dev, uint32_t base_address,
+                           size_t number_of_sectors, enum init_choices init_choice) {
+    uint64_t start = rb_op_start();
+    return rb_op_end(rb, RB_OP_CREATE, start,
+                     rb_recreate_ring(rb, dev, base_address, number_of_sectors, init_choice));
+}
+//set rb up on the sectors stream has in pool, sector indexes start at its base
+static rb_errors_t rb_setup_pooled(rb_t *rb, rb_pool_t *pool, uint8_t stream) {
+    //pool sectors are FLASH_SECTOR_SIZE on the default flash
+    if (flash_default_dev.sector_size != FLASH_SECTOR_SIZE) {
+        return RB_BAD_CALLER_DATA;
+    }
+    rb_errors_t err = rb_setup(rb, &flash_default_dev, pool->base_address, pool->quota[stream]);
+    if (err == RB_OK) {
+        rb->pool = pool;
+        rb->map = pool->map[stream];
+        rb->stream = stream;
+        rb->sector_index = RB_POOL_INDEX(stream);
+    }
+    return err;
+}
+static rb_errors_t rb_create_pooled_ring(rb_t *rb, rb_pool_t *pool, uint8_t stream,
+                                         enum init_choices init_choice) {
+    if (pool == NULL || stream >= pool->streams) {
+        return RB_BAD_CALLER_DATA;
+    }
+    rb_errors_t err = rb_setup_pooled(rb, pool, stream);
+    if (err == RB_OK) {
+        err = rb_open_ring(rb, init_choice);
+    }
+    if (init_choice == CREATE_INIT_IF_FAIL &&
+        !(err == RB_OK || err == RB_BLANK_HDR || err == RB_HDR_LOOP)) {
+        printf("*****************starting pool stream %d error %d, reiniting\n", stream, err);
+        err = rb_setup_pooled(rb, pool, stream);
+        if (err == RB_OK) {
+            err = rb_open_ring(rb, CREATE_INIT_ALWAYS);
+        }
+    }
+    return err;
+}
+rb_errors_t rb_create_pooled(rb_t *rb, rb_pool_t *pool, uint8_t stream,
+                             enum init_choices init_choice) {
+    uint64_t start = rb_op_start();
+    return rb_op_end(rb, RB_OP_CREATE, start,
+                     rb_create_pooled_ring(rb, pool, stream, init_choice));
+}
+/*
+ Fixed size record rings. All records are the same size, so they need no
+ header: after its sector header a sector is slots of a record followed by a
+ flag byte. The flag comes after the record so it reaches flash last, a slot
+ is only read once RB_SLOT_BLANK is cleared, and RB_SLOT_NOT_DELETED is
+ cleared to delete it. Records are numbered from the first the ring ever had,
+ record r is in slot r % slots of the sector with index r / slots + 1. Where
+ that sector is follows from the oldest sector, kept in rb, so finding a
+ record reads just its sector header to check the oldest has not moved.
+*/
+//ring offset of a slot in a sector
+static uint32_t rb_slot_at(rb_t *rb, uint32_t sector, uint32_t slot) {
+    return sector + sizeof(rb_sector_header) + slot * (rb->record_size + 1);
+}
+//ring offset of the sector n sectors after the oldest
+static uint32_t rb_fixed_sector(rb_t *rb, uint32_t n) {
+    return (rb->oldest + n % (rb->number_of_bytes / rb->sector_size) * rb->sector_size) %
+           rb->number_of_bytes;
+}
+static uint8_t rb_slot_flag(rb_t *rb, uint32_t at) {
+    uint8_t flag;
+    rb_flash_read(rb, at + rb->record_size, &flag, sizeof(flag));
+    return flag;
+}
+//stage size bytes at ring offset at, rb->next is left to the reader
+static rb_errors_t rb_stage_at(rb_t *rb, uint32_t at, const void *data, uint32_t size) {
+    uint32_t readnext = rb->next;
+    rb->next = at;
+    rb_errors_t res = rb_append_page(rb, data, size);
+    rb->next = readnext;
+    return res;
+}
+//find the oldest sector again, with its index. An empty ring starts anew
+static rb_errors_t rb_fixed_oldest(rb_t *rb) {
+    rb_sector_header hdr;
+    rb_errors_t res = rb_oldest_sector_at(rb, &rb->oldest);
+    if (!(res == RB_OK || res == RB_BLANK_HDR)) {
+        return res;
+    }
+    rb_flash_read(rb, rb->oldest, &hdr, sizeof(hdr));
+    RB_COUNT(rb, headers, 1);
+    rb->oldest_index = is_sector_header_good(&hdr) == RB_OK ? get_index(&hdr) :
+                                                              rb->sector_index + 1;
+    rb->tail_valid = false;
+    return RB_OK;
+}
+//move the tail on one slot, after the last one to the next sector
+static void rb_fixed_next_slot(rb_t *rb) {
+    uint32_t sector = RB_SECTOR(rb, rb->tail);
+    rb->tail += rb->record_size + 1;
+    if (rb->tail >= rb_slot_at(rb, sector, rb->slots)) {
+        rb->tail = sector + rb->sector_size < rb->number_of_bytes ? sector + rb->sector_size : 0;
+    }
+}
+/*
+ The cached tail is good if the newest sector is still where it was and the
+ tail slot is still blank. Otherwise the flags of the newest sector are
+ written in slot order, binary search them for the first slot not written.
+*/
+static rb_errors_t rb_fixed_find_tail(rb_t *rb) {
+    rb_sector_header hdr;
+    uint32_t newest = rb_fixed_sector(rb, rb->sector_index - rb->oldest_index);
+    if (rb->tail_valid) {
+        if (rb->staged) {
+            return RB_OK;
+        }
+        rb_flash_read(rb, newest, &hdr, sizeof(hdr));
+        if (is_sector_header_good(&hdr) == RB_OK && get_index(&hdr) == rb->sector_index &&
+            (RB_MOD_SECTOR(rb, rb->tail) == 0 || (rb_slot_flag(rb, rb->tail) & RB_SLOT_BLANK))) {
+            return RB_OK;
+        }
+    }
+    RB_COUNT(rb, rescans, 1);
+    rb_errors_t res = rb_fixed_oldest(rb);
+    if (res != RB_OK) {
+        return res;
+    }
+    rb->tail_valid = true;
+    if (rb->oldest_index > rb->sector_index) {
+        rb->tail = rb->oldest; //empty ring
+        return RB_OK;
+    }
+    newest = rb_fixed_sector(rb, rb->sector_index - rb->oldest_index);
+    uint32_t lo = 0;
+    uint32_t hi = rb->slots;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (rb_slot_flag(rb, rb_slot_at(rb, newest, mid)) & RB_SLOT_BLANK) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    rb->tail = rb_slot_at(rb, newest, MIN(lo, rb->slots - 1));
+    if (lo == rb->slots) {
+        rb_fixed_next_slot(rb); //full, the next append starts a sector
+    }
+    return RB_OK;
+}
+/*
+ start a sector at the tail, erasing the oldest first if the ring is full
+ and the caller allows it. A sector with a blank header but not blank after
+ it holds no records, it is erased too.
+*/
+static rb_errors_t rb_fixed_new_sector(rb_t *rb, bool erase_if_full) {
+    rb_sector_header hdr;
+    uint32_t at = rb->tail;
+    rb_flash_read(rb, at, &hdr, sizeof(hdr));
+    RB_COUNT(rb, headers, 1);
+    if (is_sector_header_good(&hdr) != RB_BLANK_HDR) {
+        if (!erase_if_full) {
+            return RB_FULL;
+        }
+        if (rb_flush(rb) != RB_OK) {
+            return RB_FLASH_ERROR;
+        }
+        rb_errors_t res = rb_erase_sector(rb, at);
+        //its records are gone even if the erase failed
+        if (at == rb->oldest) {
+            rb->oldest = rb_fixed_sector(rb, 1);
+            rb->oldest_index++;
+        }
+        if (res != RB_OK) {
+            return res;
+        }
+        RB_COUNT(rb, full_erases, 1);
+    } else if (rb_count_blanks(rb, at, rb->sector_size) != rb->sector_size) {
+        if (rb_flush(rb) != RB_OK || rb_erase_sector(rb, at) != RB_OK) {
+            return RB_FLASH_ERROR;
+        }
+    }
+    if (rb->oldest_index > rb->sector_index) {
+        //the ring was empty, this is its oldest sector now
+        rb->oldest = at;
+        rb->oldest_index = rb->sector_index + 1;
+    }
+    make_sector_header(rb, &hdr);
+    rb->tail = rb_slot_at(rb, at, 0);
+    return rb_stage_at(rb, at, &hdr, sizeof(hdr));
+}
+static rb_errors_t rb_create_fixed_ring(rb_t *rb, uint32_t base_address, size_t number_of_sectors,
+                                        uint32_t record_size, enum init_choices init_choice) {
+    if (record_size == 0 || record_size > RB_MAX_FIXED_SIZE) {
+        return RB_BAD_CALLER_DATA;
+    }
+    rb_errors_t err = rb_setup(rb, &flash_default_dev, base_address, number_of_sectors);
+    if (err != RB_OK) {
+        return err;
+    }
+    rb->record_size = record_size;
+    rb->slots = (rb->sector_size - sizeof(rb_sector_header)) / (record_size + 1);
+    err = rb_open_ring(rb, init_choice);
+    if (err == RB_OK || err == RB_BLANK_HDR) {
+        err = rb_fixed_oldest(rb);
+    }
+    return err;
+}
+rb_errors_t rb_create_fixed(rb_t *rb, uint32_t base_address, size_t number_of_sectors,
+                            uint32_t record_size, enum init_choices init_choice) {
+    uint64_t start = rb_op_start();
+    rb_errors_t err = rb_create_fixed_ring(rb, base_address, number_of_sectors, record_size,
+                                           init_choice);
+    if (init_choice == CREATE_INIT_IF_FAIL && err != RB_OK && err != RB_BAD_CALLER_DATA) {
+        printf("*****************starting fixed ring error %d, reiniting\n", err);
+        err = rb_create_fixed_ring(rb, base_address, number_of_sectors, record_size,
+                                   CREATE_INIT_ALWAYS);
+    }
+    return rb_op_end(rb, RB_OP_CREATE, start, err);
+}
+rb_errors_t rb_fixed_append(rb_t *rb, const void *data, uint8_t *pagebuffer,
+                            bool erase_if_full) {
+    uint64_t start = rb_op_start();
+    if (rb == NULL || data == NULL || rb->record_size == 0 || rb->writing ||
+        (pagebuffer == NULL && !rb->buffered)) {
+        return rb_op_end(rb, RB_OP_APPEND, start, RB_BAD_CALLER_DATA);
+    }
+    rb_start_write(rb, pagebuffer);
+    rb_errors_t res = rb_fixed_find_tail(rb);
+    while (res == RB_OK) {
+        if (RB_MOD_SECTOR(rb, rb->tail) == 0) {
+            res = rb_fixed_new_sector(rb, erase_if_full);
+        } else if (rb_count_blanks(rb, rb->tail, rb->record_size + 1) == rb->record_size + 1) {
+            break;
+        } else {
+            //written when the power went, but its flag never was
+            rb_fixed_next_slot(rb);
+        }
+    }
+    if (res == RB_OK) {
+        uint8_t flag = 0xff & ~RB_SLOT_BLANK;
+        rb->last_wrote = rb->tail;
+        res = rb_stage_at(rb, rb->tail, data, rb->record_size);
+        if (res == RB_OK) {
+            res = rb_stage_at(rb, rb->tail + rb->record_size, &flag, sizeof(flag));
+        }
+    }
+    if (res == RB_OK) {
+        rb_fixed_next_slot(rb);
+    } else {
+        rb->tail_valid = false;
+    }
+    rb_errors_t end_res = rb_end_write(rb);
+    if (res == RB_OK) {
+        res = end_res;
+    }
+    return rb_op_end(rb, RB_OP_APPEND, start, res);
+}
+/*
+ ring offset of the slot of record. Records of sectors not written yet are
+ RB_BLANK_HDR, erased ones RB_HDR_ID_NOT_FOUND. If the sector is not where
+ the oldest sector says, another rb wrote or erased, find the oldest again.
+*/
+static rb_errors_t rb_fixed_locate(rb_t *rb, uint32_t record, uint32_t *at) {
+    rb_sector_header hdr;
+    uint32_t index = record / rb->slots + 1;
+    for (int tries = 0; tries < 2; tries++) {
+        if (tries) {
+            rb_errors_t res = rb_fixed_oldest(rb);
+            if (res != RB_OK) {
+                return res;
+            }
+        }
+        if (index > rb->sector_index || index < rb->oldest_index) {
+            continue;
+        }
+        uint32_t sector = rb_fixed_sector(rb, index - rb->oldest_index);
+        rb_flash_read(rb, sector, &hdr, sizeof(hdr));
+        RB_COUNT(rb, headers, 1);
+        if (is_sector_header_good(&hdr) == RB_OK && get_index(&hdr) == index) {
+            *at = rb_slot_at(rb, sector, record % rb->slots);
+            return RB_OK;
+        }
+    }
+    return index > rb->sector_index ? RB_BLANK_HDR : RB_HDR_ID_NOT_FOUND;
+}
+int rb_fixed_read(rb_t *rb, uint32_t record, void *data) {
+    uint64_t start = rb_op_start();
+    uint32_t at;
+    if (rb == NULL || data == NULL || rb->record_size == 0) {
+        return rb_op_end(rb, RB_OP_READ, start, RB_BAD_CALLER_DATA);
+    }
+    rb_errors_t res = rb_fixed_locate(rb, record, &at);
+    if (res != RB_OK) {
+        return rb_op_end(rb, RB_OP_READ, start, res);
+    }
+    uint8_t flag = rb_slot_flag(rb, at);
+    if (flag & RB_SLOT_BLANK) {
+        return rb_op_end(rb, RB_OP_READ, start, RB_BLANK_HDR);
+    }
+    if (!(flag & RB_SLOT_NOT_DELETED)) {
+        return rb_op_end(rb, RB_OP_READ, start, RB_HDR_ID_NOT_FOUND);
+    }
+    rb_flash_read(rb, at, data, rb->record_size);
+    return rb_op_end(rb, RB_OP_READ, start, rb->record_size);
+}
+rb_errors_t rb_fixed_delete(rb_t *rb, uint32_t record, uint8_t *pagebuffer) {
+    uint64_t start = rb_op_start();
+    uint32_t at;
+    if (rb == NULL || pagebuffer == NULL || rb->record_size == 0 || rb->writing) {
+        return rb_op_end(rb, RB_OP_DELETE, start, RB_BAD_CALLER_DATA);
+    }
+    rb_errors_t res = rb_sync(rb);
+    if (res != RB_OK) {
+        return rb_op_end(rb, RB_OP_DELETE, start, res);
+    }
+    res = rb_fixed_locate(rb, record, &at);
+    if (res != RB_OK) {
+        return rb_op_end(rb, RB_OP_DELETE, start, res);
+    }
+    uint8_t flag = rb_slot_flag(rb, at);
+    if (flag & RB_SLOT_BLANK) {
+        return rb_op_end(rb, RB_OP_DELETE, start, RB_BLANK_HDR);
+    }
+    flag &= ~RB_SLOT_NOT_DELETED;
+    uint8_t *ownpage = rb->rb_page;
+    rb->rb_page = pagebuffer;
+    rb->staged = false;
+    res = rb_stage_at(rb, at + rb->record_size, &flag, sizeof(flag));
+    if (res == RB_OK) {
+        res = rb_flush(rb);
+    }
+    if (rb->buffered) {
+        rb->rb_page = ownpage;
+    }
+    return rb_op_end(rb, RB_OP_DELETE, start, res);
+}
+rb_errors_t rb_fixed_range(rb_t *rb, uint32_t *first, uint32_t *end) {
+    if (rb == NULL || first == NULL || end == NULL || rb->record_size == 0) {
+        return RB_BAD_CALLER_DATA;
+    }
+    rb_errors_t res = rb_fixed_find_tail(rb);
+    if (res != RB_OK) {
+        return res;
+    }
+    *first = (rb->oldest_index - 1) * rb->slots;
+    if (RB_MOD_SECTOR(rb, rb->tail) == 0) {
+        *end = rb->sector_index * rb->slots; //the newest sector is full, or none
+    } else {
+        *end = (rb->sector_index - 1) * rb->slots +
+               (RB_MOD_SECTOR(rb, rb->tail) - sizeof(rb_sector_header)) / (rb->record_size + 1);
+    }
+    return RB_OK;
+}
+/*
+ Checkpoints. Mounting a ring normally reads every sector header three times
+ and the first append walks every record to find the tail. A ring mounted
+ with rb_mount keeps checkpoints of where its tail and newest sector were in
+ the sector after it, one every RB_CHECKPOINT_SLOT bytes, written whenever an
+ append starts a new sector and by rb_checkpoint. Mounting finds the last
+ one by binary search and checks it against the ring:
+
+ - its crc and ring size must match, and the newest sector must still carry
+   its sector index
+ - sectors written since are followed by their index, one header each
+ - the oldest sector is the first used one after the newest, and the sector
+   indexes between them must add up
+ - the tail is found walking from the checkpointed one, at most the newest
+   sector
+
+ Anything off falls back to the full scan of rb_create, which also erases
+ the checkpoints that failed, so a checkpoint is only trusted if written
+ since the last full scan. The checkpoint sector is erased when it fills,
+ a power cut then just costs one full scan.
+*/
+//where the checkpoint sector is, in flash
+static uint32_t rb_checkpoint_base(rb_t *rb) {
+    return rb->base_address + rb->number_of_bytes;
+}
+static uint32_t rb_checkpoint_crc(rb_checkpoint_t *cp) {
+    return crc32_finalize(crc32_update(crc32_init(), cp, offsetof(rb_checkpoint_t, crc)));
+}
+//checkpoints are written in order, binary search for the first blank slot
+static uint32_t rb_checkpoint_end(rb_t *rb) {
+    uint32_t lo = 0;
+    uint32_t hi = rb->sector_size / RB_CHECKPOINT_SLOT;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        uint32_t word;
+        rb->dev->read(rb->dev, rb_checkpoint_base(rb) + mid * RB_CHECKPOINT_SLOT, &word,
+                      sizeof(word));
+        RB_COUNT(rb, reads, 1);
+        RB_COUNT(rb, read_bytes, sizeof(word));
+        if (word == 0xffffffff) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo * RB_CHECKPOINT_SLOT;
+}
+//rb_page must not hold staged bytes
+static rb_errors_t rb_write_checkpoint(rb_t *rb) {
+    rb_checkpoint_t cp;
+    rb_sector_header shdr;
+    if (!rb->tail_valid || rb->staged) {
+        return RB_OK;
+    }
+    cp.tail = rb->tail;
+    cp.newest = rb_tail_sector(rb);
+    rb_flash_read(rb, cp.newest, &shdr, sizeof(shdr));
+    if (is_sector_header_good(&shdr) != RB_OK) {
+        return RB_OK; //nothing written yet
+    }
+    cp.sector_index = get_index(&shdr);
+    rb_oldest_sector_at(rb, &cp.oldest);
+    cp.number_of_bytes = rb->number_of_bytes;
+    cp.crc = rb_checkpoint_crc(&cp);
+    if (rb->checkpoint_slot >= rb->sector_size) {
+        if (flash_dev_erase(rb->dev, rb_checkpoint_base(rb), rb->sector_size)) {
+            return RB_FLASH_ERROR; //tried again at the next sector
+        }
+        RB_COUNT(rb, erases, 1);
+        rb->checkpoint_slot = 0;
+    }
+    memset(rb->rb_page, 0xff, FLASH_PAGE_SIZE);
+    memcpy(rb->rb_page + MOD_PAGE(rb->checkpoint_slot), &cp, sizeof(cp));
+    int err = flash_prog_range(rb->dev, rb_checkpoint_base(rb) + FLASH_PAGE(rb->checkpoint_slot),
+                               rb->rb_page, MOD_PAGE(rb->checkpoint_slot),
+                               MOD_PAGE(rb->checkpoint_slot) + sizeof(cp));
+    RB_COUNT(rb, programs, 1);
+    memset(rb->rb_page, 0xff, FLASH_PAGE_SIZE);
+    //a torn slot fails its crc, mounting takes the one before
+    rb->checkpoint_slot += RB_CHECKPOINT_SLOT;
+    if (err) {
+        return RB_FLASH_ERROR;
+    }
+    rb->checkpoint_index = cp.sector_index;
+    return RB_OK;
+}
+//index of the sector at offs, or RB_CHECKPOINT_NONE if it is not in use
+#define RB_CHECKPOINT_NONE 0xffffffff
+static uint32_t rb_sector_index_at(rb_t *rb, uint32_t offs) {
+    rb_sector_header shdr;
+    rb_flash_read(rb, offs, &shdr, sizeof(shdr));
+    return is_sector_header_good(&shdr) == RB_OK ? get_index(&shdr) : RB_CHECKPOINT_NONE;
+}
+//set rb up from checkpoint cp, if the ring still agrees with it
+static rb_errors_t rb_load_checkpoint(rb_t *rb, rb_checkpoint_t *cp) {
+    rb_sector_header shdr;
+    uint32_t sectors = rb->number_of_bytes / rb->sector_size;
+    if (cp->crc != rb_checkpoint_crc(cp) || cp->number_of_bytes != rb->number_of_bytes ||
+        cp->newest >= rb->number_of_bytes || RB_MOD_SECTOR(rb, cp->newest) ||
+        cp->tail >= rb->number_of_bytes) {
+        return RB_BAD_HDR;
+    }
+    uint32_t newest = cp->newest;
+    uint32_t index = cp->sector_index;
+    if (rb_sector_index_at(rb, newest) != index) {
+        return RB_BAD_HDR; //erased or written over since
+    }
+    //follow sectors started after the checkpoint
+    uint32_t n;
+    for (n = 1; n < sectors; n++) {
+        uint32_t sector = (newest + rb->sector_size) % rb->number_of_bytes;
+        if (rb_sector_index_at(rb, sector) != ((index + 1) & RB_INDEX_MASK)) {
+            break;
+        }
+        newest = sector;
+        index = (index + 1) & RB_INDEX_MASK;
+    }
+    //the oldest is the first used sector after the newest, past erased ones
+    uint32_t oldest = newest;
+    for (n = 1; n < sectors; n++) {
+        uint32_t sector = (newest + n * rb->sector_size) % rb->number_of_bytes;
+        uint32_t i = rb_sector_index_at(rb, sector);
+        if (i != RB_CHECKPOINT_NONE) {
+            if (((i + sectors - n) & RB_INDEX_MASK) != index) {
+                return RB_BAD_HDR; //the sector indexes do not add up
+            }
+            oldest = sector;
+            break;
+        }
+    }
+    //find the tail, in the newest sector or at the start of the next one
+    rb->next = newest == cp->newest ? cp->tail : newest;
+    rb_errors_t hdr_res = rb_findnext_writeable(rb);
+    uint32_t after = (newest + rb->sector_size) % rb->number_of_bytes;
+    if (hdr_res != RB_BLANK_HDR || !(RB_SECTOR(rb, rb->next) == newest || rb->next == after)) {
+        return RB_BAD_HDR;
+    }
+    rb_save_tail(rb);
+    rb_flash_read(rb, newest, &shdr, sizeof(shdr));
+    rb->aligned = get_crc(&shdr) & RB_SECTOR_ALIGNED;
+    rb->sector_index = index;
+    rb->checkpoint_index = cp->newest == newest ? index : RB_CHECKPOINT_NONE;
+    rb->next = rb_read_start(rb, oldest);
+    return RB_OK;
+}
+static rb_errors_t rb_mount_ring(rb_t *rb, const flash_dev_t *dev, uint32_t base_address,
+                                 size_t number_of_sectors, enum init_choices init_choice) {
+    rb_checkpoint_t cp;
+    if (number_of_sectors < 2) {
+        return RB_BAD_CALLER_DATA;
+    }
+    rb_errors_t hdr_err = rb_setup(rb, dev, base_address, number_of_sectors - 1);
+    if (hdr_err != RB_OK) {
+        return hdr_err;
+    }
+    //the last sector keeps the checkpoints
+    if (rb_checkpoint_base(rb) + rb->sector_size > dev->size) {
+        return RB_BAD_CALLER_DATA;
+    }
+    uint32_t slot = rb_checkpoint_end(rb);
+    if (init_choice != CREATE_INIT_ALWAYS) {
+        //the newest checkpoint may be torn, then the one before will do
+        for (uint32_t back = 1; back <= 2 && back * RB_CHECKPOINT_SLOT <= slot; back++) {
+            rb->dev->read(rb->dev, rb_checkpoint_base(rb) + slot - back * RB_CHECKPOINT_SLOT,
+                          &cp, sizeof(cp));
+            RB_COUNT(rb, reads, 1);
+            RB_COUNT(rb, read_bytes, sizeof(cp));
+            if (rb_load_checkpoint(rb, &cp) == RB_OK) {
+                rb->checkpoints = true;
+                rb->checkpoint_slot = slot;
+                return RB_OK;
+            }
+        }
+    }
+    hdr_err = rb_recreate_ring(rb, dev, base_address, number_of_sectors - 1, init_choice);
+    if (slot) {
+        if (flash_dev_erase(rb->dev, rb_checkpoint_base(rb), rb->sector_size) &&
+            (hdr_err == RB_OK || hdr_err == RB_BLANK_HDR)) {
+            hdr_err = RB_FLASH_ERROR;
+        }
+        RB_COUNT(rb, erases, 1);
+    }
+    rb->checkpoints = true;
+    rb->checkpoint_slot = 0;
+    rb->checkpoint_index = RB_CHECKPOINT_NONE; //the first append writes one
+    return hdr_err;
+}
+rb_errors_t rb_mount(rb_t *rb, uint32_t base_address, size_t number_of_sectors,
+                     enum init_choices init_choice) {
+    uint64_t start = rb_op_start();
+    return rb_op_end(rb, RB_OP_CREATE, start,
+                     rb_mount_ring(rb, &flash_default_dev, base_address, number_of_sectors,
+                                   init_choice));
+}
+rb_errors_t rb_mount_on(rb_t *rb, const flash_dev_t *dev, uint32_t base_address,
+                        size_t number_of_sectors, enum init_choices init_choice) {
+    uint64_t start = rb_op_start();
+    return rb_op_end(rb, RB_OP_CREATE, start,
+                     rb_mount_ring(rb, dev, base_address, number_of_sectors, init_choice));
+}
+rb_errors_t rb_checkpoint(rb_t *rb, uint8_t *pagebuffer) {
+    if (rb == NULL || !rb->checkpoints || rb->writing ||
+        (pagebuffer == NULL && !rb->buffered)) {
+        return RB_BAD_CALLER_DATA;
+    }
+    rb_start_write(rb, pagebuffer);
+    rb_errors_t hdr_res = rb_flush(rb);
+    if (hdr_res != RB_OK) {
+        return hdr_res;
+    }
+    uint32_t oldnext = rb->next;
+    hdr_res = rb_find_tail(rb);
+    if (hdr_res == RB_BLANK_HDR) {
+        rb_save_tail(rb);
+        hdr_res = rb_write_checkpoint(rb);
+    }
+    rb->next = oldnext;
+    return hdr_res;
+}
+/*
+ Operation counters. Appends from the service core and reads from the other
+ both count into the global set without locking, so with a service running
+ the global numbers may miss a few.
+*/
+rb_errors_t rb_get_stats(rb_t *rb, rb_stats_t *stats) {
+    if (stats == NULL) {
+        return RB_BAD_CALLER_DATA;
+    }
+#if RB_STATS
+    *stats = rb == NULL ? rb_all_stats : rb->stats;
+#else
+    (void) rb;
+    memset(stats, 0, sizeof(*stats));
+#endif
+    return RB_OK;
+}
+//start the counters of rb, or the global ones with rb NULL, over
+void rb_reset_stats(rb_t *rb) {
+#if RB_STATS
+    memset(rb == NULL ? &rb_all_stats : &rb->stats, 0, sizeof(rb_stats_t));
+#else
+    (void) rb;
+#endif
+}